@@ -0,0 +1,91 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+
+/*
+ * Read-modify-write of a word that no interrupt can break, on the
+ * exclusive access instructions of the Cortex-M4 (LDREX/STREX, Section
+ * 3.4.8 of the arm-cortex-m4 datasheet), without masking anything.
+ *
+ * LDREX reads the word and marks it, STREX only writes it if nothing
+ * touched it since: an exception entry or return clears the mark, so
+ * when an interrupt ran in between (and maybe changed it) the store
+ * fails and we try again, with the value it left.
+ * */
+#define ATOMIC_BARRIER() __asm volatile ("dmb" ::: "memory")
+
+static inline uint32_t atomic_ldrex(volatile uint32_t *word) {
+    uint32_t value;
+
+    __asm volatile ("ldrex %0, [%1]" : "=r" (value) : "r" (word) : "memory");
+
+    return value;
+}
+
+/*
+ * Returns 0 when it stored 'value'.
+ * */
+static inline uint32_t atomic_strex(volatile uint32_t *word, uint32_t value) {
+    uint32_t failed;
+
+    __asm volatile ("strex %0, %2, [%1]" : "=&r" (failed) : "r" (word), "r" (value) : "memory");
+
+    return failed;
+}
+
+/*
+ * Drops the mark of the last LDREX, when we don't go on with the STREX.
+ * */
+static inline void atomic_clrex(void) {
+    __asm volatile ("clrex" ::: "memory");
+}
+
+/*
+ * Sets *word to 'desired' if it's 'expected', returns 1 if it did.
+ * */
+static inline int atomic_cas(volatile uint32_t *word, uint32_t expected, uint32_t desired) {
+    do {
+        if (atomic_ldrex(word) != expected) {
+            atomic_clrex();
+            return 0;
+        }
+    } while (atomic_strex(word, desired));
+
+    return 1;
+}
+
+/*
+ * The fetch ones return the value from before.
+ * */
+static inline uint32_t atomic_fetch_add(volatile uint32_t *word, uint32_t value) {
+    uint32_t old;
+
+    do {
+        old = atomic_ldrex(word);
+    } while (atomic_strex(word, old + value));
+
+    return old;
+}
+
+static inline uint32_t atomic_fetch_or(volatile uint32_t *word, uint32_t mask) {
+    uint32_t old;
+
+    do {
+        old = atomic_ldrex(word);
+    } while (atomic_strex(word, old | mask));
+
+    return old;
+}
+
+static inline uint32_t atomic_fetch_and(volatile uint32_t *word, uint32_t mask) {
+    uint32_t old;
+
+    do {
+        old = atomic_ldrex(word);
+    } while (atomic_strex(word, old & mask));
+
+    return old;
+}
+
+#endif // !ATOMIC_H
@@ -0,0 +1,60 @@
+#ifndef CRITICAL_H
+#define CRITICAL_H
+
+#include <stdint.h>
+
+/*
+ * Critical sections that only mask the interrupts that can touch what
+ * they protect, through BASEPRI (Section 2.1.3 of the arm-cortex-m4
+ * datasheet), instead of all of them with cpsid.
+ *
+ * The STM32F401 has 4 bits of priority, the high ones of each NVIC_IPR
+ * byte: 0 is the most urgent. Inside a critical section the interrupts
+ * with a priority of CRITICAL_PRIORITY or below (numbers from it to 15)
+ * wait, the ones above (0 to CRITICAL_PRIORITY - 1) still come in right
+ * away. So:
+ * - an interrupt that shares state with code using critical sections
+ *   runs at CRITICAL_PRIORITY or below;
+ * - one that must never wait (a control loop) runs above, and touches
+ *   shared state only through lock free means (atomic.h, queue.h).
+ *
+ * They nest: BASEPRI_MAX only ever raises the mask, and each exit puts
+ * back what its enter found.
+ *
+ * BASEPRI doesn't do for going to sleep: WFI doesn't wake up for an
+ * interrupt it masks (PRIMASK, and so cpsid, are the exception), that
+ * stays on cpsid.
+ *
+ * How long the mask was on, in DWT cycles (the DWT counter must be on),
+ * is measured from the outermost enter to its exit: critical_stats has
+ * the worst, and the code that entered it.
+ * */
+#ifndef CRITICAL_PRIORITY
+#define CRITICAL_PRIORITY 4
+#endif
+#define PRIORITY_BITS 4
+#define PRIORITY(n) ((n) << (8 - PRIORITY_BITS))
+
+typedef struct critical_stats_t {
+    uint32_t sections;
+    // Cycles with the mask on, the worst section and the sum of all.
+    uint32_t max_cycles;
+    uint32_t sum_cycles;
+    // Return address of the critical_enter of the worst, look it up in out.map.
+    uint32_t max_where;
+} critical_stats_t;
+
+/*
+ * Masks the interrupts at CRITICAL_PRIORITY and below, returns
+ * what critical_exit needs to undo it.
+ * */
+uint32_t critical_enter(void);
+
+void critical_exit(uint32_t basepri);
+
+/*
+ * The stats since the last call, and starts over.
+ * */
+void critical_stats(critical_stats_t *stats);
+
+#endif // !CRITICAL_H
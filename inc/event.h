@@ -0,0 +1,114 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include "queue.h"
+
+/*
+ * Run to completion event loop shared by the projects (src/common/event.c),
+ * instead of a main loop polling every flag in turn.
+ *
+ * Interrupts (and handlers) post events to queues, each queue has the
+ * handler its events go to and a priority. The loop takes the oldest event
+ * of the most urgent queue that has one, and runs its handler to the end:
+ * then it looks again from the top, so whatever got posted meanwhile to a
+ * more urgent queue goes next. A handler is never interrupted by another
+ * handler, only by interrupts, and must not block: what has to wait is an
+ * event to post later. When all the queues are empty the core sleeps.
+ *
+ * A queue is an mpsc ring (see queue.h): any interrupt, at any priority,
+ * and the handlers can post to the same one, and nothing gets masked.
+ *
+ * The loop stamps what it does with the DWT cycle counter (16 MHz, wraps
+ * every ~268 s): the dispatch latency, from the post to the start of the
+ * handler, and how much of the time it slept. Projects using it define
+ * the DWT and DCB pointers.
+ * */
+#define EVENT_PRIORITIES 4
+// A power of 2.
+#define EVENT_QUEUE_SIZE 16
+
+typedef struct event_t {
+    // What happened, up to the handler, and a value that goes with it.
+    uint16_t signal;
+    uint32_t param;
+    // DWT cycles at the post.
+    uint32_t posted;
+} event_t;
+
+typedef void (*event_handler_t)(const event_t *event);
+
+typedef struct event_queue_t {
+    event_t ring[EVENT_QUEUE_SIZE];
+    volatile uint32_t sequence[EVENT_QUEUE_SIZE];
+    mpsc_t queue;
+    // 0 is the most urgent.
+    uint8_t priority;
+    event_handler_t handler;
+    // Events posted while the queue was full.
+    volatile uint32_t lost;
+    struct event_queue_t *next;
+} event_queue_t;
+
+typedef struct event_stats_t {
+    uint32_t dispatched;
+    // Cycles from the post to the handler, the sum to make an average.
+    uint32_t latency_sum;
+    uint32_t latency_max;
+    // Cycles asleep, out of 'cycles'.
+    uint32_t idle;
+    uint32_t cycles;
+} event_stats_t;
+
+/*
+ * Called with interrupts disabled when there's nothing to do, to sleep
+ * until the next interrupt. An interrupt already pending still wakes WFI
+ * up, so nothing posted between the check and the sleep is missed. It
+ * returns with interrupts enabled.
+ * */
+typedef void (*event_idle_t)(void);
+
+/*
+ * Starts the cycle counter, and empties the loop of its queues.
+ * */
+void event_init(void);
+
+/*
+ * Adds 'queue' to the loop, with the handler its events go to.
+ * Before any event is posted to it.
+ * */
+void event_queue_init(event_queue_t *queue, uint8_t priority, event_handler_t handler);
+
+/*
+ * Posts an event, from any context.
+ * Returns 0, or -1 when the queue is full: the event is counted in lost.
+ * */
+int event_post(event_queue_t *queue, uint16_t signal, uint32_t param);
+
+static inline int event_queue_empty(const event_queue_t *queue) {
+    return mpsc_empty(&queue->queue);
+}
+
+/*
+ * Runs the handler of the next event, returns 0 when there wasn't any.
+ * */
+int event_dispatch(void);
+
+/*
+ * The loop: dispatches until the queues are empty, then calls 'idle',
+ * never returns. NULL is a plain WFI.
+ * */
+void event_run(event_idle_t idle);
+
+/*
+ * The default idle: WFI, then interrupts enabled again.
+ * */
+void event_sleep(void);
+
+/*
+ * The stats since the last call (or event_init), and starts over.
+ * Call it more often than the cycle counter wraps.
+ * */
+void event_stats(event_stats_t *stats);
+
+#endif // !EVENT_H
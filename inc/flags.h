@@ -0,0 +1,57 @@
+#ifndef FLAGS_H
+#define FLAGS_H
+
+#include <stdint.h>
+#include "atomic.h"
+
+/*
+ * Event flag groups: 32 flags in a word, that interrupts (any number of
+ * them, at any priority) set and the code waiting for them takes, all
+ * with LDREX/STREX (see atomic.h), nothing is masked.
+ *
+ * Taking is a test and clear in one: of the flags asked for, either
+ * some (FLAGS_ANY) or all of them (FLAGS_ALL) have to be set, and those
+ * are cleared and returned. A flag set again meanwhile stays set for the
+ * next take.
+ * */
+#define FLAGS_ANY 0
+#define FLAGS_ALL 1
+
+typedef struct flags_t {
+    volatile uint32_t bits;
+} flags_t;
+
+static inline void flags_set(flags_t *flags, uint32_t mask) {
+    atomic_fetch_or(&flags->bits, mask);
+}
+
+static inline void flags_clear(flags_t *flags, uint32_t mask) {
+    atomic_fetch_and(&flags->bits, ~mask);
+}
+
+static inline uint32_t flags_peek(const flags_t *flags) {
+    return flags->bits;
+}
+
+/*
+ * Returns the flags of 'mask' it took, 0 when the condition wasn't met
+ * (nothing is cleared then).
+ * */
+static inline uint32_t flags_take(flags_t *flags, uint32_t mask, int mode) {
+    uint32_t bits;
+    uint32_t taken;
+
+    do {
+        bits = atomic_ldrex(&flags->bits);
+        taken = bits & mask;
+
+        if (taken == 0 || (mode == FLAGS_ALL && taken != mask)) {
+            atomic_clrex();
+            return 0;
+        }
+    } while (atomic_strex(&flags->bits, bits & ~taken));
+
+    return taken;
+}
+
+#endif // !FLAGS_H
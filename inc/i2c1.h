@@ -0,0 +1,189 @@
+#ifndef I2C1_H
+#define I2C1_H
+
+#include <stdint.h>
+#include "pt.h"
+
+/*
+ * The I2C1 master (src/common/i2c1.c), asynchronous: a transaction is
+ * started and the call returns right away, the interrupts run it, and
+ * its callback says how it went. The core is free meanwhile.
+ *
+ * A transaction writes its register (when reg_length is 1) and
+ * tx_length bytes, then reads rx_length, after a repeated start when it
+ * did both:
+ * - write            -> tx_length > 0, rx_length = 0
+ * - read             -> tx_length = 0, rx_length > 0
+ * - write then read  -> both, a register read
+ * With a register, N of them in a row are read or written in one
+ * transaction (the burst ones): the slave moves on to the next register
+ * after each byte, some only if a bit of the register address says so,
+ * that's up to the caller.
+ *
+ * Reading, the master acknowledges each byte but the last, and the NACK
+ * and the STOP have to be asked for before that one is on the wire
+ * (Section 18.3.3, closing the communication). How depends on N:
+ * - 1 byte   -> NACK before ADDR is cleared, STOP right after;
+ * - 2 bytes  -> POS: the NACK asked for applies to the byte after the one
+ *               being received, then both are read on BTF;
+ * - 3 and up -> the bytes on RxNE, until the last 3: with the clock held
+ *               by BTF there's all the time to ask for the NACK and the
+ *               STOP before they go;
+ * - I2C1_DMA_MIN and up -> DMA1 stream 0 (channel 1, I2C1_RX) reads DR,
+ *               no interrupt per byte: LAST has the peripheral NACK the
+ *               last byte by itself, the transfer complete interrupt asks
+ *               for the STOP.
+ *
+ * Its sequence (START, address, bytes, restart, address, bytes, STOP) is
+ * a protothread (see pt.h): each step is a wait on the flag of SR1 that
+ * says it's done, and the I2C1 event interrupt resumes it when one of
+ * them is set. ITEVTEN raises it on SB, ADDR and BTF, ITBUFEN adds TxE
+ * and RxNE (Section 18.3.8): ITBUFEN is only on while the thread waits
+ * for one of those two, TxE stays set otherwise and would keep
+ * interrupting.
+ *
+ * What goes wrong ends up in the error interrupt (ITERREN): a NACK from
+ * the slave (AF), a misplaced START or STOP (BERR), another master taking
+ * the bus (ARLO). And in case nothing happens at all (a slave holding SCL
+ * low, a bus that never frees up), each transaction has a timeout in
+ * ticks of i2c1_tick: then the peripheral is reset, to let go of the bus.
+ *
+ * The three interrupts and the one calling i2c1_tick must have the same
+ * preemption priority, they don't preempt each other: nothing else
+ * guards the transaction running.
+ *
+ * One transaction at a time. The callback runs in one of those
+ * interrupts, and can start the next one: i2c_bus.h queues those of
+ * several drivers that way. Before the callback, the interrupt waits
+ * for the STOP of the one that ended to be out, a few us, so the next
+ * one starts right after it. Bounded, to two SCL periods of a standard
+ * mode bus: past that (SCL held low by a slave), the next one's first
+ * step waits for it, and as nothing interrupts when it's out,
+ * i2c1_tick resumes it (counted in i2c1_stats.stop_late).
+ * */
+#define I2C1_EV_IRQ 31
+#define I2C1_ER_IRQ 32
+// DMA1 stream 0, I2C1_RX.
+#define I2C1_DMA_IRQ 11
+
+#ifndef I2C1_DMA_MIN
+#define I2C1_DMA_MIN 4
+#endif
+
+// Ticks of i2c1_tick, when a transaction leaves its timeout at 0.
+#define I2C1_TIMEOUT_DEFAULT 10
+
+// What happened to a transaction.
+#define I2C1_RUNNING 0
+#define I2C1_DONE 1
+#define I2C1_NACK 2
+#define I2C1_ERROR 3
+#define I2C1_TIMEOUT 4
+
+typedef struct i2c1_xfer_t i2c1_xfer_t;
+
+typedef void (*i2c1_callback_t)(i2c1_xfer_t *xfer);
+
+struct i2c1_xfer_t {
+    pt_t pt;
+    uint8_t slave;
+    uint8_t reg;
+    uint8_t reg_length;
+    const uint8_t *tx;
+    uint8_t tx_length;
+    uint8_t *rx;
+    uint8_t rx_length;
+    // The byte the thread is at, across its waits.
+    uint8_t index;
+    volatile uint8_t dma_done;
+    // In ticks, 0 is I2C1_TIMEOUT_DEFAULT.
+    uint16_t timeout;
+    uint32_t deadline;
+    volatile uint8_t status;
+    // Can be NULL. 'context' is the caller's.
+    i2c1_callback_t callback;
+    void *context;
+};
+
+/*
+ * What resuming the transactions costs, in the event interrupt: DWT
+ * cycles spent in the protothread. And how they ended.
+ * */
+typedef struct i2c1_stats_t {
+    uint32_t transfers;
+    uint32_t resumes;
+    uint32_t cycles_sum;
+    uint32_t cycles_max;
+    // Reads that went through DMA.
+    uint32_t dma;
+    uint32_t nacks;
+    uint32_t errors;
+    uint32_t timeouts;
+    // Transactions that found the STOP of the one before still going.
+    uint32_t stop_late;
+} i2c1_stats_t;
+
+extern i2c1_stats_t i2c1_stats;
+
+/*
+ * Enables the event, error and DMA interrupts in the NVIC, and the DMA1
+ * clock, once the pins and the peripheral are set up (setup_i2c in the
+ * i2c project, transport_i2c_init in p_p).
+ * */
+void i2c1_init(void);
+
+/*
+ * Starts 'xfer' (slave, tx, rx, timeout and callback filled in), returns
+ * 0, or -1 when another one is running.
+ * */
+int i2c1_start(i2c1_xfer_t *xfer);
+
+/*
+ * The transactions in the three shapes.
+ * */
+int i2c1_write(i2c1_xfer_t *xfer, uint8_t slave, const uint8_t *tx, uint8_t tx_length,
+               i2c1_callback_t callback, void *context);
+int i2c1_read(i2c1_xfer_t *xfer, uint8_t slave, uint8_t *rx, uint8_t rx_length,
+              i2c1_callback_t callback, void *context);
+int i2c1_write_read(i2c1_xfer_t *xfer, uint8_t slave, const uint8_t *tx, uint8_t tx_length,
+                    uint8_t *rx, uint8_t rx_length, i2c1_callback_t callback, void *context);
+
+/*
+ * The burst ones: 'length' registers from 'reg' on, in one transaction.
+ * */
+int i2c1_read_regs(i2c1_xfer_t *xfer, uint8_t slave, uint8_t reg, uint8_t *data, uint8_t length,
+                   i2c1_callback_t callback, void *context);
+int i2c1_write_regs(i2c1_xfer_t *xfer, uint8_t slave, uint8_t reg, const uint8_t *data, uint8_t length,
+                    i2c1_callback_t callback, void *context);
+
+/*
+ * 1 while a transaction is running.
+ * */
+int i2c1_busy(void);
+
+/*
+ * Counts a tick and ends the transaction running if it's past its
+ * timeout, from an interrupt (see above for its priority).
+ * */
+void i2c1_tick(void);
+
+/*
+ * Reads the register 'mem_addr' of 'slave_addr' into 'data', the core
+ * sleeps until it's done. Returns the status (I2C1_DONE when it went well).
+ * */
+int I2C1_byte_read(char slave_addr, char mem_addr, uint8_t *data);
+
+/*
+ * Writes 'data' to the register 'mem_addr' of 'slave_addr', the core
+ * sleeps until it's done. Returns the status.
+ * */
+int I2C1_byte_write(char slave_addr, char mem_addr, uint8_t data);
+
+/*
+ * The I2C1 event and error interrupt handlers, and the DMA1 stream 0 one.
+ * */
+void I2C1_EV_IRQHandler(void);
+void I2C1_ER_IRQHandler(void);
+void DMA1_Stream0_IRQHandler(void);
+
+#endif // !I2C1_H
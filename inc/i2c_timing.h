@@ -0,0 +1,58 @@
+#ifndef I2C_TIMING_H
+#define I2C_TIMING_H
+
+#include <stdint.h>
+#include "peripherals.h"
+
+/*
+ * Clock setup of the I2C masters shared by the projects
+ * (src/common/i2c_timing.c), from the real PCLK1 and the bus speed asked
+ * for, instead of the constants of a 16 MHz APB1 at 100 kHz.
+ *
+ * Three registers make the SCL (Section 18.6):
+ * FREQ  (CR2)  -> PCLK1 in MHz, 2 to 50 (4 and up for fast mode)
+ * CCR          -> SCL high and low in PCLK1 periods:
+ *                 standard mode       high = low = CCR           SCL = PCLK1 / (2 CCR)
+ *                 fast mode, DUTY 0   low = 2 high = 2 CCR       SCL = PCLK1 / (3 CCR)
+ *                 fast mode, DUTY 1   low / high = 16 / 9        SCL = PCLK1 / (25 CCR)
+ * TRISE        -> the longest SCL rise time in PCLK1 periods, + 1:
+ *                 1000 ns in standard mode, 300 ns in fast mode
+ *
+ * CCR is rounded up, so the SCL never goes over the speed asked: 'scl'
+ * is the one it gets, of the two fast mode DUTYs the closest one (DUTY 1
+ * is the one that gets to exactly 400 kHz, with PCLK1 a multiple of
+ * 10 MHz). The real one is a bit slower still, by the rise time of the
+ * bus, that the peripheral waits for before it counts high.
+ * */
+#define I2C_STANDARD 100000
+#define I2C_FAST 400000
+
+typedef struct i2c_timing_t {
+    uint32_t pclk1;
+    uint32_t speed;
+    // The register values.
+    uint8_t freq;
+    uint16_t ccr;
+    uint8_t trise;
+    // SCL in Hz it comes out at.
+    uint32_t scl;
+} i2c_timing_t;
+
+/*
+ * PCLK1 in Hz, HCLK (systick_hclk) through the APB1 prescaler.
+ * */
+uint32_t i2c_pclk1(void);
+
+/*
+ * The registers for 'speed' (up to I2C_FAST) on 'pclk1', returns 0, or -1
+ * when the clock can't do it (out of 2 to 50 MHz, under 4 in fast mode).
+ * */
+int i2c_timing(uint32_t pclk1, uint32_t speed, i2c_timing_t *timing);
+
+/*
+ * Writes them to 'i2c', disabled meanwhile (CCR can only be written with
+ * PE off). Not with a transfer going.
+ * */
+void i2c_timing_apply(I2Cx_t *i2c, const i2c_timing_t *timing);
+
+#endif // !I2C_TIMING_H
@@ -0,0 +1,103 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+
+/*
+ * Interrupt priorities set from one table, and the cost of each handler
+ * measured against a budget (src/common/irq.c).
+ *
+ * The STM32F401 has 4 bits of priority in each NVIC_IPR/SCB_SHPR byte (the
+ * high ones). The priority grouping (AIRCR.PRIGROUP, Section 4.3.5 of the
+ * arm-cortex-m4 datasheet) splits them: the high 'preempt_bits' are the
+ * preemption priority, an interrupt only preempts a handler with a bigger
+ * one, the rest the sub-priority, which only picks which of two pending
+ * interrupts goes first. 0 is the most urgent for both.
+ *
+ * With 4 preemption bits (no sub-priority) a preemption priority is also
+ * the number of critical.h's PRIORITY(n), and CRITICAL_PRIORITY masks it.
+ *
+ * Each handler in the table that wants to be measured calls irq_enter
+ * first thing and irq_exit last, with its IRQ number:
+ * - execution time, DWT cycles from the enter to the exit, minus the
+ *   ones of the handlers that preempted it meanwhile;
+ * - entry latency, DWT cycles from the moment the interrupt was raised
+ *   to irq_enter. Only the handler knows when that was, if it knows at
+ *   all: SysTick from how far its counter went past the reload, a timer
+ *   from how far it is past the compare. It tells with irq_latency. For
+ *   the others irq_trigger pends the interrupt by hand with a timestamp,
+ *   and irq_enter measures from that: the handler has to put up with a
+ *   call with nothing to do.
+ *
+ * A run over either budget of its entry is counted, and its bit set in
+ * irq_over: the slow handlers that make the fast ones wait show up there,
+ * before what they starve does. The DWT counter must be on (irq_setup
+ * starts it).
+ * */
+#define IRQ_SLOTS 8
+// Peripheral IRQs of the STM32F401 (Table 38 of the reference manual).
+#define IRQ_LINES 85
+
+// The system handlers, as their position in the vector table - 16.
+#define IRQ_SVCALL (-5)
+#define IRQ_PENDSV (-2)
+#define IRQ_SYSTICK (-1)
+
+typedef struct irq_config_t {
+    // IRQ number, or one of the system handlers above.
+    int8_t irq;
+    uint8_t preempt;
+    uint8_t sub;
+    // DWT cycles, 0 when not checked.
+    uint32_t latency_budget;
+    uint32_t run_budget;
+} irq_config_t;
+
+typedef struct irq_stats_t {
+    uint32_t runs;
+    uint32_t run_sum;
+    uint32_t run_max;
+    // Only the runs that had a latency (irq_latency, irq_trigger).
+    uint32_t latencies;
+    uint32_t latency_sum;
+    uint32_t latency_max;
+    // Runs over budget.
+    uint32_t over;
+} irq_stats_t;
+
+/*
+ * Sets the grouping to 'preempt_bits' (0 to 4) of preemption priority,
+ * then the priorities of the 'count' entries of 'table' (up to
+ * IRQ_SLOTS), which stays in use for the measurements. Before the
+ * interrupts are enabled.
+ * */
+void irq_setup(uint8_t preempt_bits, const irq_config_t *table, uint8_t count);
+
+/*
+ * From the handler of 'irq', nothing happens for the ones not in the table.
+ * */
+void irq_enter(int8_t irq);
+void irq_exit(int8_t irq);
+
+/*
+ * From the handler of 'irq', after irq_enter: it was raised 'cycles' ago.
+ * */
+void irq_latency(int8_t irq, uint32_t cycles);
+
+/*
+ * Pends the peripheral interrupt 'irq' by hand, to measure its latency.
+ * */
+void irq_trigger(int8_t irq);
+
+/*
+ * The stats of the 'slot' entry of the table since the last call, and
+ * starts over.
+ * */
+void irq_stats(uint8_t slot, irq_stats_t *stats);
+
+/*
+ * A bit for each slot that went over budget since the last call.
+ * */
+uint32_t irq_over(void);
+
+#endif // !IRQ_H
@@ -163,6 +163,127 @@ typedef struct I2C_t {
     __IO uint32_t I2C_FLTR;
 } I2Cx_t;
 
+/*
+ * Simple struct that holds the names of the registers of one DMA stream:
+ *
+ * DMA_SxCR   -> configuration, the channel (CHSEL), direction, increments, interrupts and EN
+ * DMA_SxNDTR -> number of data items left to transfer
+ * DMA_SxPAR  -> peripheral address
+ * DMA_SxM0AR -> memory address (and M1AR the second one, in double buffer mode)
+ * DMA_SxFCR  -> FIFO control, direct mode when left at reset
+ *
+ * Section 9.5 of the reference manual.
+ * */
+typedef struct DMA_stream_t {
+	__IO uint32_t DMA_SxCR;
+	__IO uint32_t DMA_SxNDTR;
+	__IO uint32_t DMA_SxPAR;
+	__IO uint32_t DMA_SxM0AR;
+	__IO uint32_t DMA_SxM1AR;
+	__IO uint32_t DMA_SxFCR;
+} DMA_stream_t;
+
+/*
+ * Simple struct that holds the names of the DMA controller registers:
+ * the interrupt flags of streams 0 to 3 (LISR, cleared through LIFCR)
+ * and 4 to 7 (HISR, HIFCR), then the 8 streams.
+ *
+ * Section 9.5 of the reference manual.
+ * */
+typedef struct DMA_t {
+	__IO uint32_t DMA_LISR;
+	__IO uint32_t DMA_HISR;
+	__IO uint32_t DMA_LIFCR;
+	__IO uint32_t DMA_HIFCR;
+	DMA_stream_t DMA_S[8];
+} DMA_t;
+
+/*
+ * Simple struct that holds the names of the NVIC
+ * (Nested Vectored Interrupt Controller) registers.
+ * The NVIC is the one that decides if (and when) an interrupt coming
+ * from a peripheral actually reaches the core.
+ * Each IRQ number n is mapped to bit (n % 32) of the register (n / 32):
+ *
+ * NVIC_ISER -> interrupt set-enable, writing 1 enables the interrupt
+ * NVIC_ICER -> interrupt clear-enable, writing 1 disables the interrupt
+ * NVIC_ISPR -> interrupt set-pending
+ * NVIC_ICPR -> interrupt clear-pending
+ * NVIC_IABR -> interrupt active bit
+ * NVIC_IPR  -> interrupt priority, one byte for each interrupt
+ *
+ * Section 4.2 of the arm-cortex-m4 datasheet.
+ * */
+typedef struct NVIC_t {
+	__IO uint32_t NVIC_ISER[8];
+	__IO uint32_t res0[24];
+	__IO uint32_t NVIC_ICER[8];
+	__IO uint32_t res1[24];
+	__IO uint32_t NVIC_ISPR[8];
+	__IO uint32_t res2[24];
+	__IO uint32_t NVIC_ICPR[8];
+	__IO uint32_t res3[24];
+	__IO uint32_t NVIC_IABR[8];
+	__IO uint32_t res4[56];
+	__IO uint8_t  NVIC_IPR[240];
+} NVIC_t;
+
+/*
+ * Simple struct that holds the names of the SCB (System Control Block) registers:
+ *
+ * SCB_ICSR  -> interrupt control and state, bit 26 (PENDSTSET) tells a SysTick
+ *              interrupt is pending, bit 28 (PENDSVSET) asks for a PendSV
+ * SCB_VTOR  -> where the vector table is
+ * SCB_AIRCR -> application interrupt and reset control, holds the priority grouping
+ * SCB_SCR   -> system control, bit 2 (SLEEPDEEP) picks the sleep mode entered by WFI
+ * SCB_SHPR  -> priorities of the system handlers (SVCall, PendSV, SysTick...)
+ *
+ * Section 4.3 of the arm-cortex-m4 datasheet.
+ * */
+typedef struct SCB_t {
+	__IO uint32_t SCB_CPUID;
+	__IO uint32_t SCB_ICSR;
+	__IO uint32_t SCB_VTOR;
+	__IO uint32_t SCB_AIRCR;
+	__IO uint32_t SCB_SCR;
+	__IO uint32_t SCB_CCR;
+	__IO uint8_t  SCB_SHPR[12];
+	__IO uint32_t SCB_SHCSR;
+} SCB_t;
+
+/*
+ * Simple struct that holds the names of the DWT (Data Watchpoint and Trace)
+ * registers, we only use it for its cycle counter:
+ *
+ * DWT_CTRL   -> control register, bit 0 (CYCCNTENA) starts the cycle counter
+ * DWT_CYCCNT -> incremented on every core clock cycle
+ *
+ * The DWT is only powered when the TRCENA bit of the DEMCR
+ * register (in the debug control block, see DCB_t) is set.
+ *
+ * Section C1.8 of the ARMv7-M architecture reference manual.
+ * */
+typedef struct DWT_t {
+	__IO uint32_t DWT_CTRL;
+	__IO uint32_t DWT_CYCCNT;
+	__IO uint32_t DWT_CPICNT;
+	__IO uint32_t DWT_EXCCNT;
+	__IO uint32_t DWT_SLEEPCNT;
+	__IO uint32_t DWT_LSUCNT;
+	__IO uint32_t DWT_FOLDCNT;
+} DWT_t;
+
+/*
+ * Simple struct that holds the names of the debug control block registers,
+ * DEMCR bit 24 (TRCENA) enables the DWT.
+ * */
+typedef struct DCB_t {
+	__IO uint32_t DCB_DHCSR;
+	__IO uint32_t DCB_DCRSR;
+	__IO uint32_t DCB_DCRDR;
+	__IO uint32_t DCB_DEMCR;
+} DCB_t;
+
 /**
  * @brief Struct Pointer for RCC Peripherals assigned with fixed address specified in reference manual.
  *
@@ -177,6 +298,27 @@ extern RCC_t * const RCC;
  **/
 extern GPIOx_t * const GPIOA;
 
+/**
+ * @brief Struct Pointer for GPIOB Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+extern GPIOx_t * const GPIOB;
+
+/**
+ * @brief Struct Pointer for I2C1 Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+extern I2Cx_t * const I2C1;
+
+/**
+ * @brief Struct Pointer for DMA1 assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+extern DMA_t * const DMA1;
+
 /*
  * @brieft Struct pointer for the UART2 Peripherals assigned with fixed address specified in reference manual.
  *
@@ -196,4 +338,25 @@ extern SYST_t * const SYST;
  * */
 extern TIMx_t  * const TIM2;
 
+/*
+ * @brief Struct Pointer for the SCB assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.3 System control block (ARM-cortex-m4 datasheet).
+ * */
+extern SCB_t * const SCB;
+
+/*
+ * @brief Struct Pointer for the NVIC assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.2 Nested Vectored Interrupt Controller (ARM-cortex-m4 datasheet).
+ * */
+extern NVIC_t * const NVIC;
+
+/*
+ * @brief Struct Pointers for the DWT and the debug control block, at the addresses specified in the
+ * ARMv7-M architecture reference manual.
+ * */
+extern DWT_t * const DWT;
+extern DCB_t * const DCB;
+
 #endif
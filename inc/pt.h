@@ -0,0 +1,100 @@
+#ifndef PT_H
+#define PT_H
+
+#include <stdint.h>
+
+/*
+ * Protothreads: stackless coroutines in a few macros, after the ones of
+ * Adam Dunkels, for sequences that wait on hardware (the flags of an I2C
+ * transfer) written top to bottom instead of as a hand made state machine.
+ *
+ * A protothread is a function that returns each time it has to wait, and
+ * the next call goes on from that point: its whole state is pt_t, the
+ * line it stopped at. The function is called again by whoever knows the
+ * wait may be over, typically the interrupt of the flag it waits for.
+ *
+ * static int blink(pt_t *pt) {
+ *     PT_BEGIN(pt);
+ *     PT_WAIT_UNTIL(pt, button_pressed());
+ *     led_on();
+ *     PT_END(pt);
+ * }
+ *
+ * The resume is a switch on the saved line (a jump table, or a few
+ * compares), so it costs about as much as a state machine would.
+ *
+ * What it doesn't have, from being stackless:
+ * - locals don't survive a wait, what has to goes in a struct next to
+ *   the pt_t (static, or the context the function gets);
+ * - waits only in the protothread function itself, not in what it calls
+ *   (use PT_SPAWN for a child protothread);
+ * - no switch statements of its own around a wait, the macros are one.
+ * */
+#define PT_WAITING 0
+#define PT_YIELDED 1
+#define PT_EXITED 2
+#define PT_ENDED 3
+
+typedef struct pt_t {
+    uint16_t line;
+} pt_t;
+
+#define PT_INIT(pt) ((pt)->line = 0)
+
+#define PT_BEGIN(pt) { char pt_yielded = 1; (void)pt_yielded; switch ((pt)->line) { case 0:
+
+#define PT_END(pt) } PT_INIT(pt); return PT_ENDED; }
+
+/*
+ * Returns PT_WAITING until 'condition' is true, checked
+ * again at each call.
+ * */
+#define PT_WAIT_UNTIL(pt, condition)        \
+    do {                                    \
+        (pt)->line = __LINE__;              \
+        case __LINE__:                      \
+        if (!(condition)) {                 \
+            return PT_WAITING;              \
+        }                                   \
+    } while (0)
+
+#define PT_WAIT_WHILE(pt, condition) PT_WAIT_UNTIL(pt, !(condition))
+
+/*
+ * Gives the call back once, and goes on from here at the next.
+ * */
+#define PT_YIELD(pt)                        \
+    do {                                    \
+        pt_yielded = 0;                     \
+        (pt)->line = __LINE__;              \
+        case __LINE__:                      \
+        if (pt_yielded == 0) {              \
+            return PT_YIELDED;              \
+        }                                   \
+    } while (0)
+
+/*
+ * Ends the protothread here, the next call starts it over.
+ * */
+#define PT_EXIT(pt)                         \
+    do {                                    \
+        PT_INIT(pt);                        \
+        return PT_EXITED;                   \
+    } while (0)
+
+/*
+ * Starts the child protothread 'thread' (a call on 'child') and waits
+ * until it ends.
+ * */
+#define PT_SPAWN(pt, child, thread)                 \
+    do {                                            \
+        PT_INIT(child);                             \
+        PT_WAIT_UNTIL(pt, (thread) >= PT_EXITED);   \
+    } while (0)
+
+/*
+ * True while the protothread hasn't ended.
+ * */
+#define PT_SCHEDULE(thread) ((thread) < PT_EXITED)
+
+#endif // !PT_H
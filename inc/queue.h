@@ -0,0 +1,82 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+
+/*
+ * Lock free queues of fixed size items, on storage the caller gives them
+ * (src/common/queue.c), to pass things from interrupts to the main loop
+ * without masking anything. Capacities are powers of 2.
+ *
+ * spsc -> one producer and one consumer: the producer only writes head,
+ *         the consumer only tail, plain loads and stores with a barrier
+ *         in between are enough.
+ * mpsc -> any number of producers (interrupts at any priority, and the
+ *         main loop) and one consumer. A producer reserves a slot moving
+ *         head with LDREX/STREX (see atomic.h), fills it, then publishes
+ *         it in the slot's sequence number: the consumer takes a slot
+ *         only once it's published, so a producer interrupted between
+ *         the two by another one just holds the ones after it back
+ *         until it's done (the bounded queue of Dmitry Vyukov).
+ *
+ * Items are copied in and out a byte at a time (there's no memcpy
+ * without libc), keep them small.
+ * */
+typedef struct spsc_t {
+    uint8_t *items;
+    uint16_t size;
+    uint16_t capacity;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+} spsc_t;
+
+typedef struct mpsc_t {
+    uint8_t *items;
+    // One per slot: the position it can be written at, + 1 once it was.
+    volatile uint32_t *sequence;
+    uint16_t size;
+    uint16_t capacity;
+    volatile uint32_t head;
+    uint32_t tail;
+} mpsc_t;
+
+/*
+ * 'items' holds 'capacity' items of 'size' bytes.
+ * */
+void spsc_init(spsc_t *queue, void *items, uint16_t size, uint16_t capacity);
+
+/*
+ * Returns 0, or -1 when the queue is full.
+ * */
+int spsc_push(spsc_t *queue, const void *item);
+
+/*
+ * Returns 0, or -1 when the queue is empty.
+ * */
+int spsc_pop(spsc_t *queue, void *item);
+
+static inline int spsc_empty(const spsc_t *queue) {
+    return queue->head == queue->tail;
+}
+
+/*
+ * 'items' holds 'capacity' items of 'size' bytes, 'sequence' 'capacity' words.
+ * */
+void mpsc_init(mpsc_t *queue, void *items, volatile uint32_t *sequence, uint16_t size, uint16_t capacity);
+
+/*
+ * From any context. Returns 0, or -1 when the queue is full.
+ * */
+int mpsc_push(mpsc_t *queue, const void *item);
+
+/*
+ * From the consumer only. Returns 0, or -1 when there's nothing
+ * published to take.
+ * */
+int mpsc_pop(mpsc_t *queue, void *item);
+
+static inline int mpsc_empty(const mpsc_t *queue) {
+    return queue->sequence[queue->tail & (queue->capacity - 1)] != queue->tail + 1;
+}
+
+#endif // !QUEUE_H
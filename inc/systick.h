@@ -0,0 +1,59 @@
+#ifndef SYSTICK_H
+#define SYSTICK_H
+
+#include <stdint.h>
+
+/*
+ * SysTick driver shared by the projects (src/common/systick.c), so that
+ * each of them just says how many ticks per second it wants.
+ *
+ * The reload value is computed from the real HCLK, read back from the RCC
+ * (HSI, HSE or PLL, then the AHB prescaler), not from a constant. SysTick
+ * counts RVR + 1 cycles per tick on 24 bits: when the rate is too slow
+ * for that on HCLK, it counts on the reference clock (HCLK / 8 on this
+ * part, Section 6.2), if SYST_CALIB says there is one (NOREF clear).
+ *
+ * SYST_CALIB's TENMS is not used for the math: ST fixes it to the 1 ms of
+ * the maximum HCLK / 8 (10500 for 84 MHz), which isn't the clock we run at.
+ *
+ * A rate of 0 is the tickless setup: the counter runs over all its 24
+ * bits with no interrupt, for code that programs the reload itself.
+ * */
+#define SYSTICK_MAX_RELOAD 0x00FFFFFF
+#define SYSTICK_TICKLESS 0
+
+// The board feeds HSE from the 8 MHz MCO of its ST-LINK.
+#ifndef HSE_FREQUENCY
+#define HSE_FREQUENCY 8000000
+#endif
+#define HSI_FREQUENCY 16000000
+
+typedef struct systick_t {
+    // Core clock, and the one SysTick counts (HCLK or HCLK / 8).
+    uint32_t hclk;
+    uint32_t clock;
+    // What went in SYST_RVR, the counter counts reload + 1 per tick.
+    uint32_t reload;
+    // The period it actually got, the closest to the one asked. On 64
+    // bits: 2^24 counts of the reference clock at a low HCLK are more
+    // than the 4.29 s 32 bits of ns hold.
+    uint64_t period_ns;
+} systick_t;
+
+/*
+ * HCLK in Hz, from how the RCC is set up right now.
+ * */
+uint32_t systick_hclk(void);
+
+/*
+ * Sets SysTick up for 'rate' ticks per second, with the SysTick
+ * interrupt on every tick if 'interrupt', and starts it.
+ * The counter starts from a full tick.
+ *
+ * Returns 0, or -1 when the rate can't be made (too fast for a reload of
+ * at least 1, or too slow for 24 bits even on the reference clock): it
+ * runs at the closest one it can, 'tick' says which.
+ * */
+int systick_setup(systick_t *tick, uint32_t rate, uint8_t interrupt);
+
+#endif // !SYSTICK_H
@@ -0,0 +1,54 @@
+/*
+ *@brief BASEPRI critical sections shared by the projects, see inc/critical.h
+ **/
+#include "../../inc/peripherals.h"
+#include "../../inc/critical.h"
+
+/*
+ * @brief Written with the mask on only, and read in critical_stats with it on too.
+ * */
+static critical_stats_t s_stats;
+static uint32_t s_entered;
+static uint32_t s_where;
+
+uint32_t critical_enter(void) {
+    uint32_t basepri;
+
+    __asm volatile ("mrs %0, basepri" : "=r" (basepri) :: "memory");
+    __asm volatile ("msr basepri_max, %0" :: "r" (PRIORITY(CRITICAL_PRIORITY)) : "memory");
+
+    // The outermost one, or one in an interrupt above the mask while
+    // none is on: they can't overlap.
+    if (basepri == 0) {
+        s_entered = DWT->DWT_CYCCNT;
+        s_where = (uint32_t)__builtin_return_address(0);
+    }
+
+    return basepri;
+}
+
+void critical_exit(uint32_t basepri) {
+    if (basepri == 0) {
+        uint32_t cycles = DWT->DWT_CYCCNT - s_entered;
+
+        s_stats.sections++;
+        s_stats.sum_cycles += cycles;
+
+        if (cycles > s_stats.max_cycles) {
+            s_stats.max_cycles = cycles;
+            s_stats.max_where = s_where;
+        }
+    }
+
+    __asm volatile ("msr basepri, %0" :: "r" (basepri) : "memory");
+}
+
+void critical_stats(critical_stats_t *stats) {
+    uint32_t basepri = critical_enter();
+
+    *stats = s_stats;
+    s_stats = (critical_stats_t){0};
+
+    // This one doesn't count.
+    __asm volatile ("msr basepri, %0" :: "r" (basepri) : "memory");
+}
@@ -0,0 +1,151 @@
+/*
+ *@brief Event loop shared by the projects, see inc/event.h
+ **/
+#include "../../inc/peripherals.h"
+#include "../../inc/event.h"
+#include "../../inc/atomic.h"
+
+#include <stddef.h>
+
+#define DEMCR_TRCENA 24
+#define CTRL_CYCCNTENA 0
+
+/*
+ * @brief The queues of each priority, in the order they were added.
+ * */
+static event_queue_t *s_queues[EVENT_PRIORITIES];
+
+/*
+ * @brief Written by the loop only, event_stats reads them from a handler.
+ * */
+static event_stats_t s_stats;
+static uint32_t s_since;
+
+void event_init(void) {
+    // Power the DWT through DEMCR.TRCENA and start the cycle counter,
+    // left running if it already is (the benchmarks use it too).
+    DCB->DCB_DEMCR |= (1 << DEMCR_TRCENA);
+    DWT->DWT_CTRL |= (1 << CTRL_CYCCNTENA);
+
+    for (uint8_t priority = 0; priority < EVENT_PRIORITIES; ++priority) {
+        s_queues[priority] = NULL;
+    }
+
+    s_stats = (event_stats_t){0};
+    s_since = DWT->DWT_CYCCNT;
+}
+
+void event_queue_init(event_queue_t *queue, uint8_t priority, event_handler_t handler) {
+    if (priority >= EVENT_PRIORITIES) {
+        priority = EVENT_PRIORITIES - 1;
+    }
+
+    mpsc_init(&queue->queue, queue->ring, queue->sequence, sizeof(event_t), EVENT_QUEUE_SIZE);
+    queue->priority = priority;
+    queue->handler = handler;
+    queue->lost = 0;
+    queue->next = NULL;
+
+    event_queue_t **link = &s_queues[priority];
+
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+
+    *link = queue;
+}
+
+int event_post(event_queue_t *queue, uint16_t signal, uint32_t param) {
+    event_t event = {.signal = signal, .param = param, .posted = DWT->DWT_CYCCNT};
+
+    if (mpsc_push(&queue->queue, &event) < 0) {
+        atomic_fetch_add(&queue->lost, 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+int event_dispatch(void) {
+    for (uint8_t priority = 0; priority < EVENT_PRIORITIES; ++priority) {
+        for (event_queue_t *queue = s_queues[priority]; queue != NULL; queue = queue->next) {
+            event_t event;
+
+            // A copy, so the slot goes back to the producers before the
+            // handler runs, and it can post to its own queue.
+            if (mpsc_pop(&queue->queue, &event) < 0) {
+                continue;
+            }
+
+            uint32_t latency = DWT->DWT_CYCCNT - event.posted;
+
+            s_stats.dispatched++;
+            s_stats.latency_sum += latency;
+
+            if (latency > s_stats.latency_max) {
+                s_stats.latency_max = latency;
+            }
+
+            queue->handler(&event);
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int event_pending(void) {
+    for (uint8_t priority = 0; priority < EVENT_PRIORITIES; ++priority) {
+        for (event_queue_t *queue = s_queues[priority]; queue != NULL; queue = queue->next) {
+            if (!event_queue_empty(queue)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void event_sleep(void) {
+    __asm volatile ("dsb\n\twfi\n\tisb\n\tcpsie i" ::: "memory");
+}
+
+void event_run(event_idle_t idle) {
+    if (idle == NULL) {
+        idle = event_sleep;
+    }
+
+    while (1) {
+        if (event_dispatch()) {
+            continue;
+        }
+
+        // Off from the last look at the queues to the sleep: an event
+        // posted in between would wait for the next interrupt otherwise.
+        __asm volatile ("cpsid i" ::: "memory");
+
+        if (event_pending()) {
+            __asm volatile ("cpsie i" ::: "memory");
+            continue;
+        }
+
+        // The interrupt that wakes us up runs before idle returns,
+        // its cycles count as idle too.
+        uint32_t start = DWT->DWT_CYCCNT;
+
+        idle();
+
+        s_stats.idle += DWT->DWT_CYCCNT - start;
+    }
+}
+
+void event_stats(event_stats_t *stats) {
+    uint32_t now = DWT->DWT_CYCCNT;
+
+    *stats = s_stats;
+    stats->cycles = now - s_since;
+
+    s_stats = (event_stats_t){0};
+    s_since = now;
+}
@@ -0,0 +1,520 @@
+#include "../../inc/peripherals.h"
+#include "../../inc/flags.h"
+#include "../../inc/i2c_timing.h"
+#include "../../inc/systick.h"
+#include "../../inc/i2c1.h"
+
+#include <stddef.h>
+
+#define CR1_SWRST       15
+#define CR1_POS         11
+#define CR1_ACK         10
+#define CR1_STOP         9
+#define CR1_START        8
+#define CR1_PE           0
+#define CR2_LAST        12
+#define CR2_DMAEN       11
+#define CR2_ITBUFEN     10
+#define CR2_ITEVTEN      9
+#define CR2_ITERREN      8
+#define CR2_FREQ      0x3F
+#define SR1_AF          10
+#define SR1_ARLO         9
+#define SR1_BERR         8
+#define SR1_TxE          7
+#define SR1_RxNE         6
+#define SR1_BTF          2
+#define SR1_ADDR         1
+#define SR1_SB           0
+// The error flags we handle, cleared writing 0 (Section 18.6.6).
+#define SR1_ERRORS ((1 << SR1_AF) | (1 << SR1_ARLO) | (1 << SR1_BERR))
+#define CR2_INTERRUPTS ((1 << CR2_ITBUFEN) | (1 << CR2_ITEVTEN) | (1 << CR2_ITERREN))
+
+// DMA1 stream 0 on channel 1 is I2C1_RX (Table 28), a byte at a time from
+// DR to memory, incrementing the memory address (Section 9.5.5).
+#define DMA_STREAM 0
+#define SxCR_CHSEL      25
+#define SxCR_PL         16
+#define SxCR_MINC       10
+#define SxCR_TCIE        4
+#define SxCR_TEIE        2
+#define SxCR_EN          0
+// The flags of stream 0 in LISR and LIFCR (Section 9.5.1).
+#define LISR_TCIF0       5
+#define LISR_TEIF0       3
+#define LIFCR_STREAM0 0x3D
+#define RCC_DMA1EN      21
+
+// SCL periods of a standard mode bus the STOP gets to be out, at the
+// end of a transaction.
+#define I2C1_STOP_PERIODS 2
+
+// The blocking calls wait on this flag.
+#define SYNC_DONE (1 << 0)
+
+i2c1_stats_t i2c1_stats;
+
+/*
+ * @brief The transaction running, NULL when there's none.
+ * */
+static i2c1_xfer_t * volatile s_xfer;
+static volatile uint32_t s_ticks;
+// Set while the transaction waits for the STOP of the one before.
+static uint8_t s_stopping;
+// I2C1_STOP_PERIODS in DWT cycles.
+static uint32_t s_stop_cycles;
+static flags_t s_sync;
+
+static int flag(uint8_t bit) {
+    return (I2C1->I2C_SR1 & (1 << bit)) != 0;
+}
+
+static void buffer_interrupt(int on) {
+    if (on) {
+        I2C1->I2C_CR2 |= (1 << CR2_ITBUFEN);
+    } else {
+        I2C1->I2C_CR2 &= ~(1 << CR2_ITBUFEN);
+    }
+}
+
+/*
+ * @brief DMA1 stream 0 reads the 'rx_length' bytes of 'xfer' from DR,
+ * as soon as ADDR is cleared (DMAEN). With LAST the peripheral NACKs
+ * the one the DMA says is the last (Section 18.3.7).
+ * */
+static void dma_start(i2c1_xfer_t *xfer) {
+    DMA_stream_t *stream = &DMA1->DMA_S[DMA_STREAM];
+
+    stream->DMA_SxCR &= ~(1 << SxCR_EN);
+    while (stream->DMA_SxCR & (1 << SxCR_EN));
+
+    DMA1->DMA_LIFCR = LIFCR_STREAM0;
+    stream->DMA_SxPAR = (uint32_t)&I2C1->I2C_DR;
+    stream->DMA_SxM0AR = (uint32_t)xfer->rx;
+    stream->DMA_SxNDTR = xfer->rx_length;
+    stream->DMA_SxCR = (1 << SxCR_CHSEL) | (2 << SxCR_PL) | (1 << SxCR_MINC) |
+                       (1 << SxCR_TCIE) | (1 << SxCR_TEIE);
+    stream->DMA_SxCR |= (1 << SxCR_EN);
+
+    xfer->dma_done = 0;
+    I2C1->I2C_CR2 |= (1 << CR2_DMAEN) | (1 << CR2_LAST);
+    i2c1_stats.dma++;
+}
+
+// The sections used here are all under
+// the main I2C section, so the section 18.
+static int xfer_thread(i2c1_xfer_t *xfer) {
+    volatile int tmp;
+
+    PT_BEGIN(&xfer->pt);
+
+    // The STOP of the one before, when it's started from its callback:
+    // a START asked for before it's out is lost with it (Section 18.6.1,
+    // no write to CR1 while START or STOP are set). finish waits for it,
+    // for a while: if it's still not out, no interrupt says when it is,
+    // i2c1_tick resumes us meanwhile.
+    if (I2C1->I2C_CR1 & (1 << CR1_STOP)) {
+        i2c1_stats.stop_late++;
+    }
+
+    s_stopping = 1;
+    PT_WAIT_UNTIL(&xfer->pt, !(I2C1->I2C_CR1 & (1 << CR1_STOP)));
+    s_stopping = 0;
+
+    if (xfer->reg_length + xfer->tx_length > 0) {
+        // Generate a Start Signal to initiate communication, and wait until
+        // it has been successfully transmitted (SB)
+        I2C1->I2C_CR1 |= (1 << CR1_START);
+        PT_WAIT_UNTIL(&xfer->pt, flag(SR1_SB));
+
+        // Transmit the Slave Address along with the Write bit (SLA+W),
+        // and wait for the Address Acknowledge (ACK) from the slave device:
+        // a NACK ends up in the error interrupt instead
+        I2C1->I2C_DR = xfer->slave << 1;
+        PT_WAIT_UNTIL(&xfer->pt, flag(SR1_ADDR));
+        tmp = I2C1->I2C_SR2;  // Clear ADDR Bit by reading SR2
+
+        // Send the register, then the bytes, each time the Transmit Data
+        // Register (DR) is empty
+        buffer_interrupt(1);
+
+        if (xfer->reg_length > 0) {
+            PT_WAIT_UNTIL(&xfer->pt, flag(SR1_TxE));
+            I2C1->I2C_DR = xfer->reg;
+        }
+
+        for (xfer->index = 0; xfer->index < xfer->tx_length; xfer->index++) {
+            PT_WAIT_UNTIL(&xfer->pt, flag(SR1_TxE));
+            I2C1->I2C_DR = xfer->tx[xfer->index];
+        }
+
+        buffer_interrupt(0);
+
+        // Wait until the last one is out (BTF), then either the
+        // Stop Signal or the restart to read
+        PT_WAIT_UNTIL(&xfer->pt, flag(SR1_BTF));
+
+        if (xfer->rx_length == 0) {
+            I2C1->I2C_CR1 |= (1 << CR1_STOP);
+            PT_EXIT(&xfer->pt);
+        }
+    }
+
+    // Generate a Start (or Restart) Signal to read
+    I2C1->I2C_CR1 |= (1 << CR1_START);
+    PT_WAIT_UNTIL(&xfer->pt, flag(SR1_SB));
+
+    // Transmit the Slave Address along with the Read bit (SLA+R). For two
+    // bytes POS and ACK go before ADDR: the first is acknowledged, the
+    // NACK asked for once ADDR is cleared goes to the second
+    I2C1->I2C_DR = xfer->slave << 1 | 1;
+
+    if (xfer->rx_length == 2) {
+        I2C1->I2C_CR1 |= (1 << CR1_POS) | (1 << CR1_ACK);
+    }
+
+    PT_WAIT_UNTIL(&xfer->pt, flag(SR1_ADDR));
+
+    if (xfer->rx_length == 1) {
+        // Disable Acknowledge (ACK) from the master to indicate the end of data reception,
+        // clear ADDR and ask for the Stop Signal: it comes after the byte
+        I2C1->I2C_CR1 &= ~(1 << CR1_ACK);
+        tmp = I2C1->I2C_SR2;
+        I2C1->I2C_CR1 |= (1 << CR1_STOP);
+
+        buffer_interrupt(1);
+        PT_WAIT_UNTIL(&xfer->pt, flag(SR1_RxNE));
+        buffer_interrupt(0);
+        xfer->rx[0] = I2C1->I2C_DR;
+    } else if (xfer->rx_length == 2) {
+        // Both bytes in (BTF: the first in DR, the second in the shift
+        // register, the clock held), then the STOP and the two reads
+        tmp = I2C1->I2C_SR2;
+        I2C1->I2C_CR1 &= ~(1 << CR1_ACK);
+        PT_WAIT_UNTIL(&xfer->pt, flag(SR1_BTF));
+
+        I2C1->I2C_CR1 |= (1 << CR1_STOP);
+        xfer->rx[0] = I2C1->I2C_DR;
+        xfer->rx[1] = I2C1->I2C_DR;
+        I2C1->I2C_CR1 &= ~(1 << CR1_POS);
+    } else if (xfer->rx_length < I2C1_DMA_MIN) {
+        // Acknowledge every byte, read them on RxNE up to the last 3
+        I2C1->I2C_CR1 |= (1 << CR1_ACK);
+        tmp = I2C1->I2C_SR2;
+        buffer_interrupt(1);
+
+        for (xfer->index = 0; xfer->index + 3 < xfer->rx_length; xfer->index++) {
+            PT_WAIT_UNTIL(&xfer->pt, flag(SR1_RxNE));
+            xfer->rx[xfer->index] = I2C1->I2C_DR;
+        }
+
+        buffer_interrupt(0);
+
+        // N-2 in DR, N-1 in the shift register: the NACK goes with N
+        PT_WAIT_UNTIL(&xfer->pt, flag(SR1_BTF));
+        I2C1->I2C_CR1 &= ~(1 << CR1_ACK);
+        xfer->rx[xfer->index++] = I2C1->I2C_DR;
+
+        // N-1 in DR, N in the shift register: STOP, then both
+        PT_WAIT_UNTIL(&xfer->pt, flag(SR1_BTF));
+        I2C1->I2C_CR1 |= (1 << CR1_STOP);
+        xfer->rx[xfer->index++] = I2C1->I2C_DR;
+        xfer->rx[xfer->index] = I2C1->I2C_DR;
+    } else {
+        // The DMA reads them all, ADDR cleared last so it's ready for
+        // the first byte. Only its transfer complete resumes us
+        dma_start(xfer);
+        I2C1->I2C_CR1 |= (1 << CR1_ACK);
+        tmp = I2C1->I2C_SR2;
+        PT_WAIT_UNTIL(&xfer->pt, xfer->dma_done);
+
+        I2C1->I2C_CR1 |= (1 << CR1_STOP);
+    }
+
+    (void)tmp;
+    PT_END(&xfer->pt);
+}
+
+/*
+ * @brief Resets the peripheral, and sets it up the way it was: the way
+ * out when it's stuck, SWRST lets go of SDA and SCL (Section 18.6.1).
+ * */
+static void recover(void) {
+    uint32_t freq = I2C1->I2C_CR2 & CR2_FREQ;
+    uint32_t ccr = I2C1->I2C_CCR;
+    uint32_t trise = I2C1->I2C_TRISE;
+
+    I2C1->I2C_CR1 = (1 << CR1_SWRST);
+    I2C1->I2C_CR1 = 0;
+    I2C1->I2C_CR2 = freq;
+    I2C1->I2C_CCR = ccr;
+    I2C1->I2C_TRISE = trise;
+    I2C1->I2C_CR1 = (1 << CR1_PE);
+}
+
+/*
+ * @brief Waits for the STOP asked for to be out, up to I2C1_STOP_PERIODS:
+ * it is a few us after the last byte (at most an SCL period and the
+ * setup time of the STOP), so the next transaction can start right away.
+ * */
+static void stop_wait(void) {
+    uint32_t start = DWT->DWT_CYCCNT;
+
+    while ((I2C1->I2C_CR1 & (1 << CR1_STOP)) && DWT->DWT_CYCCNT - start < s_stop_cycles);
+}
+
+/*
+ * @brief Ends the transaction running with 'status', from one of the
+ * interrupts: the callback can start the next one.
+ * */
+static void finish(uint8_t status) {
+    i2c1_xfer_t *xfer = s_xfer;
+
+    stop_wait();
+
+    I2C1->I2C_CR2 &= ~(CR2_INTERRUPTS | (1 << CR2_DMAEN) | (1 << CR2_LAST));
+    I2C1->I2C_CR1 &= ~(1 << CR1_POS);
+    DMA1->DMA_S[DMA_STREAM].DMA_SxCR &= ~(1 << SxCR_EN);
+    s_xfer = NULL;
+    s_stopping = 0;
+
+    i2c1_stats.transfers++;
+
+    if (status == I2C1_NACK) {
+        i2c1_stats.nacks++;
+    } else if (status == I2C1_ERROR) {
+        i2c1_stats.errors++;
+    } else if (status == I2C1_TIMEOUT) {
+        i2c1_stats.timeouts++;
+    }
+
+    xfer->status = status;
+
+    if (xfer->callback != NULL) {
+        xfer->callback(xfer);
+    }
+}
+
+/*
+ * @brief Runs the transaction up to its next wait, from the event or the
+ * DMA interrupt, or from i2c1_tick while it waits for a STOP.
+ * */
+static void resume(void) {
+    uint32_t start = DWT->DWT_CYCCNT;
+    int state = xfer_thread(s_xfer);
+    uint32_t cycles = DWT->DWT_CYCCNT - start;
+
+    i2c1_stats.resumes++;
+    i2c1_stats.cycles_sum += cycles;
+
+    if (cycles > i2c1_stats.cycles_max) {
+        i2c1_stats.cycles_max = cycles;
+    }
+
+    if (state >= PT_EXITED) {
+        finish(I2C1_DONE);
+    }
+}
+
+void i2c1_init(void) {
+    s_stop_cycles = systick_hclk() / I2C_STANDARD * I2C1_STOP_PERIODS;
+
+    // DMA1 is on AHB1 (Section 6.3.9).
+    RCC->RCC_AHB1ENR |= (1 << RCC_DMA1EN);
+
+    NVIC->NVIC_ISER[I2C1_EV_IRQ / 32] = (1 << (I2C1_EV_IRQ % 32));
+    NVIC->NVIC_ISER[I2C1_ER_IRQ / 32] = (1 << (I2C1_ER_IRQ % 32));
+    NVIC->NVIC_ISER[I2C1_DMA_IRQ / 32] = (1 << (I2C1_DMA_IRQ % 32));
+}
+
+int i2c1_start(i2c1_xfer_t *xfer) {
+    if (s_xfer != NULL || xfer->reg_length + xfer->tx_length + xfer->rx_length == 0) {
+        return -1;
+    }
+
+    PT_INIT(&xfer->pt);
+    xfer->status = I2C1_RUNNING;
+    // A tick may be partly gone already.
+    xfer->deadline = s_ticks + (xfer->timeout ? xfer->timeout : I2C1_TIMEOUT_DEFAULT) + 1;
+    s_xfer = xfer;
+
+    // Up to the first wait from here, the interrupts go on from there: if
+    // SB is set already it comes right away. A bus still busy with
+    // someone else's transfer only delays the START, the hardware waits
+    // for the STOP by itself.
+    xfer_thread(xfer);
+    I2C1->I2C_CR2 |= (1 << CR2_ITEVTEN) | (1 << CR2_ITERREN);
+
+    return 0;
+}
+
+/*
+ * @brief Fills 'xfer' in and starts it, with a register first when 'reg_length' is 1.
+ * */
+static int prepare(i2c1_xfer_t *xfer, uint8_t slave, uint8_t reg, uint8_t reg_length,
+                   const uint8_t *tx, uint8_t tx_length, uint8_t *rx, uint8_t rx_length,
+                   i2c1_callback_t callback, void *context) {
+    xfer->slave = slave;
+    xfer->reg = reg;
+    xfer->reg_length = reg_length;
+    xfer->tx = tx;
+    xfer->tx_length = tx_length;
+    xfer->rx = rx;
+    xfer->rx_length = rx_length;
+    xfer->callback = callback;
+    xfer->context = context;
+
+    return i2c1_start(xfer);
+}
+
+int i2c1_write(i2c1_xfer_t *xfer, uint8_t slave, const uint8_t *tx, uint8_t tx_length,
+               i2c1_callback_t callback, void *context) {
+    return prepare(xfer, slave, 0, 0, tx, tx_length, NULL, 0, callback, context);
+}
+
+int i2c1_read(i2c1_xfer_t *xfer, uint8_t slave, uint8_t *rx, uint8_t rx_length,
+              i2c1_callback_t callback, void *context) {
+    return prepare(xfer, slave, 0, 0, NULL, 0, rx, rx_length, callback, context);
+}
+
+int i2c1_write_read(i2c1_xfer_t *xfer, uint8_t slave, const uint8_t *tx, uint8_t tx_length,
+                    uint8_t *rx, uint8_t rx_length, i2c1_callback_t callback, void *context) {
+    return prepare(xfer, slave, 0, 0, tx, tx_length, rx, rx_length, callback, context);
+}
+
+int i2c1_read_regs(i2c1_xfer_t *xfer, uint8_t slave, uint8_t reg, uint8_t *data, uint8_t length,
+                   i2c1_callback_t callback, void *context) {
+    // Just the register would be a write.
+    if (length == 0) {
+        return -1;
+    }
+
+    return prepare(xfer, slave, reg, 1, NULL, 0, data, length, callback, context);
+}
+
+int i2c1_write_regs(i2c1_xfer_t *xfer, uint8_t slave, uint8_t reg, const uint8_t *data, uint8_t length,
+                    i2c1_callback_t callback, void *context) {
+    return prepare(xfer, slave, reg, 1, data, length, NULL, 0, callback, context);
+}
+
+int i2c1_busy(void) {
+    return s_xfer != NULL;
+}
+
+void i2c1_tick(void) {
+    s_ticks++;
+
+    if (s_xfer == NULL) {
+        return;
+    }
+
+    if ((int32_t)(s_ticks - s_xfer->deadline) >= 0) {
+        recover();
+        finish(I2C1_TIMEOUT);
+    } else if (s_stopping) {
+        resume();
+    }
+}
+
+static void on_sync(i2c1_xfer_t *xfer) {
+    flags_set(&s_sync, SYNC_DONE);
+}
+
+/*
+ * @brief Starts 'xfer', once the one running is over, and sleeps until its callback.
+ * */
+static int i2c1_wait(i2c1_xfer_t *xfer) {
+    xfer->callback = on_sync;
+
+    // Off between the try and the sleep, or the interrupt that ends the
+    // one running could come in between and we'd sleep for good: WFI
+    // still wakes up on it. The same for ours, after.
+    while (1) {
+        __asm volatile ("cpsid i" ::: "memory");
+
+        if (i2c1_start(xfer) == 0) {
+            break;
+        }
+
+        __asm volatile ("dsb\n\twfi\n\tisb\n\tcpsie i" ::: "memory");
+    }
+
+    while (1) {
+        __asm volatile ("cpsid i" ::: "memory");
+
+        if (flags_take(&s_sync, SYNC_DONE, FLAGS_ANY)) {
+            break;
+        }
+
+        __asm volatile ("dsb\n\twfi\n\tisb\n\tcpsie i" ::: "memory");
+    }
+
+    __asm volatile ("cpsie i" ::: "memory");
+
+    return xfer->status;
+}
+
+int I2C1_byte_read(char slave_addr, char mem_addr, uint8_t *data) {
+    i2c1_xfer_t xfer = {.slave = slave_addr, .reg = mem_addr, .reg_length = 1, .rx = data, .rx_length = 1};
+
+    return i2c1_wait(&xfer);
+}
+
+int I2C1_byte_write(char slave_addr, char mem_addr, uint8_t data) {
+    i2c1_xfer_t xfer = {.slave = slave_addr, .reg = mem_addr, .reg_length = 1, .tx = &data, .tx_length = 1};
+
+    return i2c1_wait(&xfer);
+}
+
+void I2C1_EV_IRQHandler(void) {
+    if (s_xfer == NULL) {
+        I2C1->I2C_CR2 &= ~CR2_INTERRUPTS;
+        return;
+    }
+
+    resume();
+}
+
+void I2C1_ER_IRQHandler(void) {
+    uint32_t errors = I2C1->I2C_SR1 & SR1_ERRORS;
+
+    // Writing 1 leaves the other flags as they are.
+    I2C1->I2C_SR1 = ~errors;
+
+    if (s_xfer == NULL) {
+        I2C1->I2C_CR2 &= ~CR2_INTERRUPTS;
+        return;
+    }
+
+    if (errors & (1 << SR1_ARLO)) {
+        // Another master has the bus, and we are a slave already: no STOP.
+        finish(I2C1_ERROR);
+    } else if (errors & (1 << SR1_AF)) {
+        // The slave didn't acknowledge its address or a byte: the master
+        // has to let go of the bus itself (Section 18.3.3).
+        I2C1->I2C_CR1 |= (1 << CR1_STOP);
+        finish(I2C1_NACK);
+    } else if (errors & (1 << SR1_BERR)) {
+        I2C1->I2C_CR1 |= (1 << CR1_STOP);
+        finish(I2C1_ERROR);
+    }
+}
+
+void DMA1_Stream0_IRQHandler(void) {
+    uint32_t status = DMA1->DMA_LISR;
+
+    DMA1->DMA_LIFCR = LIFCR_STREAM0;
+
+    if (s_xfer == NULL) {
+        return;
+    }
+
+    if (status & (1 << LISR_TEIF0)) {
+        I2C1->I2C_CR1 |= (1 << CR1_STOP);
+        finish(I2C1_ERROR);
+    } else if (status & (1 << LISR_TCIF0)) {
+        // The last byte is in: the STOP goes now (Section 18.3.7).
+        s_xfer->dma_done = 1;
+        resume();
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ *@brief I2C clock setup shared by the projects, see inc/i2c_timing.h
+ **/
+#include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
+#include "../../inc/i2c_timing.h"
+
+#define CFGR_PPRE1 10
+#define CR1_PE 0
+#define CR2_FREQ 0x3F
+#define CCR_FS 15
+#define CCR_DUTY 14
+#define CCR_MAX 0xFFF
+// The smallest CCR standard mode takes (Section 18.6.8).
+#define CCR_MIN_STANDARD 4
+
+uint32_t i2c_pclk1(void) {
+    // APB1 prescaler: 0xx is 1, then 2, 4, 8 and 16 (Section 6.3.3).
+    uint32_t ppre1 = (RCC->RCC_CFGR >> CFGR_PPRE1) & 7;
+    uint32_t hclk = systick_hclk();
+
+    return ppre1 & 4 ? hclk >> ((ppre1 & 3) + 1) : hclk;
+}
+
+static uint32_t divide_up(uint32_t value, uint32_t by) {
+    return (value + by - 1) / by;
+}
+
+int i2c_timing(uint32_t pclk1, uint32_t speed, i2c_timing_t *timing) {
+    uint32_t mhz = pclk1 / 1000000;
+    uint32_t ccr;
+    uint32_t mode = 0;
+
+    if (speed == 0 || speed > I2C_FAST || mhz < 2 || mhz > 50) {
+        return -1;
+    }
+
+    timing->pclk1 = pclk1;
+    timing->speed = speed;
+    timing->freq = mhz;
+
+    if (speed <= I2C_STANDARD) {
+        ccr = divide_up(pclk1, 2 * speed);
+
+        if (ccr < CCR_MIN_STANDARD) {
+            ccr = CCR_MIN_STANDARD;
+        }
+
+        timing->scl = pclk1 / (2 * ccr);
+        // 1000 ns of rise time.
+        timing->trise = mhz + 1;
+    } else {
+        if (mhz < 4) {
+            return -1;
+        }
+
+        uint32_t duty0 = divide_up(pclk1, 3 * speed);
+        uint32_t duty1 = divide_up(pclk1, 25 * speed);
+        uint32_t scl0 = pclk1 / (3 * duty0);
+        uint32_t scl1 = pclk1 / (25 * duty1);
+
+        if (scl1 > scl0) {
+            ccr = duty1;
+            timing->scl = scl1;
+            mode = (1 << CCR_FS) | (1 << CCR_DUTY);
+        } else {
+            ccr = duty0;
+            timing->scl = scl0;
+            mode = (1 << CCR_FS);
+        }
+
+        // 300 ns of rise time.
+        timing->trise = mhz * 300 / 1000 + 1;
+    }
+
+    if (ccr > CCR_MAX) {
+        return -1;
+    }
+
+    timing->ccr = ccr | mode;
+
+    return 0;
+}
+
+void i2c_timing_apply(I2Cx_t *i2c, const i2c_timing_t *timing) {
+    uint32_t cr1 = i2c->I2C_CR1;
+
+    i2c->I2C_CR1 = cr1 & ~(1 << CR1_PE);
+    i2c->I2C_CR2 = (i2c->I2C_CR2 & ~CR2_FREQ) | timing->freq;
+    i2c->I2C_CCR = timing->ccr;
+    i2c->I2C_TRISE = timing->trise;
+    i2c->I2C_CR1 = cr1 | (1 << CR1_PE);
+}
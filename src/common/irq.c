@@ -0,0 +1,224 @@
+/*
+ *@brief Interrupt priorities and handler budgets shared by the projects, see inc/irq.h
+ **/
+#include "../../inc/peripherals.h"
+#include "../../inc/irq.h"
+#include "../../inc/atomic.h"
+
+#include <stddef.h>
+
+#define DEMCR_TRCENA 24
+#define CTRL_CYCCNTENA 0
+// AIRCR is only written with this key in VECTKEY (Section 4.3.5).
+#define AIRCR_VECTKEY 0x05FA
+#define AIRCR_PRIGROUP 8
+#define PRIORITY_BITS 4
+
+typedef struct irq_slot_t {
+    irq_stats_t stats;
+    // Odd while the handler updates stats, for irq_stats to copy them whole.
+    volatile uint32_t sequence;
+    // Set by irq_stats, the next update starts from 0.
+    volatile uint8_t clear;
+    // Set by irq_trigger, with the time it pended the interrupt.
+    volatile uint8_t triggered;
+    uint32_t pended;
+    // The run in progress.
+    uint32_t entered;
+    uint32_t inner;
+    uint32_t latency;
+    uint8_t has_latency;
+} irq_slot_t;
+
+static const irq_config_t *s_table;
+static irq_slot_t s_slots[IRQ_SLOTS];
+
+/*
+ * @brief Slot + 1 of each vector, 0 when it's not in the table.
+ * */
+static uint8_t s_slot_of[16 + IRQ_LINES];
+
+/*
+ * @brief Cycles of all the handlers that ran to the end so far: what went
+ * up while one was running is what the ones preempting it took.
+ * */
+static volatile uint32_t s_inner;
+static volatile uint32_t s_over;
+
+static irq_slot_t *slot_of(int8_t irq) {
+    if (irq < -16 || irq >= IRQ_LINES || s_slot_of[irq + 16] == 0) {
+        return NULL;
+    }
+
+    return &s_slots[s_slot_of[irq + 16] - 1];
+}
+
+void irq_setup(uint8_t preempt_bits, const irq_config_t *table, uint8_t count) {
+    if (preempt_bits > PRIORITY_BITS) {
+        preempt_bits = PRIORITY_BITS;
+    }
+
+    if (count > IRQ_SLOTS) {
+        count = IRQ_SLOTS;
+    }
+
+    DCB->DCB_DEMCR |= (1 << DEMCR_TRCENA);
+    DWT->DWT_CTRL |= (1 << CTRL_CYCCNTENA);
+
+    // PRIGROUP n makes bits [7:n+1] of a priority the preemption one,
+    // only [7:4] are there.
+    SCB->SCB_AIRCR = (AIRCR_VECTKEY << 16) | ((7 - preempt_bits) << AIRCR_PRIGROUP);
+
+    for (uint8_t vector = 0; vector < 16 + IRQ_LINES; ++vector) {
+        s_slot_of[vector] = 0;
+    }
+
+    s_table = table;
+    s_over = 0;
+
+    uint8_t sub_bits = PRIORITY_BITS - preempt_bits;
+
+    for (uint8_t slot = 0; slot < count; ++slot) {
+        const irq_config_t *config = &table[slot];
+        uint8_t preempt = config->preempt & ((1 << preempt_bits) - 1);
+        uint8_t sub = config->sub & ((1 << sub_bits) - 1);
+        uint8_t priority = ((preempt << sub_bits) | sub) << (8 - PRIORITY_BITS);
+
+        if (config->irq < 0) {
+            // SHPR starts from the handler 4 (Section 4.3.7).
+            SCB->SCB_SHPR[config->irq + 16 - 4] = priority;
+        } else {
+            NVIC->NVIC_IPR[config->irq] = priority;
+        }
+
+        s_slots[slot] = (irq_slot_t){0};
+        s_slot_of[config->irq + 16] = slot + 1;
+    }
+}
+
+void irq_enter(int8_t irq) {
+    uint32_t now = DWT->DWT_CYCCNT;
+    irq_slot_t *slot = slot_of(irq);
+
+    if (slot == NULL) {
+        return;
+    }
+
+    slot->entered = now;
+    slot->inner = s_inner;
+    slot->has_latency = 0;
+
+    if (slot->triggered) {
+        slot->triggered = 0;
+        slot->latency = now - slot->pended;
+        slot->has_latency = 1;
+    }
+}
+
+void irq_latency(int8_t irq, uint32_t cycles) {
+    irq_slot_t *slot = slot_of(irq);
+
+    if (slot != NULL) {
+        slot->latency = cycles;
+        slot->has_latency = 1;
+    }
+}
+
+void irq_exit(int8_t irq) {
+    uint32_t now = DWT->DWT_CYCCNT;
+    irq_slot_t *slot = slot_of(irq);
+
+    if (slot == NULL) {
+        return;
+    }
+
+    const irq_config_t *config = &s_table[slot - s_slots];
+    uint32_t total = now - slot->entered;
+    uint32_t run = total - (s_inner - slot->inner);
+
+    // For the one we preempted, all of it: the ones that preempted us
+    // are in total already.
+    s_inner = slot->inner + total;
+
+    uint8_t over = (config->run_budget && run > config->run_budget) ||
+                   (slot->has_latency && config->latency_budget && slot->latency > config->latency_budget);
+
+    slot->sequence++;
+    ATOMIC_BARRIER();
+
+    irq_stats_t *stats = &slot->stats;
+
+    if (slot->clear) {
+        slot->clear = 0;
+        *stats = (irq_stats_t){0};
+    }
+
+    stats->runs++;
+    stats->run_sum += run;
+
+    if (run > stats->run_max) {
+        stats->run_max = run;
+    }
+
+    if (slot->has_latency) {
+        stats->latencies++;
+        stats->latency_sum += slot->latency;
+
+        if (slot->latency > stats->latency_max) {
+            stats->latency_max = slot->latency;
+        }
+    }
+
+    if (over) {
+        stats->over++;
+        atomic_fetch_or(&s_over, 1 << (slot - s_slots));
+    }
+
+    ATOMIC_BARRIER();
+    slot->sequence++;
+}
+
+void irq_trigger(int8_t irq) {
+    irq_slot_t *slot = slot_of(irq);
+
+    if (slot == NULL || irq < 0) {
+        return;
+    }
+
+    slot->pended = DWT->DWT_CYCCNT;
+    slot->triggered = 1;
+    ATOMIC_BARRIER();
+    NVIC->NVIC_ISPR[irq / 32] = (1 << (irq % 32));
+}
+
+void irq_stats(uint8_t index, irq_stats_t *stats) {
+    if (index >= IRQ_SLOTS) {
+        *stats = (irq_stats_t){0};
+        return;
+    }
+
+    irq_slot_t *slot = &s_slots[index];
+    uint32_t sequence;
+    uint8_t clear;
+
+    // The handler only runs over us, not the other way around: a copy it
+    // didn't touch is a good one.
+    do {
+        sequence = slot->sequence;
+        ATOMIC_BARRIER();
+        *stats = slot->stats;
+        clear = slot->clear;
+        ATOMIC_BARRIER();
+    } while ((sequence & 1) || sequence != slot->sequence);
+
+    // Nothing ran since the last call, those are the old ones.
+    if (clear) {
+        *stats = (irq_stats_t){0};
+    }
+
+    slot->clear = 1;
+}
+
+uint32_t irq_over(void) {
+    return atomic_fetch_and(&s_over, 0);
+}
@@ -0,0 +1,117 @@
+/*
+ *@brief Lock free queues shared by the projects, see inc/queue.h
+ **/
+#include "../../inc/queue.h"
+#include "../../inc/atomic.h"
+
+static void copy(uint8_t *to, const uint8_t *from, uint16_t size) {
+    while (size-- > 0) {
+        *to++ = *from++;
+    }
+}
+
+void spsc_init(spsc_t *queue, void *items, uint16_t size, uint16_t capacity) {
+    queue->items = items;
+    queue->size = size;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+int spsc_push(spsc_t *queue, const void *item) {
+    uint32_t head = queue->head;
+
+    if (head - queue->tail >= queue->capacity) {
+        return -1;
+    }
+
+    copy(queue->items + (head & (queue->capacity - 1)) * queue->size, item, queue->size);
+
+    // The item is in before the consumer can see it.
+    ATOMIC_BARRIER();
+    queue->head = head + 1;
+
+    return 0;
+}
+
+int spsc_pop(spsc_t *queue, void *item) {
+    uint32_t tail = queue->tail;
+
+    if (queue->head == tail) {
+        return -1;
+    }
+
+    // Read after head, and out before the producer can have the slot back.
+    ATOMIC_BARRIER();
+    copy(item, queue->items + (tail & (queue->capacity - 1)) * queue->size, queue->size);
+    ATOMIC_BARRIER();
+    queue->tail = tail + 1;
+
+    return 0;
+}
+
+void mpsc_init(mpsc_t *queue, void *items, volatile uint32_t *sequence, uint16_t size, uint16_t capacity) {
+    queue->items = items;
+    queue->sequence = sequence;
+    queue->size = size;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->tail = 0;
+
+    for (uint32_t slot = 0; slot < capacity; ++slot) {
+        sequence[slot] = slot;
+    }
+}
+
+int mpsc_push(mpsc_t *queue, const void *item) {
+    uint32_t mask = queue->capacity - 1;
+    uint32_t head;
+
+    while (1) {
+        head = atomic_ldrex(&queue->head);
+
+        int32_t free = (int32_t)(queue->sequence[head & mask] - head);
+
+        if (free < 0) {
+            // The slot still holds the item of a lap ago: full.
+            atomic_clrex();
+            return -1;
+        }
+
+        if (free > 0) {
+            // Another producer got it before our LDREX, head is past it.
+            atomic_clrex();
+            continue;
+        }
+
+        if (atomic_strex(&queue->head, head + 1) == 0) {
+            break;
+        }
+    }
+
+    copy(queue->items + (head & mask) * queue->size, item, queue->size);
+
+    ATOMIC_BARRIER();
+    queue->sequence[head & mask] = head + 1;
+
+    return 0;
+}
+
+int mpsc_pop(mpsc_t *queue, void *item) {
+    uint32_t mask = queue->capacity - 1;
+    uint32_t tail = queue->tail;
+
+    if (queue->sequence[tail & mask] != tail + 1) {
+        return -1;
+    }
+
+    ATOMIC_BARRIER();
+    copy(item, queue->items + (tail & mask) * queue->size, queue->size);
+    ATOMIC_BARRIER();
+
+    // Free for the producer one lap ahead.
+    queue->sequence[tail & mask] = tail + queue->capacity;
+    queue->tail = tail + 1;
+
+    return 0;
+}
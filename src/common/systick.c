@@ -0,0 +1,125 @@
+/*
+ *@brief SysTick driver shared by the projects, see inc/systick.h
+ **/
+#include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
+
+#define CSR_ENABLE 0
+#define CSR_TICKINT 1
+#define CSR_CLKSOURCE 2
+#define CALIB_NOREF 31
+
+#define CFGR_SWS 2
+#define CFGR_HPRE 4
+#define PLLCFGR_PLLN 6
+#define PLLCFGR_PLLP 16
+#define PLLCFGR_PLLSRC 22
+
+/*
+ * 'counts' cycles of 'clock' in ns, a decimal digit at a time: 64 bit
+ * divisions aren't there without libgcc (the multiplications are).
+ * */
+static uint64_t period_ns(uint32_t counts, uint32_t clock) {
+    uint64_t ns = counts / clock;
+    uint32_t rest = counts % clock;
+
+    for (uint8_t digit = 0; digit < 9; ++digit) {
+        rest *= 10;
+        ns = ns * 10 + rest / clock;
+        rest %= clock;
+    }
+
+    return ns;
+}
+
+uint32_t systick_hclk(void) {
+    uint32_t sysclk;
+
+    // Which clock the system runs on (Section 6.3.3, SWS).
+    switch ((RCC->RCC_CFGR >> CFGR_SWS) & 3) {
+    case 1:
+        sysclk = HSE_FREQUENCY;
+        break;
+
+    case 2: {
+        // PLL: input / M * N / P (Section 6.3.2).
+        uint32_t pll = RCC->RCC_PLLCFGT;
+        uint32_t input = pll & (1 << PLLCFGR_PLLSRC) ? HSE_FREQUENCY : HSI_FREQUENCY;
+        uint32_t m = pll & 0x3F;
+        uint32_t n = (pll >> PLLCFGR_PLLN) & 0x1FF;
+        uint32_t p = (((pll >> PLLCFGR_PLLP) & 3) + 1) * 2;
+
+        sysclk = input / m * n / p;
+        break;
+    }
+
+    default:
+        sysclk = HSI_FREQUENCY;
+        break;
+    }
+
+    // AHB prescaler: 0xxx is 1, then 2, 4, 8, 16 and (no 32) 64 to 512.
+    uint32_t hpre = (RCC->RCC_CFGR >> CFGR_HPRE) & 0xF;
+
+    if (hpre & 0x8) {
+        uint8_t shift = (hpre & 0x7) + 1;
+
+        sysclk >>= shift < 5 ? shift : shift + 1;
+    }
+
+    return sysclk;
+}
+
+int systick_setup(systick_t *tick, uint32_t rate, uint8_t interrupt) {
+    int result = 0;
+    uint32_t csr = 0;
+
+    tick->hclk = systick_hclk();
+    tick->clock = tick->hclk;
+
+    if (rate == SYSTICK_TICKLESS) {
+        tick->reload = SYSTICK_MAX_RELOAD;
+        interrupt = 0;
+    } else {
+        // Rounded to the closest.
+        uint32_t counts = (tick->clock + rate / 2) / rate;
+
+        if (counts > SYSTICK_MAX_RELOAD + 1 && !(SYST->SYST_CALIB & (1u << CALIB_NOREF))) {
+            tick->clock = tick->hclk / 8;
+            counts = (tick->clock + rate / 2) / rate;
+        }
+
+        if (counts > SYSTICK_MAX_RELOAD + 1) {
+            counts = SYSTICK_MAX_RELOAD + 1;
+            result = -1;
+        } else if (counts < 2) {
+            // A reload of 0 stops the counter (Section 4.4.2).
+            counts = 2;
+            result = -1;
+        }
+
+        tick->reload = counts - 1;
+    }
+
+    tick->period_ns = period_ns(tick->reload + 1, tick->clock);
+
+    // Stopped while it's set up, assigned and not OR'd: whatever was in
+    // there before would stay otherwise (Section 4.4.1).
+    SYST->SYST_CSR = 0;
+    SYST->SYST_RVR = tick->reload;
+    // Any write clears it, it loads RVR on the next cycle (Section 4.4.3).
+    SYST->SYST_CVR = 0;
+
+    // Processor clock, or the reference one when CLKSOURCE is 0.
+    if (tick->clock == tick->hclk) {
+        csr |= (1 << CSR_CLKSOURCE);
+    }
+
+    if (interrupt) {
+        csr |= (1 << CSR_TICKINT);
+    }
+
+    SYST->SYST_CSR = csr | (1 << CSR_ENABLE);
+
+    return result;
+}
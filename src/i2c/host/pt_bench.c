@@ -0,0 +1,220 @@
+/*
+ *@brief what a protothread costs, against the same sequence as a hand made state machine.
+ *
+ * The sequence has the shape of the I2C1 register read of i2c1.c: seven
+ * waits on a flag of SR1 (SB, ADDR, TxE, TxE, SB, ADDR, RxNE) with a
+ * register write after each. SR1 and DR are plain variables here, the
+ * bench sets the flag each wait is for, like the hardware would before
+ * the interrupt.
+ *
+ * Two kinds of resume, in ns per call:
+ * step     -> the flag is set, it goes on to the next wait
+ * spurious -> it isn't (another flag raised the interrupt), it returns
+ *             right away
+ *
+ * Then the RAM a transfer takes: the protothread keeps its place in
+ * pt_t, the rest is the transfer itself (i2c1_xfer_t, on the host the
+ * pointers in it are 8 bytes instead of 4).
+ *
+ * Usage: pt_bench [-n transfers]
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "i2c1.h"
+
+#define SB (1 << 0)
+#define ADDR (1 << 1)
+#define TXE (1 << 7)
+#define RXNE (1 << 6)
+#define WAITS 7
+
+static const uint32_t sequence[WAITS] = {SB, ADDR, TXE, TXE, SB, ADDR, RXNE};
+
+static volatile uint32_t sr1;
+static volatile uint32_t dr;
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static __attribute__((noinline)) int read_pt(i2c1_xfer_t *xfer) {
+    PT_BEGIN(&xfer->pt);
+
+    dr = 1;
+    PT_WAIT_UNTIL(&xfer->pt, sr1 & SB);
+    dr = xfer->slave << 1;
+    PT_WAIT_UNTIL(&xfer->pt, sr1 & ADDR);
+    dr = 2;
+    PT_WAIT_UNTIL(&xfer->pt, sr1 & TXE);
+    dr = xfer->tx[0];
+    PT_WAIT_UNTIL(&xfer->pt, sr1 & TXE);
+    dr = 3;
+    PT_WAIT_UNTIL(&xfer->pt, sr1 & SB);
+    dr = xfer->slave << 1 | 1;
+    PT_WAIT_UNTIL(&xfer->pt, sr1 & ADDR);
+    dr = 4;
+    PT_WAIT_UNTIL(&xfer->pt, sr1 & RXNE);
+    xfer->rx[0] = dr;
+
+    PT_END(&xfer->pt);
+}
+
+typedef enum read_state_t {
+    READ_START,
+    READ_SLAVE_W,
+    READ_REG,
+    READ_REG_SENT,
+    READ_RESTART,
+    READ_SLAVE_R,
+    READ_DATA,
+} read_state_t;
+
+typedef struct read_sm_t {
+    read_state_t state;
+    uint8_t slave;
+    uint8_t reg;
+    uint8_t *data;
+} read_sm_t;
+
+static __attribute__((noinline)) int read_sm(read_sm_t *sm) {
+    switch (sm->state) {
+    case READ_START:
+        if (!(sr1 & SB)) return PT_WAITING;
+        dr = sm->slave << 1;
+        sm->state = READ_SLAVE_W;
+        return PT_WAITING;
+
+    case READ_SLAVE_W:
+        if (!(sr1 & ADDR)) return PT_WAITING;
+        dr = 2;
+        sm->state = READ_REG;
+        return PT_WAITING;
+
+    case READ_REG:
+        if (!(sr1 & TXE)) return PT_WAITING;
+        dr = sm->reg;
+        sm->state = READ_REG_SENT;
+        return PT_WAITING;
+
+    case READ_REG_SENT:
+        if (!(sr1 & TXE)) return PT_WAITING;
+        dr = 3;
+        sm->state = READ_RESTART;
+        return PT_WAITING;
+
+    case READ_RESTART:
+        if (!(sr1 & SB)) return PT_WAITING;
+        dr = sm->slave << 1 | 1;
+        sm->state = READ_SLAVE_R;
+        return PT_WAITING;
+
+    case READ_SLAVE_R:
+        if (!(sr1 & ADDR)) return PT_WAITING;
+        dr = 4;
+        sm->state = READ_DATA;
+        return PT_WAITING;
+
+    case READ_DATA:
+        if (!(sr1 & RXNE)) return PT_WAITING;
+        *sm->data = dr;
+        sm->state = READ_START;
+        return PT_ENDED;
+    }
+
+    return PT_ENDED;
+}
+
+/*
+ * Runs 'n' transfers, with a spurious resume before each step when
+ * 'spurious', returns the seconds.
+ * */
+static double run_pt(uint32_t n, int spurious) {
+    uint8_t reg = 0x10;
+    uint8_t data;
+    i2c1_xfer_t xfer = {.slave = 0x40, .tx = &reg, .tx_length = 1, .rx = &data, .rx_length = 1};
+    double start = now_s();
+
+    for (uint32_t i = 0; i < n; i++) {
+        PT_INIT(&xfer.pt);
+        sr1 = 0;
+        // Up to the first wait, like i2c1_start does.
+        read_pt(&xfer);
+
+        for (uint32_t w = 0; w < WAITS; w++) {
+            if (spurious) {
+                sr1 = 0;
+                read_pt(&xfer);
+            }
+
+            sr1 = sequence[w];
+            read_pt(&xfer);
+        }
+    }
+
+    return now_s() - start;
+}
+
+static double run_sm(uint32_t n, int spurious) {
+    uint8_t data;
+    read_sm_t sm = {.state = READ_START, .slave = 0x40, .reg = 0x10, .data = &data};
+    double start = now_s();
+
+    for (uint32_t i = 0; i < n; i++) {
+        sr1 = 0;
+        dr = 1;
+
+        for (uint32_t w = 0; w < WAITS; w++) {
+            if (spurious) {
+                sr1 = 0;
+                read_sm(&sm);
+            }
+
+            sr1 = sequence[w];
+            read_sm(&sm);
+        }
+    }
+
+    return now_s() - start;
+}
+
+int main(int argc, char **argv) {
+    uint32_t n = 10000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': n = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n transfers]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (n == 0) {
+        fprintf(stderr, "transfers must be more than 0\n");
+        return 1;
+    }
+
+    double pt_steps = run_pt(n, 0);
+    double sm_steps = run_sm(n, 0);
+    // The spurious ones are what's left once the steps are taken out.
+    double pt_spurious = run_pt(n, 1) - pt_steps;
+    double sm_spurious = run_sm(n, 1) - sm_steps;
+    double resumes = (double)n * WAITS;
+
+    printf("%u transfers of %u waits\n", n, WAITS);
+    printf("protothread:   step %5.2f ns, spurious %5.2f ns\n",
+           pt_steps * 1e9 / resumes, pt_spurious * 1e9 / resumes);
+    printf("state machine: step %5.2f ns, spurious %5.2f ns\n",
+           sm_steps * 1e9 / resumes, sm_spurious * 1e9 / resumes);
+    printf("RAM: pt_t %zu bytes, i2c1_xfer_t %zu bytes, stack between resumes 0\n",
+           sizeof(pt_t), sizeof(i2c1_xfer_t));
+
+    return 0;
+}
@@ -1,24 +1,24 @@
 /**
  *@brief simple i2c project
  **/
+#include <stddef.h>
 #include <stdint.h>
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
+#include "../../inc/flags.h"
+#include "../../inc/irq.h"
+#include "../../inc/i2c_timing.h"
+#include "../../inc/i2c1.h"
+#include "i2c_bus.h"
 
 #define MODER 2
 #define PA5 5
 #define PA8 8
 #define PA9 9
 #define CR1_SWRST       15
-#define CR1_ACK         10
-#define CR1_STOP         9
-#define CR1_START        8
 #define CR1_PE           0
-#define SR1_TxE         7
-#define SR1_RxNE        6
-#define SR1_BTF         2
-#define SR1_ADDR        1
-#define SR1_SB          0
-#define SR2_BUSY        1
+#define TICK_FREQUENCY 1000
+#define BLINK_TICKS 500
 
 /**
  * @brief Struct Pointer for RCC Peripherals assigned with fixed address specified in reference manual.
@@ -39,14 +39,21 @@ GPIOx_t * const GPIOA   = (GPIOx_t  *)  0x40020000;
  *
  * See Memory map, Section 2.3.
  **/
-GPIOx_t * const GPIOB = (GPIOx_t  *)  (0x40020000 + 0x400);
+GPIOx_t * const GPIOB = (GPIOx_t  *)  0x40020400;
 
 /**
  * @brief Struct Pointer for I2C1 Peripherals assigned with fixed address specified in reference manual.
  *
  * See Memory map, Section 2.3.
  **/
-I2Cx_t * const I2C1 = (I2Cx_t *)  (0x40020000 + 0x400);
+I2Cx_t * const I2C1 = (I2Cx_t *)  0x40005400;
+
+/**
+ * @brief Struct Pointer for DMA1 assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+DMA_t * const DMA1 = (DMA_t *) 0x40026000;
 
 /*
  * @brief Struct Pointer for SYST (System Timer) assigned with fixed address specified in the datasheet.
@@ -55,6 +62,28 @@ I2Cx_t * const I2C1 = (I2Cx_t *)  (0x40020000 + 0x400);
  * */
 SYST_t * const SYST = (SYST_t *) 0xE000E010;
 
+/*
+ * @brief Struct Pointer for the NVIC assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.2 Nested Vectored Interrupt Controller (ARM-cortex-m4 datasheet).
+ * */
+NVIC_t * const NVIC = (NVIC_t *) 0xE000E100;
+
+/*
+ * @brief Struct Pointer for the SCB assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.3 System control block (ARM-cortex-m4 datasheet).
+ * */
+SCB_t * const SCB = (SCB_t *) 0xE000ED00;
+
+/*
+ * @brief Struct Pointers for the DWT and the debug control block, used to
+ * count the cycles the transfers take in their interrupt (see i2c1_stats).
+ *
+ * See section C1.8 of the ARMv7-M architecture reference manual.
+ * */
+DWT_t * const DWT = (DWT_t *) 0xE0001000;
+DCB_t * const DCB = (DCB_t *) 0xE000EDF0;
 
 void setup_gpio(void) {
     // Enable Clock for the GPIOA Peripheral (Section 6.3.9)
@@ -132,12 +161,18 @@ void setup_i2c_pullup(void) {
     GPIOA->GPIOx_ODR |= (1 << PA9);
 }
 
+/*
+ * @brief The clock setup of the bus, scl is the SCL frequency it gets
+ * (print i2c1_timing from make debug).
+ * */
+i2c_timing_t i2c1_timing;
+
 void setup_i2c(void) {
     // We enable the clock needed to use the 
-    // GPIOB peripheral.
+    // GPIOB peripheral (bit 1 of AHB1ENR, like GPIOA is bit 0).
     // We also enable the I2C clock for the same reason.
     // Section 6.3.9 and Section 6.3.11
-    RCC->RCC_AHB2ENR |= 2;
+    RCC->RCC_AHB1ENR |= 2;
     RCC->RCC_APB1ENR |= (1 << 21);
 
     // We configure the GPIOB the same we did for the GPIOA, so
@@ -167,158 +202,144 @@ void setup_i2c(void) {
     // The second set is to deactivate it, right after resetting.
     // Section 18.6.1.
     //
-    // The next step, is to set the frequency of the clock line,
-    // to do that, we are gonna use the I2C control register 2, 
-    // by controlling and setting the bits FREQ[0:5].
-    // We are gonna set it to 16MHz.
-    // Section 18.6.2.
+    // The next step, is to set the frequency of the clock line: FREQ[0:5]
+    // of the I2C control register 2 says what PCLK1 is, CCR how many of
+    // its periods SCL is high and low, TRISE the maximum rise time (the
+    // time taken for the line to climb from LOW to HIGH). They are all
+    // computed from the PCLK1 we really run on (see i2c_timing.h), for
+    // fast mode: our sensors take 400 kHz, 4 times the samples of the
+    // standard 100 kHz.
+    // Sections 18.6.2, 18.6.8 and 18.6.9.
     //
-    // The next step is to just set up the standard mode of 
-    // the data line, which is the initial transfer speed mode
-    // of the I2C specification.
-    // We are gonna set it up to maximum available: 100kHz.
-    // Section 18.6.8.
-    //
-    // After setting up the maximum rise time (Section 18.6.9) which is 
-    // basically the time taken for the line to climb from LOW to HIGH 
-    // (measured in ns), we finally enable the I2C1 module.
-    I2C1->I2C_CR1 = (1 << 15);                  
-    I2C1->I2C_CR1 &= ~(1 << 15);               
-    I2C1->I2C_CR2 = (1 << 4);                 
-    I2C1->I2C_CCR = 80;                         
-    I2C1->I2C_TRISE = 17;                       // Set maximum rise time
-    I2C1->I2C_CR1 |= 1;                         // Enable I2C1 Module
-}
-
-// Function to write a byte to I2C bus
-// The section used for this function are all under
-// the main I2C section, so the section 18.
-int I2C1_byte_read(char slave_addr, char mem_addr, uint8_t *data){
-    volatile int tmp;
-
-    // Wait until the I2C bus is not busy
-    while(I2C1->I2C_SR2 & (1 << SR2_BUSY));
-
-    // Generate a Start Signal to initiate communication
-    I2C1->I2C_CR1 |= (1 << CR1_START);
-
-    // Wait until the Start Bit is set, indicating that the Start Signal has been successfully transmitted
-    while(!(I2C1->I2C_SR1 & (1 << SR1_SB)));
-
-    // Transmit the Slave Address along with the Write bit (SLA+W)
-    I2C1->I2C_DR = slave_addr << 1;
-
-    // Wait for the Address Acknowledge (ACK) from the slave device
-    while(!(I2C1->I2C_SR1 & (1 << SR1_ADDR)));
-    tmp = I2C1->I2C_SR2;  // Clear ADDR Bit by reading SR2
-
-    // Wait for the Transmit Data Register (DR) to be empty to send the memory address
-    while(!(I2C1->I2C_SR1 & (1 << SR1_TxE)));
-    // Send the Memory Address to read from
-    I2C1->I2C_DR = mem_addr;
-    // Wait for the Transmit Data Register (DR) to be empty again
-    while(!(I2C1->I2C_SR1 & (1 << SR1_TxE)));
-
-    // Generate a Restart Signal to switch from Write to Read mode
-    I2C1->I2C_CR1 |= (1 << CR1_START);
-    // Wait until the Start Bit is set, indicating that the Restart Signal has been successfully transmitted
-    while(!(I2C1->I2C_SR1 & 1));
-
-    // Transmit the Slave Address along with the Read bit (SLA+R)
-    I2C1->I2C_DR = slave_addr << 1 | 1;
-    // Check if ACK received from the slave device
-    while(!(I2C1->I2C_SR1 & (1 << SR1_ADDR)));
-    // Disable Acknowledge (ACK) from the master to indicate the end of data reception
-    I2C1->I2C_CR1 &= ~(1 << CR1_ACK);
-    tmp = I2C1->I2C_SR2;  // Clear ADDR FLAG by reading SR2
-
-    // Generate a Stop Signal to end the communication
-    I2C1->I2C_CR1 |= (1 << CR1_STOP);
-
-    // Wait until the Receive Data Register (DR) is not empty
-    while(!(I2C1->I2C_SR1 & (1 << SR1_RxNE)));
-    // Read the received data from the Receive Data Register (DR)
-    *data = I2C1->I2C_DR;
-
-    return 0;
-}
-
-// Function to write a byte to the I2C bus.
-// Like for the byte_read, all the stuff used here
-// is documentaed inside the section 18 of the MCU's datasheet.
-int I2C1_byte_write(char slave_addr, char mem_addr, uint8_t data){
-    volatile int tmp;
-
-    // Wait until the I2C bus is not busy
-    while(I2C1->I2C_SR2 & (1 << SR2_BUSY));
+    // i2c_timing_apply finally enables the I2C1 module.
+    I2C1->I2C_CR1 = (1 << CR1_SWRST);
+    I2C1->I2C_CR1 &= ~(1 << CR1_SWRST);
 
-    // Generate a Start Signal to initiate communication
-    I2C1->I2C_CR1 |= (1 << CR1_START);
-
-    // Wait until the Start Bit is set, indicating that the Start Signal has been successfully transmitted
-    while(!(I2C1->I2C_SR1 & (1 << SR1_SB)));
+    // With a PCLK1 under 4 MHz there's no fast mode, standard it is.
+    if (i2c_timing(i2c_pclk1(), I2C_FAST, &i2c1_timing) < 0) {
+        i2c_timing(i2c_pclk1(), I2C_STANDARD, &i2c1_timing);
+    }
 
-    // Send the Slave Address along with the Write bit (SLA+W)
-    I2C1->I2C_DR = slave_addr << 1;
+    i2c_timing_apply(I2C1, &i2c1_timing);
+}
 
-    // Wait until the Address Acknowledge (ACK) from the slave device
-    while(!(I2C1->I2C_SR1 & (1 << SR1_ADDR)));
-    tmp = I2C1->I2C_SR2;  // Clear ADDR Bit by reading SR2
+/*
+ * @brief The I2C1 interrupts, its DMA and SysTick, that times the
+ * transactions out, at the same preemption priority (see i2c1.h). The
+ * errors go first when they are pending together with an event.
+ * Preemption 1 of 2 bits is 4 to 6 in critical.h's numbers, all masked
+ * by the critical section of i2c_bus_submit (CRITICAL_PRIORITY 4).
+ * */
+static const irq_config_t irqs[] = {
+    {.irq = I2C1_ER_IRQ, .preempt = 1, .sub = 0},
+    {.irq = I2C1_DMA_IRQ, .preempt = 1, .sub = 1},
+    {.irq = I2C1_EV_IRQ, .preempt = 1, .sub = 1},
+    {.irq = IRQ_SYSTICK, .preempt = 1, .sub = 2},
+};
+
+static volatile uint32_t s_ticks;
+
+void SysTick_Handler(void) {
+    s_ticks++;
+    i2c1_tick();
+}
 
-    // Wait until the Transmit Data Register (DR) is empty to send the memory address
-    while(!(I2C1->I2C_SR1 & (1 << SR1_TxE)));
+/*
+ * @brief Two drivers sharing the bus through the queue (see i2c_bus.h),
+ * each with its own request, they don't know about each other:
+ * - the accelerometer samples, the registers 0x10 and 0x11 in one burst
+ *   transaction, the most urgent: each one is submitted again from the
+ *   callback of the one before, the main loop only hears about the
+ *   failures, to try them again;
+ * - its status, the register 0x0F into s_status, every STATUS_TICKS from
+ *   the main loop, behind the sample running.
+ * How long they waited for the bus is in i2c_bus_stats (print it from
+ * make debug).
+ * */
+#define SAMPLE_PRIORITY 0
+#define STATUS_PRIORITY 1
+#define STATUS_TICKS 100
 
-    // Send the Memory Address to write to
-    I2C1->I2C_DR = mem_addr;
+#define SAMPLE_FAILED (1 << 0)
 
-    // Wait until the Transmit Data Register (DR) is empty to send the data
-    while(!(I2C1->I2C_SR1 & (1 << SR1_TxE)));
-    // Send the data to be written
-    I2C1->I2C_DR = data;
+static flags_t s_events;
+static i2c_bus_request_t s_sample_request;
+static uint8_t s_sample[2];
+static i2c_bus_request_t s_status_request;
+static uint8_t s_status;
 
-    // Wait until all the Transmit Bytes have been sent
-    while(!(I2C1->I2C_SR1 & (1 << SR1_BTF)));
-    // Generate a Stop Signal to end the communication
-    I2C1->I2C_CR1 |= (1 << CR1_STOP);
+static void start_sample(void);
 
-    return 0;
+static void on_sample(i2c_bus_request_t *request) {
+    if (request->xfer.status == I2C1_DONE) {
+        start_sample();
+    } else {
+        flags_set(&s_events, SAMPLE_FAILED);
+    }
 }
 
-void setup_systick(void) {
-    // Enable Clock for SysTick (Section 6.3.12)
-    RCC->RCC_APB2ENR |= (1 << 14);
-
-    // We load the reload register with the maximum value (Section 4.4.2)
-    SYST->SYST_RVR |= 0x00FFFFFF;
+static void start_sample(void) {
+    i2c_bus_read_regs(&s_sample_request, 0x40, 0x10, s_sample, sizeof(s_sample),
+                      SAMPLE_PRIORITY, on_sample, NULL);
+}
 
-    // We set as internal source the processor clock, from where our systick will 'based' on, the 
-    // 'rhythm' to derive from (Section 4.4.1).
-    SYST->SYST_CSR |= (1 << 2);
-    
-    // We then proceed to finally enable the SysTick timer (Section 4.4.1)
-    SYST->SYST_CSR |= (1 << 0);
+static void start_status(void) {
+    i2c_bus_read_regs(&s_status_request, 0x40, 0x0F, &s_status, 1, STATUS_PRIORITY, NULL, NULL);
 }
 
 /**
  * @brief Main entry of the i2c project.
  **/
 int main(void) {
+    systick_t systick;
+
     setup_gpio();
-    setup_systick();
+    // The priorities must be there before any interrupt is enabled,
+    // irq_setup starts the DWT cycle counter too (for i2c1_stats).
+    irq_setup(2, irqs, sizeof(irqs) / sizeof(irqs[0]));
+    // The ticks time the transactions out, and the blinking.
+    systick_setup(&systick, TICK_FREQUENCY, 1);
     setup_i2c_pullup();
     setup_i2c();
+    i2c1_init();
 
-    uint8_t a, b;
+    uint8_t a;
 
     I2C1_byte_read(0x40, 0x0F, &a);
     I2C1_byte_write(0x40, 0x2E, 0x84);
 
+    // From here on the bus is the queue's.
+    start_sample();
+
+    uint32_t last_blink = s_ticks;
+    uint32_t last_status = s_ticks;
+
+    // The transactions run on their interrupts, back to back, the loop is
+    // free for anything else in the meantime: here, only the LED. What
+    // resuming them costs is in i2c1_stats (print i2c1_stats from make debug).
     while (1) {
-        I2C1_byte_read(0x40, 0x10, &a);
-        I2C1_byte_read(0x40, 0x11, &b);
-    
-        if (SYST->SYST_CSR & (1 << 16)) {
+        // A failed one (a NACK, a timeout) is tried again from here.
+        if (flags_take(&s_events, SAMPLE_FAILED, FLAGS_ANY)) {
+            start_sample();
+        }
+
+        if (s_ticks - last_status >= STATUS_TICKS) {
+            last_status += STATUS_TICKS;
+            start_status();
+        }
+
+        if (s_ticks - last_blink >= BLINK_TICKS) {
+            last_blink += BLINK_TICKS;
             GPIOA->GPIOx_ODR ^= (1 << PA5);
         }
+
+        // Asleep until the next interrupt, the same way as I2C1_byte_read.
+        __asm volatile ("cpsid i" ::: "memory");
+
+        if (flags_peek(&s_events) == 0) {
+            __asm volatile ("dsb\n\twfi\n\tisb" ::: "memory");
+        }
+
+        __asm volatile ("cpsie i" ::: "memory");
     }
 }
@@ -0,0 +1,192 @@
+#include "../../inc/peripherals.h"
+#include "../../inc/critical.h"
+#include "i2c_bus.h"
+
+#include <stddef.h>
+
+i2c_bus_stats_t i2c_bus_stats[I2C_BUS_PRIORITIES];
+
+/*
+ * @brief A FIFO of requests per priority level, and the one running.
+ * Only touched with the I2C1 interrupts masked, or from them.
+ * */
+static i2c_bus_request_t *s_head[I2C_BUS_PRIORITIES];
+static i2c_bus_request_t *s_tail[I2C_BUS_PRIORITIES];
+static i2c_bus_request_t * volatile s_running;
+
+/*
+ * @brief The oldest request of the most urgent level, NULL when they are all empty.
+ * */
+static i2c_bus_request_t *pop(void) {
+    for (uint8_t priority = 0; priority < I2C_BUS_PRIORITIES; ++priority) {
+        i2c_bus_request_t *request = s_head[priority];
+
+        if (request != NULL) {
+            s_head[priority] = request->next;
+
+            if (s_head[priority] == NULL) {
+                s_tail[priority] = NULL;
+            }
+
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Accounts for 'request' having ended, and tells its driver.
+ * */
+static void done(i2c_bus_request_t *request) {
+    i2c_bus_stats_t *stats = &i2c_bus_stats[request->priority];
+
+    request->latency = DWT->DWT_CYCCNT - request->submitted;
+    request->pending = 0;
+
+    stats->requests++;
+    stats->latency_sum += request->latency;
+
+    if (request->latency > stats->latency_max) {
+        stats->latency_max = request->latency;
+    }
+
+    if (request->xfer.status != I2C1_DONE) {
+        stats->failed++;
+    }
+
+    if (request->callback != NULL) {
+        request->callback(request);
+    }
+}
+
+/*
+ * @brief Starts the next request, if there's one and nothing is running.
+ * With the I2C1 interrupts masked, or from one of them.
+ * */
+static void next(void) {
+    i2c_bus_request_t *request;
+
+    while (s_running == NULL && (request = pop()) != NULL) {
+        i2c_bus_stats_t *stats = &i2c_bus_stats[request->priority];
+
+        request->wait = DWT->DWT_CYCCNT - request->submitted;
+
+        if (request->wait > stats->wait_max) {
+            stats->wait_max = request->wait;
+        }
+
+        s_running = request;
+
+        // Someone used i2c1 without us: that request is lost, the
+        // driver hears about it, the others go on.
+        if (i2c1_start(&request->xfer) < 0) {
+            s_running = NULL;
+            request->xfer.status = I2C1_ERROR;
+            done(request);
+        }
+    }
+}
+
+/*
+ * @brief The callback of all the transactions, from the interrupt that
+ * ended one: the next one goes first, the bus is busy again while the
+ * driver looks at what it got.
+ * */
+static void on_xfer(i2c1_xfer_t *xfer) {
+    i2c_bus_request_t *request = xfer->context;
+
+    s_running = NULL;
+    next();
+    done(request);
+}
+
+int i2c_bus_submit(i2c_bus_request_t *request) {
+    i2c1_xfer_t *xfer = &request->xfer;
+
+    if (request->priority >= I2C_BUS_PRIORITIES ||
+        xfer->reg_length + xfer->tx_length + xfer->rx_length == 0) {
+        return -1;
+    }
+
+    uint32_t basepri = critical_enter();
+
+    if (request->pending) {
+        critical_exit(basepri);
+        return -1;
+    }
+
+    xfer->callback = on_xfer;
+    xfer->context = request;
+    request->pending = 1;
+    request->next = NULL;
+    request->submitted = DWT->DWT_CYCCNT;
+
+    if (s_tail[request->priority] != NULL) {
+        s_tail[request->priority]->next = request;
+    } else {
+        s_head[request->priority] = request;
+    }
+
+    s_tail[request->priority] = request;
+    next();
+
+    critical_exit(basepri);
+
+    return 0;
+}
+
+/*
+ * @brief Fills the register transaction of 'request' in and submits it.
+ * */
+static int submit_regs(i2c_bus_request_t *request, uint8_t slave, uint8_t reg,
+                       const uint8_t *tx, uint8_t tx_length, uint8_t *rx, uint8_t rx_length,
+                       uint8_t priority, i2c_bus_callback_t callback, void *context) {
+    i2c1_xfer_t *xfer = &request->xfer;
+
+    // Not over one still queued or running.
+    if (request->pending) {
+        return -1;
+    }
+
+    xfer->slave = slave;
+    xfer->reg = reg;
+    xfer->reg_length = 1;
+    xfer->tx = tx;
+    xfer->tx_length = tx_length;
+    xfer->rx = rx;
+    xfer->rx_length = rx_length;
+    request->priority = priority;
+    request->callback = callback;
+    request->context = context;
+
+    return i2c_bus_submit(request);
+}
+
+int i2c_bus_read_regs(i2c_bus_request_t *request, uint8_t slave, uint8_t reg, uint8_t *data, uint8_t length,
+                      uint8_t priority, i2c_bus_callback_t callback, void *context) {
+    // Just the register would be a write.
+    if (length == 0) {
+        return -1;
+    }
+
+    return submit_regs(request, slave, reg, NULL, 0, data, length, priority, callback, context);
+}
+
+int i2c_bus_write_regs(i2c_bus_request_t *request, uint8_t slave, uint8_t reg, const uint8_t *data,
+                       uint8_t length, uint8_t priority, i2c_bus_callback_t callback, void *context) {
+    return submit_regs(request, slave, reg, data, length, NULL, 0, priority, callback, context);
+}
+
+int i2c_bus_busy(void) {
+    uint32_t basepri = critical_enter();
+    int busy = s_running != NULL;
+
+    for (uint8_t priority = 0; priority < I2C_BUS_PRIORITIES && !busy; ++priority) {
+        busy = s_head[priority] != NULL;
+    }
+
+    critical_exit(basepri);
+
+    return busy;
+}
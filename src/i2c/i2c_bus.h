@@ -0,0 +1,96 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stdint.h>
+#include "../../inc/i2c1.h"
+
+/*
+ * The I2C1 bus shared by several device drivers: each one hands its
+ * transactions in as requests, the bus queues them and runs them one
+ * after the other on i2c1 (see i2c1.h), instead of each driver waiting
+ * for the bus to be free by itself.
+ *
+ * The queue has I2C_BUS_PRIORITIES levels, 0 is the most urgent: the next
+ * request to run is the oldest of the most urgent level that has one.
+ * When a transaction ends, the next one is started right there, in the
+ * interrupt that ended it, before the callback of the one that ended
+ * runs: the bus doesn't wait for the main loop, nor for the callbacks.
+ * So a request submitted again from its own callback goes behind the
+ * ones that were waiting already, whatever its priority, and a driver
+ * polling that way can't starve the others.
+ *
+ * Each request gets how long it took, in DWT cycles from the submit
+ * (the DWT counter must be on, irq_setup starts it):
+ * - wait     -> until it started, the time spent behind the others;
+ * - latency  -> until it ended, all of it.
+ * i2c_bus_stats has them per priority level.
+ *
+ * A request can be submitted from the main loop or from an interrupt, a
+ * callback too: the queue is guarded by a critical section (critical.h),
+ * that masks the I2C1 interrupts. Those, and the one calling i2c1_tick,
+ * must be at CRITICAL_PRIORITY or below, the other side of the critical
+ * section. While the bus is in use, its drivers go through it only:
+ * i2c1_start, and so the blocking calls of i2c1.h, only get the gaps
+ * when the queue is empty.
+ * */
+#ifndef I2C_BUS_PRIORITIES
+#define I2C_BUS_PRIORITIES 4
+#endif
+
+typedef struct i2c_bus_request_t i2c_bus_request_t;
+
+typedef void (*i2c_bus_callback_t)(i2c_bus_request_t *request);
+
+struct i2c_bus_request_t {
+    // The transaction, the bus has its callback and context: the
+    // request's are the ones for the driver.
+    i2c1_xfer_t xfer;
+    uint8_t priority;
+    // Can be NULL, runs in an interrupt. 'context' is the driver's.
+    i2c_bus_callback_t callback;
+    void *context;
+    // DWT cycles from the submit to the start, and to the end.
+    uint32_t wait;
+    uint32_t latency;
+    // The bus's.
+    volatile uint8_t pending;
+    uint32_t submitted;
+    i2c_bus_request_t *next;
+};
+
+/*
+ * How the requests of a priority level went, DWT cycles.
+ * */
+typedef struct i2c_bus_stats_t {
+    uint32_t requests;
+    // Ended with a status other than I2C1_DONE.
+    uint32_t failed;
+    uint32_t wait_max;
+    uint32_t latency_sum;
+    uint32_t latency_max;
+} i2c_bus_stats_t;
+
+extern i2c_bus_stats_t i2c_bus_stats[I2C_BUS_PRIORITIES];
+
+/*
+ * Queues 'request' (its xfer filled in as for i2c1_start, its priority
+ * and callback), started right away if the bus is free. Returns 0, or -1
+ * when the priority or the transaction is not valid, or the request is
+ * still queued or running.
+ * */
+int i2c_bus_submit(i2c_bus_request_t *request);
+
+/*
+ * The burst register reads and writes of i2c1.h, through the queue.
+ * */
+int i2c_bus_read_regs(i2c_bus_request_t *request, uint8_t slave, uint8_t reg, uint8_t *data, uint8_t length,
+                      uint8_t priority, i2c_bus_callback_t callback, void *context);
+int i2c_bus_write_regs(i2c_bus_request_t *request, uint8_t slave, uint8_t reg, const uint8_t *data,
+                       uint8_t length, uint8_t priority, i2c_bus_callback_t callback, void *context);
+
+/*
+ * 1 while a request is queued or running.
+ * */
+int i2c_bus_busy(void);
+
+#endif // !I2C_BUS_H
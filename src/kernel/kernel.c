@@ -0,0 +1,348 @@
+#include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
+#include "kernel.h"
+
+#include <stddef.h>
+
+#define ICSR_PENDSVSET 28
+// The system handlers 14 (PendSV) and 15 (SysTick) in SHPR3 (Section 4.3.7).
+#define SHPR_PENDSV 10
+#define SHPR_SYSTICK 11
+#define LOWEST_PRIORITY 0xFF
+#define CONTROL_SPSEL 1
+#define XPSR_THUMB (1u << 24)
+// Back to thread mode on the process stack, with no FPU frame.
+#define EXC_RETURN_THREAD_PSP 0xFFFFFFFD
+
+/*
+ * @brief The ready threads: a ring per priority, its head is the one that
+ * runs, and bit 31 - priority of s_ready_mask says it isn't empty.
+ * */
+static kernel_thread_t *s_ready[KERNEL_PRIORITIES];
+static uint32_t s_ready_mask;
+static kernel_thread_t *s_threads;
+
+/*
+ * @brief Read by PendSV_Handler by name.
+ * */
+static kernel_thread_t *s_current __attribute__((used));
+static volatile uint32_t s_ticks;
+
+static kernel_thread_t s_idle;
+KERNEL_STACK(s_idle_stack, KERNEL_MIN_STACK);
+
+/*
+ * @brief What main was: the first switch saves it here, it never runs again.
+ * */
+static kernel_thread_t s_boot;
+KERNEL_STACK(s_boot_stack, KERNEL_MIN_STACK);
+
+static uint32_t kernel_lock(void) {
+    uint32_t primask;
+
+    __asm volatile ("mrs %0, primask\n\tcpsid i" : "=r" (primask) :: "memory");
+
+    return primask;
+}
+
+static void kernel_unlock(uint32_t primask) {
+    __asm volatile ("msr primask, %0" :: "r" (primask) : "memory");
+}
+
+static kernel_thread_t *kernel_highest(void) {
+    // The idle thread is always ready, the mask is never 0.
+    return s_ready[__builtin_clz(s_ready_mask)];
+}
+
+static void ready_insert(kernel_thread_t *thread) {
+    kernel_thread_t **head = &s_ready[thread->priority];
+
+    thread->state = KERNEL_READY;
+
+    // At the end of its turn, after the ones already waiting.
+    if (*head == NULL) {
+        thread->next = thread;
+        thread->prev = thread;
+        *head = thread;
+        s_ready_mask |= 1u << (31 - thread->priority);
+    } else {
+        thread->next = *head;
+        thread->prev = (*head)->prev;
+        (*head)->prev->next = thread;
+        (*head)->prev = thread;
+    }
+}
+
+static void ready_remove(kernel_thread_t *thread) {
+    kernel_thread_t **head = &s_ready[thread->priority];
+
+    if (thread->next == thread) {
+        *head = NULL;
+        s_ready_mask &= ~(1u << (31 - thread->priority));
+    } else {
+        thread->prev->next = thread->next;
+        thread->next->prev = thread->prev;
+
+        if (*head == thread) {
+            *head = thread->next;
+        }
+    }
+
+    thread->next = NULL;
+    thread->prev = NULL;
+}
+
+/*
+ * @brief Asks for a switch if the thread that should run isn't the one
+ * running, it happens when the interrupts (and the lock) are done.
+ * */
+static void kernel_reschedule(void) {
+    if (kernel_highest() != s_current) {
+        SCB->SCB_ICSR = (1 << ICSR_PENDSVSET);
+    }
+}
+
+/*
+ * @brief Called by PendSV_Handler between the save and the restore.
+ * */
+static void __attribute__((used)) kernel_switch(void) {
+    s_current = kernel_highest();
+    s_current->switches++;
+}
+
+/*
+ * @brief Where the entry of a thread returns to.
+ * */
+static void kernel_exit(void) {
+    kernel_lock();
+
+    ready_remove(s_current);
+    s_current->state = KERNEL_DONE;
+    kernel_reschedule();
+
+    // The switch happens as soon as PendSV isn't masked anymore.
+    __asm volatile ("cpsie i" ::: "memory");
+
+    while (1);
+}
+
+static void idle(void *arg) {
+    while (1) {
+        __asm volatile ("dsb\n\twfi\n\tisb" ::: "memory");
+    }
+}
+
+void kernel_init(void) {
+    for (uint8_t priority = 0; priority < KERNEL_PRIORITIES; ++priority) {
+        s_ready[priority] = NULL;
+    }
+
+    s_ready_mask = 0;
+    s_threads = NULL;
+    s_ticks = 0;
+
+    // The boot context isn't in the ready lists, nor does it take turns.
+    s_boot.state = KERNEL_DONE;
+    s_current = &s_boot;
+
+    kernel_thread_create(&s_idle, s_idle_stack, KERNEL_MIN_STACK, KERNEL_IDLE_PRIORITY, idle, NULL);
+}
+
+void kernel_thread_create(kernel_thread_t *thread, uint32_t *stack, uint32_t words, uint8_t priority,
+                          kernel_entry_t entry, void *arg) {
+    // 8 byte aligned at the top (Section 2.3.7, stack alignment).
+    uint32_t *sp = (uint32_t *)((uint32_t)(stack + words) & ~7u);
+
+    if (priority > KERNEL_IDLE_PRIORITY) {
+        priority = KERNEL_IDLE_PRIORITY;
+    }
+
+    // What the exception return pops: xPSR, PC, LR, R12, R3-R0. The PC
+    // without the thumb bit, the T bit of xPSR has it.
+    *--sp = XPSR_THUMB;
+    *--sp = (uint32_t)entry & ~1u;
+    *--sp = (uint32_t)kernel_exit;
+    for (uint8_t reg = 0; reg < 4; ++reg) {
+        *--sp = 0;
+    }
+    *--sp = (uint32_t)arg;
+
+    // What PendSV_Handler pops: EXC_RETURN, then R11-R4.
+    *--sp = EXC_RETURN_THREAD_PSP;
+    for (uint8_t reg = 0; reg < 8; ++reg) {
+        *--sp = 0;
+    }
+
+    thread->sp = sp;
+    thread->priority = priority;
+    thread->notified = 0;
+    thread->switches = 0;
+
+    uint32_t primask = kernel_lock();
+
+    thread->link = s_threads;
+    s_threads = thread;
+    ready_insert(thread);
+
+    // Once started, a thread more urgent than us runs right away.
+    if (s_current != &s_boot) {
+        kernel_reschedule();
+    }
+
+    kernel_unlock(primask);
+}
+
+void kernel_start(uint32_t rate) {
+    systick_t systick;
+
+    // Both below everything else: a switch (or a turn) never delays an interrupt.
+    SCB->SCB_SHPR[SHPR_PENDSV] = LOWEST_PRIORITY;
+    SCB->SCB_SHPR[SHPR_SYSTICK] = LOWEST_PRIORITY;
+
+    // Nothing may switch before we are on the process stack.
+    kernel_lock();
+    systick_setup(&systick, rate, 1);
+
+    // From here main runs on a stack of its own, which the first switch
+    // saves into s_boot: all in one go, the compiler can't have anything
+    // left on the old one.
+    __asm volatile (
+        "msr psp, %0\n\t"
+        "msr control, %1\n\t"
+        "isb\n\t"
+        "str %2, [%3]\n\t"
+        "dsb\n\t"
+        "cpsie i\n\t"
+        "isb\n\t"
+        "1: b 1b"
+        :: "r" (s_boot_stack + KERNEL_MIN_STACK), "r" (1 << CONTROL_SPSEL),
+           "r" (1 << ICSR_PENDSVSET), "r" (&SCB->SCB_ICSR)
+        : "memory");
+
+    while (1);
+}
+
+kernel_thread_t *kernel_self(void) {
+    return s_current;
+}
+
+uint32_t kernel_ticks(void) {
+    return s_ticks;
+}
+
+void kernel_yield(void) {
+    uint32_t primask = kernel_lock();
+    kernel_thread_t **head = &s_ready[s_current->priority];
+
+    if (*head == s_current) {
+        *head = s_current->next;
+    }
+
+    kernel_reschedule();
+    kernel_unlock(primask);
+}
+
+void kernel_sleep(uint32_t ticks) {
+    uint32_t primask = kernel_lock();
+
+    ready_remove(s_current);
+    s_current->state = KERNEL_SLEEPING;
+    s_current->wake = s_ticks + (ticks ? ticks : 1);
+    kernel_reschedule();
+
+    kernel_unlock(primask);
+}
+
+uint32_t kernel_wait(void) {
+    uint32_t primask = kernel_lock();
+
+    if (s_current->notified == 0) {
+        ready_remove(s_current);
+        s_current->state = KERNEL_WAITING;
+        kernel_reschedule();
+
+        // The switch happens here, we are back once notified.
+        kernel_unlock(primask);
+        primask = kernel_lock();
+    }
+
+    uint32_t notified = s_current->notified;
+
+    s_current->notified = 0;
+    kernel_unlock(primask);
+
+    return notified;
+}
+
+void kernel_notify(kernel_thread_t *thread) {
+    uint32_t primask = kernel_lock();
+
+    thread->notified++;
+
+    if (thread->state == KERNEL_WAITING) {
+        ready_insert(thread);
+        kernel_reschedule();
+    }
+
+    kernel_unlock(primask);
+}
+
+void SysTick_Handler(void) {
+    uint32_t primask = kernel_lock();
+
+    s_ticks++;
+
+    for (kernel_thread_t *thread = s_threads; thread != NULL; thread = thread->link) {
+        if (thread->state == KERNEL_SLEEPING && (int32_t)(s_ticks - thread->wake) >= 0) {
+            ready_insert(thread);
+        }
+    }
+
+    // End of the turn: the next one of the same priority, if any.
+    if (s_current->state == KERNEL_READY && s_ready[s_current->priority] == s_current) {
+        s_ready[s_current->priority] = s_current->next;
+    }
+
+    kernel_reschedule();
+    kernel_unlock(primask);
+}
+
+/*
+ * Saves the context of the thread running on its own stack, on top of
+ * what the exception entry already stacked, and restores the one of the
+ * thread kernel_switch picks (Section 2.3.7, exception entry and return).
+ *
+ * EXC_RETURN goes with the context: bit 4 clear means the thread had an
+ * FPU context, s0-s15 were stacked by the hardware (lazily) and s16-s31
+ * are ours. The .fpu directive only lets the assembler take those, with
+ * soft float they never run.
+ * */
+__attribute__((naked)) void PendSV_Handler(void) {
+    __asm volatile (
+        ".fpu fpv4-sp-d16\n\t"
+        "mrs r0, psp\n\t"
+        "isb\n\t"
+        "tst lr, #0x10\n\t"
+        "it eq\n\t"
+        "vstmdbeq r0!, {s16-s31}\n\t"
+        "stmdb r0!, {r4-r11, lr}\n\t"
+        "ldr r1, =s_current\n\t"
+        "ldr r2, [r1]\n\t"
+        "str r0, [r2]\n\t"
+        "cpsid i\n\t"
+        "bl kernel_switch\n\t"
+        "cpsie i\n\t"
+        "ldr r1, =s_current\n\t"
+        "ldr r2, [r1]\n\t"
+        "ldr r0, [r2]\n\t"
+        "ldmia r0!, {r4-r11, lr}\n\t"
+        "tst lr, #0x10\n\t"
+        "it eq\n\t"
+        "vldmiaeq r0!, {s16-s31}\n\t"
+        "msr psp, r0\n\t"
+        "isb\n\t"
+        "bx lr\n\t"
+        ".ltorg\n\t"
+        ".fpu softvfp\n\t"
+    );
+}
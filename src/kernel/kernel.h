@@ -0,0 +1,118 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdint.h>
+
+/*
+ * A small preemptive kernel: threads with their own stacks, where the most
+ * urgent one ready always runs, so a long job (a CRC, a compression) can't
+ * hold back the thread waiting for a sensor.
+ *
+ * - priorities 0 (the most urgent) to KERNEL_PRIORITIES - 1, one ready
+ *   list each, and a 32 bit mask of the ones that aren't empty: the next
+ *   thread is a CLZ away, however many there are;
+ * - threads of the same priority share the core in turns of one tick
+ *   (SysTick), the others only run when nothing more urgent is ready;
+ * - the context switch is in PendSV, at the lowest priority, so it only
+ *   happens once no other interrupt is running: interrupts just make a
+ *   thread ready and ask for one (kernel_notify);
+ * - FPU aware: a thread that used the FPU has its lazily stacked frame
+ *   (EXC_RETURN bit 4 clear) and s16-s31 saved with the rest. The
+ *   projects build with -mfloat-abi=soft so far, it's never the case yet.
+ *
+ * The stacks are static arrays given to kernel_thread_create, 8 byte
+ * aligned (AAPCS): 64 words of it go to the context and the interrupts
+ * that come in while the thread runs (they stack on it too). The kernel
+ * itself and the interrupts run on the main stack.
+ *
+ * kernel_start starts SysTick with the shared driver and never returns:
+ * SysTick_Handler and PendSV_Handler belong to the kernel.
+ * */
+#define KERNEL_PRIORITIES 32
+#define KERNEL_IDLE_PRIORITY (KERNEL_PRIORITIES - 1)
+#define KERNEL_MIN_STACK 64
+#define KERNEL_STACK(name, words) static uint32_t name[words] __attribute__((aligned(8)))
+
+typedef void (*kernel_entry_t)(void *arg);
+
+typedef enum kernel_state_t {
+    KERNEL_READY,
+    KERNEL_SLEEPING,
+    KERNEL_WAITING,
+    KERNEL_DONE,
+} kernel_state_t;
+
+typedef struct kernel_thread_t {
+    // Saved stack pointer, the first member: PendSV finds it at offset 0.
+    uint32_t *sp;
+    // Ring of the ready threads with the same priority.
+    struct kernel_thread_t *next;
+    struct kernel_thread_t *prev;
+    // All the threads, for the tick to find the sleeping ones.
+    struct kernel_thread_t *link;
+    uint8_t priority;
+    kernel_state_t state;
+    // Tick it sleeps until.
+    uint32_t wake;
+    // Notifications not taken yet by kernel_wait.
+    uint32_t notified;
+    // Times it got the core.
+    uint32_t switches;
+} kernel_thread_t;
+
+/*
+ * Makes the idle thread, before anything else.
+ * */
+void kernel_init(void);
+
+/*
+ * Makes a thread ready, that runs entry(arg) on 'stack' ('words' long),
+ * from kernel_init on, threads too can make threads. Returning from
+ * entry ends the thread.
+ * */
+void kernel_thread_create(kernel_thread_t *thread, uint32_t *stack, uint32_t words, uint8_t priority,
+                          kernel_entry_t entry, void *arg);
+
+/*
+ * Starts SysTick for 'rate' ticks per second, and the most urgent thread.
+ * Never returns.
+ * */
+void kernel_start(uint32_t rate) __attribute__((noreturn));
+
+/*
+ * The thread running now.
+ * */
+kernel_thread_t *kernel_self(void);
+
+/*
+ * Ticks since kernel_start.
+ * */
+uint32_t kernel_ticks(void);
+
+/*
+ * Gives the rest of the turn to the next thread of the same priority.
+ * */
+void kernel_yield(void);
+
+/*
+ * Sleeps for 'ticks' (at least 1) ticks.
+ * */
+void kernel_sleep(uint32_t ticks);
+
+/*
+ * Waits for a kernel_notify, returns how many came (at least 1)
+ * since the last time it waited.
+ * */
+uint32_t kernel_wait(void);
+
+/*
+ * Wakes 'thread' up from kernel_wait, from a thread or an interrupt: if
+ * it's more urgent than what was running, it runs as soon as the
+ * interrupts are done.
+ * */
+void kernel_notify(kernel_thread_t *thread);
+
+void SysTick_Handler(void);
+void PendSV_Handler(void);
+
+#endif // !KERNEL_H
@@ -0,0 +1,283 @@
+/*
+ *@brief preemptive kernel project, and its benchmark
+ *
+ * Four threads, from the most urgent:
+ *
+ * sensor -> waits for the EXTI0 interrupt, like it would for the data
+ *           ready line of a sensor, and measures how long it took to get
+ *           to it since the interrupt was asked for
+ * ping   -> once per REPORT_TICKS bounces the core with pong, at the same
+ *           priority, SWITCH_ROUNDS times, to measure a context switch,
+ *           then prints what was measured over USART2
+ * pong   -> the other half of the bounce
+ * job    -> a CRC-32 of a buffer, over and over, the long job that must
+ *           not delay the sensor: it's also what asks for the interrupt,
+ *           every CRC, so the sensor always preempts it
+ *
+ * Nothing is wired to EXTI0, it's pended by hand through NVIC_ISPR,
+ * which raises it the same as the line would. Cycles of the DWT counter
+ * (62.5 ns at 16 MHz), once per REPORT_TICKS:
+ *
+ * switch cycles <n>
+ * irq latency cycles avg <n> max <n>
+ * thread latency cycles avg <n> max <n>
+ * crc/s <n>
+ **/
+#include "../../inc/peripherals.h"
+#include "kernel.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define PA2 2
+#define CPU_FREQUENCY 16000000
+#define TICK_FREQUENCY 1000
+#define EXTI0_IRQ 6
+#define REPORT_TICKS 1000
+#define SWITCH_ROUNDS 1000
+#define CRC_BYTES 256
+#define STACK_WORDS 256
+
+/**
+ * @brief Struct Pointer for RCC Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+RCC_t   * const RCC     = (RCC_t    *)  0x40023800;
+
+/**
+ * @brief Struct Pointer for GPIOA Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+GPIOx_t * const GPIOA   = (GPIOx_t  *)  0x40020000;
+
+/*
+ * @brieft Struct pointer for the UART2 Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory Map, Section 2.3.
+ * */
+USART_t * const USART2 = (USART_t *)  0x40004400;
+
+/*
+ * @brief Struct Pointer for SYST (System Timer) assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.4 System timer, SysTick (ARM-cortex-m4 datasheet).
+ * */
+SYST_t * const SYST = (SYST_t *) 0xE000E010;
+
+/*
+ * @brief Struct Pointer for the NVIC assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.2 Nested Vectored Interrupt Controller (ARM-cortex-m4 datasheet).
+ * */
+NVIC_t * const NVIC = (NVIC_t *) 0xE000E100;
+
+/*
+ * @brief Struct Pointer for the SCB assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.3 System control block (ARM-cortex-m4 datasheet).
+ * */
+SCB_t * const SCB = (SCB_t *) 0xE000ED00;
+
+/*
+ * @brief Struct Pointers for the DWT and the debug control block, used by the benchmark
+ * to count cycles.
+ *
+ * See section C1.8 of the ARMv7-M architecture reference manual.
+ * */
+DWT_t * const DWT = (DWT_t *) 0xE0001000;
+DCB_t * const DCB = (DCB_t *) 0xE000EDF0;
+
+static kernel_thread_t sensor;
+static kernel_thread_t ping;
+static kernel_thread_t pong;
+static kernel_thread_t job;
+KERNEL_STACK(sensor_stack, STACK_WORDS);
+KERNEL_STACK(ping_stack, STACK_WORDS);
+KERNEL_STACK(pong_stack, STACK_WORDS);
+KERNEL_STACK(job_stack, STACK_WORDS);
+
+/*
+ * @brief When the interrupt was asked for, and when it ran, in cycles.
+ * */
+static volatile uint32_t s_pended;
+static volatile uint32_t s_entered;
+
+static uint32_t s_irq_sum;
+static uint32_t s_irq_max;
+static uint32_t s_thread_sum;
+static uint32_t s_thread_max;
+static uint32_t s_samples;
+static volatile uint32_t s_crcs;
+
+void setup_gpio() {
+    /** Enable CLOCK for GPIOA **/
+    RCC->RCC_AHB1ENR |= 1;
+
+    /** SET AF07 for PA2 **/
+    GPIOA->GPIOx_AFRL &= ~(0xF << (PA2 * 4));
+    GPIOA->GPIOx_AFRL |=  (7   << (PA2 * 4));
+
+    /** SET MODER to alternate function for PA2 **/
+    GPIOA->GPIOx_MODER &= ~(3 << (PA2 * 2));
+    GPIOA->GPIOx_MODER |=  (2 << (PA2 * 2));
+}
+
+void setup_usart() {
+    /** Enable CLOCK for USART2 (Section 6.3.11) **/
+    RCC->RCC_APB1ENR |= (1 << 17);
+
+    /** 9600 baud, transmitter and USART enabled (Section 19.6) **/
+    USART2->USART_BRR = CPU_FREQUENCY/9600;
+    USART2->USART_CR1 |= (1 << 3);
+    USART2->USART_CR1 |= (1 << 13);
+}
+
+void write_byte(uint8_t byte) {
+    // Only ping writes, polling: the job waits meanwhile, the sensor doesn't.
+    while(!((USART2->USART_SR & (1 << 7))));
+
+    USART2->USART_DR = (byte & 0xFF);
+}
+
+void write_number(char *label, uint32_t value) {
+    char digits[10];
+    uint8_t n = 0;
+
+    while (*label) {
+        write_byte(*label++);
+    }
+
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (n > 0) {
+        write_byte(digits[--n]);
+    }
+}
+
+void EXTI0_IRQHandler(void) {
+    s_entered = DWT->DWT_CYCCNT;
+    kernel_notify(&sensor);
+}
+
+static void sensor_thread(void *arg) {
+    while (1) {
+        kernel_wait();
+
+        uint32_t now = DWT->DWT_CYCCNT;
+        uint32_t irq = s_entered - s_pended;
+        uint32_t thread = now - s_pended;
+
+        s_irq_sum += irq;
+        s_thread_sum += thread;
+        s_samples++;
+
+        if (irq > s_irq_max) {
+            s_irq_max = irq;
+        }
+
+        if (thread > s_thread_max) {
+            s_thread_max = thread;
+        }
+    }
+}
+
+static void pong_thread(void *arg) {
+    while (1) {
+        kernel_wait();
+
+        for (uint32_t round = 0; round < SWITCH_ROUNDS; ++round) {
+            kernel_yield();
+        }
+    }
+}
+
+static void ping_thread(void *arg) {
+    uint32_t last_crcs = 0;
+
+    while (1) {
+        kernel_sleep(REPORT_TICKS);
+
+        kernel_notify(&pong);
+
+        uint32_t start = DWT->DWT_CYCCNT;
+
+        for (uint32_t round = 0; round < SWITCH_ROUNDS; ++round) {
+            kernel_yield();
+        }
+
+        // Every yield is two switches: to pong, and back.
+        write_number("switch cycles ", (DWT->DWT_CYCCNT - start) / (2 * SWITCH_ROUNDS));
+
+        // The sensor can't run while we read, it's more urgent but waits
+        // for the interrupt, which only the job asks for.
+        uint32_t samples = s_samples;
+        uint32_t crcs = s_crcs;
+
+        write_number("\nirq latency cycles avg ", samples ? s_irq_sum / samples : 0);
+        write_number(" max ", s_irq_max);
+        write_number("\nthread latency cycles avg ", samples ? s_thread_sum / samples : 0);
+        write_number(" max ", s_thread_max);
+        write_number("\ncrc/s ", (crcs - last_crcs) * TICK_FREQUENCY / REPORT_TICKS);
+        write_byte('\n');
+
+        s_irq_sum = 0;
+        s_irq_max = 0;
+        s_thread_sum = 0;
+        s_thread_max = 0;
+        s_samples = 0;
+        last_crcs = crcs;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= data[i];
+
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static void job_thread(void *arg) {
+    static uint8_t buffer[CRC_BYTES];
+
+    while (1) {
+        buffer[s_crcs % CRC_BYTES] = crc32(buffer, CRC_BYTES);
+        s_crcs++;
+
+        s_pended = DWT->DWT_CYCCNT;
+        NVIC->NVIC_ISPR[EXTI0_IRQ / 32] = (1 << (EXTI0_IRQ % 32));
+    }
+}
+
+int main(void) {
+    setup_gpio();
+    setup_usart();
+
+    // Power the DWT through DEMCR.TRCENA, then start
+    // the cycle counter (DWT_CTRL.CYCCNTENA).
+    DCB->DCB_DEMCR |= (1 << 24);
+    DWT->DWT_CTRL |= (1 << 0);
+
+    NVIC->NVIC_ISER[EXTI0_IRQ / 32] = (1 << (EXTI0_IRQ % 32));
+
+    kernel_init();
+    kernel_thread_create(&sensor, sensor_stack, STACK_WORDS, 0, sensor_thread, NULL);
+    kernel_thread_create(&ping, ping_stack, STACK_WORDS, 1, ping_thread, NULL);
+    kernel_thread_create(&pong, pong_stack, STACK_WORDS, 1, pong_thread, NULL);
+    kernel_thread_create(&job, job_stack, STACK_WORDS, 2, job_thread, NULL);
+
+    // One tick is 1 ms, the turn of threads of the same priority.
+    kernel_start(TICK_FREQUENCY);
+
+    return 0;
+}
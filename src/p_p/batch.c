@@ -0,0 +1,126 @@
+#include "batch.h"
+
+/*
+ * Tick comparison that keeps working when the counter wraps:
+ * the difference of two uint32_t is read as signed, so a deadline just
+ * past the wrap is still 'in the future' for a 'now' just before it.
+ * */
+static inline int tick_reached(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+static void batch_clear(batch_t *batch) {
+    batch->data[0] = BATCH;
+    batch->len = 1;
+}
+
+void batch_init(batch_t *batch, uint8_t threshold) {
+    if (threshold > DATA_LENGTH) {
+        threshold = DATA_LENGTH;
+    }
+
+    batch->threshold = threshold;
+    batch->deadline = 0;
+    batch->send = NULL;
+    batch->records = 0;
+    batch->frames = 0;
+
+    for (uint8_t i = 0; i < BATCH_CLASSES; i++) {
+        batch->class_deadline[i] = 0;
+    }
+
+    batch_clear(batch);
+}
+
+void batch_set_sender(batch_t *batch, packet_sender_t send) {
+    batch->send = send;
+}
+
+void batch_set_deadline(batch_t *batch, uint8_t class, uint32_t ticks) {
+    if (class < BATCH_CLASSES) {
+        batch->class_deadline[class] = ticks;
+    }
+}
+
+void batch_flush(batch_t *batch) {
+    // Nothing but the marker, nothing to send.
+    if (batch->len <= 1) {
+        return;
+    }
+
+    if (batch->send) {
+        batch->send(CHANNEL(CHANNEL_TELEMETRY), batch->len, batch->data);
+    } else {
+        send_packet(create_flagged_packet(CHANNEL(CHANNEL_TELEMETRY), batch->len, batch->data));
+    }
+
+    batch->frames++;
+    batch_clear(batch);
+}
+
+int batch_add(batch_t *batch, uint8_t class, uint8_t *value, uint8_t len, uint32_t now) {
+    if (class >= BATCH_CLASSES || len == 0 || len > BATCH_RECORD_MAX) {
+        return -1;
+    }
+
+    // Header plus value must fit in what's left of the data section.
+    if (batch->len + 1 + len > DATA_LENGTH) {
+        batch_flush(batch);
+    }
+
+    // The batch has to leave when its most urgent record has to, so the
+    // first record sets the deadline and the next ones can only bring it closer.
+    uint32_t deadline = now + batch->class_deadline[class];
+
+    if (batch->len == 1 || !tick_reached(deadline, batch->deadline)) {
+        batch->deadline = deadline;
+    }
+
+    batch->data[batch->len++] = BATCH_HEADER(class, len);
+    for (uint8_t i = 0; i < len; i++) {
+        batch->data[batch->len++] = value[i];
+    }
+    batch->records++;
+
+    if (batch->len >= batch->threshold) {
+        batch_flush(batch);
+    } else {
+        batch_poll(batch, now);
+    }
+
+    return 0;
+}
+
+void batch_poll(batch_t *batch, uint32_t now) {
+    if (batch->len > 1 && tick_reached(now, batch->deadline)) {
+        batch_flush(batch);
+    }
+}
+
+int batch_unpack(packet_t *p, record_handler_t handler) {
+    int records = 0;
+    uint8_t i = 1;
+    uint8_t length = p->length & LENGTH_MASK;
+
+    if (length < 1 || length > DATA_LENGTH || p->data[0] != BATCH) {
+        return -1;
+    }
+
+    while (i < length) {
+        uint8_t header = p->data[i++];
+        uint8_t len = BATCH_LEN(header);
+
+        if (i + len > length) {
+            return -1;
+        }
+
+        if (handler) {
+            handler(BATCH_CLASS(header), &p->data[i], len);
+        }
+
+        i += len;
+        records++;
+    }
+
+    return records;
+}
@@ -0,0 +1,101 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include "p_p.h"
+
+/*
+ * Fixed hex value that marks a packet carrying a batch of small records,
+ * it goes in the first byte of the data section, like ACK and RCK.
+ * */
+#define BATCH 0x14
+
+/*
+ * Every record is a header byte followed by 1 to 4 bytes of value:
+ *
+ *  7      2 1   0
+ * | class  | len-1 |
+ *
+ * so after the BATCH marker there's room for 3 one byte values,
+ * 2 two byte values or one of up to 4 bytes and a one byte value.
+ * */
+#define BATCH_RECORD_MAX 4
+#define BATCH_CLASSES 8
+#define BATCH_PAYLOAD (DATA_LENGTH - 1)
+#define BATCH_HEADER(class, len) ((uint8_t)(((class) << 2) | ((len) - 1)))
+#define BATCH_CLASS(header) ((header) >> 2)
+#define BATCH_LEN(header) (((header) & 0x3) + 1)
+
+/*
+ * Struct that holds the records waiting to be sent.
+ * Batches travel on CHANNEL_TELEMETRY.
+ *
+ * The batch goes out as soon as it holds 'threshold' bytes, or when the
+ * deadline of any of its records expires, whichever comes first.
+ * Each class of messages has its own deadline, so that e.g. an alarm
+ * doesn't sit in the batch as long as a temperature reading.
+ * */
+typedef struct batch_t {
+    uint8_t data[DATA_LENGTH];
+    uint8_t len;
+    // Bytes (marker included) after which the batch is flushed right away.
+    uint8_t threshold;
+    // Tick at which the batch must be sent, only valid if len > 1.
+    uint32_t deadline;
+    // Maximum time (in ticks) a record of each class can wait.
+    uint32_t class_deadline[BATCH_CLASSES];
+    // Where full batches go, NULL means straight to send_packet.
+    packet_sender_t send;
+    // Counters, used by the benchmark.
+    uint32_t records;
+    uint32_t frames;
+} batch_t;
+
+/*
+ * Callback that gets every record unpacked from a batch.
+ * */
+typedef void (*record_handler_t)(uint8_t class, uint8_t *value, uint8_t len);
+
+/*
+ * Initializes an empty batch, all the classes start with a deadline of 0,
+ * which means their records are sent right away.
+ * */
+void batch_init(batch_t *batch, uint8_t threshold);
+
+/*
+ * Sends the batches through 'send' (e.g. a link channel queue)
+ * instead of putting them on the wire right away.
+ * */
+void batch_set_sender(batch_t *batch, packet_sender_t send);
+
+/*
+ * Sets how many ticks a record of the given class is allowed to wait.
+ * */
+void batch_set_deadline(batch_t *batch, uint8_t class, uint32_t ticks);
+
+/*
+ * Adds a record to the batch, flushing it first if the record doesn't fit.
+ * 'now' is the current tick, from get_systicks().
+ * Returns 0 on success, -1 if class or len are out of range.
+ *
+ * Not safe to call from an interrupt, since it may end up sending a packet.
+ * */
+int batch_add(batch_t *batch, uint8_t class, uint8_t *value, uint8_t len, uint32_t now);
+
+/*
+ * Sends the batch if its deadline has expired, call it from the main loop.
+ * */
+void batch_poll(batch_t *batch, uint32_t now);
+
+/*
+ * Sends whatever is in the batch.
+ * */
+void batch_flush(batch_t *batch);
+
+/*
+ * Splits a received BATCH packet back into its records.
+ * Returns the number of records, or -1 if the packet is malformed.
+ * */
+int batch_unpack(packet_t *p, record_handler_t handler);
+
+#endif // !BATCH_H
@@ -0,0 +1,289 @@
+#include "baud.h"
+
+const uint32_t baud_rates[BAUD_RATES] = {
+    9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600,
+};
+
+/*
+ * What the test packets carry after {BAUD, BAUD_TEST, n}: alternating bits,
+ * a zero (the COBS delimiter) and long runs of equal bits, the bytes a wrong
+ * sampling point gets wrong first.
+ * */
+static const uint8_t pattern[DATA_LENGTH - 3] = {0x55, 0xAA, 0x00, 0xFF, 0x0F};
+
+#define BAUD_ECHOES_ALL ((1 << BAUD_TEST_PACKETS) - 1)
+
+static uint8_t highest(uint8_t mask) {
+    for (uint8_t i = BAUD_RATES; i > 0; --i) {
+        if (mask & (1 << (i - 1))) {
+            return i - 1;
+        }
+    }
+
+    return BAUD_RATES;
+}
+
+static int baud_send(baud_t *baud, uint8_t channel, uint8_t *data, uint8_t length) {
+    return link_send(baud->link, CHANNEL(channel), data, length);
+}
+
+static int baud_offer(baud_t *baud, uint32_t now) {
+    uint8_t offer[] = {BAUD, BAUD_OFFER, baud->supported & ~baud->failed};
+
+    if (baud_send(baud, CHANNEL_CONTROL, offer, sizeof(offer)) < 0) {
+        return -1;
+    }
+
+    baud->state = BAUD_STATE_OFFERED;
+    baud->initiator = 1;
+    baud->since = now;
+
+    return 0;
+}
+
+/*
+ * The rate being switched to didn't work: back to the one we had,
+ * and the initiator tries again without it.
+ * */
+static void baud_fall_back(baud_t *baud, uint32_t now) {
+    baud->failed |= 1 << baud->pending;
+    baud->set_rate(baud_rates[baud->current]);
+    baud->state = BAUD_STATE_IDLE;
+    baud->heard_at = now;
+    baud->fallbacks++;
+
+    if (baud->initiator) {
+        baud_offer(baud, now);
+    }
+}
+
+static void baud_done(baud_t *baud) {
+    baud->current = baud->pending;
+    baud->state = BAUD_STATE_IDLE;
+    baud->switches++;
+}
+
+uint8_t baud_supported(uint32_t clock) {
+    uint8_t mask = 0;
+
+    for (uint8_t i = 0; i < BAUD_RATES; ++i) {
+        uint32_t rate = baud_rates[i];
+        uint32_t brr = (clock + rate / 2) / rate;
+
+        // USARTDIV can't go below 1, that's BRR 16 with 16x oversampling.
+        if (brr < 16) {
+            continue;
+        }
+
+        uint32_t actual = clock / brr;
+        uint32_t error = actual > rate ? actual - rate : rate - actual;
+
+        if (error * 100 <= rate * BAUD_MAX_ERROR) {
+            mask |= 1 << i;
+        }
+    }
+
+    return mask;
+}
+
+void baud_init(baud_t *baud, link_t *link, uint8_t supported, baud_setter_t set_rate, baud_idle_t idle, uint32_t now) {
+    baud->link = link;
+    baud->set_rate = set_rate;
+    baud->idle = idle;
+    baud->supported = supported | (1 << BAUD_DEFAULT_INDEX);
+    baud->failed = 0;
+    baud->current = BAUD_DEFAULT_INDEX;
+    baud->pending = BAUD_DEFAULT_INDEX;
+    baud->state = BAUD_STATE_IDLE;
+    baud->initiator = 0;
+    baud->tests_sent = 0;
+    baud->echoes = 0;
+    baud->since = now;
+    baud->heard_at = now;
+    baud->frames_heard = link->counters[LINK_FRAMES_RECEIVED];
+    baud->switches = 0;
+    baud->fallbacks = 0;
+}
+
+int baud_negotiate(baud_t *baud, uint32_t now) {
+    if (baud->state != BAUD_STATE_IDLE) {
+        return -1;
+    }
+
+    // A new negotiation gives every rate another chance.
+    baud->failed = 0;
+
+    return baud_offer(baud, now);
+}
+
+void baud_receive(baud_t *baud, const packet_t *p, uint32_t now) {
+    uint8_t length = p->length & LENGTH_MASK;
+
+    if (length < 2 || p->data[0] != BAUD) {
+        return;
+    }
+
+    switch (p->data[1]) {
+    case BAUD_OFFER: {
+        if (length < 3 || baud->state == BAUD_STATE_SWITCHING) {
+            break;
+        }
+
+        uint8_t index = highest(p->data[2] & baud->supported);
+
+        if (index == BAUD_RATES) {
+            index = baud->current;
+        }
+
+        uint8_t accept[] = {BAUD, BAUD_ACCEPT, index};
+
+        if (baud_send(baud, CHANNEL_CONTROL, accept, sizeof(accept)) < 0) {
+            break;
+        }
+
+        baud->initiator = 0;
+        baud->state = BAUD_STATE_IDLE;
+
+        if (index != baud->current) {
+            baud->pending = index;
+            baud->state = BAUD_STATE_SWITCHING;
+            baud->since = now;
+        }
+        break;
+    }
+
+    case BAUD_ACCEPT:
+        if (length < 3 || baud->state != BAUD_STATE_OFFERED) {
+            break;
+        }
+
+        if (p->data[2] >= BAUD_RATES || p->data[2] == baud->current) {
+            // Nothing better in common, we stay where we are.
+            baud->state = BAUD_STATE_IDLE;
+            break;
+        }
+
+        baud->pending = p->data[2];
+        baud->state = BAUD_STATE_SWITCHING;
+        baud->since = now;
+        break;
+
+    case BAUD_TEST: {
+        // Echoed as it is, whatever the state, the initiator checks it.
+        uint8_t echo[DATA_LENGTH];
+
+        for (uint8_t i = 0; i < length; ++i) {
+            echo[i] = p->data[i];
+        }
+        echo[1] = BAUD_ECHO;
+
+        baud_send(baud, CHANNEL_TELEMETRY, echo, length);
+        break;
+    }
+
+    case BAUD_ECHO:
+        if (baud->state != BAUD_STATE_TESTING || length != DATA_LENGTH || p->data[2] >= BAUD_TEST_PACKETS) {
+            break;
+        }
+
+        for (uint8_t i = 0; i < sizeof(pattern); ++i) {
+            if (p->data[3 + i] != pattern[i]) {
+                return;
+            }
+        }
+
+        baud->echoes |= 1 << p->data[2];
+
+        if (baud->echoes == BAUD_ECHOES_ALL) {
+            uint8_t confirm[] = {BAUD, BAUD_CONFIRM};
+
+            if (baud_send(baud, CHANNEL_CONTROL, confirm, sizeof(confirm)) == 0) {
+                baud_done(baud);
+            }
+        }
+        break;
+
+    case BAUD_CONFIRM:
+        if (baud->state == BAUD_STATE_CONFIRMING) {
+            baud_done(baud);
+        }
+        break;
+    }
+}
+
+void baud_poll(baud_t *baud, uint32_t now) {
+    uint32_t frames = baud->link->counters[LINK_FRAMES_RECEIVED];
+
+    if (frames != baud->frames_heard) {
+        baud->frames_heard = frames;
+        baud->heard_at = now;
+    }
+
+    switch (baud->state) {
+    case BAUD_STATE_OFFERED:
+        // The link gave up on the offer, or the answer never came.
+        if (now - baud->since >= BAUD_SILENCE_TICKS) {
+            baud->state = BAUD_STATE_IDLE;
+        }
+        break;
+
+    case BAUD_STATE_SWITCHING:
+        if (link_idle(baud->link) && baud->idle()) {
+            baud->set_rate(baud_rates[baud->pending]);
+            baud->state = baud->initiator ? BAUD_STATE_TESTING : BAUD_STATE_CONFIRMING;
+            baud->since = now;
+            baud->heard_at = now;
+            baud->tests_sent = 0;
+            baud->echoes = 0;
+        } else if (now - baud->since >= BAUD_SILENCE_TICKS) {
+            // The link never went quiet, the other side goes back
+            // to the old rate on its own when the test fails.
+            baud->failed |= 1 << baud->pending;
+            baud->state = BAUD_STATE_IDLE;
+        }
+        break;
+
+    case BAUD_STATE_TESTING:
+        // The other side may switch a little after us.
+        if (baud->tests_sent < BAUD_TEST_PACKETS && now - baud->since >= BAUD_SETTLE_TICKS) {
+            uint8_t test[DATA_LENGTH] = {BAUD, BAUD_TEST, baud->tests_sent};
+
+            for (uint8_t i = 0; i < sizeof(pattern); ++i) {
+                test[3 + i] = pattern[i];
+            }
+
+            if (baud_send(baud, CHANNEL_TELEMETRY, test, sizeof(test)) == 0) {
+                baud->tests_sent++;
+            }
+        }
+
+        if (now - baud->since >= BAUD_VERIFY_TICKS) {
+            baud_fall_back(baud, now);
+        }
+        break;
+
+    case BAUD_STATE_CONFIRMING:
+        if (now - baud->since >= BAUD_VERIFY_TICKS + BAUD_SETTLE_TICKS) {
+            baud_fall_back(baud, now);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // Lost contact: back to the rate both sides start from, once
+    // our last byte is out so that it doesn't get cut in half.
+    if (baud->state == BAUD_STATE_IDLE && baud->current != BAUD_DEFAULT_INDEX &&
+        now - baud->heard_at >= BAUD_SILENCE_TICKS && baud->idle()) {
+        baud->set_rate(BAUD_DEFAULT);
+        baud->current = BAUD_DEFAULT_INDEX;
+        baud->failed = 0;
+        baud->heard_at = now;
+        baud->fallbacks++;
+    }
+}
+
+int baud_busy(baud_t *baud) {
+    return baud->state != BAUD_STATE_IDLE;
+}
@@ -0,0 +1,152 @@
+#ifndef BAUD_H
+#define BAUD_H
+
+#include <stdint.h>
+#include "p_p.h"
+#include "link.h"
+
+/*
+ * Link speed negotiation.
+ *
+ * Both ends start at BAUD_DEFAULT, which any cable carries. Then one of
+ * them (the initiator, usually the host) offers the rates it supports, the
+ * other picks the highest one they have in common, and both switch:
+ *
+ * initiator                           responder
+ * {BAUD, BAUD_OFFER, rates}    ->
+ *                              <-     {BAUD, BAUD_ACCEPT, index}
+ * ACK                          ->
+ * (switch)                            (switch)
+ * {BAUD, BAUD_TEST, n, pattern} ->    BAUD_TEST_PACKETS of them
+ *                              <-     {BAUD, BAUD_ECHO, n, pattern}
+ * {BAUD, BAUD_CONFIRM}         ->
+ *
+ * Each side switches only when its link has nothing left to send and the
+ * last byte is out (the 'idle' callback), so nothing is ever sent half at
+ * one rate and half at the other.
+ *
+ * The test packets travel on CHANNEL_TELEMETRY, without retransmissions,
+ * so that a rate the cable can't carry shows up as missing or broken echoes
+ * instead of being hidden by the link. If they don't all come back within
+ * BAUD_VERIFY_TICKS, the initiator goes back to the previous rate, and so
+ * does the responder when no CONFIRM comes; that rate is then left out and
+ * the next lower one is tried, until one passes the test or there's none
+ * left above the current one.
+ *
+ * Later on, if nothing at all is received for BAUD_SILENCE_TICKS (both
+ * sides send a heartbeat every HEARTBEAT_TICKS) the rate is assumed lost,
+ * and both sides end up back at BAUD_DEFAULT on their own.
+ * */
+#define BAUD 0x17
+
+#define BAUD_OFFER 1
+#define BAUD_ACCEPT 2
+#define BAUD_TEST 3
+#define BAUD_ECHO 4
+#define BAUD_CONFIRM 5
+
+/*
+ * Rates that can be negotiated, BAUD_OFFER carries them as a bit mask
+ * and BAUD_ACCEPT as an index in this table.
+ * */
+#define BAUD_RATES 8
+#define BAUD_DEFAULT_INDEX 0
+#define BAUD_DEFAULT 9600
+#define BAUD_ALL ((1 << BAUD_RATES) - 1)
+
+extern const uint32_t baud_rates[BAUD_RATES];
+
+#define BAUD_TEST_PACKETS 4
+#define BAUD_SETTLE_TICKS 10
+#define BAUD_VERIFY_TICKS 500
+#define BAUD_SILENCE_TICKS 3000
+
+/*
+ * A rate counts as supported by a USART if the closest one it
+ * can make is within BAUD_MAX_ERROR % of it.
+ * */
+#define BAUD_MAX_ERROR 2
+
+/*
+ * Changes the rate of the wire, only called when it's idle.
+ * */
+typedef void (*baud_setter_t)(uint32_t baud);
+
+/*
+ * 1 when the last byte handed to the wire is out of it.
+ * */
+typedef int (*baud_idle_t)(void);
+
+typedef enum baud_state_t {
+    BAUD_STATE_IDLE,
+    BAUD_STATE_OFFERED,
+    // Waiting for the link to be idle, to switch to 'pending'.
+    BAUD_STATE_SWITCHING,
+    // Initiator, switched, sending the test packets and counting echoes.
+    BAUD_STATE_TESTING,
+    // Responder, switched, waiting for CONFIRM.
+    BAUD_STATE_CONFIRMING,
+} baud_state_t;
+
+typedef struct baud_t {
+    link_t *link;
+    baud_setter_t set_rate;
+    baud_idle_t idle;
+    // Masks of the rates we support, and of the ones that failed the test.
+    uint8_t supported;
+    uint8_t failed;
+    // Index of the rate in use, and of the one being switched to.
+    uint8_t current;
+    uint8_t pending;
+    uint8_t state;
+    uint8_t initiator;
+    uint8_t tests_sent;
+    uint8_t echoes;
+    // Tick the current state started at.
+    uint32_t since;
+    // Last time the link received something, and its counter back then.
+    uint32_t heard_at;
+    uint32_t frames_heard;
+    // Counters.
+    uint32_t switches;
+    uint32_t fallbacks;
+} baud_t;
+
+/*
+ * Mask of the rates a USART clocked at 'clock' Hz can make
+ * (16x oversampling, BRR = clock / baud).
+ * */
+uint8_t baud_supported(uint32_t clock);
+
+/*
+ * Starts at BAUD_DEFAULT, the wire must already be running at it.
+ * */
+void baud_init(baud_t *baud, link_t *link, uint8_t supported, baud_setter_t set_rate, baud_idle_t idle, uint32_t now);
+
+/*
+ * Starts a negotiation as the initiator.
+ * Returns -1 if one is already going on (or the offer couldn't be queued).
+ * */
+int baud_negotiate(baud_t *baud, uint32_t now);
+
+/*
+ * Handles a BAUD packet.
+ * */
+void baud_receive(baud_t *baud, const packet_t *p, uint32_t now);
+
+/*
+ * Moves the negotiation along and watches the link, call
+ * it from the main loop together with link_poll.
+ * */
+void baud_poll(baud_t *baud, uint32_t now);
+
+/*
+ * 1 while a negotiation is going on.
+ * */
+int baud_busy(baud_t *baud);
+
+static inline uint32_t baud_rate(baud_t *baud) {
+    return baud_rates[baud->current];
+}
+
+#endif // !BAUD_H
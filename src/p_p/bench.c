@@ -0,0 +1,201 @@
+#include "bench.h"
+#include "p_p.h"
+#include "cobs.h"
+#include "batch.h"
+#include "compress.h"
+#include "transport.h"
+
+#define BENCH_ROUNDS 100
+#define BENCH_RECORDS 24
+#define CPU_FREQUENCY 16000000
+#define BENCH_COMPRESS_BYTES 1024
+
+void bench_init(void) {
+    // Power the DWT through DEMCR.TRCENA, then start the cycle
+    // counter (DWT_CTRL.CYCCNTENA). Not reset: the event loop
+    // keeps time with it as well.
+    DCB->DCB_DEMCR |= (1 << 24);
+    DWT->DWT_CTRL |= (1 << 0);
+}
+
+void bench_report(char *label, uint32_t value) {
+    char digits[10];
+    uint8_t n = 0;
+
+    while (*label) {
+        write_byte(*label++);
+    }
+
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (n > 0) {
+        write_byte(digits[--n]);
+    }
+
+    write_byte('\n');
+}
+
+static void bench_cobs_frame(uint32_t len) {
+    uint8_t src[COBS_BLOCK];
+    uint8_t encoded[COBS_MAX_ENCODED(COBS_BLOCK)];
+    uint8_t tmp[COBS_MAX_ENCODED(COBS_BLOCK)];
+    uint32_t encoded_len = 0;
+
+    // Something that looks like sensor data: mostly small
+    // values, with a zero every now and then.
+    for (uint32_t i = 0; i < len; i++) {
+        src[i] = (i % 7 == 0) ? 0 : (uint8_t)(i * 13);
+    }
+
+    uint32_t start = bench_cycles();
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+        encoded_len = cobs_encode(src, len, encoded);
+    }
+    uint32_t encode = bench_cycles() - start;
+
+    // Decoding is in place, so every round works on a fresh copy,
+    // the cost of the copy is measured on its own and taken away.
+    start = bench_cycles();
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < encoded_len; i++) {
+            tmp[i] = encoded[i];
+        }
+    }
+    uint32_t copy = bench_cycles() - start;
+
+    start = bench_cycles();
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+        for (uint32_t i = 0; i < encoded_len; i++) {
+            tmp[i] = encoded[i];
+        }
+        cobs_decode(tmp, encoded_len);
+    }
+    uint32_t decode = bench_cycles() - start - copy;
+
+    bench_report("cobs frame bytes: ", len);
+    bench_report("cobs encode cycles/byte x100: ", encode / len);
+    bench_report("cobs decode cycles/byte x100: ", decode / len);
+}
+
+static void bench_batch(uint8_t len) {
+    uint8_t value[BATCH_RECORD_MAX] = {1, 2, 3, 4};
+    batch_t batch;
+
+    // One packet for every value, what the telemetry does today.
+    uint32_t start = bench_cycles();
+    for (uint32_t r = 0; r < BENCH_RECORDS; r++) {
+        send_packet(create_packet(len, value));
+    }
+    uint32_t single = bench_cycles() - start;
+
+    // Same values through a batch that only leaves when it's full.
+    batch_init(&batch, DATA_LENGTH);
+    batch_set_deadline(&batch, 0, 0xFFFF);
+
+    start = bench_cycles();
+    for (uint32_t r = 0; r < BENCH_RECORDS; r++) {
+        batch_add(&batch, 0, value, len, 0);
+    }
+    batch_flush(&batch);
+    uint32_t batched = bench_cycles() - start;
+
+    // Both runs are wire bound and last hundreds of ms, so we count in ms
+    // and keep the math in 32 bits (there is no libgcc for 64 bit divisions).
+    uint32_t single_ms = single / (CPU_FREQUENCY / 1000) + 1;
+    uint32_t batched_ms = batched / (CPU_FREQUENCY / 1000) + 1;
+
+    bench_report("batch record bytes: ", len);
+    bench_report("single records/s: ", BENCH_RECORDS * 1000 / single_ms);
+    bench_report("batched records/s: ", BENCH_RECORDS * 1000 / batched_ms);
+    bench_report("batched frames: ", batch.frames);
+}
+
+static uint32_t compressed_bytes;
+
+static void count_sink(uint8_t byte) {
+    compressed_bytes++;
+}
+
+static void bench_compress(void) {
+    static uint8_t samples[BENCH_COMPRESS_BYTES];
+    uint32_t seed = 1;
+    int16_t z = 1000;
+    compress_t c;
+
+    // Accelerometer like samples: 16 bit, little endian, around 1 g with
+    // some noise from a small linear congruential generator.
+    for (uint32_t i = 0; i + 2 <= BENCH_COMPRESS_BYTES; i += 2) {
+        seed = seed * 1103515245 + 12345;
+        z += (int16_t)((seed >> 16) % 5) - 2;
+        samples[i] = z & 0xFF;
+        samples[i + 1] = (z >> 8) & 0xFF;
+    }
+
+    compressed_bytes = 0;
+
+    uint32_t start = bench_cycles();
+    compress_init(&c, count_sink);
+    compress_feed(&c, samples, BENCH_COMPRESS_BYTES);
+    compress_finish(&c);
+    uint32_t cycles = bench_cycles() - start;
+
+    uint32_t cycles_per_byte = cycles / BENCH_COMPRESS_BYTES;
+
+    bench_report("compress ratio %: ", compressed_bytes * 100 / BENCH_COMPRESS_BYTES);
+    bench_report("compress cycles/byte: ", cycles_per_byte);
+    // With 10 bits per byte on the wire, compressing pays off as long as
+    // we compress faster than the link sends raw bytes.
+    bench_report("compress pays off below baud: ", 10 * (CPU_FREQUENCY / (cycles_per_byte + 1)));
+}
+
+static void bench_transport(transport_t *t) {
+    uint8_t value[DATA_LENGTH] = {1, 2, 3, 4, 5, 6, 7, 8};
+    packet_t *p = create_packet(DATA_LENGTH, value);
+    uint32_t in_send = 0;
+    uint32_t refused = t->busy;
+
+    // The packets go out back to back, a refused one is tried again
+    // right away, that's the transport at full speed.
+    uint32_t start = bench_cycles();
+    for (uint32_t r = 0; r < BENCH_RECORDS; r++) {
+        int sent;
+
+        do {
+            uint32_t before = bench_cycles();
+            sent = transport_send_packet(t, p);
+            in_send += bench_cycles() - before;
+        } while (sent < 0);
+    }
+
+#if !P_P_I2C
+    // Done once the last byte left the USART.
+    while (!transport_uart_idle());
+#endif
+    uint32_t total = bench_cycles() - start;
+    uint32_t total_ms = total / (CPU_FREQUENCY / 1000) + 1;
+
+    bench_report("transport packets/s: ", BENCH_RECORDS * 1000 / total_ms);
+    bench_report("transport payload bytes/s: ", BENCH_RECORDS * DATA_LENGTH * 1000 / total_ms);
+    // Time the CPU spends in the transport per call, the rest of the
+    // time it's free to do something else (with the UART) or not (I2C).
+    bench_report("transport cpu cycles/call: ", in_send / (BENCH_RECORDS + t->busy - refused));
+    bench_report("transport busy: ", t->busy - refused);
+}
+
+void bench_run(transport_t *wire) {
+    bench_init();
+
+    bench_cobs_frame(PACKET_LENGTH);
+    bench_cobs_frame(COBS_BLOCK);
+
+    bench_batch(1);
+    bench_batch(2);
+    bench_batch(4);
+
+    bench_compress();
+
+    bench_transport(wire);
+}
@@ -0,0 +1,39 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include "../../inc/peripherals.h"
+#include "transport.h"
+
+/*
+ * When set to 1, main runs the on target benchmarks once at startup
+ * and prints the results over USART2.
+ * */
+#ifndef P_P_BENCH
+#define P_P_BENCH 0
+#endif
+
+/*
+ * Starts the DWT cycle counter.
+ * */
+void bench_init(void);
+
+/*
+ * Current value of the cycle counter, subtract two readings
+ * to get the cycles spent in between (it wraps every ~268 s at 16 MHz).
+ * */
+static inline uint32_t bench_cycles(void) {
+    return DWT->DWT_CYCCNT;
+}
+
+/*
+ * Prints a label followed by a number and a new line.
+ * */
+void bench_report(char *label, uint32_t value);
+
+/*
+ * Runs all the benchmarks, the transport ones on 'wire'.
+ * */
+void bench_run(transport_t *wire);
+
+#endif // !BENCH_H
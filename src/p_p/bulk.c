@@ -0,0 +1,140 @@
+#include "bulk.h"
+
+/*
+ * Compressor and decompressor used for the p_p streams, together with
+ * the payload of the next packet to send, and the packets waiting for
+ * the sender to take them.
+ * */
+static compress_t tx_stream;
+static uint8_t tx_payload[DATA_LENGTH];
+static uint8_t tx_len;
+static uint8_t tx_queue[BULK_TX_QUEUE][DATA_LENGTH];
+static uint8_t tx_lengths[BULK_TX_QUEUE];
+static uint8_t tx_head;
+static uint8_t tx_tail;
+static decompress_t rx_stream;
+static byte_sink_t rx_handler;
+static packet_sender_t tx_sender;
+
+static uint8_t tx_room(void) {
+    return BULK_TX_QUEUE - (uint8_t)(tx_head - tx_tail);
+}
+
+/*
+ * The callers made sure there's room.
+ * */
+static void queue_payload(void) {
+    uint8_t slot = tx_head % BULK_TX_QUEUE;
+
+    for (uint8_t i = 0; i < tx_len; ++i) {
+        tx_queue[slot][i] = tx_payload[i];
+    }
+
+    tx_lengths[slot] = tx_len;
+    tx_head++;
+    tx_len = 0;
+}
+
+static void tx_sink(uint8_t byte) {
+    tx_payload[tx_len++] = byte;
+
+    if (tx_len == DATA_LENGTH) {
+        queue_payload();
+    }
+}
+
+/*
+ * Without a handler the bytes of the streams are just dropped.
+ * */
+static void rx_sink(uint8_t byte) {
+    if (rx_handler) {
+        rx_handler(byte);
+    }
+}
+
+void bulk_begin(void) {
+    tx_len = 0;
+    compress_init(&tx_stream, tx_sink);
+}
+
+size_t bulk_write(const uint8_t *data, size_t len) {
+    size_t taken = 0;
+
+    bulk_poll();
+
+    // A byte makes one token at most, 2 bytes of output at most: it can
+    // fill one packet, never two. So one free slot is enough for it.
+    while (taken < len && tx_room() > 0) {
+        compress_feed(&tx_stream, data + taken, 1);
+        taken++;
+    }
+
+    bulk_poll();
+
+    return taken;
+}
+
+int bulk_end(void) {
+    bulk_poll();
+
+    if (tx_room() < BULK_END_PACKETS) {
+        return -1;
+    }
+
+    compress_finish(&tx_stream);
+
+    // The last packet is never full, that's how the receiver knows
+    // the stream is over, so if we just filled one we send an empty one.
+    queue_payload();
+    bulk_poll();
+
+    return 0;
+}
+
+void bulk_poll(void) {
+    uint8_t flags = CHANNEL(CHANNEL_BULK) | FLAG_COMPRESSED;
+
+    while (tx_head != tx_tail) {
+        uint8_t slot = tx_tail % BULK_TX_QUEUE;
+
+        if (tx_sender) {
+            if (tx_sender(flags, tx_lengths[slot], tx_queue[slot]) < 0) {
+                return;
+            }
+        } else {
+            send_packet(create_flagged_packet(flags, tx_lengths[slot], tx_queue[slot]));
+        }
+
+        tx_tail++;
+    }
+}
+
+void bulk_init(void) {
+    tx_len = 0;
+    tx_head = 0;
+    tx_tail = 0;
+    tx_sender = NULL;
+    rx_handler = NULL;
+    decompress_init(&rx_stream, rx_sink);
+}
+
+void bulk_set_sender(packet_sender_t send) {
+    tx_sender = send;
+}
+
+void bulk_set_handler(byte_sink_t handler) {
+    rx_handler = handler;
+    decompress_init(&rx_stream, rx_sink);
+}
+
+void bulk_receive(const packet_t *p) {
+    uint8_t length = p->length & LENGTH_MASK;
+
+    decompress_feed(&rx_stream, p->data, length);
+
+    // A short packet closes the stream, the padding bits of the last byte
+    // are thrown away and the next packet starts a new stream.
+    if (length < DATA_LENGTH) {
+        decompress_init(&rx_stream, rx_sink);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "p_p.h"
+#include "compress.h"
+
+/*
+ * Bulk transfers over p_p, compressed with compress.h.
+ * A stream travels on CHANNEL_BULK, in packets with the FLAG_COMPRESSED flag set. Every packet
+ * but the last one is full, the last one has less than DATA_LENGTH bytes
+ * (even 0) and closes the stream.
+ *
+ * Only one stream at a time can be sent, and one received.
+ *
+ * The decompressor needs every packet of the stream, in order: a piece
+ * that went missing would shift everything after it, and spoil the
+ * window the next matches are copied from. So the stream must go on a
+ * reliable channel, which CHANNEL_BULK is (LINK_RELIABLE_CHANNELS), through
+ * the link (bulk_set_sender). A packet the link gives up on (LINK_FAILED)
+ * still ruins the rest of its stream, the next one starts clean.
+ * */
+#ifndef BULK_TX_QUEUE
+#define BULK_TX_QUEUE 8
+#endif
+
+/*
+ * Most packets a stream can still produce when it's closed: what's left
+ * of the lookahead as literals (9 bits each), the bits waiting for a
+ * byte, the payload being filled, and the short packet that ends it.
+ * */
+#define BULK_END_PACKETS \
+    ((DATA_LENGTH - 1 + (9 * (COMPRESS_MAX_MATCH - 1) + 7 + 7) / 8) / DATA_LENGTH + 1)
+
+#if BULK_TX_QUEUE < BULK_END_PACKETS
+#error "BULK_TX_QUEUE can't hold the end of a stream"
+#endif
+
+/*
+ * Gets both directions ready, no stream going and no handler: call it
+ * before the first packet can come in, bulk_receive needs it.
+ * */
+void bulk_init(void);
+
+/*
+ * Packets wait in a queue of BULK_TX_QUEUE until the sender takes them,
+ * nothing blocks when it can't: bulk_write only takes the bytes it has
+ * room for and returns how many, bulk_end returns -1 until the end of
+ * the stream fits, call them again later with the rest. bulk_poll hands
+ * the queue to the sender, call it from the main loop.
+ * */
+void bulk_begin(void);
+size_t bulk_write(const uint8_t *data, size_t len);
+int bulk_end(void);
+void bulk_poll(void);
+
+/*
+ * Sends the packets of the stream through 'send' (e.g. a link channel
+ * queue), a packet it refuses (-1) is offered again by bulk_poll. By
+ * default they go straight to send_packet, with nothing to get them
+ * there again when the wire loses one.
+ * */
+void bulk_set_sender(packet_sender_t send);
+
+/*
+ * Sets where the bytes of received streams go.
+ * */
+void bulk_set_handler(byte_sink_t handler);
+
+/*
+ * Feeds a received packet with FLAG_COMPRESSED to the decompressor.
+ * */
+void bulk_receive(const packet_t *p);
+
+#endif // !BULK_H
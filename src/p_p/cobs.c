@@ -0,0 +1,139 @@
+#include "cobs.h"
+
+size_t cobs_encode_in_place(uint8_t *buf, size_t len) {
+    // With at most 254 bytes, no run of non zero bytes can be longer than
+    // what a single code byte can describe, so no extra code byte is ever
+    // needed and the frame only grows by the one in buf[0].
+    if (len > COBS_BLOCK) {
+        return 0;
+    }
+
+    // We walk the frame and every time we meet a zero, we replace the
+    // previous code byte (the last zero, or buf[0]) with the distance
+    // to it, the zero itself becomes the next code byte.
+    size_t code_pos = 0;
+
+    for (size_t i = 1; i <= len; i++) {
+        if (buf[i] == 0) {
+            buf[code_pos] = (uint8_t)(i - code_pos);
+            code_pos = i;
+        }
+    }
+
+    // The last code byte points right after the end of the frame.
+    buf[code_pos] = (uint8_t)(len + 1 - code_pos);
+
+    return len + 1;
+}
+
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    uint8_t *code_ptr = dst;
+    uint8_t *out = dst + 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == 0) {
+            *code_ptr = code;
+            code_ptr = out++;
+            code = 1;
+            continue;
+        }
+
+        *out++ = src[i];
+        code++;
+
+        // 254 non zero bytes in a row is the most a code byte can describe,
+        // we close the block and start a new one, without an implicit zero.
+        if (code == 0xFF) {
+            *code_ptr = code;
+            code_ptr = out++;
+            code = 1;
+        }
+    }
+
+    *code_ptr = code;
+
+    return (size_t)(out - dst);
+}
+
+size_t cobs_decode(uint8_t *buf, size_t len) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len) {
+        uint8_t code = buf[in++];
+
+        // A zero can't be there (it's the delimiter), and the block
+        // can't go past the end of the frame.
+        if (code == 0 || in + code - 1 > len) {
+            return 0;
+        }
+
+        for (uint8_t i = 1; i < code; i++) {
+            if (buf[in] == 0) {
+                return 0;
+            }
+            buf[out++] = buf[in++];
+        }
+
+        // Every code but 0xFF stands for a zero, except for the last one,
+        // which just marks the end of the frame.
+        if (code != 0xFF && in < len) {
+            buf[out++] = 0;
+        }
+    }
+
+    return out;
+}
+
+static void decoder_reset(cobs_decoder_t *decoder) {
+    decoder->len = 0;
+    // 0xFF means 'no implicit zero pending', which is what we want
+    // for the first code byte of a frame.
+    decoder->code = 0xFF;
+    decoder->remaining = 0;
+    decoder->error = 0;
+}
+
+static void decoder_emit(cobs_decoder_t *decoder, uint8_t byte) {
+    if (decoder->len < decoder->size) {
+        decoder->buf[decoder->len++] = byte;
+    } else {
+        decoder->error = 1;
+    }
+}
+
+void cobs_decoder_init(cobs_decoder_t *decoder, uint8_t *buf, size_t size) {
+    decoder->buf = buf;
+    decoder->size = size;
+
+    decoder_reset(decoder);
+}
+
+size_t cobs_decoder_feed(cobs_decoder_t *decoder, uint8_t byte) {
+    if (byte == COBS_DELIMITER) {
+        // The frame is only valid if the last block was complete,
+        // if it wasn't, we lost bytes somewhere in the middle.
+        size_t len = decoder->len;
+        uint8_t valid = !decoder->error && decoder->remaining == 0;
+
+        decoder_reset(decoder);
+
+        return valid ? len : 0;
+    }
+
+    if (decoder->remaining == 0) {
+        // This is a code byte, so the previous block (if any) ended with a zero.
+        if (decoder->code != 0xFF) {
+            decoder_emit(decoder, 0);
+        }
+
+        decoder->code = byte;
+        decoder->remaining = byte - 1;
+    } else {
+        decoder_emit(decoder, byte);
+        decoder->remaining--;
+    }
+
+    return 0;
+}
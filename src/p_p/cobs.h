@@ -0,0 +1,79 @@
+#ifndef COBS_H
+#define COBS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * COBS (Consistent Overhead Byte Stuffing) framing.
+ *
+ * Every zero byte of a frame gets replaced by the distance to the next zero,
+ * so the encoded frame never contains a 0x00 and we can use 0x00 as the
+ * delimiter between frames. A receiver that joins mid-stream, or that loses
+ * a byte, only has to wait for the next 0x00 to be aligned again.
+ *
+ * The overhead is 1 byte for every 254 bytes of data (plus the delimiter).
+ * */
+#define COBS_DELIMITER 0x00
+
+/*
+ * Biggest frame that can be encoded in place with a single code byte.
+ * */
+#define COBS_BLOCK 254
+
+/*
+ * Worst case size of an encoded frame of 'len' bytes (without the delimiter).
+ * */
+#define COBS_MAX_ENCODED(len) ((len) + ((len) / COBS_BLOCK) + 1)
+
+/*
+ * Encodes in place a frame of 'len' bytes (at most COBS_BLOCK) stored
+ * starting at buf[1], buf[0] is reserved for the first code byte.
+ * Returns the encoded length (len + 1), or 0 if the frame is too long.
+ * */
+size_t cobs_encode_in_place(uint8_t *buf, size_t len);
+
+/*
+ * Encodes 'len' bytes from src into dst, for frames of any length.
+ * dst must have room for COBS_MAX_ENCODED(len) bytes.
+ * Returns the encoded length.
+ * */
+size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+
+/*
+ * Decodes in place an encoded frame of 'len' bytes (without the delimiter).
+ * Since the decoded frame is always shorter, the output just overwrites the input.
+ * Returns the decoded length, or 0 if the frame is not valid COBS.
+ * */
+size_t cobs_decode(uint8_t *buf, size_t len);
+
+/*
+ * Struct that holds the state of the streaming decoder,
+ * which decodes one byte at a time, straight from the RX interrupt.
+ * */
+typedef struct cobs_decoder_t {
+    // Where the decoded frame gets written.
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    // Current code byte, and how many data bytes are left before the next one.
+    uint8_t code;
+    uint8_t remaining;
+    // Set when the frame overflows buf or is malformed, the frame gets
+    // thrown away when its delimiter arrives.
+    uint8_t error;
+} cobs_decoder_t;
+
+/*
+ * Initializes the decoder, decoded frames are written into buf.
+ * */
+void cobs_decoder_init(cobs_decoder_t *decoder, uint8_t *buf, size_t size);
+
+/*
+ * Feeds one received byte to the decoder.
+ * Returns the length of the decoded frame when 'byte' is the delimiter
+ * that closes a valid frame, 0 otherwise.
+ * */
+size_t cobs_decoder_feed(cobs_decoder_t *decoder, uint8_t byte);
+
+#endif // !COBS_H
@@ -0,0 +1,175 @@
+#include "compress.h"
+
+#define RING_MASK (2 * COMPRESS_WINDOW - 1)
+
+static void put_bits(compress_t *c, uint16_t value, uint8_t bits) {
+    // Bits go out most significant first, a byte at a time.
+    while (bits > 0) {
+        bits--;
+        c->out_byte = (c->out_byte << 1) | ((value >> bits) & 1);
+        c->out_bits++;
+
+        if (c->out_bits == 8) {
+            c->sink(c->out_byte);
+            c->bytes_out++;
+            c->out_byte = 0;
+            c->out_bits = 0;
+        }
+    }
+}
+
+/*
+ * Encodes one token starting at 'pos': the longest match in the window
+ * if it's worth it, a literal otherwise.
+ * */
+static void encode_step(compress_t *c) {
+    uint32_t avail = c->end - c->pos;
+    uint32_t max_distance = c->pos < COMPRESS_WINDOW ? c->pos : COMPRESS_WINDOW;
+    uint32_t best_len = 0;
+    uint32_t best_distance = 0;
+
+    if (avail > COMPRESS_MAX_MATCH) {
+        avail = COMPRESS_MAX_MATCH;
+    }
+
+    // Plain search over the window, the closest match wins the ties.
+    // The match can run past 'pos' into the bytes it's copying, which is
+    // fine since the decoder copies one byte at a time.
+    for (uint32_t distance = 1; distance <= max_distance; distance++) {
+        uint32_t from = c->pos - distance;
+        uint32_t len = 0;
+
+        while (len < avail && c->ring[(from + len) & RING_MASK] == c->ring[(c->pos + len) & RING_MASK]) {
+            len++;
+        }
+
+        if (len > best_len) {
+            best_len = len;
+            best_distance = distance;
+
+            if (len == avail) {
+                break;
+            }
+        }
+    }
+
+    if (best_len >= COMPRESS_MIN_MATCH) {
+        put_bits(c, 0, 1);
+        put_bits(c, best_distance - 1, COMPRESS_WINDOW_BITS);
+        put_bits(c, best_len - COMPRESS_MIN_MATCH, COMPRESS_LENGTH_BITS);
+        c->pos += best_len;
+    } else {
+        put_bits(c, 1, 1);
+        put_bits(c, c->ring[c->pos & RING_MASK], 8);
+        c->pos++;
+    }
+}
+
+void compress_init(compress_t *c, byte_sink_t sink) {
+    c->pos = 0;
+    c->end = 0;
+    c->out_byte = 0;
+    c->out_bits = 0;
+    c->sink = sink;
+    c->bytes_in = 0;
+    c->bytes_out = 0;
+}
+
+void compress_feed(compress_t *c, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        c->ring[c->end & RING_MASK] = *data++;
+        c->end++;
+        c->bytes_in++;
+        len--;
+
+        // We only encode once we have a full lookahead, so that we always
+        // get the longest match. The ring is big enough to keep the whole
+        // window behind 'pos' while the lookahead fills up in front of it.
+        if (c->end - c->pos == COMPRESS_MAX_MATCH) {
+            encode_step(c);
+        }
+    }
+}
+
+void compress_finish(compress_t *c) {
+    while (c->pos < c->end) {
+        encode_step(c);
+    }
+
+    if (c->out_bits > 0) {
+        put_bits(c, 0, 8 - c->out_bits);
+    }
+}
+
+static void decompress_output(decompress_t *d, uint8_t byte) {
+    d->window[d->head & (COMPRESS_WINDOW - 1)] = byte;
+    d->head++;
+    d->sink(byte);
+}
+
+static void decompress_field(decompress_t *d, decompress_state_t state) {
+    d->state = state;
+    d->field = 0;
+    d->field_bits = 0;
+}
+
+static void decompress_bit(decompress_t *d, uint8_t bit) {
+    d->field = (d->field << 1) | bit;
+    d->field_bits++;
+
+    switch (d->state) {
+    case DECOMPRESS_TAG:
+        decompress_field(d, bit ? DECOMPRESS_LITERAL : DECOMPRESS_DISTANCE);
+        break;
+
+    case DECOMPRESS_LITERAL:
+        if (d->field_bits == 8) {
+            decompress_output(d, (uint8_t)d->field);
+            decompress_field(d, DECOMPRESS_TAG);
+        }
+        break;
+
+    case DECOMPRESS_DISTANCE:
+        if (d->field_bits == COMPRESS_WINDOW_BITS) {
+            d->distance = d->field + 1;
+            decompress_field(d, DECOMPRESS_COUNT);
+        }
+        break;
+
+    case DECOMPRESS_COUNT:
+        if (d->field_bits == COMPRESS_LENGTH_BITS) {
+            uint16_t count = d->field + COMPRESS_MIN_MATCH;
+
+            // A corrupted stream could point before the start, we
+            // just skip it instead of making up data.
+            if (d->distance <= d->head) {
+                while (count > 0) {
+                    decompress_output(d, d->window[(d->head - d->distance) & (COMPRESS_WINDOW - 1)]);
+                    count--;
+                }
+            }
+
+            decompress_field(d, DECOMPRESS_TAG);
+        }
+        break;
+    }
+}
+
+void decompress_init(decompress_t *d, byte_sink_t sink) {
+    d->head = 0;
+    d->distance = 0;
+    d->sink = sink;
+
+    decompress_field(d, DECOMPRESS_TAG);
+}
+
+void decompress_feed(decompress_t *d, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        for (int8_t bit = 7; bit >= 0; bit--) {
+            decompress_bit(d, (*data >> bit) & 1);
+        }
+
+        data++;
+        len--;
+    }
+}
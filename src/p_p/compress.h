@@ -0,0 +1,112 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Streaming LZSS compression (the same scheme as heatshrink) for bulk
+ * transfers, like log and sensor dumps, over the slow UART link.
+ *
+ * The output is a stream of bits, each token starts with a tag bit:
+ *
+ * 1 | literal (8 bits)                                  -> one raw byte
+ * 0 | distance - 1 (WINDOW_BITS) | count - MIN (LENGTH_BITS) -> copy 'count'
+ *     bytes starting 'distance' bytes back in what was already decoded
+ *
+ * Everything lives in fixed size buffers, no heap:
+ * the compressor needs 2 * COMPRESS_WINDOW bytes, the decompressor COMPRESS_WINDOW.
+ * */
+#ifndef COMPRESS_WINDOW_BITS
+#define COMPRESS_WINDOW_BITS 8
+#endif
+
+#ifndef COMPRESS_LENGTH_BITS
+#define COMPRESS_LENGTH_BITS 4
+#endif
+
+#define COMPRESS_WINDOW (1 << COMPRESS_WINDOW_BITS)
+#define COMPRESS_MIN_MATCH 2
+#define COMPRESS_MAX_MATCH (COMPRESS_MIN_MATCH + (1 << COMPRESS_LENGTH_BITS) - 1)
+
+/*
+ * The padding of the last byte (up to 7 zero bits) must never look like
+ * a complete token: a zero tag bit asks for WINDOW_BITS + LENGTH_BITS more bits.
+ * */
+#if COMPRESS_WINDOW_BITS + COMPRESS_LENGTH_BITS < 7
+#error "COMPRESS_WINDOW_BITS + COMPRESS_LENGTH_BITS must be at least 7"
+#endif
+
+#if COMPRESS_MAX_MATCH > COMPRESS_WINDOW
+#error "COMPRESS_LENGTH_BITS too big for the window"
+#endif
+
+/*
+ * Callback that gets every byte produced by the (de)compressor.
+ * */
+typedef void (*byte_sink_t)(uint8_t byte);
+
+/*
+ * Struct that holds the state of the compressor.
+ *
+ * The ring holds the last COMPRESS_WINDOW bytes already encoded, where we
+ * look for matches, followed by up to COMPRESS_MAX_MATCH bytes still to encode.
+ * 'pos' and 'end' keep counting up, and get masked to index the ring.
+ * */
+typedef struct compress_t {
+    uint8_t ring[2 * COMPRESS_WINDOW];
+    uint32_t pos;
+    uint32_t end;
+    uint8_t out_byte;
+    uint8_t out_bits;
+    byte_sink_t sink;
+    // Counters, to know how well we are doing.
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+} compress_t;
+
+/*
+ * Decoder states, one for each field of a token.
+ * */
+typedef enum decompress_state_t {
+    DECOMPRESS_TAG,
+    DECOMPRESS_LITERAL,
+    DECOMPRESS_DISTANCE,
+    DECOMPRESS_COUNT,
+} decompress_state_t;
+
+/*
+ * Struct that holds the state of the decompressor.
+ * */
+typedef struct decompress_t {
+    uint8_t window[COMPRESS_WINDOW];
+    uint32_t head;
+    decompress_state_t state;
+    // Bits collected so far for the current field.
+    uint16_t field;
+    uint8_t field_bits;
+    uint16_t distance;
+    byte_sink_t sink;
+} decompress_t;
+
+void compress_init(compress_t *c, byte_sink_t sink);
+
+/*
+ * Compresses 'len' more bytes of the stream, the output goes to the sink
+ * as soon as it's ready.
+ * */
+void compress_feed(compress_t *c, const uint8_t *data, size_t len);
+
+/*
+ * Encodes whatever is still pending and pads the last byte with zeros.
+ * */
+void compress_finish(compress_t *c);
+
+void decompress_init(decompress_t *d, byte_sink_t sink);
+
+/*
+ * Decompresses 'len' more bytes of the stream, the output goes to the sink.
+ * */
+void decompress_feed(decompress_t *d, const uint8_t *data, size_t len);
+
+#endif // !COMPRESS_H
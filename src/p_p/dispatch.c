@@ -0,0 +1,58 @@
+#include "dispatch.h"
+
+static packet_sender_t echo_sender;
+
+int dispatch(const dispatch_table_t *table, const packet_t *p) {
+    uint8_t length = p->length & LENGTH_MASK;
+    packet_view_t view;
+
+    view.packet = p;
+    view.channel = packet_channel(p);
+    view.flags = p->length & LENGTH_FLAGS;
+
+    if (p->length & FLAG_COMPRESSED) {
+        view.key = DISPATCH_STREAM;
+        view.payload = p->data;
+        view.length = length;
+    } else if (length == 0) {
+        view.key = DISPATCH_EMPTY;
+        view.payload = p->data;
+        view.length = 0;
+    } else {
+        view.key = p->data[0];
+        view.payload = p->data + 1;
+        view.length = length - 1;
+    }
+
+    dispatch_handler_t handler = table->handlers[view.key];
+
+    if (handler == NULL) {
+        handler = table->fallback;
+    }
+
+    if (handler == NULL) {
+        return -1;
+    }
+
+    handler(&view);
+
+    return 0;
+}
+
+void dispatch_set_echo_sender(packet_sender_t send) {
+    echo_sender = send;
+}
+
+void dispatch_echo(const packet_view_t *view) {
+    const packet_t *p = view->packet;
+
+    if (echo_sender == NULL) {
+        // handle_packet doesn't change the packet, it only writes it out.
+        handle_packet((packet_t *)p);
+        return;
+    }
+
+    // Same channel, and compressed if it was: the sequence bit is the
+    // sender's own. A packet it refuses is just not echoed.
+    echo_sender(p->length & (LENGTH_FLAGS & ~FLAG_SEQUENCE), p->length & LENGTH_MASK, (uint8_t *)p->data);
+}
@@ -0,0 +1,79 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdint.h>
+#include "p_p.h"
+
+/*
+ * Routing of received packets to the application, by packet type.
+ *
+ * The type is the first byte of the data section (like ACK, RCK and BATCH),
+ * so the table has one slot per possible value, plus two for the packets
+ * that don't carry one: pieces of compressed streams (FLAG_COMPRESSED) and
+ * empty packets. Finding the handler is a single load, whatever the number
+ * of types in use.
+ *
+ * The table is const, built by the compiler from designated initializers
+ * (like the vector table in init.c), so it lives in flash:
+ *
+ * static const dispatch_table_t handlers = {
+ *     .handlers = {
+ *         DISPATCH(BATCH, on_batch),
+ *         DISPATCH(DISPATCH_STREAM, on_stream),
+ *     },
+ *     .fallback = NULL,
+ * };
+ * */
+/*
+ * When set to 1, main echoes back every packet it has no handler for,
+ * which is what all the sends used to do before the table existed.
+ * */
+#ifndef P_P_ECHO
+#define P_P_ECHO 0
+#endif
+
+#define DISPATCH_STREAM 256
+#define DISPATCH_EMPTY 257
+#define DISPATCH_KEYS 258
+#define DISPATCH(key, handler) [(key)] = (handler)
+
+/*
+ * What a handler gets: a view into the packet as it sits in the receive
+ * buffer, nothing is copied. Like the packet itself, it's only valid for
+ * the duration of the call.
+ * */
+typedef struct packet_view_t {
+    const packet_t *packet;
+    // Type byte, or DISPATCH_STREAM / DISPATCH_EMPTY.
+    uint16_t key;
+    uint8_t channel;
+    uint8_t flags;
+    // What follows the type byte (the whole data section for streams).
+    const uint8_t *payload;
+    uint8_t length;
+} packet_view_t;
+
+typedef void (*dispatch_handler_t)(const packet_view_t *view);
+
+typedef struct dispatch_table_t {
+    dispatch_handler_t handlers[DISPATCH_KEYS];
+    // Gets the packets whose slot is empty, can be NULL.
+    dispatch_handler_t fallback;
+} dispatch_table_t;
+
+/*
+ * Hands the packet to its handler.
+ * Returns -1 if there was none (nor a fallback).
+ * */
+int dispatch(const dispatch_table_t *table, const packet_t *p);
+
+/*
+ * Debug handler: sends the packet back as it came in, register it for the
+ * types you want to see bounced back. It goes through 'send' (e.g. a link
+ * channel queue, so through the active transport), by default straight to
+ * the USART (see handle_packet).
+ * */
+void dispatch_set_echo_sender(packet_sender_t send);
+void dispatch_echo(const packet_view_t *view);
+
+#endif // !DISPATCH_H
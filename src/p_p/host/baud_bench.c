@@ -0,0 +1,257 @@
+/*
+ *@brief link speed negotiation between two endpoints over a pseudo terminal pair.
+ *
+ * Same setup as channel_bench: the child process plays the board, the parent
+ * the host, both pace their bytes at their current rate (see peer_set_baud).
+ * The board supports what a USART clocked like ours can make
+ * (baud_supported), the host every rate in the table.
+ *
+ * Three runs:
+ * fixed -> no negotiation, everything at BAUD_DEFAULT
+ * clean -> negotiation over a cable that carries any rate
+ * bad   -> negotiation over a cable that only carries up to -c baud, above
+ *          it bytes get corrupted (PEER_TOO_FAST), so the fastest rates
+ *          fail their test and the link settles on a slower one
+ *
+ * For each: the rate it ended up at, how long the negotiation took and the
+ * telemetry goodput the board sees afterwards.
+ *
+ * Usage: baud_bench [-c cable_max_baud] [-t seconds] [-s seed]
+ **/
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "peer.h"
+#include "link.h"
+#include "baud.h"
+
+#define CPU_FREQUENCY 16000000
+#define HEARTBEAT_TICKS 1000
+#define TELEMETRY_MARK 'T'
+
+typedef enum mode_t {
+    MODE_FIXED,
+    MODE_CLEAN,
+    MODE_BAD,
+} bench_mode_t;
+
+static const char *mode_names[] = {"fixed", "clean", "bad"};
+
+/*
+ * What the board saw, in memory shared between the two processes.
+ * */
+typedef struct device_stats_t {
+    uint64_t telemetry_bytes;
+    uint32_t rate;
+    uint32_t switches;
+    uint32_t fallbacks;
+} device_stats_t;
+
+static device_stats_t *device;
+
+static link_t device_link;
+static baud_t device_baud;
+static link_t host_link;
+static baud_t host_baud;
+
+static int peer_idle(void) {
+    return peer_busy_us() == 0;
+}
+
+static void device_on_packet(packet_t *p) {
+    link_rx_packet(&device_link, p);
+}
+
+static void device_on_error(packet_t *p) {
+    link_rx_error(&device_link);
+}
+
+static void device_on_data(packet_t *p) {
+    if ((p->length & LENGTH_MASK) == 0) {
+        return;
+    }
+
+    if (p->data[0] == BAUD) {
+        baud_receive(&device_baud, p, get_systicks());
+    } else if (p->data[0] == TELEMETRY_MARK) {
+        device->telemetry_bytes += p->length & LENGTH_MASK;
+    }
+}
+
+static void heartbeat(link_t *link, uint32_t *last) {
+    if (get_systicks() - *last >= HEARTBEAT_TICKS) {
+        *last += HEARTBEAT_TICKS;
+        link_heartbeat(link);
+    }
+}
+
+static void run_device(int fd, const peer_impairment_t *impairment, unsigned seed) {
+    parser_t parser;
+    uint32_t last_heartbeat;
+
+    peer_open(fd, impairment, seed + 1);
+    link_init(&device_link, device_on_data, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    baud_init(&device_baud, &device_link, baud_supported(CPU_FREQUENCY), peer_set_baud, peer_idle, get_systicks());
+    parser_init(&parser, device_on_packet, device_on_error);
+    last_heartbeat = get_systicks();
+
+    while (1) {
+        peer_poll(&parser);
+
+        if (peer_busy_us() == 0) {
+            link_poll(&device_link, get_systicks());
+        }
+
+        baud_poll(&device_baud, get_systicks());
+        heartbeat(&device_link, &last_heartbeat);
+
+        device->rate = baud_rate(&device_baud);
+        device->switches = device_baud.switches;
+        device->fallbacks = device_baud.fallbacks;
+
+        usleep(0);
+    }
+}
+
+static void host_on_packet(packet_t *p) {
+    link_rx_packet(&host_link, p);
+}
+
+static void host_on_error(packet_t *p) {
+    link_rx_error(&host_link);
+}
+
+static void host_on_data(packet_t *p) {
+    if ((p->length & LENGTH_MASK) > 0 && p->data[0] == BAUD) {
+        baud_receive(&host_baud, p, get_systicks());
+    }
+}
+
+static void host_step(parser_t *parser, uint32_t *last_heartbeat) {
+    peer_poll(parser);
+
+    if (peer_busy_us() == 0) {
+        link_poll(&host_link, get_systicks());
+    }
+
+    baud_poll(&host_baud, get_systicks());
+    heartbeat(&host_link, last_heartbeat);
+
+    usleep(0);
+}
+
+static void run_host(int fd, bench_mode_t mode, const peer_impairment_t *impairment, uint32_t seconds, unsigned seed) {
+    uint8_t telemetry[DATA_LENGTH] = {TELEMETRY_MARK, 1, 2, 3, 4, 5, 6, 7};
+    parser_t parser;
+    uint32_t last_heartbeat;
+
+    peer_open(fd, impairment, seed);
+    link_init(&host_link, host_on_data, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    baud_init(&host_baud, &host_link, BAUD_ALL, peer_set_baud, peer_idle, get_systicks());
+    parser_init(&parser, host_on_packet, host_on_error);
+    last_heartbeat = get_systicks();
+
+    uint64_t start = peer_now_us();
+
+    if (mode != MODE_FIXED) {
+        baud_negotiate(&host_baud, get_systicks());
+    }
+
+    while (baud_busy(&host_baud)) {
+        host_step(&parser, &last_heartbeat);
+    }
+
+    // The board confirms a little after us.
+    while (device->rate != baud_rate(&host_baud) && peer_now_us() - start < 10000000) {
+        host_step(&parser, &last_heartbeat);
+    }
+
+    uint64_t negotiated = peer_now_us();
+    uint64_t bytes = device->telemetry_bytes;
+
+    while (peer_now_us() - negotiated < seconds * 1000000ull) {
+        while (link_send(&host_link, CHANNEL(CHANNEL_TELEMETRY), telemetry, sizeof(telemetry)) == 0) {
+        }
+
+        host_step(&parser, &last_heartbeat);
+    }
+
+    double elapsed = (peer_now_us() - negotiated) / 1e6;
+
+    printf("%-5s rate %6u (board %6u), negotiation %5.0f ms, switches %u, fallbacks %u | telemetry %8.1f B/s\n",
+           mode_names[mode], baud_rate(&host_baud), device->rate, (negotiated - start) / 1e3,
+           host_baud.switches, host_baud.fallbacks, (device->telemetry_bytes - bytes) / elapsed);
+}
+
+static int run_mode(bench_mode_t mode, uint32_t cable, uint32_t seconds, unsigned seed) {
+    peer_impairment_t impairment = {
+        .baud = BAUD_DEFAULT,
+        .max_baud = mode == MODE_BAD ? cable : 0,
+    };
+    int master, slave;
+
+    if (openpty(&master, &slave, NULL, NULL, NULL) != 0) {
+        perror("openpty");
+        return -1;
+    }
+
+    memset(device, 0, sizeof(*device));
+    device->rate = BAUD_DEFAULT;
+
+    pid_t child = fork();
+
+    if (child == 0) {
+        close(master);
+        run_device(slave, &impairment, seed);
+        _exit(0);
+    }
+
+    close(slave);
+    run_host(master, mode, &impairment, seconds, seed);
+
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    close(master);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t cable = 115200;
+    uint32_t seconds = 1;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:s:")) != -1) {
+        switch (opt) {
+        case 'c': cable = strtoul(optarg, NULL, 0); break;
+        case 't': seconds = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-c cable_max_baud] [-t seconds] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    device = mmap(NULL, sizeof(*device), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (device == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("board supports rates mask 0x%02x at %u Hz, bad cable up to %u baud, cobs %d\n",
+           baud_supported(CPU_FREQUENCY), CPU_FREQUENCY, cable, P_P_COBS);
+
+    for (bench_mode_t mode = MODE_FIXED; mode <= MODE_BAD; mode++) {
+        if (run_mode(mode, cable, seconds, seed) < 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
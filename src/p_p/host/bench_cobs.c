@@ -0,0 +1,67 @@
+/*
+ *@brief host benchmark of the COBS encoder and decoder used by p_p.
+ **/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cobs.h"
+
+#define BENCH_BYTES (64u * 1024u * 1024u)
+
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_frame(size_t len, int zero_every) {
+    uint8_t src[4 * COBS_BLOCK];
+    uint8_t encoded[COBS_MAX_ENCODED(sizeof(src))];
+    uint8_t tmp[COBS_MAX_ENCODED(sizeof(src))];
+    size_t encoded_len = 0;
+    size_t rounds = BENCH_BYTES / len;
+    volatile size_t sink = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        src[i] = (zero_every && i % zero_every == 0) ? 0 : (uint8_t)(1 + i * 13 % 255);
+    }
+
+    double start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        encoded_len = cobs_encode(src, len, encoded);
+        sink += encoded[r % encoded_len];
+    }
+    double encode = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        memcpy(tmp, encoded, encoded_len);
+        sink += cobs_decode(tmp, encoded_len);
+    }
+    double decode = now_seconds() - start;
+
+    // Make sure we measured something that actually works.
+    memcpy(tmp, encoded, encoded_len);
+    if (cobs_decode(tmp, encoded_len) != len || memcmp(tmp, src, len) != 0) {
+        fprintf(stderr, "cobs round trip failed for %zu bytes\n", len);
+        exit(1);
+    }
+
+    printf("%5zu bytes, zero every %3d: overhead %zu, encode %8.1f MB/s, decode %8.1f MB/s\n",
+           len, zero_every, encoded_len - len,
+           rounds * len / encode / 1e6, rounds * len / decode / 1e6);
+}
+
+int main(void) {
+    bench_frame(10, 7);
+    bench_frame(10, 0);
+    bench_frame(COBS_BLOCK, 7);
+    bench_frame(COBS_BLOCK, 0);
+    bench_frame(4 * COBS_BLOCK, 0);
+
+    return 0;
+}
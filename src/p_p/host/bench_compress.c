@@ -0,0 +1,148 @@
+/*
+ *@brief host benchmark of the p_p stream compressor, on data that looks like what we dump.
+ **/
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "compress.h"
+
+#define SAMPLE_BYTES (64u * 1024u)
+#define ROUNDS 50
+
+static uint8_t input[SAMPLE_BYTES];
+static uint8_t output[2 * SAMPLE_BYTES];
+static size_t output_len;
+static uint8_t decoded[SAMPLE_BYTES];
+static size_t decoded_len;
+
+static void output_sink(uint8_t byte) {
+    output[output_len++] = byte;
+}
+
+static void decoded_sink(uint8_t byte) {
+    decoded[decoded_len++] = byte;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * 3 axis accelerometer samples, 16 bit little endian, slowly moving
+ * around 1 g on z with a bit of noise.
+ * */
+static size_t make_accelerometer(uint8_t *buf, size_t len) {
+    size_t n = 0;
+
+    for (uint32_t t = 0; n + 6 <= len; t++) {
+        int16_t axis[3] = {
+            (int16_t)(40 * sin(t / 50.0) + rand() % 5),
+            (int16_t)(25 * cos(t / 80.0) + rand() % 5),
+            (int16_t)(1000 + rand() % 5),
+        };
+
+        for (int i = 0; i < 3; i++) {
+            buf[n++] = axis[i] & 0xFF;
+            buf[n++] = (axis[i] >> 8) & 0xFF;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Temperature readings, one byte each, that barely change.
+ * */
+static size_t make_temperature(uint8_t *buf, size_t len) {
+    uint8_t value = 22;
+
+    for (size_t i = 0; i < len; i++) {
+        if (rand() % 16 == 0) {
+            value += (rand() % 3) - 1;
+        }
+        buf[i] = value;
+    }
+
+    return len;
+}
+
+/*
+ * Text log lines, the kind of thing we print over the UART.
+ * */
+static size_t make_log(uint8_t *buf, size_t len) {
+    size_t n = 0;
+
+    for (uint32_t t = 0; n < len; t++) {
+        char line[64];
+        int l = snprintf(line, sizeof(line), "[%08u] i2c read 0x40 reg 0x%02x = %d\n",
+                         t * 10, 0x10 + (t & 1), rand() % 256);
+
+        for (int i = 0; i < l && n < len; i++) {
+            buf[n++] = line[i];
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Random bytes, the worst case.
+ * */
+static size_t make_random(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = rand();
+    }
+
+    return len;
+}
+
+static void bench(const char *name, size_t (*make)(uint8_t *, size_t)) {
+    size_t len = make(input, sizeof(input));
+    compress_t c;
+    decompress_t d;
+
+    double start = now_seconds();
+    for (int r = 0; r < ROUNDS; r++) {
+        output_len = 0;
+        compress_init(&c, output_sink);
+        compress_feed(&c, input, len);
+        compress_finish(&c);
+    }
+    double encode = (now_seconds() - start) / ROUNDS;
+
+    start = now_seconds();
+    for (int r = 0; r < ROUNDS; r++) {
+        decoded_len = 0;
+        decompress_init(&d, decoded_sink);
+        decompress_feed(&d, output, output_len);
+    }
+    double decode = (now_seconds() - start) / ROUNDS;
+
+    if (decoded_len != len || memcmp(input, decoded, len) != 0) {
+        fprintf(stderr, "%s: round trip failed\n", name);
+        exit(1);
+    }
+
+    printf("%-14s ratio %5.1f%%, compress %7.2f MB/s, decompress %7.2f MB/s\n",
+           name, 100.0 * output_len / len, len / encode / 1e6, len / decode / 1e6);
+}
+
+int main(void) {
+    srand(1);
+
+    printf("window %d bytes, max match %d bytes\n", COMPRESS_WINDOW, COMPRESS_MAX_MATCH);
+
+    bench("accelerometer", make_accelerometer);
+    bench("temperature", make_temperature);
+    bench("log", make_log);
+    bench("random", make_random);
+
+    return 0;
+}
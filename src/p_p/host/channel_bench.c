@@ -0,0 +1,278 @@
+/*
+ *@brief latency of control packets while a bulk transfer keeps the p_p link busy.
+ *
+ * Same setup as pty_bench: the child process plays the board, the parent the
+ * host, over a pty paced at the given baud. Both sides only hand a packet to
+ * the wire when the previous one is out (see peer_busy_us), like the board
+ * does by blocking on the TX register.
+ *
+ * The host keeps the CHANNEL_BULK queue full and, every period, asks for a
+ * control packet to be sent. The board writes down when each one gets
+ * delivered (in memory shared by the two processes, CLOCK_MONOTONIC is the
+ * same clock for both), which gives the latency from the moment it was asked.
+ *
+ * Three runs:
+ * idle     -> control packets only
+ * priority -> under bulk load, control packets on CHANNEL_CONTROL
+ * fifo     -> under bulk load, control packets queued behind the bulk ones
+ *             on CHANNEL_BULK, what a link without channels would do
+ *
+ * Usage: channel_bench [-n control_packets] [-b baud] [-p period_ms] [-s seed]
+ **/
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "peer.h"
+#include "link.h"
+
+#define CONTROL_MARK 'C'
+#define BULK_MARK 'B'
+
+typedef enum mode_t {
+    MODE_IDLE,
+    MODE_PRIORITY,
+    MODE_FIFO,
+} bench_mode_t;
+
+static const char *mode_names[] = {"idle", "priority", "fifo"};
+
+/*
+ * What the board saw, in memory shared between the two processes.
+ * */
+typedef struct device_stats_t {
+    uint64_t bulk_packets;
+    uint64_t bulk_bytes;
+    uint64_t delivered_us[];
+} device_stats_t;
+
+static device_stats_t *device;
+static uint32_t control_count = 200;
+
+static link_t device_link;
+static link_t host_link;
+
+static void device_on_packet(packet_t *p) {
+    link_rx_packet(&device_link, p);
+}
+
+static void device_on_error(packet_t *p) {
+    link_rx_error(&device_link);
+}
+
+static void device_on_data(packet_t *p) {
+    if ((p->length & LENGTH_MASK) < 3) {
+        return;
+    }
+
+    if (p->data[0] == CONTROL_MARK) {
+        uint32_t id = p->data[1] << 8 | p->data[2];
+
+        if (id < control_count && device->delivered_us[id] == 0) {
+            device->delivered_us[id] = peer_now_us();
+        }
+    } else if (p->data[0] == BULK_MARK) {
+        device->bulk_packets++;
+        device->bulk_bytes += p->length & LENGTH_MASK;
+    }
+}
+
+static void run_device(int fd, uint32_t baud, unsigned seed) {
+    peer_impairment_t impairment = { .baud = baud };
+    parser_t parser;
+
+    peer_open(fd, &impairment, seed + 1);
+    link_init(&device_link, device_on_data, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    parser_init(&parser, device_on_packet, device_on_error);
+
+    while (1) {
+        peer_poll(&parser);
+
+        if (peer_busy_us() == 0) {
+            link_poll(&device_link, get_systicks());
+        }
+
+        usleep(0);
+    }
+}
+
+static void host_on_packet(packet_t *p) {
+    link_rx_packet(&host_link, p);
+}
+
+static void host_on_error(packet_t *p) {
+    link_rx_error(&host_link);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(uint64_t *sorted, uint32_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+
+    return sorted[(uint32_t)(p * (n - 1))];
+}
+
+static void run_host(int fd, bench_mode_t mode, uint32_t baud, uint32_t period_ms, unsigned seed) {
+    peer_impairment_t impairment = { .baud = baud };
+    parser_t parser;
+    uint64_t *asked_us = calloc(control_count, sizeof(uint64_t));
+    uint64_t *latency = calloc(control_count, sizeof(uint64_t));
+    uint8_t control_flags = CHANNEL(mode == MODE_FIFO ? CHANNEL_BULK : CHANNEL_CONTROL);
+    uint8_t bulk[DATA_LENGTH] = {BULK_MARK, 1, 2, 3, 4, 5, 6, 7};
+    uint32_t next = 0;
+
+    peer_open(fd, &impairment, seed);
+    link_init(&host_link, NULL, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    parser_init(&parser, host_on_packet, host_on_error);
+
+    uint64_t start = peer_now_us();
+    uint64_t next_us = start;
+
+    while (next < control_count) {
+        uint64_t now = peer_now_us();
+
+        peer_poll(&parser);
+
+        // Time for the next control packet: it's asked for now, and
+        // handed to the link as soon as its queue takes it.
+        if (now >= next_us && asked_us[next] == 0) {
+            asked_us[next] = now;
+        }
+
+        if (asked_us[next] != 0) {
+            uint8_t control[DATA_LENGTH] = {CONTROL_MARK, next >> 8, next, 0, 0, 0, 0, 0};
+
+            if (link_send(&host_link, control_flags, control, sizeof(control)) == 0) {
+                next++;
+                next_us += period_ms * 1000;
+            }
+        }
+
+        // The bulk transfer takes whatever room is left.
+        if (mode != MODE_IDLE) {
+            while (link_send(&host_link, CHANNEL(CHANNEL_BULK), bulk, sizeof(bulk)) == 0) {
+            }
+        }
+
+        if (peer_busy_us() == 0) {
+            link_poll(&host_link, get_systicks());
+        }
+
+        usleep(0);
+    }
+
+    // Let the last control packets through.
+    uint64_t end = peer_now_us() + 500000;
+
+    while (peer_now_us() < end && device->delivered_us[control_count - 1] == 0) {
+        peer_poll(&parser);
+
+        if (peer_busy_us() == 0) {
+            link_poll(&host_link, get_systicks());
+        }
+
+        usleep(0);
+    }
+
+    double elapsed = (peer_now_us() - start) / 1e6;
+    uint32_t delivered = 0;
+
+    for (uint32_t i = 0; i < control_count; i++) {
+        if (device->delivered_us[i] != 0) {
+            latency[delivered++] = device->delivered_us[i] - asked_us[i];
+        }
+    }
+
+    qsort(latency, delivered, sizeof(uint64_t), compare_u64);
+
+    printf("%-8s control: delivered %u/%u, latency us p50 %llu, p99 %llu, max %llu | bulk %.1f B/s\n",
+           mode_names[mode], delivered, control_count,
+           (unsigned long long)percentile(latency, delivered, 0.50),
+           (unsigned long long)percentile(latency, delivered, 0.99),
+           (unsigned long long)percentile(latency, delivered, 1.0),
+           device->bulk_bytes / elapsed);
+
+    free(asked_us);
+    free(latency);
+}
+
+static int run_mode(bench_mode_t mode, uint32_t baud, uint32_t period_ms, unsigned seed) {
+    int master, slave;
+
+    if (openpty(&master, &slave, NULL, NULL, NULL) != 0) {
+        perror("openpty");
+        return -1;
+    }
+
+    memset(device, 0, sizeof(*device) + control_count * sizeof(uint64_t));
+
+    pid_t child = fork();
+
+    if (child == 0) {
+        close(master);
+        run_device(slave, baud, seed);
+        _exit(0);
+    }
+
+    close(slave);
+    run_host(master, mode, baud, period_ms, seed);
+
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    close(master);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t baud = 115200;
+    uint32_t period_ms = 10;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:p:s:")) != -1) {
+        switch (opt) {
+        case 'n': control_count = strtoul(optarg, NULL, 0); break;
+        case 'b': baud = strtoul(optarg, NULL, 0); break;
+        case 'p': period_ms = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n control_packets] [-b baud] [-p period_ms] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (baud == 0 || control_count == 0) {
+        fprintf(stderr, "the link needs a baud rate, and at least one control packet\n");
+        return 1;
+    }
+
+    device = mmap(NULL, sizeof(*device) + control_count * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (device == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("control packets %u every %u ms, baud %u, tx queue %u packets per channel, cobs %d\n",
+           control_count, period_ms, baud, LINK_TX_QUEUE, P_P_COBS);
+
+    for (bench_mode_t mode = MODE_IDLE; mode <= MODE_FIFO; mode++) {
+        if (run_mode(mode, baud, period_ms, seed) < 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
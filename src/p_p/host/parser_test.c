@@ -0,0 +1,159 @@
+/*
+ *@brief the parser against what the I2C transport hands it.
+ *
+ * The co-processor answers every read of TRANSPORT_I2C_CHUNK bytes, and
+ * pads what it has to say with TRANSPORT_I2C_IDLE. The parser has to skip
+ * the filler byte by byte and get every packet around it, whichever way
+ * the packets and the filler fall on the chunks:
+ *
+ * tail     -> a packet then filler up to the end of the chunk, every chunk
+ * split    -> packets across chunk boundaries, random filler between them
+ * idle     -> whole chunks of filler between packets
+ *
+ * Exits with 1 when a packet is lost, or filler counted in the wrong place.
+ *
+ * Usage: parser_test [-s seed]
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "parser.h"
+#include "transport.h"
+
+#define PACKETS 1000
+
+static uint32_t received;
+static uint32_t wrong;
+static uint32_t expected;
+
+static void on_packet(packet_t *p) {
+    // Every packet carries its number in the first two bytes, a
+    // packet lost only counts the one after it as wrong.
+    uint32_t n = p->data[0] << 8 | p->data[1];
+
+    if ((p->length & LENGTH_MASK) != DATA_LENGTH || n != expected) {
+        wrong++;
+    }
+
+    expected = n + 1;
+    received++;
+}
+
+/*
+ * The bytes the slave would put on the bus: packet 'n', framed.
+ * */
+static size_t frame(uint32_t n, uint8_t *out) {
+    uint8_t data[DATA_LENGTH] = {n >> 8, n, 0xA5, 0x5A, 0x12, 0x13, TRANSPORT_I2C_IDLE, 0xFF};
+    packet_t *p = create_packet(sizeof(data), data);
+    uint8_t raw[PACKET_LENGTH];
+
+    raw[0] = p->length;
+
+    for (uint8_t i = 0; i < DATA_LENGTH; ++i) {
+        raw[1 + i] = p->data[i];
+    }
+
+    raw[PACKET_LENGTH - 1] = p->crc;
+
+#if P_P_COBS
+    size_t len = cobs_encode(raw, PACKET_LENGTH, out);
+    out[len] = COBS_DELIMITER;
+    return len + 1;
+#else
+    for (uint8_t i = 0; i < PACKET_LENGTH; ++i) {
+        out[i] = raw[i];
+    }
+
+    return PACKET_LENGTH;
+#endif
+}
+
+typedef enum layout_t {
+    LAYOUT_TAIL,
+    LAYOUT_SPLIT,
+    LAYOUT_IDLE,
+} layout_t;
+
+static const char *layout_names[] = {"tail", "split", "idle"};
+
+/*
+ * Feeds PACKETS packets laid out on the chunks as 'layout' says.
+ * Returns 0 when they all came through.
+ * */
+static int run(layout_t layout) {
+    parser_t parser;
+    uint8_t stream[PACKETS * 3 * TRANSPORT_I2C_CHUNK];
+    size_t len = 0;
+    uint32_t idle = 0;
+
+    parser_init(&parser, on_packet, NULL);
+    received = 0;
+    wrong = 0;
+    expected = 0;
+
+    for (uint32_t n = 0; n < PACKETS; ++n) {
+        size_t filler = 0;
+
+        len += frame(n, stream + len);
+
+        if (layout == LAYOUT_TAIL) {
+            filler = TRANSPORT_I2C_CHUNK - len % TRANSPORT_I2C_CHUNK;
+        } else if (layout == LAYOUT_SPLIT) {
+            filler = rand() % 8;
+        } else if (rand() % 4 == 0) {
+            filler = TRANSPORT_I2C_CHUNK;
+        }
+
+        for (size_t i = 0; i < filler; ++i) {
+            stream[len++] = TRANSPORT_I2C_IDLE;
+        }
+
+        idle += filler;
+    }
+
+    // What the transport reads, a chunk at a time.
+    for (size_t at = 0; at < len; at += TRANSPORT_I2C_CHUNK) {
+        size_t n = len - at < TRANSPORT_I2C_CHUNK ? len - at : TRANSPORT_I2C_CHUNK;
+
+        for (size_t i = 0; i < n; ++i) {
+            parser_feed_wire(&parser, stream[at + i]);
+        }
+    }
+
+    int failed = received != PACKETS || wrong != 0 || parser.crc_errors != 0;
+
+#if !P_P_COBS
+    // Raw framing: the filler, and nothing else, is dropped.
+    failed |= parser.dropped_bytes != idle;
+#endif
+
+    printf("%-6s packets %u/%u, wrong %u, crc errors %u, dropped bytes %u (filler %u) %s\n",
+           layout_names[layout], received, PACKETS, wrong, parser.crc_errors, parser.dropped_bytes,
+           idle, failed ? "FAILED" : "ok");
+
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            seed = strtoul(optarg, NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    srand(seed);
+
+    int failed = 0;
+
+    failed |= run(LAYOUT_TAIL);
+    failed |= run(LAYOUT_SPLIT);
+    failed |= run(LAYOUT_IDLE);
+
+    return failed;
+}
@@ -0,0 +1,211 @@
+/*
+ *@brief host implementation of the byte level access used by the p_p protocol.
+ **/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "peer.h"
+
+/*
+ * Bytes that can sit in the delay line, enough for a few
+ * seconds of traffic at 1 Mbaud with a large latency.
+ * */
+#define DELAY_LINE 65536
+
+typedef struct delayed_byte_t {
+    uint64_t due_us;
+    uint8_t byte;
+} delayed_byte_t;
+
+static int link_fd = -1;
+static peer_impairment_t impairment;
+static peer_stats_t stats;
+static uint64_t start_us;
+static unsigned rand_state;
+
+static delayed_byte_t delay_line[DELAY_LINE];
+static uint32_t delay_head;
+static uint32_t delay_tail;
+// When the last byte queued is done being 'transmitted' at the given baud.
+static uint64_t wire_free_us;
+
+uint64_t peer_now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t get_systicks() {
+    return (uint32_t)((peer_now_us() - start_us) / 1000);
+}
+
+uint32_t get_micros() {
+    return (uint32_t)(peer_now_us() - start_us);
+}
+
+static double random_unit(void) {
+    return (double)rand_r(&rand_state) / ((double)RAND_MAX + 1);
+}
+
+static void flush_due(void) {
+    uint64_t now = peer_now_us();
+
+    while (delay_tail != delay_head && delay_line[delay_tail % DELAY_LINE].due_us <= now) {
+        uint8_t byte = delay_line[delay_tail % DELAY_LINE].byte;
+
+        if (write(link_fd, &byte, 1) != 1) {
+            // The other end is not reading fast enough, try again later.
+            return;
+        }
+
+        delay_tail++;
+    }
+}
+
+static int read_available(uint8_t *byte) {
+    if (read(link_fd, byte, 1) == 1) {
+        stats.bytes_read++;
+        return 1;
+    }
+
+    return 0;
+}
+
+void peer_open(int fd, const peer_impairment_t *imp, unsigned seed) {
+    struct termios tio;
+
+    // Raw mode: no echo, no line editing and, since RCK is 0x13,
+    // no XON/XOFF flow control eating our bytes.
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    link_fd = fd;
+    rand_state = seed;
+    start_us = peer_now_us();
+    wire_free_us = start_us;
+    delay_head = 0;
+    delay_tail = 0;
+
+    if (imp) {
+        impairment = *imp;
+    }
+}
+
+void write_byte(uint8_t byte) {
+    uint64_t now = peer_now_us();
+
+    // A full delay line behaves like a full TX register: we wait.
+    while (delay_head - delay_tail >= DELAY_LINE) {
+        flush_due();
+    }
+
+    stats.bytes_written++;
+
+    if (impairment.baud > 0) {
+        uint64_t byte_us = 10000000ull / impairment.baud;
+
+        wire_free_us = (wire_free_us > now ? wire_free_us : now) + byte_us;
+    } else {
+        wire_free_us = now;
+    }
+
+    if (impairment.loss > 0 && random_unit() < impairment.loss) {
+        stats.bytes_lost++;
+        return;
+    }
+
+    int too_fast = impairment.max_baud > 0 && impairment.baud > impairment.max_baud;
+
+    if ((impairment.corrupt > 0 && random_unit() < impairment.corrupt) ||
+        (too_fast && random_unit() < PEER_TOO_FAST)) {
+        byte ^= 1 << (rand_r(&rand_state) % 8);
+        stats.bytes_corrupted++;
+    }
+
+    delay_line[delay_head % DELAY_LINE].byte = byte;
+    delay_line[delay_head % DELAY_LINE].due_us = wire_free_us + impairment.latency_us;
+
+    if (impairment.jitter_us > 0) {
+        delay_line[delay_head % DELAY_LINE].due_us += rand_r(&rand_state) % impairment.jitter_us;
+    }
+    delay_head++;
+
+    flush_due();
+}
+
+uint8_t read_byte() {
+    uint8_t byte;
+    struct pollfd pfd = { .fd = link_fd, .events = POLLIN };
+
+    while (!read_available(&byte)) {
+        flush_due();
+        poll(&pfd, 1, 1);
+    }
+
+    return byte;
+}
+
+void peer_poll(parser_t *parser) {
+    uint8_t byte;
+
+    flush_due();
+
+    while (read_available(&byte)) {
+        parser_feed_wire(parser, byte);
+    }
+}
+
+uint64_t peer_busy_us(void) {
+    uint64_t now = peer_now_us();
+
+    return wire_free_us > now ? wire_free_us - now : 0;
+}
+
+void peer_set_baud(uint32_t baud) {
+    struct termios tio;
+
+    impairment.baud = baud;
+
+    // A pty doesn't care, a real serial port does. Rates termios
+    // doesn't know about are left to the pacing alone.
+    if (tcgetattr(link_fd, &tio) == 0) {
+        speed_t speed = 0;
+
+        switch (baud) {
+        case 9600: speed = B9600; break;
+        case 19200: speed = B19200; break;
+        case 38400: speed = B38400; break;
+        case 57600: speed = B57600; break;
+        case 115200: speed = B115200; break;
+        case 230400: speed = B230400; break;
+        case 460800: speed = B460800; break;
+        case 921600: speed = B921600; break;
+        }
+
+        if (speed) {
+            cfsetspeed(&tio, speed);
+            tcsetattr(link_fd, TCSADRAIN, &tio);
+        }
+    }
+}
+
+void peer_drain(void) {
+    while (delay_tail != delay_head) {
+        flush_due();
+        usleep(100);
+    }
+}
+
+peer_stats_t *peer_stats(void) {
+    return &stats;
+}
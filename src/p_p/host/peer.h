@@ -0,0 +1,85 @@
+#ifndef PEER_H
+#define PEER_H
+
+#include <stdint.h>
+#include "p_p.h"
+#include "parser.h"
+
+/*
+ * Host side of a p_p link.
+ *
+ * The protocol itself comes from the same sources as the firmware (p_p.c,
+ * parser.c, cobs.c, link.c...), this file only provides what usart.c and
+ * main.c provide on the board: write_byte, read_byte and get_systicks, on
+ * top of a file descriptor (a serial port, or one end of a pty).
+ *
+ * Everything written goes through a delay line, where bytes can be paced
+ * at a given baud rate, delayed, dropped or corrupted, to see how the
+ * protocol behaves on a bad link without needing one.
+ * */
+typedef struct peer_impairment_t {
+    // Bytes per second are baud / 10 (8N1), 0 means as fast as the fd goes.
+    uint32_t baud;
+    // One way latency added to every byte, in microseconds.
+    uint32_t latency_us;
+    // On top of it, up to jitter_us more, at random (bytes still
+    // arrive in order, a late one holds back those behind it).
+    uint32_t jitter_us;
+    // Probability that a byte gets dropped, or gets one bit flipped.
+    double loss;
+    double corrupt;
+    // Fastest rate the cable carries, 0 means any. Above it every byte
+    // has a PEER_TOO_FAST chance of getting one bit flipped.
+    uint32_t max_baud;
+} peer_impairment_t;
+
+#define PEER_TOO_FAST 0.1
+
+/*
+ * Counters of what the delay line did.
+ * */
+typedef struct peer_stats_t {
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    uint64_t bytes_lost;
+    uint64_t bytes_corrupted;
+} peer_stats_t;
+
+/*
+ * Uses fd for the link (it gets switched to raw, non blocking mode).
+ * impairment can be NULL for a clean link.
+ * */
+void peer_open(int fd, const peer_impairment_t *impairment, unsigned seed);
+
+/*
+ * Sends whatever is due in the delay line and feeds everything that
+ * arrived to the parser, never blocks.
+ * */
+void peer_poll(parser_t *parser);
+
+/*
+ * How long (in microseconds) until the bytes written so far are all on the
+ * wire, at the configured baud. The board blocks on the TX register instead,
+ * so a host that wants to behave the same only hands the next packet over
+ * when this is 0.
+ * */
+uint64_t peer_busy_us(void);
+
+/*
+ * Changes the baud rate, of the pacing and of the fd if it's a serial port.
+ * */
+void peer_set_baud(uint32_t baud);
+
+/*
+ * Waits until the delay line is empty.
+ * */
+void peer_drain(void);
+
+/*
+ * Monotonic time in microseconds.
+ * */
+uint64_t peer_now_us(void);
+
+peer_stats_t *peer_stats(void);
+
+#endif // !PEER_H
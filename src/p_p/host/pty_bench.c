@@ -0,0 +1,281 @@
+/*
+ *@brief p_p throughput benchmark between two endpoints over a pseudo terminal pair.
+ *
+ * The child process plays the board: its parser feeds a link.c link, which
+ * answers every packet with an ACK (or an RCK when the crc doesn't match),
+ * exactly like src/p_p/main.c.
+ * The parent plays the host: it sends numbered packets on CHANNEL_CONTROL
+ * through its own link, one at a time, and measures how long each one takes to be acknowledged.
+ * At the end it reads the counters of the board side with QUERY packets,
+ * the same way a host tool would ask a real board.
+ *
+ * Usage: pty_bench [-n packets] [-b baud] [-l latency_us] [-d loss] [-c corrupt]
+ *                  [-t initial_rto_ms] [-r retries] [-s seed]
+ **/
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "peer.h"
+#include "link.h"
+
+/*
+ * Counters of the board side, in memory shared between the two processes.
+ * */
+typedef struct device_stats_t {
+    uint64_t packets;
+    uint64_t unique;
+    uint64_t duplicates;
+    uint64_t crc_errors;
+    uint64_t dropped_bytes;
+    // One byte per sequence number, to spot duplicates.
+    uint8_t seen[];
+} device_stats_t;
+
+static device_stats_t *device;
+static uint32_t packet_count = 1000;
+
+static link_t device_link;
+static link_t host_link;
+
+// Counters of the board, as read through QUERY.
+static uint32_t remote[LINK_COUNTERS];
+static uint8_t remote_valid[LINK_COUNTERS];
+
+static const char *counter_names[LINK_COUNTERS] = {
+    [LINK_FRAMES_SENT] = "frames sent",
+    [LINK_FRAMES_RECEIVED] = "frames received",
+    [LINK_CRC_ERRORS] = "crc errors",
+    [LINK_RCKS_SENT] = "rcks sent",
+    [LINK_RCKS_RECEIVED] = "rcks received",
+    [LINK_RETRANSMITS] = "retransmits",
+    [LINK_DUPLICATES] = "duplicates",
+    [LINK_DELIVERED] = "delivered",
+    [LINK_FAILED] = "failed",
+    [LINK_TX_QUEUE_HIGH] = "tx queue high",
+    [LINK_RX_QUEUE_HIGH] = "rx queue high",
+    [LINK_RX_OVERFLOWS] = "rx overflows",
+    [LINK_TX_DROPPED] = "tx dropped",
+    [LINK_SRTT] = "srtt",
+    [LINK_RTTVAR] = "rttvar",
+    [LINK_RTO] = "rto",
+};
+
+static uint32_t sequence_of(packet_t *p) {
+    return (uint32_t)p->data[0] << 24 | (uint32_t)p->data[1] << 16 | p->data[2] << 8 | p->data[3];
+}
+
+static void device_on_packet(packet_t *p) {
+    link_rx_packet(&device_link, p);
+}
+
+static void device_on_error(packet_t *p) {
+    link_rx_error(&device_link);
+}
+
+static void device_on_data(packet_t *p) {
+    uint32_t seq = sequence_of(p);
+
+    // The link already drops retransmissions, anything seen twice
+    // here got through it.
+    device->packets++;
+    if (seq < packet_count && !device->seen[seq]) {
+        device->seen[seq] = 1;
+        device->unique++;
+    } else {
+        device->duplicates++;
+    }
+}
+
+static void run_device(int fd, const peer_impairment_t *impairment, uint32_t timeout, uint32_t retries, unsigned seed) {
+    parser_t parser;
+
+    peer_open(fd, impairment, seed + 1);
+    link_init(&device_link, device_on_data, timeout, retries);
+    parser_init(&parser, device_on_packet, device_on_error);
+
+    while (1) {
+        peer_poll(&parser);
+        link_poll(&device_link, get_systicks());
+
+        device->crc_errors = parser.crc_errors;
+        device->dropped_bytes = parser.dropped_bytes;
+        usleep(0);
+    }
+}
+
+static void host_on_packet(packet_t *p) {
+    link_rx_packet(&host_link, p);
+}
+
+static void host_on_error(packet_t *p) {
+    link_rx_error(&host_link);
+}
+
+static void host_on_data(packet_t *p) {
+    if ((p->length & LENGTH_MASK) == 6 && p->data[0] == STATS && p->data[1] < LINK_COUNTERS) {
+        remote[p->data[1]] = (uint32_t)p->data[2] << 24 | (uint32_t)p->data[3] << 16 | p->data[4] << 8 | p->data[5];
+        remote_valid[p->data[1]] = 1;
+    }
+}
+
+/*
+ * Asks the board for all of its counters, each QUERY gets a few
+ * tries since neither the question nor the answer are acknowledged.
+ * */
+static void query_device(parser_t *parser, uint32_t timeout) {
+    for (uint8_t counter = 0; counter < LINK_COUNTERS; counter++) {
+        for (int tries = 0; tries < 5 && !remote_valid[counter]; tries++) {
+            uint32_t asked = get_systicks();
+
+            link_query(&host_link, counter);
+
+            while (!remote_valid[counter] && get_systicks() - asked < timeout) {
+                peer_poll(parser);
+                link_poll(&host_link, get_systicks());
+                usleep(0);
+            }
+        }
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(uint64_t *sorted, uint32_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+
+    return sorted[(uint32_t)(p * (n - 1))];
+}
+
+int main(int argc, char **argv) {
+    peer_impairment_t impairment = {0};
+    uint32_t timeout = LINK_TIMEOUT_TICKS;
+    uint32_t retries = LINK_MAX_RETRIES;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:l:d:c:t:r:s:")) != -1) {
+        switch (opt) {
+        case 'n': packet_count = strtoul(optarg, NULL, 0); break;
+        case 'b': impairment.baud = strtoul(optarg, NULL, 0); break;
+        case 'l': impairment.latency_us = strtoul(optarg, NULL, 0); break;
+        case 'd': impairment.loss = strtod(optarg, NULL); break;
+        case 'c': impairment.corrupt = strtod(optarg, NULL); break;
+        case 't': timeout = strtoul(optarg, NULL, 0); break;
+        case 'r': retries = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n packets] [-b baud] [-l latency_us] [-d loss] "
+                            "[-c corrupt] [-t timeout_ms] [-r retries] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int master, slave;
+
+    if (openpty(&master, &slave, NULL, NULL, NULL) != 0) {
+        perror("openpty");
+        return 1;
+    }
+
+    device = mmap(NULL, sizeof(*device) + packet_count, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (device == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    pid_t child = fork();
+
+    if (child == 0) {
+        close(master);
+        run_device(slave, &impairment, timeout, retries, seed);
+        return 0;
+    }
+
+    close(slave);
+
+    parser_t parser;
+    uint64_t *latency = calloc(packet_count, sizeof(uint64_t));
+    uint32_t delivered = 0;
+    uint32_t failed = 0;
+
+    peer_open(master, &impairment, seed);
+    link_init(&host_link, host_on_data, timeout, retries);
+    parser_init(&parser, host_on_packet, host_on_error);
+
+    uint64_t start = peer_now_us();
+
+    for (uint32_t seq = 0; seq < packet_count; seq++) {
+        uint8_t data[DATA_LENGTH] = {seq >> 24, seq >> 16, seq >> 8, seq, 0xA5, 0x5A, 0x00, 0x13};
+        uint64_t sent = peer_now_us();
+        uint32_t failed_before = host_link.counters[LINK_FAILED];
+
+        link_send(&host_link, CHANNEL(CHANNEL_CONTROL), data, sizeof(data));
+
+        while (!link_idle(&host_link)) {
+            peer_poll(&parser);
+            link_poll(&host_link, get_systicks());
+            usleep(0);
+        }
+
+        if (host_link.counters[LINK_FAILED] == failed_before) {
+            latency[delivered++] = peer_now_us() - sent;
+        } else {
+            failed++;
+        }
+    }
+
+    double elapsed = (peer_now_us() - start) / 1e6;
+
+    query_device(&parser, host_link.rto);
+
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+
+    qsort(latency, delivered, sizeof(uint64_t), compare_u64);
+
+    printf("packets %u, baud %u, latency %u us, loss %.4f, corrupt %.4f, initial rto %u ms, cobs %d\n",
+           packet_count, impairment.baud, impairment.latency_us, impairment.loss,
+           impairment.corrupt, timeout, P_P_COBS);
+    printf("delivered %u, failed %u, retransmits %u, elapsed %.3f s\n",
+           delivered, failed, host_link.counters[LINK_RETRANSMITS], elapsed);
+    printf("rtt: srtt %u ms, rttvar %u ms, rto %u ms\n", host_link.counters[LINK_SRTT],
+           host_link.counters[LINK_RTTVAR], host_link.counters[LINK_RTO]);
+    printf("frames/s %.1f, goodput %.1f B/s, wire %.1f B/s\n",
+           delivered / elapsed, delivered * DATA_LENGTH / elapsed,
+           peer_stats()->bytes_written / elapsed);
+    printf("latency us: p50 %llu, p90 %llu, p99 %llu, max %llu\n",
+           (unsigned long long)percentile(latency, delivered, 0.50),
+           (unsigned long long)percentile(latency, delivered, 0.90),
+           (unsigned long long)percentile(latency, delivered, 0.99),
+           (unsigned long long)percentile(latency, delivered, 1.0));
+    printf("device: packets %llu, unique %llu, duplicates %llu, crc errors %llu, dropped bytes %llu\n",
+           (unsigned long long)device->packets, (unsigned long long)device->unique,
+           (unsigned long long)device->duplicates, (unsigned long long)device->crc_errors,
+           (unsigned long long)device->dropped_bytes);
+    printf("device link (QUERY):");
+    for (uint8_t counter = 0; counter < LINK_COUNTERS; counter++) {
+        if (remote_valid[counter]) {
+            printf(" %s %u%s", counter_names[counter], remote[counter], counter + 1 < LINK_COUNTERS ? "," : "");
+        } else {
+            printf(" %s ?%s", counter_names[counter], counter + 1 < LINK_COUNTERS ? "," : "");
+        }
+    }
+    printf("\n");
+
+    free(latency);
+
+    return failed ? 2 : 0;
+}
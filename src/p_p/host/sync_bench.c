@@ -0,0 +1,238 @@
+/*
+ *@brief accuracy of the p_p clock synchronization, over a pseudo terminal pair with jitter.
+ *
+ * Same setup as channel_bench: the child process plays the board, the parent
+ * the host, which answers the SYNC requests with its CLOCK_MONOTONIC.
+ * The board clock is the same clock, but shifted and running fast by the
+ * given ppm, like an HSI that's a little off.
+ *
+ * Since both processes read the same clock, the board can check every
+ * 50 ms how far sync_time is from the real host time. The first 'warmup'
+ * seconds, while the drift is not known yet, are left out.
+ *
+ * One run for each jitter (random extra one way latency, per byte).
+ *
+ * Usage: sync_bench [-t seconds] [-w warmup_seconds] [-i interval_ms] [-p skew_ppm] [-b baud] [-s seed]
+ **/
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "peer.h"
+#include "link.h"
+#include "sync.h"
+
+#define CHECK_US 50000
+#define MAX_CHECKS 4096
+#define BOARD_OFFSET_US 123456789u
+
+static const uint32_t jitters_us[] = {0, 500, 5000};
+
+/*
+ * What the board saw, in memory shared between the two processes.
+ * */
+typedef struct device_stats_t {
+    uint32_t checks;
+    int32_t drift_ppb;
+    uint32_t requests;
+    uint32_t replies;
+    int32_t error_us[MAX_CHECKS];
+} device_stats_t;
+
+static device_stats_t *device;
+static int32_t skew_ppm = 2000;
+
+static link_t device_link;
+static sync_t device_sync;
+static link_t host_link;
+
+/*
+ * The board clock: fast by skew_ppm, and started at a different time.
+ * */
+static uint32_t board_us(uint64_t start) {
+    uint64_t elapsed = peer_now_us() - start;
+
+    return BOARD_OFFSET_US + (uint32_t)(elapsed + (int64_t)elapsed * skew_ppm / 1000000);
+}
+
+static void device_on_packet(packet_t *p) {
+    link_rx_packet(&device_link, p);
+}
+
+static void device_on_error(packet_t *p) {
+    link_rx_error(&device_link);
+}
+
+static uint64_t device_start;
+
+static void device_on_data(packet_t *p) {
+    sync_receive(&device_sync, p, board_us(device_start));
+}
+
+static void run_device(int fd, const peer_impairment_t *impairment, uint32_t interval_ms,
+                       uint32_t warmup_s, unsigned seed) {
+    parser_t parser;
+
+    device_start = peer_now_us();
+    peer_open(fd, impairment, seed + 1);
+    link_init(&device_link, device_on_data, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    sync_init(&device_sync, &device_link, interval_ms);
+    parser_init(&parser, device_on_packet, device_on_error);
+
+    uint64_t next_check = device_start + warmup_s * 1000000ull;
+
+    while (1) {
+        peer_poll(&parser);
+
+        if (peer_busy_us() == 0) {
+            link_poll(&device_link, get_systicks());
+        }
+
+        sync_poll(&device_sync, get_systicks(), board_us(device_start));
+
+        uint64_t now = peer_now_us();
+
+        if (now >= next_check && device->checks < MAX_CHECKS) {
+            uint32_t host = (uint32_t)peer_now_us();
+            uint32_t estimate = sync_time(&device_sync, board_us(device_start));
+
+            device->error_us[device->checks++] = (int32_t)(estimate - host);
+            next_check += CHECK_US;
+        }
+
+        device->drift_ppb = sync_drift_ppb(&device_sync);
+        device->requests = device_sync.requests;
+        device->replies = device_sync.replies;
+
+        usleep(0);
+    }
+}
+
+static void host_on_packet(packet_t *p) {
+    link_rx_packet(&host_link, p);
+}
+
+static void host_on_error(packet_t *p) {
+    link_rx_error(&host_link);
+}
+
+static void host_on_data(packet_t *p) {
+    sync_answer(&host_link, p, (uint32_t)peer_now_us());
+}
+
+static int compare_abs(const void *a, const void *b) {
+    int32_t x = abs(*(const int32_t *)a);
+    int32_t y = abs(*(const int32_t *)b);
+
+    return (x > y) - (x < y);
+}
+
+static void run_host(int fd, const peer_impairment_t *impairment, uint32_t seconds, unsigned seed) {
+    parser_t parser;
+
+    peer_open(fd, impairment, seed);
+    link_init(&host_link, host_on_data, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    parser_init(&parser, host_on_packet, host_on_error);
+
+    uint64_t end = peer_now_us() + seconds * 1000000ull;
+
+    while (peer_now_us() < end) {
+        peer_poll(&parser);
+
+        if (peer_busy_us() == 0) {
+            link_poll(&host_link, get_systicks());
+        }
+
+        usleep(0);
+    }
+
+    uint32_t n = device->checks;
+    int64_t sum = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        sum += device->error_us[i];
+    }
+
+    qsort(device->error_us, n, sizeof(int32_t), compare_abs);
+
+    printf("jitter %5u us: replies %u/%u, error us mean %+6.0f, |p50| %5d, |p99| %5d, |max| %5d,"
+           " drift %+8.1f ppm (true %+d)\n",
+           impairment->jitter_us, device->replies, device->requests,
+           n ? (double)sum / n : 0.0,
+           n ? abs(device->error_us[n / 2]) : 0,
+           n ? abs(device->error_us[(n - 1) * 99 / 100]) : 0,
+           n ? abs(device->error_us[n - 1]) : 0,
+           // The board runs fast, so to follow the host it slows down.
+           device->drift_ppb / 1000.0, -skew_ppm);
+}
+
+int main(int argc, char **argv) {
+    uint32_t seconds = 25;
+    uint32_t warmup_s = 10;
+    uint32_t interval_ms = 250;
+    uint32_t baud = 115200;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:w:i:p:b:s:")) != -1) {
+        switch (opt) {
+        case 't': seconds = strtoul(optarg, NULL, 0); break;
+        case 'w': warmup_s = strtoul(optarg, NULL, 0); break;
+        case 'i': interval_ms = strtoul(optarg, NULL, 0); break;
+        case 'p': skew_ppm = strtol(optarg, NULL, 0); break;
+        case 'b': baud = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-t seconds] [-w warmup_seconds] [-i interval_ms] [-p skew_ppm]"
+                    " [-b baud] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (seconds <= warmup_s || interval_ms == 0) {
+        fprintf(stderr, "the run must be longer than the warmup, and the interval not 0\n");
+        return 1;
+    }
+
+    device = mmap(NULL, sizeof(*device), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (device == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    printf("%u s per run (first %u s left out), sync every %u ms, board %+d ppm, baud %u, cobs %d\n",
+           seconds, warmup_s, interval_ms, skew_ppm, baud, P_P_COBS);
+
+    for (uint32_t j = 0; j < sizeof(jitters_us) / sizeof(jitters_us[0]); j++) {
+        peer_impairment_t impairment = { .baud = baud, .jitter_us = jitters_us[j] };
+        int master, slave;
+
+        if (openpty(&master, &slave, NULL, NULL, NULL) != 0) {
+            perror("openpty");
+            return 1;
+        }
+
+        memset(device, 0, sizeof(*device));
+
+        pid_t child = fork();
+
+        if (child == 0) {
+            close(master);
+            run_device(slave, &impairment, interval_ms, warmup_s, seed);
+            _exit(0);
+        }
+
+        close(slave);
+        run_host(master, &impairment, seconds, seed);
+
+        kill(child, SIGTERM);
+        waitpid(child, NULL, 0);
+        close(master);
+    }
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ *@brief p_p throughput through the transport interface, over an in memory loopback.
+ *
+ * There's no wire here, so what's measured is the cost of the software:
+ *
+ * transport -> transport_send_packet on one end, transport_poll and the
+ *              parser on the other
+ * link      -> the same packets through two link.c links on top of it,
+ *              on CHANNEL_TELEMETRY (no ACKs) and on CHANNEL_CONTROL (stop
+ *              and wait, every packet waits for its ACK)
+ *
+ * Then, from the bytes each packet took on the loopback, the packets per
+ * second the real transports can carry at most: the UART at the given baud
+ * (10 bits per byte) and I2C at 100 kHz (9 bits per byte, plus the address
+ * byte, START and STOP of every write transfer), which is what the software
+ * has to keep up with.
+ *
+ * Usage: transport_bench [-n packets] [-b baud]
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "peer.h"
+#include "link.h"
+#include "transport.h"
+
+#define I2C_CLOCK 100000
+
+static transport_loopback_t pair;
+static link_t link_a;
+static link_t link_b;
+static uint64_t received;
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void count_packet(packet_t *p) {
+    received++;
+}
+
+static void count_error(packet_t *p) {
+}
+
+static void b_on_packet(packet_t *p) {
+    link_rx_packet(&link_b, p);
+}
+
+static void b_on_error(packet_t *p) {
+    link_rx_error(&link_b);
+}
+
+static void a_on_packet(packet_t *p) {
+    link_rx_packet(&link_a, p);
+}
+
+static void a_on_error(packet_t *p) {
+    link_rx_error(&link_a);
+}
+
+static void b_on_data(packet_t *p) {
+    received++;
+}
+
+static void report(const char *name, double packets_per_s) {
+    printf("%-16s %10.0f packets/s %12.0f payload B/s\n",
+           name, packets_per_s, packets_per_s * DATA_LENGTH);
+}
+
+static void bench_transport(uint32_t count) {
+    uint8_t value[DATA_LENGTH] = {1, 2, 3, 4, 5, 6, 7, 8};
+    packet_t *p = create_packet(DATA_LENGTH, value);
+    parser_t parser;
+
+    transport_loopback_init(&pair);
+    parser_init(&parser, count_packet, count_error);
+    received = 0;
+
+    double start = now_s();
+
+    for (uint32_t i = 0; i < count; i++) {
+        while (transport_send_packet(&pair.a, p) < 0) {
+            transport_poll(&pair.b, &parser);
+        }
+    }
+    transport_poll(&pair.b, &parser);
+
+    report("transport", received / (now_s() - start));
+}
+
+static void bench_link(uint32_t count, uint8_t channel) {
+    uint8_t value[DATA_LENGTH] = {1, 2, 3, 4, 5, 6, 7, 8};
+    parser_t parser_a;
+    parser_t parser_b;
+    uint32_t tick = 0;
+    uint32_t queued = 0;
+
+    transport_loopback_init(&pair);
+    link_init(&link_a, NULL, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    link_init(&link_b, b_on_data, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    link_set_transport(&link_a, &pair.a);
+    link_set_transport(&link_b, &pair.b);
+    parser_init(&parser_a, a_on_packet, a_on_error);
+    parser_init(&parser_b, b_on_packet, b_on_error);
+    received = 0;
+
+    double start = now_s();
+
+    while (received < count) {
+        while (queued < count && link_send(&link_a, CHANNEL(channel), value, sizeof(value)) == 0) {
+            queued++;
+        }
+
+        link_poll(&link_a, tick);
+        transport_poll(&pair.b, &parser_b);
+        link_poll(&link_b, tick);
+        transport_poll(&pair.a, &parser_a);
+
+        // Nothing is ever lost here, the clock only has to move so that
+        // the links work as usual.
+        tick++;
+    }
+
+    report(channel == CHANNEL_CONTROL ? "link control" : "link telemetry", received / (now_s() - start));
+}
+
+int main(int argc, char **argv) {
+    uint32_t count = 1000000;
+    uint32_t baud = 115200;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+        switch (opt) {
+        case 'n': count = strtoul(optarg, NULL, 0); break;
+        case 'b': baud = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n packets] [-b baud]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (count == 0 || baud == 0) {
+        fprintf(stderr, "needs at least one packet, and a baud rate\n");
+        return 1;
+    }
+
+    printf("packets %u, cobs %d\n", count, P_P_COBS);
+
+    bench_transport(count);
+    uint32_t frame = pair.a.bytes_sent / count;
+
+    bench_link(count / 10, CHANNEL_TELEMETRY);
+    bench_link(count / 10, CHANNEL_CONTROL);
+
+    // What the wires allow, one packet is 'frame' bytes on the wire.
+    double uart = baud / 10.0 / frame;
+    double i2c = I2C_CLOCK / (9.0 * (frame + 1) + 2);
+
+    printf("frame %u bytes on the wire\n", frame);
+    report("uart model", uart);
+    report("i2c model", i2c);
+
+    return 0;
+}
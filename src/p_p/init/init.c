@@ -18,12 +18,27 @@ extern uint32_t _ebss;
 /** Prototypes **/
 extern int main(void);
 void Reset_handler          (void);
+extern void SysTick_Handler        (void);
+extern void USART2_IRQHandler      (void);
+extern void I2C1_EV_IRQHandler     (void);
+extern void I2C1_ER_IRQHandler     (void);
+extern void DMA1_Stream0_IRQHandler(void);
 
 /** Initialize Interrupt Vector **/
 __attribute__ ((section(".isr_vector")))
 void (* const fpn_vector[])(void) = {
     (void (*)(void))(&_estack),
     Reset_handler,
+    [15] = SysTick_Handler,
+    /*
+     * The peripheral interrupts start right after the 16 system exceptions,
+     * USART2 is the IRQ number 38, I2C1 event and error 31 and 32, DMA1
+     * stream 0 11 (Section 10.2, vector table).
+     * */
+    [16 + 11] = DMA1_Stream0_IRQHandler,
+    [16 + 31] = I2C1_EV_IRQHandler,
+    [16 + 32] = I2C1_ER_IRQHandler,
+    [16 + 38] = USART2_IRQHandler,
 };
 
 void Reset_handler(void){
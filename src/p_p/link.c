@@ -0,0 +1,449 @@
+#include "link.h"
+
+/*
+ * Keeps the compiler from moving the packet copy past the index update,
+ * the RX interrupt and the main loop only share the indexes.
+ * */
+#define LINK_BARRIER() __asm volatile ("" ::: "memory")
+
+static inline int link_reliable(uint8_t channel) {
+    return (LINK_RELIABLE_CHANNELS >> channel) & 1;
+}
+
+static inline packet_t *channel_head(link_channel_t *ch) {
+    return &ch->queue[ch->tail % LINK_TX_QUEUE];
+}
+
+static inline int channel_empty(link_channel_t *ch) {
+    return ch->head == ch->tail;
+}
+
+/*
+ * Hands a packet to the transport, or writes it on the USART when there's
+ * none. Returns -1 if the transport can't take it right now.
+ * */
+static int link_put(link_t *link, packet_t *p) {
+    if (link->transport) {
+        return transport_send_packet(link->transport, p);
+    }
+
+    send_packet(p);
+
+    return 0;
+}
+
+static int link_transmit(link_t *link, link_channel_t *ch, uint32_t now) {
+    if (link_put(link, channel_head(ch)) < 0) {
+        return -1;
+    }
+
+    ch->sent_at = now;
+    ch->rck_taken = 0;
+    link->counters[LINK_FRAMES_SENT]++;
+
+    return 0;
+}
+
+static void link_done(link_t *link, link_channel_t *ch, link_counter_t outcome) {
+    link->counters[outcome]++;
+    ch->in_flight = 0;
+    ch->resend = 0;
+    ch->tail++;
+}
+
+/*
+ * Asks for the packet in flight to be sent again, or gives
+ * up on it if it already had all of its retries.
+ * */
+static void link_resend(link_t *link, link_channel_t *ch) {
+    if (ch->retries >= link->max_retries) {
+        link_done(link, ch, LINK_FAILED);
+        return;
+    }
+
+    ch->resend = 1;
+}
+
+static void link_set_rto(link_t *link, uint32_t rto) {
+    if (rto < LINK_MIN_RTO) {
+        rto = LINK_MIN_RTO;
+    } else if (rto > LINK_MAX_RTO) {
+        rto = LINK_MAX_RTO;
+    }
+
+    link->rto = rto;
+    link->counters[LINK_RTO] = rto;
+}
+
+/*
+ * Feeds a round trip measurement into SRTT and RTTVAR (RFC 6298, section 2),
+ * with srtt kept as 8 * SRTT and rttvar as 4 * RTTVAR:
+ *
+ * RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - rtt|
+ * SRTT   = 7/8 SRTT + 1/8 rtt
+ * RTO    = SRTT + max(1 tick, 4 * RTTVAR)
+ * */
+static void link_rtt_sample(link_t *link, uint32_t rtt) {
+    if (!link->has_rtt) {
+        // First measurement: SRTT = rtt, RTTVAR = rtt / 2. A round trip
+        // under a tick is 0 for both, it still counts as one.
+        link->srtt = rtt << 3;
+        link->rttvar = rtt << 1;
+        link->has_rtt = 1;
+    } else {
+        int32_t error = (int32_t)rtt - (int32_t)(link->srtt >> 3);
+
+        link->srtt += error;
+
+        if (error < 0) {
+            error = -error;
+        }
+
+        link->rttvar += error - (int32_t)(link->rttvar >> 2);
+    }
+
+    link->counters[LINK_SRTT] = link->srtt >> 3;
+    link->counters[LINK_RTTVAR] = link->rttvar >> 2;
+
+    link_set_rto(link, (link->srtt >> 3) + (link->rttvar > 1 ? link->rttvar : 1));
+}
+
+/*
+ * Queues one of the link's own answers, if there's no room it's dropped:
+ * the other side will ask again (or send again) anyway.
+ * */
+static void link_answer(link_t *link, uint8_t *data, uint8_t length) {
+    if (link_send(link, CHANNEL(CHANNEL_LINK) | FLAG_LINK, data, length) < 0) {
+        link->counters[LINK_TX_DROPPED]++;
+    }
+}
+
+static void link_send_stats(link_t *link, uint8_t counter) {
+    if (counter >= LINK_COUNTERS) {
+        return;
+    }
+
+    uint32_t value = link->counters[counter];
+    uint8_t data[] = {STATS, counter, value >> 24, value >> 16, value >> 8, value};
+
+    link_answer(link, data, sizeof(data));
+}
+
+/*
+ * Packets of a reliable channel carry the sequence bit of their sender, a
+ * packet with the same bit and crc as the last one is a retransmission of it.
+ * (An identical packet, sent right after one lost for good, would look the
+ * same, that's the price of a single bit.)
+ * */
+static int link_is_duplicate(link_channel_t *ch, packet_t *p) {
+    uint8_t sequence = (p->length & FLAG_SEQUENCE) != 0;
+
+    if (ch->has_last && ch->last_sequence == sequence && ch->last_crc == p->crc) {
+        return 1;
+    }
+
+    ch->has_last = 1;
+    ch->last_sequence = sequence;
+    ch->last_crc = p->crc;
+
+    return 0;
+}
+
+static void link_on_ack(link_t *link, uint8_t crc, uint32_t now) {
+    for (uint8_t c = 0; c < CHANNELS; ++c) {
+        link_channel_t *ch = &link->channels[c];
+
+        if (!ch->in_flight || channel_head(ch)->crc != crc) {
+            continue;
+        }
+
+        // Karn's algorithm: we don't know which copy of a
+        // retransmitted packet this ACK is for, so no sample.
+        if (ch->retries == 0) {
+            link_rtt_sample(link, now - ch->sent_at);
+        }
+
+        link_done(link, ch, LINK_DELIVERED);
+        return;
+    }
+}
+
+static void link_on_rck(link_t *link) {
+    // The other side got garbage, that's most likely one of our packets.
+    for (uint8_t c = 0; c < CHANNELS; ++c) {
+        link_channel_t *ch = &link->channels[c];
+
+        if (ch->in_flight && !ch->rck_taken) {
+            ch->rck_taken = 1;
+            link_resend(link, ch);
+        }
+    }
+}
+
+static void link_handle(link_t *link, packet_t *p, uint32_t now) {
+    uint8_t length = p->length & LENGTH_MASK;
+    uint8_t channel = packet_channel(p);
+
+    link->counters[LINK_FRAMES_RECEIVED]++;
+
+    // The link's own packets are tagged with FLAG_LINK, anything else
+    // is data even if its first byte happens to look like one of them.
+    if ((p->length & LENGTH_FLAGS) == (CHANNEL(CHANNEL_LINK) | FLAG_LINK)) {
+        switch (length >= 1 ? p->data[0] : 0) {
+        case ACK:
+            if (length == 2) {
+                link_on_ack(link, p->data[1], now);
+            }
+            return;
+
+        case RCK:
+            link->counters[LINK_RCKS_RECEIVED]++;
+            link_on_rck(link);
+            return;
+
+        case QUERY:
+            if (length == 2) {
+                link_send_stats(link, p->data[1]);
+            }
+            return;
+
+        case STATS:
+            // An answer as well, not acknowledged.
+            if (link->on_data) {
+                link->on_data(p);
+            }
+            return;
+        }
+
+        // One we don't know about, not data either.
+        return;
+    }
+
+    int duplicate = link_reliable(channel) && link_is_duplicate(&link->channels[channel], p);
+
+    if (duplicate) {
+        link->counters[LINK_DUPLICATES]++;
+    } else if (link->on_data) {
+        // Before the ACK, so that a reply on CHANNEL_LINK (like the one
+        // to a SYNC request, see sync.h) doesn't wait behind it.
+        link->on_data(p);
+    }
+
+    // Nobody waits for an ACK on the other unreliable channels, packets on
+    // CHANNEL_LINK still get one, as they always did. We acknowledge
+    // duplicates too, it means our previous ACK got lost.
+    if (channel == CHANNEL_LINK || link_reliable(channel)) {
+        uint8_t ack[] = {ACK, p->crc};
+
+        link_answer(link, ack, sizeof(ack));
+    }
+}
+
+/*
+ * Puts the next packet on the wire: the lowest numbered channel with
+ * something ready wins. Returns 0 if there was nothing to send, or the
+ * transport was busy, in which case the packet stays where it is and
+ * gets another chance (against whatever got queued meanwhile) next time.
+ * */
+static int link_transmit_next(link_t *link, uint32_t now) {
+    for (uint8_t c = 0; c < CHANNELS; ++c) {
+        link_channel_t *ch = &link->channels[c];
+
+        if (!link_reliable(c)) {
+            if (channel_empty(ch)) {
+                continue;
+            }
+
+            if (link_put(link, channel_head(ch)) < 0) {
+                return 0;
+            }
+
+            link->counters[LINK_FRAMES_SENT]++;
+            ch->tail++;
+            return 1;
+        }
+
+        if (ch->in_flight) {
+            // Stop and wait: nothing new goes out before this one is done.
+            if (!ch->resend) {
+                continue;
+            }
+
+            if (link_transmit(link, ch, now) < 0) {
+                return 0;
+            }
+
+            ch->resend = 0;
+            ch->retries++;
+            link->counters[LINK_RETRANSMITS]++;
+            return 1;
+        }
+
+        if (!channel_empty(ch)) {
+            if (link_transmit(link, ch, now) < 0) {
+                return 0;
+            }
+
+            ch->in_flight = 1;
+            ch->retries = 0;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void link_init(link_t *link, packet_handler_t on_data, uint32_t timeout, uint8_t max_retries) {
+    for (uint8_t c = 0; c < CHANNELS; ++c) {
+        link_channel_t *ch = &link->channels[c];
+
+        ch->head = 0;
+        ch->tail = 0;
+        ch->in_flight = 0;
+        ch->resend = 0;
+        ch->sequence = 0;
+        ch->retries = 0;
+        ch->rck_taken = 0;
+        ch->sent_at = 0;
+        ch->has_last = 0;
+        ch->last_sequence = 0;
+        ch->last_crc = 0;
+    }
+
+    link->max_retries = max_retries;
+
+    link->srtt = 0;
+    link->rttvar = 0;
+    link->has_rtt = 0;
+
+    link->rx_head = 0;
+    link->rx_tail = 0;
+    link->rx_errors = 0;
+    link->rx_errors_handled = 0;
+
+    link->on_data = on_data;
+    link->transport = NULL;
+
+    for (uint8_t i = 0; i < LINK_COUNTERS; ++i) {
+        link->counters[i] = 0;
+    }
+
+    link_set_rto(link, timeout);
+}
+
+int link_send(link_t *link, uint8_t flags, uint8_t *data, uint8_t length) {
+    uint8_t channel = (flags & CHANNEL_MASK) >> CHANNEL_SHIFT;
+    link_channel_t *ch = &link->channels[channel];
+    uint8_t queued = ch->head - ch->tail;
+
+    if (queued >= LINK_TX_QUEUE) {
+        return -1;
+    }
+
+    if (link_reliable(channel)) {
+        flags = (flags & ~FLAG_SEQUENCE) | (ch->sequence ? FLAG_SEQUENCE : 0);
+    }
+
+    packet_t *p = create_flagged_packet(flags, length, data);
+
+    if (p == NULL) {
+        return -1;
+    }
+
+    // We keep our own copy, since create_packet always
+    // hands out the same static packet.
+    ch->queue[ch->head % LINK_TX_QUEUE] = *p;
+    ch->head++;
+
+    if (link_reliable(channel)) {
+        ch->sequence ^= 1;
+    }
+
+    if (queued + 1u > link->counters[LINK_TX_QUEUE_HIGH]) {
+        link->counters[LINK_TX_QUEUE_HIGH] = queued + 1;
+    }
+
+    return 0;
+}
+
+int link_idle(link_t *link) {
+    for (uint8_t c = 0; c < CHANNELS; ++c) {
+        if (link->channels[c].in_flight || !channel_empty(&link->channels[c])) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void link_rx_packet(link_t *link, packet_t *p) {
+    uint8_t queued = link->rx_head - link->rx_tail;
+
+    // No room: the packet is dropped without an ACK,
+    // so the sender will try again.
+    if (queued >= LINK_RX_QUEUE) {
+        link->counters[LINK_RX_OVERFLOWS]++;
+        return;
+    }
+
+    link->rx_queue[link->rx_head % LINK_RX_QUEUE] = *p;
+    LINK_BARRIER();
+    link->rx_head++;
+
+    if (queued + 1u > link->counters[LINK_RX_QUEUE_HIGH]) {
+        link->counters[LINK_RX_QUEUE_HIGH] = queued + 1;
+    }
+}
+
+void link_rx_error(link_t *link) {
+    link->rx_errors++;
+}
+
+void link_poll(link_t *link, uint32_t now) {
+    while (link->rx_tail != link->rx_head) {
+        link_handle(link, &link->rx_queue[link->rx_tail % LINK_RX_QUEUE], now);
+        LINK_BARRIER();
+        link->rx_tail++;
+    }
+
+    // Any number of errors since the last poll get a single RCK.
+    uint8_t errors = link->rx_errors - link->rx_errors_handled;
+
+    if (errors) {
+        uint8_t rck[] = {RCK};
+
+        link->rx_errors_handled += errors;
+        link->counters[LINK_CRC_ERRORS] += errors;
+        link->counters[LINK_RCKS_SENT]++;
+        link_answer(link, rck, sizeof(rck));
+    }
+
+    // No answer in time: we try again, and give the
+    // other side twice as long (RFC 6298, section 5).
+    for (uint8_t c = 0; c < CHANNELS; ++c) {
+        link_channel_t *ch = &link->channels[c];
+
+        if (ch->in_flight && !ch->resend && now - ch->sent_at >= link->rto) {
+            link_set_rto(link, link->rto * 2);
+            link_resend(link, ch);
+        }
+    }
+
+    link_transmit_next(link, now);
+}
+
+void link_set_transport(link_t *link, transport_t *t) {
+    link->transport = t;
+}
+
+void link_query(link_t *link, link_counter_t counter) {
+    uint8_t data[] = {QUERY, counter};
+
+    link_answer(link, data, sizeof(data));
+}
+
+void link_heartbeat(link_t *link) {
+    uint8_t data[] = {ACK};
+
+    link_answer(link, data, sizeof(data));
+}
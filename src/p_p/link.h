@@ -0,0 +1,194 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include "p_p.h"
+#include "parser.h"
+#include "transport.h"
+
+/*
+ * Link layer of p_p: channels, reliable sending, answers and statistics.
+ *
+ * Every channel (see CHANNEL_* in p_p.h) has its own queue of packets to
+ * send. link_poll puts at most one packet on the wire per call, taken from
+ * the lowest numbered channel that has one ready (strict priority). So an
+ * ACK, or a control reply, waits for the packet currently on the wire at
+ * most, never for a whole burst of telemetry queued before it.
+ *
+ * Reliable channels (LINK_RELIABLE_CHANNELS) are stop and wait: one packet
+ * at a time is in flight, and it's sent again on the first RCK after each
+ * copy, or when its ACK doesn't come back within the retransmission timeout
+ * (RTO). The ACK that frees it must carry its crc (see send_ack_for),
+ * so plain ACKs like the heartbeat don't count.
+ *
+ * The RTO follows the measured round trip time (RFC 6298): a smoothed
+ * RTT (SRTT) and its variation (RTTVAR) are updated on every ACK, and
+ * RTO = SRTT + 4 * RTTVAR. Retransmitted packets are not sampled, since we
+ * can't tell which copy the ACK is for, and every timeout doubles the RTO.
+ * Everything is measured in SysTick ticks (1 ms).
+ *
+ * Receiving: the RX interrupt hands packets and crc errors to the link
+ * (link_rx_packet, link_rx_error), which only queues them. link_poll, from
+ * the main loop, answers them (ACK, RCK, STATS) and passes the data on.
+ * The link's own packets are the ones on CHANNEL_LINK with FLAG_LINK, so
+ * data on CHANNEL_LINK can start with any byte, ACK and RCK included.
+ * FLAG_SEQUENCE alternates between the packets of a reliable channel, so
+ * a retransmission of a packet we already got (its ACK was lost) is ACKed
+ * again but not delivered twice.
+ * */
+#define LINK_TIMEOUT_TICKS 100
+#define LINK_MIN_RTO 5
+#define LINK_MAX_RTO 2000
+#define LINK_MAX_RETRIES 5
+#define LINK_TX_QUEUE 8
+#define LINK_RX_QUEUE 4
+// Bulk streams are compressed, every packet depends on the ones before
+// it (see bulk.h): a lost one would spoil the rest of the stream.
+#define LINK_RELIABLE_CHANNELS ((1 << CHANNEL_CONTROL) | (1 << CHANNEL_BULK))
+
+// On CHANNEL_LINK the sequence bit is FLAG_LINK.
+#if LINK_RELIABLE_CHANNELS & (1 << CHANNEL_LINK)
+#error "CHANNEL_LINK can't be reliable"
+#endif
+
+/*
+ * Fixed hex values for the statistics exchange, in the first byte of the
+ * data section like ACK and RCK (with FLAG_LINK as well):
+ *
+ * QUERY -> {QUERY, counter}, asks for one of the link_counter_t
+ * STATS -> {STATS, counter, value (4 bytes, big endian)}, the answer
+ * */
+#define QUERY 0x15
+#define STATS 0x16
+
+/*
+ * Counters of a link, also the index used by QUERY.
+ * */
+typedef enum link_counter_t {
+    LINK_FRAMES_SENT,
+    LINK_FRAMES_RECEIVED,
+    LINK_CRC_ERRORS,
+    LINK_RCKS_SENT,
+    LINK_RCKS_RECEIVED,
+    LINK_RETRANSMITS,
+    LINK_DUPLICATES,
+    LINK_DELIVERED,
+    LINK_FAILED,
+    LINK_TX_QUEUE_HIGH,
+    LINK_RX_QUEUE_HIGH,
+    LINK_RX_OVERFLOWS,
+    LINK_TX_DROPPED,
+    LINK_SRTT,
+    LINK_RTTVAR,
+    LINK_RTO,
+    LINK_COUNTERS,
+} link_counter_t;
+
+/*
+ * Send side of a channel.
+ * */
+typedef struct link_channel_t {
+    packet_t queue[LINK_TX_QUEUE];
+    uint8_t head;
+    uint8_t tail;
+
+    // Reliable channels only: the packet at tail stays
+    // there, in flight, until it's ACKed or given up.
+    uint8_t in_flight;
+    uint8_t resend;
+    uint8_t sequence;
+    uint8_t retries;
+    // Set once an RCK made us send the current copy again, further
+    // RCKs are most likely about the same garbage.
+    uint8_t rck_taken;
+    uint32_t sent_at;
+
+    // Last reliable packet received on this channel, to spot duplicates.
+    uint8_t has_last;
+    uint8_t last_sequence;
+    uint8_t last_crc;
+} link_channel_t;
+
+/*
+ * Struct that holds the state of a link.
+ * */
+typedef struct link_t {
+    link_channel_t channels[CHANNELS];
+    uint8_t max_retries;
+
+    // Round trip estimation, srtt is scaled by 8 and rttvar by 4, so that
+    // the 1/8 and 1/4 gains are just shifts.
+    uint32_t srtt;
+    uint32_t rttvar;
+    uint32_t rto;
+    // Set by the first measurement, until then srtt and rttvar mean nothing.
+    uint8_t has_rtt;
+
+    // Packets queued by the RX interrupt, read by link_poll.
+    packet_t rx_queue[LINK_RX_QUEUE];
+    volatile uint8_t rx_head;
+    volatile uint8_t rx_tail;
+    volatile uint8_t rx_errors;
+    uint8_t rx_errors_handled;
+
+    // Called (from link_poll) for every packet that is not one of the
+    // link's own (FLAG_LINK) but STATS, and not a duplicate.
+    packet_handler_t on_data;
+
+    // Where the packets go, NULL means straight on the USART (send_packet).
+    transport_t *transport;
+
+    uint32_t counters[LINK_COUNTERS];
+} link_t;
+
+/*
+ * Initializes the link, 'timeout' is the RTO to use until
+ * the first round trip has been measured.
+ * */
+void link_init(link_t *link, packet_handler_t on_data, uint32_t timeout, uint8_t max_retries);
+
+/*
+ * Sends everything through 't' from now on (see transport.h).
+ * */
+void link_set_transport(link_t *link, transport_t *t);
+
+/*
+ * Queues a packet on the channel given by the CHANNEL() bits of 'flags',
+ * it goes out from link_poll. FLAG_SEQUENCE is set by the link.
+ * Returns -1 if the queue is full (or the length or flags are wrong).
+ * */
+int link_send(link_t *link, uint8_t flags, uint8_t *data, uint8_t length);
+
+/*
+ * 1 when there's nothing in flight, nor waiting to be sent.
+ * */
+int link_idle(link_t *link);
+
+/*
+ * Called from the RX interrupt (e.g. as the parser callbacks):
+ * they only copy the packet, or count the error.
+ * */
+void link_rx_packet(link_t *link, packet_t *p);
+void link_rx_error(link_t *link);
+
+/*
+ * Does all the work: answers what was received, retransmits on timeout
+ * and sends the next queued packet, at most one per call, so that what
+ * comes in meanwhile is answered before anything else goes out.
+ * Call it from the main loop.
+ * */
+void link_poll(link_t *link, uint32_t now);
+
+/*
+ * Asks the other side for one of its counters, the answer comes back
+ * as a STATS packet through on_data.
+ * */
+void link_query(link_t *link, link_counter_t counter);
+
+/*
+ * Lets the other side know we are alive: a plain ACK, that doesn't
+ * acknowledge anything.
+ * */
+void link_heartbeat(link_t *link);
+
+#endif // !LINK_H
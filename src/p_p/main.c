@@ -1,11 +1,33 @@
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
 #include "p_p.h"
+#include "parser.h"
+#include "bench.h"
+#include "bulk.h"
+#include "link.h"
+#include "dispatch.h"
+#include "transport.h"
+#include "baud.h"
+#include "sync.h"
+#include "../../inc/event.h"
+#include "../../inc/irq.h"
+#include "../../inc/i2c1.h"
 #include <stddef.h>
 #include <stdint.h>
 
 #define PA2 2
 #define PA3 3
 #define CPU_FREQUENCY 16000000
+#define USART2_IRQ 38
+#define TICK_FREQUENCY 1000
+#define HEARTBEAT_TICKS 1000
+#define SYNC_TICKS 1000
+#define SR_ORE 3
+#define SR_RXNE 5
+// Type of the event loop statistics exchange, see on_loop.
+#define LOOP 0x19
+// And of the interrupt budgets, see on_irqs.
+#define IRQS 0x1A
 
 /**
  * @brief Struct Pointer for RCC Peripherals assigned with fixed address specified in reference manual.
@@ -21,6 +43,27 @@ RCC_t   * const RCC     = (RCC_t    *)  0x40023800;
  **/
 GPIOx_t * const GPIOA   = (GPIOx_t  *)  0x40020000;
 
+/**
+ * @brief Struct Pointer for GPIOB Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+GPIOx_t * const GPIOB   = (GPIOx_t  *)  0x40020400;
+
+/**
+ * @brief Struct Pointer for I2C1 Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ **/
+I2Cx_t * const I2C1 = (I2Cx_t *)  0x40005400;
+
+/*
+ * @brief Struct Pointer for DMA1, the I2C1 master reads through its stream 0.
+ *
+ * See Memory map, Section 2.3.
+ * */
+DMA_t * const DMA1 = (DMA_t *) 0x40026000;
+
 /*
  * @brieft Struct pointer for the UART2 Peripherals assigned with fixed address specified in reference manual.
  *
@@ -35,6 +78,320 @@ USART_t * const USART2 = (USART_t *)  0x40004400;
  * */
 SYST_t * const SYST = (SYST_t *) 0xE000E010;
 
+/*
+ * @brief Struct Pointer for the NVIC assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.2 Nested Vectored Interrupt Controller (ARM-cortex-m4 datasheet).
+ * */
+NVIC_t * const NVIC = (NVIC_t *) 0xE000E100;
+
+/*
+ * @brief Struct Pointer for the SCB assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.3 System control block (ARM-cortex-m4 datasheet).
+ * */
+SCB_t * const SCB = (SCB_t *) 0xE000ED00;
+
+/*
+ * @brief Struct Pointers for the DWT and the debug control block, used by the benchmarks
+ * to count cycles.
+ *
+ * See section C1.8 of the ARMv7-M architecture reference manual.
+ * */
+DWT_t * const DWT = (DWT_t *) 0xE0001000;
+DCB_t * const DCB = (DCB_t *) 0xE000EDF0;
+
+/*
+ * @brief Interrupt priorities (see irq.h), 2 bits of preemption.
+ *
+ * A byte sits in DR for one character time before the next one overruns
+ * it, 87 us at 115200: USART2 preempts everything else, and it's meant to
+ * be in well before that. SysTick only counts and posts, but if it ever
+ * takes long it's the USART2 it would hold back (not preempting it, but
+ * as the tail of everything else that runs above the loop).
+ *
+ * Budgets in DWT cycles, 62.5 ns each.
+ *
+ * There's no telling when a byte came in, so the USART2 latency is only
+ * measured with P_P_IRQ_PROBE set: then USART2 is pended by hand once a
+ * tick (irq_trigger), with no flags set the handler has nothing to do.
+ * Those runs count with the real ones in its stats, a debug build only.
+ *
+ * With P_P_I2C the I2C1 master's interrupts share SysTick's preemption
+ * priority, which times its transfers out (see i2c1.h), their cost is
+ * in i2c1_stats.
+ * */
+#ifndef P_P_IRQ_PROBE
+#define P_P_IRQ_PROBE 0
+#endif
+
+#define IRQ_USART2 0
+#define IRQ_TICK 1
+#if P_P_I2C
+#define IRQ_I2C1_EV 2
+#define IRQ_I2C1_ER 3
+#define IRQ_I2C1_DMA 4
+#define IRQ_COUNT 5
+#else
+#define IRQ_COUNT 2
+#endif
+
+static const irq_config_t irqs[IRQ_COUNT] = {
+    [IRQ_USART2] = {.irq = USART2_IRQ, .preempt = 0, .sub = 0, .latency_budget = 400, .run_budget = 600},
+    [IRQ_TICK] = {.irq = IRQ_SYSTICK, .preempt = 1, .sub = 0, .latency_budget = 400, .run_budget = 200},
+#if P_P_I2C
+    [IRQ_I2C1_EV] = {.irq = I2C1_EV_IRQ, .preempt = 1, .sub = 1},
+    [IRQ_I2C1_ER] = {.irq = I2C1_ER_IRQ, .preempt = 1, .sub = 1},
+    [IRQ_I2C1_DMA] = {.irq = I2C1_DMA_IRQ, .preempt = 1, .sub = 1},
+#endif
+};
+
+/*
+ * @brief What the main loop runs on (see event.h): the USART2 interrupt
+ * posts to rx_queue when bytes come in, SysTick to tick_queue on every
+ * tick. The bytes are the most urgent, so answers don't wait for a tick.
+ * */
+#define SIGNAL_RX 0
+#define SIGNAL_TICK 1
+
+/*
+ * @brief Simple variable (and relative function) that keeps track of the number of ticks that happened since
+ * the program started, one tick is 1 ms (see systick_setup in main).
+ *
+ * Gets called everytime SysTick generates an interrupt.
+ * */
+static volatile uint32_t s_ticks;
+static event_queue_t tick_queue;
+void SysTick_Handler(void) {
+    irq_enter(IRQ_SYSTICK);
+
+    // The counter reloaded when the interrupt was raised, and SysTick
+    // counts HCLK at TICK_FREQUENCY: how far it went since is the latency.
+    irq_latency(IRQ_SYSTICK, SYST->SYST_RVR - SYST->SYST_CVR);
+
+    s_ticks++;
+
+#if P_P_I2C
+    i2c1_tick();
+#endif
+
+    // The handler looks at get_systicks, one tick it hasn't run yet is enough.
+    if (event_queue_empty(&tick_queue)) {
+        event_post(&tick_queue, SIGNAL_TICK, 0);
+    }
+
+    irq_exit(IRQ_SYSTICK);
+}
+
+uint32_t get_systicks() {
+    return s_ticks;
+}
+
+/*
+ * @brief Microseconds since startup: the ticks, plus how far SysTick has
+ * counted down into the current one (SYST_CVR, Section 4.4.3).
+ *
+ * If the interrupt comes in between the two reads we read both again,
+ * so the ticks and the counter always belong together.
+ * */
+uint32_t get_micros() {
+    uint32_t ticks;
+    uint32_t counter;
+
+    do {
+        ticks = s_ticks;
+        counter = SYST->SYST_CVR;
+    } while (ticks != s_ticks);
+
+    return ticks * (1000000 / TICK_FREQUENCY) + (SYST->SYST_RVR - counter) / (CPU_FREQUENCY / 1000000);
+}
+
+/*
+ * @brief Receive side of the link.
+ *
+ * The USART2 interrupt only moves bytes between the wire and the rings of
+ * the UART transport. The main loop feeds what came in to the parser
+ * (transport_poll), whose callbacks queue it into the link, and link_poll
+ * answers and hands the next packet to the transport, so nothing ever
+ * blocks on the TX line.
+ *
+ * With P_P_I2C the link talks to a co-processor on I2C1 instead.
+ * */
+static parser_t rx_parser;
+static link_t link;
+static transport_t uart;
+#if P_P_I2C
+static transport_t i2c;
+static transport_t * const wire = &i2c;
+#else
+static transport_t * const wire = &uart;
+#endif
+
+static void on_packet(packet_t *p) {
+    link_rx_packet(&link, p);
+}
+
+static void on_corrupted_packet(packet_t *p) {
+    link_rx_error(&link);
+}
+
+/*
+ * @brief Speed of the USART, negotiated with the host (see baud.h).
+ * */
+static baud_t baud;
+
+/*
+ * @brief Host time, to stamp what we send with (see sync.h).
+ * */
+static sync_t sync;
+
+static void usart_set_rate(uint32_t rate) {
+    // BRR can only be changed with the USART disabled (Section 19.6.3),
+    // baud.c only calls this once the last byte is out.
+    USART2->USART_CR1 &= ~(1 << 13);
+    USART2->USART_BRR = (CPU_FREQUENCY + rate / 2) / rate;
+    USART2->USART_CR1 |= (1 << 13);
+}
+
+/*
+ * @brief Sender for bulk transfers: packets go in the CHANNEL_BULK queue of the link,
+ * so ACKs and control replies still get out first. When the queue is full the packet
+ * stays with bulk, and bulk_poll tries again from the loop once the link made room.
+ * */
+static int send_on_link(uint8_t flags, uint8_t length, uint8_t *data) {
+    return link_send(&link, flags, data, length);
+}
+
+/*
+ * @brief What the application does with each type of packet (see dispatch.h).
+ * */
+static void on_stream(const packet_view_t *view) {
+    // Pieces of a compressed bulk transfer go to the decompressor, the
+    // bytes come out wherever bulk_set_handler said.
+    bulk_receive(view->packet);
+}
+
+static void on_baud(const packet_view_t *view) {
+    baud_receive(&baud, view->packet, get_systicks());
+}
+
+static void on_sync(const packet_view_t *view) {
+    sync_receive(&sync, view->packet, get_micros());
+}
+
+/*
+ * @brief The host asks how the event loop is doing with {LOOP}, we
+ * answer on CHANNEL_LINK with what it did since the last time it asked
+ * (the window has to be shorter than the ~268 s of the cycle counter):
+ *
+ * {LOOP, 0, dispatched (4 bytes), idle (2)}
+ * {LOOP, 1, latency avg (2), latency max (2)}
+ *
+ * Two packets, as it doesn't fit in the DATA_LENGTH of one. Big endian, latencies in CPU cycles (62.5 ns each) from the post of an
+ * event to its handler, saturated at 0xFFFF, idle in per mille of the time.
+ * */
+static void on_loop(const packet_view_t *view) {
+    event_stats_t stats;
+
+    event_stats(&stats);
+
+    uint32_t average = stats.dispatched ? stats.latency_sum / stats.dispatched : 0;
+    uint32_t max = stats.latency_max;
+    uint32_t idle = stats.cycles >= 1000 ? stats.idle / (stats.cycles / 1000) : 0;
+
+    average = average > 0xFFFF ? 0xFFFF : average;
+    max = max > 0xFFFF ? 0xFFFF : max;
+    idle = idle > 1000 ? 1000 : idle;
+
+    uint8_t counts[] = {
+        LOOP, 0,
+        stats.dispatched >> 24, stats.dispatched >> 16, stats.dispatched >> 8, stats.dispatched,
+        idle >> 8, idle,
+    };
+    uint8_t latencies[] = {
+        LOOP, 1,
+        average >> 8, average,
+        max >> 8, max,
+    };
+
+    link_send(&link, CHANNEL(CHANNEL_LINK), counts, sizeof(counts));
+    link_send(&link, CHANNEL(CHANNEL_LINK), latencies, sizeof(latencies));
+}
+
+/*
+ * @brief With {IRQS} the host asks how the interrupts did against their
+ * budgets since the last time, we answer on CHANNEL_LINK with a packet
+ * for each slot of irqs (the whole table doesn't fit in one):
+ *
+ * {IRQS, slot (bit 7 set if it went over budget), runs (2), latency max (2), run max (2)}
+ *
+ * The USART2 latency is 0 unless P_P_IRQ_PROBE is set.
+ *
+ * Big endian, cycles (62.5 ns each), all saturated at 0xFFFF.
+ * */
+static uint16_t saturate(uint32_t value) {
+    return value > 0xFFFF ? 0xFFFF : value;
+}
+
+static void on_irqs(const packet_view_t *view) {
+    uint32_t over = irq_over();
+
+    for (uint8_t slot = 0; slot < IRQ_COUNT; ++slot) {
+        irq_stats_t stats;
+
+        irq_stats(slot, &stats);
+
+        uint16_t runs = saturate(stats.runs);
+        uint16_t latency_max = saturate(stats.latency_max);
+        uint16_t run_max = saturate(stats.run_max);
+        uint8_t reply[] = {
+            IRQS, slot | ((over & (1 << slot)) ? 0x80 : 0),
+            runs >> 8, runs,
+            latency_max >> 8, latency_max,
+            run_max >> 8, run_max,
+        };
+
+        link_send(&link, CHANNEL(CHANNEL_LINK), reply, sizeof(reply));
+    }
+}
+
+static const dispatch_table_t handlers = {
+    .handlers = {
+        DISPATCH(DISPATCH_STREAM, on_stream),
+        DISPATCH(BAUD, on_baud),
+        DISPATCH(SYNC, on_sync),
+        DISPATCH(LOOP, on_loop),
+        DISPATCH(IRQS, on_irqs),
+    },
+#if P_P_ECHO
+    .fallback = dispatch_echo,
+#else
+    .fallback = NULL,
+#endif
+};
+
+static void on_data(packet_t *p) {
+    dispatch(&handlers, p);
+}
+
+static event_queue_t rx_queue;
+void USART2_IRQHandler(void) {
+    irq_enter(USART2_IRQ);
+
+    // Reading SR is harmless here, it's the read of DR
+    // in transport_uart_irq that clears the flags.
+    uint32_t received = USART2->USART_SR & ((1 << SR_RXNE) | (1 << SR_ORE));
+
+    transport_uart_irq();
+
+    // The handler takes everything in the ring, not just this byte.
+    if (received && event_queue_empty(&rx_queue)) {
+        event_post(&rx_queue, SIGNAL_RX, 0);
+    }
+
+    irq_exit(USART2_IRQ);
+}
+
 void setup_gpio() {
     /** Enable CLOCK for GPIOA **/
     RCC->RCC_AHB1ENR |= 1;
@@ -71,8 +428,10 @@ void setup_usart() {
     // the USART_BRR.
     // The value for this for the register, is 16MhZ (cpu's frequency) divided by the baud 
     // rate that we wanna communicate with.
+    // We always start at 9600 (BAUD_DEFAULT), the host can then
+    // negotiate something faster (see baud.h).
     USART2->USART_BRR &= ~0xFFFF;
-    USART2->USART_BRR = CPU_FREQUENCY/9600;
+    USART2->USART_BRR = CPU_FREQUENCY/BAUD_DEFAULT;
 
     // Enabling the oversampling.
     USART2->USART_CR1 &= ~(1 << 15);
@@ -90,6 +449,14 @@ void setup_usart() {
     USART2->USART_CR1 |= (1 << 3); // CR1[3], transmitter enable
     USART2->USART_CR1 |= (1 << 2); // CR1[2], receiver enable
 
+    // We want an interrupt for every received byte, so that we
+    // can feed the parser without polling (Section 19.6.4).
+    USART2->USART_CR1 |= (1 << 5); // CR1[5], RXNE interrupt enable
+
+    // And we let the USART2 interrupt through the NVIC (Section 4.2.3 of the
+    // arm-cortex-m4 datasheet).
+    NVIC->NVIC_ISER[USART2_IRQ / 32] = (1 << (USART2_IRQ % 32));
+
     // We also set up the stop bit.
     USART2->USART_CR2 &= ~(3 << 12);
 
@@ -100,21 +467,6 @@ void setup_usart() {
     USART2->USART_CR1 |= (1 << 13); // CR1[13], USART enable.
 }
 
-void setup_systick() {
-    // Enable Clock for SysTick (Section 6.3.12)
-    RCC->RCC_APB2ENR |= (1 << 14);
-
-    // We load the reload register with the maximum value (Section 4.4.2)
-    SYST->SYST_RVR |= 0x00FFFFFF;
-
-    // We set as internal source the processor clock, from where our systick will 'based' on, the 
-    // 'rhythm' to derive from (Section 4.4.1).
-    SYST->SYST_CSR |= (1 << 2);
-    
-    // We then proceed to finally enable the SysTick timer (Section 4.4.1)
-    SYST->SYST_CSR |= (1 << 0);
-}
-
 void write_string(char *string, size_t len) {
     while (len > 0) {
         write_byte(*(uint8_t *) string++);
@@ -122,21 +474,85 @@ void write_string(char *string, size_t len) {
     }
 }
 
+/*
+ * @brief The link, the negotiations and the heartbeat only move on
+ * ticks and on what comes in, both events run all of it. The I2C
+ * transport has no interrupt of its own, it's polled on every tick.
+ * */
+static uint32_t last_heartbeat;
+
+static void service(void) {
+    // Answer to what the transport received so far,
+    // and keep our own packets going.
+    transport_poll(wire, &rx_parser);
+    link_poll(&link, get_systicks());
+    bulk_poll();
+    baud_poll(&baud, get_systicks());
+    sync_poll(&sync, get_systicks(), get_micros());
+}
+
+static void on_rx(const event_t *event) {
+    service();
+}
+
+static void on_tick(const event_t *event) {
+#if P_P_IRQ_PROBE
+    // How long USART2 takes to get in, see irqs.
+    irq_trigger(USART2_IRQ);
+#endif
+
+    service();
+
+    // Every HEARTBEAT_TICKS we let the other side know we are alive.
+    // The subtraction keeps working when s_ticks wraps.
+    if (get_systicks() - last_heartbeat >= HEARTBEAT_TICKS) {
+        last_heartbeat += HEARTBEAT_TICKS;
+
+        link_heartbeat(&link);
+    }
+}
+
 int main(void) {
+    systick_t systick;
+
     setup_gpio();
-    setup_systick();
+
+    // The priorities must be there before any interrupt is enabled.
+    irq_setup(2, irqs, IRQ_COUNT);
+
+    // The queues must be there before the interrupts that post to them.
+    event_init();
+    event_queue_init(&rx_queue, 0, on_rx);
+    event_queue_init(&tick_queue, 1, on_tick);
+
+    // TICK_FREQUENCY ticks per second, each one interrupting.
+    systick_setup(&systick, TICK_FREQUENCY, 1);
+
+    // The transport must be ready before the RX interrupt gets enabled.
+    link_init(&link, on_data, LINK_TIMEOUT_TICKS, LINK_MAX_RETRIES);
+    bulk_init();
+    bulk_set_sender(send_on_link);
+#if P_P_ECHO
+    dispatch_set_echo_sender(send_on_link);
+#endif
+    parser_init(&rx_parser, on_packet, on_corrupted_packet);
+    transport_uart_init(&uart);
+#if P_P_I2C
+    transport_i2c_init(&i2c, TRANSPORT_I2C_ADDRESS);
+#endif
+    link_set_transport(&link, wire);
     setup_usart();
+    // The host starts the negotiation, we only answer.
+    baud_init(&baud, &link, baud_supported(CPU_FREQUENCY), usart_set_rate, transport_uart_idle, get_systicks());
+    sync_init(&sync, &link, SYNC_TICKS);
 
-    while(1) {
-        // We check each iteration if the timer has expired
-        // in particular we check if the COUNTFLAG is 1, if so
-        // it means that the timer counter to 0 since last time this was read.
-        // (Section 4.4.1)
-        //
-        if (SYST->SYST_CSR & (1 << 16)) {
-            send_ack();
-        }
-    }
+#if P_P_BENCH
+    bench_run(wire);
+#endif
+
+    last_heartbeat = get_systicks();
+
+    event_run(NULL);
 
     return 0;
 }
@@ -1,16 +1,20 @@
 #include "p_p.h"
-#include "../../inc/peripherals.h"
+#include "cobs.h"
 
 static packet_t created_packet;  // Static instance to hold the created packet
 
 packet_t *create_packet(uint8_t length, uint8_t *data) {
-    // Check if the provided length is valid
-    if (length > DATA_LENGTH) {
+    return create_flagged_packet(0, length, data);
+}
+
+packet_t *create_flagged_packet(uint8_t flags, uint8_t length, uint8_t *data) {
+    // Check if the provided length and flags are valid
+    if (length > DATA_LENGTH || (flags & ~LENGTH_FLAGS)) {
         return NULL;
     }
 
     // Set the packet fields
-    created_packet.length = length;
+    created_packet.length = flags | length;
 
     // Copy the data into the packet
     for (uint8_t i = 0; i < length; ++i) {
@@ -23,121 +27,130 @@ packet_t *create_packet(uint8_t length, uint8_t *data) {
     }
 
     // Compute and set the CRC
-    created_packet.crc = compute_crc(length, data);
+    created_packet.crc = crc_with_flags(compute_crc(length, data), flags);
 
     return &created_packet;
 }
 
+/*
+ * Lookup table for the CRC-8 (polynomial 0x07), entry i is the result of
+ * shifting the byte i through the polynomial 8 times.
+ * It lives in flash, and lets us update the crc with a single load per byte,
+ * which is what the receive path needs to keep up from the RX interrupt.
+ * */
+const uint8_t crc_table[256] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+    0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65,
+    0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+    0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5,
+    0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85,
+    0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+    0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2,
+    0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+    0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2,
+    0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+    0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32,
+    0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+    0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42,
+    0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+    0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C,
+    0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+    0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC,
+    0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+    0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C,
+    0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+    0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C,
+    0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+    0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B,
+    0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+    0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B,
+    0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+    0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB,
+    0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+    0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB,
+    0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3,
+};
+
 uint8_t compute_crc(uint8_t length, uint8_t *data) {
     uint8_t crc = 0;
 
     for (uint32_t i = 0; i < length; i++) {
-        crc ^= data[i];
-        for (uint8_t j = 0; j < 8; j++) {
-            if (crc & 0x80) {
-                crc = (crc << 1) ^ 0x07;
-            } else {
-                crc <<= 1;
-            }
-        }
+        crc = crc_update(crc, data[i]);
     }
 
     return crc;
 }
 
-void write_byte(uint8_t byte) {
-    // We check if there are any data that is being transferred 
-    // using the USART_SR register, if the bit 7 is 1, it means that 
-    // the data has finished writing.
-    // If so, we can use the USART_DR register to write the new data.
-    //
-    // Section 19.6.1
-    while(!((USART2->USART_SR & (1 << 7)))); 
-
-    // Sets the data register to the ASCII code of the 
-    // character 'x' by bitwise ANDing it with 0xFF
-    // to ensure only the lower 8 bits (byte that we wanna transmit) are considered.
-    // To see the actual bytes sent, I used picocom, but any dumb-terminal emulation works
-    // fine:
-    //
-    // picocom -b 9600 /dev/ttyACM0.
-    USART2->USART_DR = (byte & 0xFF); 
-
-    // We wait for the transmission to be completed.
-    while(!(USART2->USART_SR & (1 << 6)));
-}
+void write_packet(packet_t *p) {
+#if P_P_COBS
+    // The packet gets copied after buf[0], which is where
+    // the encoder puts the first code byte.
+    uint8_t buf[1 + PACKET_LENGTH];
 
-void send_packet(packet_t *p) {
-    // Send packet over UART
+    buf[1] = p->length;
+    for (uint8_t i = 0; i < DATA_LENGTH; ++i) {
+        buf[2 + i] = p->data[i];
+    }
+    buf[1 + LENGTH + DATA_LENGTH] = p->crc;
+
+    size_t len = cobs_encode_in_place(buf, PACKET_LENGTH);
+
+    for (size_t i = 0; i < len; ++i) {
+        write_byte(buf[i]);
+    }
+
+    // The delimiter is what lets the receiver find the start of the next packet.
+    write_byte(COBS_DELIMITER);
+#else
     write_byte(p->length);
+
     for (uint8_t i = 0; i < DATA_LENGTH; ++i) {
         write_byte(p->data[i]);
     }
+
     write_byte(p->crc);
+#endif
+}
 
-    handle_packet(p);
+void send_packet(packet_t *p) {
+    // Send packet over UART
+    write_packet(p);
 }
 
 void send_ack() {
     // Create an ACK packet
     uint8_t test_data[] = {ACK};
-    packet_t ack_packet = *create_packet(sizeof(test_data), test_data);
+    packet_t ack_packet = *create_flagged_packet(FLAG_LINK, sizeof(test_data), test_data);
 
     // Send the ACK packet over UART
-    write_byte(ack_packet.length);
-
-    for (uint8_t i = 0; i < DATA_LENGTH; ++i) {
-        write_byte(ack_packet.data[i]);
-    }
+    write_packet(&ack_packet);
+}
 
-    write_byte(ack_packet.crc);
+void send_ack_for(uint8_t crc) {
+    // Same as a plain ACK, but it also carries the crc of the packet
+    // it acknowledges, so the sender can tell it apart from a heartbeat.
+    uint8_t ack_data[] = {ACK, crc};
+    packet_t ack_packet = *create_flagged_packet(FLAG_LINK, sizeof(ack_data), ack_data);
 
-    handle_packet(&ack_packet);
+    write_packet(&ack_packet);
 }
 
 void send_rck() {
     // Create an ACK packet
     uint8_t test_data[] = {RCK};
-    packet_t rck_packet = *create_packet(sizeof(test_data), test_data);
+    packet_t rck_packet = *create_flagged_packet(FLAG_LINK, sizeof(test_data), test_data);
 
     // Send the ACK packet over UART
-    write_byte(rck_packet.length);
-
-    for (uint8_t i = 0; i < DATA_LENGTH; ++i) {
-        write_byte(rck_packet.data[i]);
-    }
-
-    write_byte(rck_packet.crc);
-
-    handle_packet(&rck_packet);
-}
-
-uint8_t read_byte() {
-    // We check if there are any data that is being transferred 
-    // using the USART_SR register, if the bit 5 is 1, it means that 
-    // the data has finished writing.
-    // If so, we can return the USART_DR register to read new data.
-    //
-    // Section 19.6.1
-    while(!((USART2->USART_SR & (1 << 5))));
-
-    return USART2->USART_DR;
+    write_packet(&rck_packet);
 }
 
 void handle_packet(packet_t *p) {
-    // For testing purposes and simplicity of implementation, 
-    // this function only prints out the packet that has just been sent.
-    // But obviously, since this is a pretty flexible API, you can use it for other
-    // purposes.
-    // e.g.: I received an ACK packet on my Arduino Uno (open RX pin waiting for data), amazing, now I can go to the next packet to send etc...
-    // Obviously to do that, you need to patch the stm32 pin TX to the RX pin of the Arduino Uno, in order to serially
-    // communicate with it.
-    
-    write_byte(p->length);
-
-    for (uint8_t i = 0; i < DATA_LENGTH; ++i) {
-        write_byte(p->data[i]);
-    }
-
-    write_byte(p->crc);
+    // Debug helper: it puts the packet back on the wire as it is.
+    // It used to be called on everything we sent, which doubled the traffic,
+    // now it only runs for dispatch_echo when it has no sender, e.g. for
+    // the types you want to see bounced back while patching the stm32 TX pin
+    // to the RX pin of another board.
+    write_packet(p);
 }
@@ -15,15 +15,66 @@
 #define CRC 1
 #define PACKET_LENGTH (LENGTH + DATA_LENGTH + CRC)
 
+/*
+ * The length only needs the lower 4 bits of its byte (0 to DATA_LENGTH),
+ * the upper ones tell how to read the data section:
+ *
+ * CHANNEL_MASK    -> logical channel of the packet (bits 4-5, see below)
+ * FLAG_SEQUENCE   -> alternates between packets of a reliable channel, to spot retransmissions
+ * FLAG_LINK       -> the same bit on CHANNEL_LINK, which is never reliable: the
+ *                    packet is one of the link's own (ACK, RCK, QUERY, STATS),
+ *                    anything else on CHANNEL_LINK is data, whatever its first byte
+ * FLAG_COMPRESSED -> the data is a piece of a compressed stream (see compress.h)
+ *
+ * Flags are covered by the crc, but only when set, so packets without
+ * flags have the same crc they always had.
+ * */
+#define LENGTH_MASK 0x0F
+#define CHANNEL_MASK 0x30
+#define CHANNEL_SHIFT 4
+#define FLAG_SEQUENCE 0x40
+#define FLAG_LINK FLAG_SEQUENCE
+#define FLAG_COMPRESSED 0x80
+#define LENGTH_FLAGS (FLAG_COMPRESSED | FLAG_SEQUENCE | CHANNEL_MASK)
+
+/*
+ * Logical channels sharing the link, a lower number means a higher priority
+ * when packets wait to be sent (see link.h):
+ *
+ * CHANNEL_LINK      -> ACK, RCK and the other answers of the link itself (with
+ *                      FLAG_LINK), and packets from senders that don't know
+ *                      about channels
+ * CHANNEL_CONTROL   -> commands and their replies, sent reliably
+ * CHANNEL_TELEMETRY -> periodic readings (see batch.h)
+ * CHANNEL_BULK      -> large transfers, sent reliably too (see bulk.h)
+ *
+ * CHANNEL(n) gives the bits to pass as flags.
+ * */
+#define CHANNEL_LINK 0
+#define CHANNEL_CONTROL 1
+#define CHANNEL_TELEMETRY 2
+#define CHANNEL_BULK 3
+#define CHANNELS 4
+#define CHANNEL(n) ((n) << CHANNEL_SHIFT)
+
 /*
  * Fixed hex values that indicate an acknowledgement (ACK)
  * or a request to retrasmit a packet (RCK).
  * In particular this ones get inserted in the data section
- * of a packet, with the rest of bits set to 0xFF.
+ * of a packet with FLAG_LINK, with the rest of bits set to 0xFF.
  * */ 
 #define ACK 0x12
 #define RCK 0x13
 
+/*
+ * When set to 1, packets travel COBS encoded and are separated by a 0x00
+ * delimiter (see cobs.h), so a receiver can always find where a packet starts.
+ * Both ends of the link must agree on it.
+ * */
+#ifndef P_P_COBS
+#define P_P_COBS 0
+#endif
+
 /*
  * Struct that holds the
  * fields for the packets of the 
@@ -37,16 +88,61 @@ typedef struct packet_t {
 	uint8_t crc;
 } packet_t;
 
+/*
+ * Channel a packet travels on.
+ * */
+static inline uint8_t packet_channel(const packet_t *p) {
+    return (p->length & CHANNEL_MASK) >> CHANNEL_SHIFT;
+}
+
+/*
+ * Something that can send a packet, built from the same arguments as
+ * create_flagged_packet (e.g. link_send behind a wrapper).
+ * Returns -1 when the packet can't be taken.
+ * */
+typedef int (*packet_sender_t)(uint8_t flags, uint8_t length, uint8_t *data);
+
 /*
  * Function that handles the creation of the packet struct.
  * */
 packet_t *create_packet(uint8_t length, uint8_t *data);
 
+/*
+ * Same as create_packet, with some of the LENGTH_FLAGS set in the length byte.
+ * */
+packet_t *create_flagged_packet(uint8_t flags, uint8_t length, uint8_t *data);
+
 /*
  * Computes the rcc (CRC-8 implementation, it uses the polynomial '0x07'
  * */
 uint8_t compute_crc(uint8_t length, uint8_t *data);
 
+/*
+ * Lookup table used by compute_crc and crc_update (defined in p_p.c).
+ * */
+extern const uint8_t crc_table[256];
+
+/*
+ * Feeds a single byte into a running crc, so the receiver can
+ * validate a packet while the bytes are still arriving.
+ * compute_crc(n, data) is the same as n calls to crc_update starting from 0.
+ * */
+static inline uint8_t crc_update(uint8_t crc, uint8_t byte) {
+    return crc_table[crc ^ byte];
+}
+
+/*
+ * Crc that a packet with the given flags, and 'crc' over its data, must carry.
+ * */
+static inline uint8_t crc_with_flags(uint8_t crc, uint8_t flags) {
+    return flags ? crc_update(crc, flags) : crc;
+}
+
+/*
+ * Puts the packet on the wire, framed as configured by P_P_COBS.
+ * */
+void write_packet(packet_t *p);
+
 /*
  * Actually sends the packet, and waits for the response.
  * */
@@ -57,16 +153,38 @@ void send_packet(packet_t *p);
  * */
 void send_ack();
 
+/*
+ * Sends the ACK for a received packet, data is {ACK, crc of that packet}.
+ * Plain ACKs (like the heartbeat) only have the ACK byte.
+ * */
+void send_ack_for(uint8_t crc);
+
 /*
  * Sends aan RCK packet.
  * */
 void send_rck();
 
 /*
- * Handles a received packet.
+ * Echoes a packet back on the wire, a debug handler (see dispatch.h).
  * */
 void handle_packet(packet_t *p);
 
+/*
+ * Number of SysTick ticks (1 ms each) since startup, defined in main.c
+ * (and in host/peer.c for the host).
+ * */
+uint32_t get_systicks();
+
+/*
+ * Microseconds since startup, wraps every ~71 minutes
+ * (main.c, and host/peer.c for the host).
+ * */
+uint32_t get_micros();
+
+/*
+ * Byte level access to the link, the only part of the protocol that
+ * depends on where it runs: usart.c on the board, host/peer.c on the host.
+ * */
 void write_byte(uint8_t byte);
 
 uint8_t read_byte();
@@ -0,0 +1,150 @@
+#include "parser.h"
+
+/*
+ * Padding value that create_packet writes after the 'length' data bytes.
+ * */
+#define PADDING 0xFF
+
+/*
+ * What we took for a packet isn't one, we found out 'consumed' bytes
+ * into it (its length byte and the one that gave it away included).
+ * Drops the bytes up to where the next packet would start, one further
+ * after PARSER_SHIFT_AFTER errors in a row (see parser.h).
+ * */
+static void resync(parser_t *parser, uint8_t consumed) {
+    parser->skip = PACKET_LENGTH - consumed;
+
+    if (parser->misses < PARSER_SHIFT_AFTER) {
+        parser->misses++;
+    }
+
+    if (parser->misses == PARSER_SHIFT_AFTER) {
+        parser->skip++;
+    }
+
+    parser->state = parser->skip > 0 ? PARSER_SKIP : PARSER_LENGTH;
+}
+
+static void start_packet(parser_t *parser, uint8_t byte) {
+    // A length byte can't be bigger than the data section, nor carry
+    // flags we don't know about. It's most likely filler between packets
+    // (like TRANSPORT_I2C_IDLE), or we are not aligned yet: we drop just
+    // that byte, the next one may be the start of a packet.
+    if ((byte & LENGTH_MASK) > DATA_LENGTH || (byte & ~(LENGTH_MASK | LENGTH_FLAGS))) {
+        parser->dropped_bytes++;
+        return;
+    }
+
+    parser->packet.length = byte;
+    parser->index = 0;
+    parser->crc = 0;
+    parser->state = PARSER_DATA;
+}
+
+void parser_init(parser_t *parser, packet_handler_t on_packet, packet_handler_t on_error) {
+    parser->on_packet = on_packet;
+    parser->on_error = on_error;
+    parser->packets = 0;
+    parser->crc_errors = 0;
+    parser->dropped_bytes = 0;
+    parser->misses = 0;
+
+#if P_P_COBS
+    cobs_decoder_init(&parser->cobs, parser->frame, sizeof(parser->frame));
+#endif
+
+    parser_reset(parser);
+}
+
+void parser_reset(parser_t *parser) {
+    parser->state = PARSER_LENGTH;
+    parser->index = 0;
+    parser->crc = 0;
+    parser->skip = 0;
+}
+
+void parser_feed_byte(parser_t *parser, uint8_t byte) {
+    switch (parser->state) {
+    case PARSER_LENGTH:
+        start_packet(parser, byte);
+        break;
+
+    case PARSER_DATA:
+        if (parser->index < (parser->packet.length & LENGTH_MASK)) {
+            // Payload byte, it goes into the crc.
+            parser->crc = crc_update(parser->crc, byte);
+        } else if (byte != PADDING) {
+            // The padding must be 0xFF, anything else means that what we
+            // took for a length byte was actually something in the middle
+            // of a packet. Instead of going back and rescanning what we
+            // already consumed, we drop it, and what's left of it.
+            parser->dropped_bytes += parser->index + 1;
+            resync(parser, LENGTH + parser->index + 1);
+            break;
+        }
+
+        parser->packet.data[parser->index++] = byte;
+
+        if (parser->index == DATA_LENGTH) {
+            parser->state = PARSER_CRC;
+        }
+        break;
+
+    case PARSER_CRC:
+        parser->packet.crc = byte;
+        parser->state = PARSER_LENGTH;
+
+        if (byte == crc_with_flags(parser->crc, parser->packet.length & LENGTH_FLAGS)) {
+            parser->misses = 0;
+            parser->packets++;
+            if (parser->on_packet) {
+                parser->on_packet(&parser->packet);
+            }
+        } else {
+            parser->crc_errors++;
+            resync(parser, PACKET_LENGTH);
+
+            if (parser->on_error) {
+                parser->on_error(&parser->packet);
+            }
+        }
+        break;
+
+    case PARSER_SKIP:
+        parser->dropped_bytes++;
+
+        if (--parser->skip == 0) {
+            parser->state = PARSER_LENGTH;
+        }
+        break;
+    }
+}
+
+void parser_feed(parser_t *parser, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        parser_feed_byte(parser, *buf++);
+        len--;
+    }
+}
+
+void parser_feed_wire(parser_t *parser, uint8_t byte) {
+#if P_P_COBS
+    size_t len = cobs_decoder_feed(&parser->cobs, byte);
+
+    if (len > 0) {
+        parser_reset(parser);
+        parser_feed(parser, parser->frame, len);
+    }
+#else
+    parser_feed_byte(parser, byte);
+#endif
+}
+
+void parser_lost_bytes(parser_t *parser) {
+    parser_reset(parser);
+
+#if P_P_COBS
+    // The frame will be thrown away when its delimiter comes in.
+    parser->cobs.error = 1;
+#endif
+}
@@ -0,0 +1,127 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "p_p.h"
+#include "cobs.h"
+
+/*
+ * States of the receive state machine, one for each field
+ * of the packet (see arch.png):
+ *
+ * PARSER_LENGTH -> waiting for the length byte, this is also where
+ *                  we fall back to whenever we lose the frame alignment.
+ * PARSER_DATA   -> collecting the DATA_LENGTH data bytes.
+ * PARSER_CRC    -> waiting for the crc byte that closes the packet.
+ * PARSER_SKIP   -> dropping bytes up to where the next packet should
+ *                  start, after a framing error (see below).
+ *
+ * Every packet is PACKET_LENGTH bytes, so with raw framing being out of
+ * alignment means being a few bytes off the packets, and taking one
+ * packet's worth of bytes for a packet keeps us just as off: a sender
+ * retransmitting the same packet with no gap would never get through.
+ * So what follows a framing error (a padding byte that isn't 0xFF, a
+ * crc that doesn't match) is not the byte after it, but where the next
+ * packet starts if we were aligned: right after what we took for a
+ * packet, as the error was most likely just a corrupted byte. From the
+ * PARSER_SHIFT_AFTER-th error in a row on, one byte further than that,
+ * so in PARSER_SHIFT_AFTER + PACKET_LENGTH errors at most we are aligned
+ * again, without going back over the bytes consumed: the cost per byte
+ * stays the same.
+ *
+ * A length byte that can't be one is not a framing error: only that
+ * byte is dropped. Filler between packets (TRANSPORT_I2C_IDLE) is made of
+ * those, and the packet right after it must not be skipped.
+ * */
+#define PARSER_SHIFT_AFTER 4
+
+typedef enum parser_state_t {
+    PARSER_LENGTH,
+    PARSER_DATA,
+    PARSER_CRC,
+    PARSER_SKIP,
+} parser_state_t;
+
+/*
+ * Callback that gets a completed packet.
+ * The pointer is only valid for the duration of the call, since the
+ * parser reuses the same storage for the next packet, so copy it if you
+ * need to keep it around.
+ * */
+typedef void (*packet_handler_t)(packet_t *p);
+
+/*
+ * Struct that holds the state of the byte-at-a-time receiver.
+ *
+ * The crc is updated as every byte comes in, so when the last byte
+ * arrives the only thing left is a single comparison: the cost per byte
+ * is constant, no matter where in the packet we are.
+ * */
+typedef struct parser_t {
+    parser_state_t state;
+    // Number of data bytes received so far for the current packet.
+    uint8_t index;
+    // Running crc over the first 'length' data bytes.
+    uint8_t crc;
+    // Bytes left to drop in PARSER_SKIP.
+    uint8_t skip;
+    // Framing errors since the last good packet, up to PARSER_SHIFT_AFTER.
+    uint8_t misses;
+    // Packet being assembled.
+    packet_t packet;
+    // Called for every packet whose crc matches.
+    packet_handler_t on_packet;
+    // Called for every packet that was framed correctly but failed the crc,
+    // this is where the application would usually send an RCK. Can be NULL.
+    packet_handler_t on_error;
+#if P_P_COBS
+    // With COBS framing the bytes go through the decoder first, and the
+    // packet state machine only sees whole frames, each one starting
+    // right after a delimiter.
+    cobs_decoder_t cobs;
+    uint8_t frame[COBS_MAX_ENCODED(PACKET_LENGTH)];
+#endif
+    // Counters, mostly useful while debugging a link.
+    uint32_t packets;
+    uint32_t crc_errors;
+    uint32_t dropped_bytes;
+} parser_t;
+
+/*
+ * Initializes the parser, and sets the callbacks for the valid
+ * and the corrupted packets.
+ * */
+void parser_init(parser_t *parser, packet_handler_t on_packet, packet_handler_t on_error);
+
+/*
+ * Throws away the packet in progress and waits for the next length byte.
+ * Useful when the caller knows bytes were lost (e.g. an USART overrun).
+ * */
+void parser_reset(parser_t *parser);
+
+/*
+ * Feeds a single received byte to the parser.
+ * It never blocks and never loops, so it's safe to call it directly
+ * from the USART RX interrupt.
+ * */
+void parser_feed_byte(parser_t *parser, uint8_t byte);
+
+/*
+ * Feeds a whole buffer to the parser, e.g. from a DMA completion callback.
+ * */
+void parser_feed(parser_t *parser, const uint8_t *buf, size_t len);
+
+/*
+ * Feeds a byte as it came from the wire, so it goes through the COBS
+ * decoder first when P_P_COBS is set. This is what the RX interrupt calls.
+ * */
+void parser_feed_wire(parser_t *parser, uint8_t byte);
+
+/*
+ * Tells the parser that some bytes never made it (e.g. an USART overrun),
+ * so whatever packet is in progress gets thrown away.
+ * */
+void parser_lost_bytes(parser_t *parser);
+
+#endif // !PARSER_H
@@ -0,0 +1,203 @@
+#include "sync.h"
+
+/*
+ * num * 2^32 / den for num < den, by shift and subtract: there's no libgcc
+ * for 64 bit divisions, and it only runs once per sample anyway.
+ * */
+static uint32_t fraction(uint32_t num, uint32_t den) {
+    uint32_t q = 0;
+    uint32_t r = num;
+
+    for (uint8_t i = 0; i < 32; ++i) {
+        uint32_t carry = r >> 31;
+
+        r <<= 1;
+        q <<= 1;
+
+        if (carry || r >= den) {
+            r -= den;
+            q |= 1;
+        }
+    }
+
+    return q;
+}
+
+/*
+ * Rate error between two samples, scaled by 2^32 like sync_t.drift.
+ * */
+static int32_t rate(const sync_sample_t *from, const sync_sample_t *to) {
+    uint32_t span = to->board - from->board;
+    int32_t error = (int32_t)((to->host - from->host) - span);
+    uint32_t magnitude = error < 0 ? -(uint32_t)error : (uint32_t)error;
+
+    // More than 50% off is not a clock, it's a bad sample.
+    if (magnitude >= span / 2) {
+        return 0;
+    }
+
+    int32_t r = (int32_t)fraction(magnitude, span);
+
+    return error < 0 ? -r : r;
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+void sync_init(sync_t *sync, link_t *link, uint32_t interval) {
+    sync->link = link;
+    sync->interval = interval;
+    sync->asked_at = 0;
+    sync->seq = 0;
+    sync->waiting = 0;
+    sync->t1 = 0;
+    sync->count = 0;
+    sync->used_board = 0;
+    sync->synced = 0;
+    sync->base = 0;
+    sync->base_host = 0;
+    sync->drift = 0;
+    sync->has_drift = 0;
+    sync->requests = 0;
+    sync->replies = 0;
+    sync->last_delay = 0;
+    sync->last_error = 0;
+}
+
+void sync_poll(sync_t *sync, uint32_t now, uint32_t now_us) {
+    if (sync->requests > 0 && now - sync->asked_at < sync->interval) {
+        return;
+    }
+
+    uint8_t request[] = {SYNC, SYNC_REQUEST, sync->seq + 1};
+
+    if (link_send(sync->link, CHANNEL(CHANNEL_LINK), request, sizeof(request)) < 0) {
+        return;
+    }
+
+    // A reply that didn't come by now is lost, a late one
+    // has the old seq and gets ignored.
+    sync->seq++;
+    sync->waiting = 1;
+    sync->t1 = now_us;
+    sync->asked_at = now;
+    sync->requests++;
+}
+
+uint32_t sync_time(sync_t *sync, uint32_t board_us) {
+    if (!sync->synced) {
+        return board_us;
+    }
+
+    int32_t elapsed = (int32_t)(board_us - sync->base);
+    int32_t correction = (int32_t)(((int64_t)elapsed * sync->drift) >> 32);
+
+    return sync->base_host + elapsed + correction;
+}
+
+/*
+ * One more filtered sample: phase, and every SYNC_DRIFT_SPAN, rate.
+ * */
+static void sync_apply(sync_t *sync, const sync_sample_t *s) {
+    if (!sync->synced) {
+        sync->base = s->board;
+        sync->base_host = s->host;
+        sync->anchor = *s;
+        sync->synced = 1;
+        return;
+    }
+
+    uint32_t predicted = sync_time(sync, s->board);
+    int32_t error = (int32_t)(s->host - predicted);
+
+    sync->last_error = error;
+    sync->base = s->board;
+    sync->base_host = s->host;
+
+    if (s->board - sync->anchor.board >= SYNC_DRIFT_SPAN) {
+        int32_t r = rate(&sync->anchor, s);
+
+        // The first estimate as it is, then a running average.
+        sync->drift = sync->has_drift ? sync->drift + (r - sync->drift) / 2 : r;
+        sync->has_drift = 1;
+        sync->anchor = *s;
+    }
+}
+
+void sync_receive(sync_t *sync, const packet_t *p, uint32_t now_us) {
+    uint8_t length = p->length & LENGTH_MASK;
+
+    if (length != 7 || p->data[0] != SYNC || p->data[1] != SYNC_REPLY) {
+        return;
+    }
+
+    if (!sync->waiting || p->data[2] != sync->seq) {
+        return;
+    }
+
+    sync->waiting = 0;
+    sync->replies++;
+
+    sync_sample_t s;
+    uint32_t delay = now_us - sync->t1;
+
+    s.board = sync->t1 + delay / 2;
+    s.host = read_u32(&p->data[3]);
+    s.delay = delay;
+    sync->last_delay = delay;
+
+    // The window of the last samples, oldest first.
+    if (sync->count == SYNC_FILTER) {
+        for (uint8_t i = 1; i < SYNC_FILTER; ++i) {
+            sync->samples[i - 1] = sync->samples[i];
+        }
+        sync->count--;
+    }
+    sync->samples[sync->count++] = s;
+
+    const sync_sample_t *best = &sync->samples[0];
+
+    for (uint8_t i = 1; i < sync->count; ++i) {
+        if (sync->samples[i].delay <= best->delay) {
+            best = &sync->samples[i];
+        }
+    }
+
+    // Until a better one comes along the best sample stays the same, and
+    // it has nothing new to say, nor has one older than the last one used.
+    if (sync->synced && (int32_t)(best->board - sync->used_board) <= 0) {
+        return;
+    }
+
+    sync->used_board = best->board;
+    sync_apply(sync, best);
+}
+
+void sync_stamp(sync_t *sync, uint32_t board_us, uint8_t *out) {
+    uint32_t t = sync_time(sync, board_us);
+
+    out[0] = t >> 24;
+    out[1] = t >> 16;
+    out[2] = t >> 8;
+    out[3] = t;
+}
+
+int32_t sync_drift_ppb(sync_t *sync) {
+    return (int32_t)(((int64_t)sync->drift * 1000000000) >> 32);
+}
+
+void sync_answer(link_t *link, const packet_t *p, uint32_t host_us) {
+    uint8_t length = p->length & LENGTH_MASK;
+
+    if (length != 3 || p->data[0] != SYNC || p->data[1] != SYNC_REQUEST) {
+        return;
+    }
+
+    uint8_t reply[] = {
+        SYNC, SYNC_REPLY, p->data[2],
+        host_us >> 24, host_us >> 16, host_us >> 8, host_us,
+    };
+
+    link_send(link, CHANNEL(CHANNEL_LINK), reply, sizeof(reply));
+}
@@ -0,0 +1,126 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+#include "p_p.h"
+#include "link.h"
+
+/*
+ * Clock synchronization with the host, so that the board can stamp its
+ * readings with host time.
+ *
+ * Like an NTP client, with the host as the server: every interval the
+ * board asks for the time, and from when it asked (t1, board clock), when
+ * it got the answer (t4, board clock) and what the host said (t, stamped
+ * when it handled the request) it gets one sample:
+ *
+ * delay  = t4 - t1
+ * offset = t - (t1 + t4) / 2
+ *
+ * which is off by at most delay / 2, and exact when both directions take
+ * the same time. So, like the NTP clock filter, only the sample with the
+ * lowest delay among the last SYNC_FILTER is used, the ones that waited
+ * behind other packets are thrown away.
+ *
+ * The board clock doesn't tick at the host rate (the HSI is only good to
+ * 1%), so besides the offset the drift is estimated as well, from samples
+ * at least SYNC_DRIFT_SPAN apart, and sync_time keeps following the host
+ * between samples:
+ *
+ * host = base_host + (now - base) + (now - base) * drift / 2^32
+ *
+ * Every new filtered sample becomes the base, the error the model had at
+ * that point is kept in last_error.
+ *
+ * Requests and replies travel on CHANNEL_LINK, so they don't wait behind
+ * anything queued on the other channels:
+ *
+ * {SYNC, SYNC_REQUEST, seq}
+ * {SYNC, SYNC_REPLY, seq, t (4 bytes, big endian)}
+ *
+ * Times are in microseconds, as uint32_t, they wrap every ~71 minutes and
+ * all the math works on differences, so the wrap doesn't matter. The host
+ * has the rest of its clock to put a timestamp back in full.
+ * */
+#define SYNC 0x18
+
+#define SYNC_REQUEST 1
+#define SYNC_REPLY 2
+
+#define SYNC_FILTER 8
+#define SYNC_DRIFT_SPAN 4000000
+
+typedef struct sync_sample_t {
+    // Board time half way between request and reply, and the host time then.
+    uint32_t board;
+    uint32_t host;
+    uint32_t delay;
+} sync_sample_t;
+
+typedef struct sync_t {
+    link_t *link;
+    // Ticks between two requests, and when the last one went out.
+    uint32_t interval;
+    uint32_t asked_at;
+    // Request waiting for its reply.
+    uint8_t seq;
+    uint8_t waiting;
+    uint32_t t1;
+
+    sync_sample_t samples[SYNC_FILTER];
+    uint8_t count;
+    // Filtered sample used last, to never use the same one twice.
+    uint32_t used_board;
+
+    // The model of the host clock, see above.
+    uint8_t synced;
+    uint32_t base;
+    uint32_t base_host;
+    int32_t drift;
+    uint8_t has_drift;
+    sync_sample_t anchor;
+
+    // Counters.
+    uint32_t requests;
+    uint32_t replies;
+    // Delay of the last sample, and error of the model it found.
+    uint32_t last_delay;
+    int32_t last_error;
+} sync_t;
+
+void sync_init(sync_t *sync, link_t *link, uint32_t interval);
+
+/*
+ * Sends the next request when it's time, call it from the main loop
+ * with both clocks (ticks for the interval, microseconds for the sample).
+ * */
+void sync_poll(sync_t *sync, uint32_t now, uint32_t now_us);
+
+/*
+ * Handles a SYNC_REPLY, 'now_us' being the time it's handled at.
+ * */
+void sync_receive(sync_t *sync, const packet_t *p, uint32_t now_us);
+
+/*
+ * Host time for a board time in microseconds, the board time
+ * itself until the first sample.
+ * */
+uint32_t sync_time(sync_t *sync, uint32_t board_us);
+
+/*
+ * Host time for 'board_us' in 4 bytes (big endian), as the value of a batch
+ * record (see batch.h), to stamp the readings that follow it.
+ * */
+void sync_stamp(sync_t *sync, uint32_t board_us, uint8_t *out);
+
+/*
+ * Drift of the board clock, in parts per billion (positive when it's slow).
+ * */
+int32_t sync_drift_ppb(sync_t *sync);
+
+/*
+ * Server side: answers a SYNC_REQUEST with 'host_us', the time it's handled at.
+ * */
+void sync_answer(link_t *link, const packet_t *p, uint32_t host_us);
+
+#endif // !SYNC_H
@@ -0,0 +1,146 @@
+#include "transport.h"
+#include "cobs.h"
+
+#if P_P_COBS
+static const uint8_t delimiter = COBS_DELIMITER;
+#endif
+
+int transport_send_packet(transport_t *t, const packet_t *p) {
+#if P_P_COBS
+    // Same layout as write_packet: the encoder needs buf[0] for its first code byte.
+    uint8_t buf[1 + PACKET_LENGTH];
+
+    buf[1] = p->length;
+    for (uint8_t i = 0; i < DATA_LENGTH; ++i) {
+        buf[2 + i] = p->data[i];
+    }
+    buf[1 + LENGTH + DATA_LENGTH] = p->crc;
+
+    transport_iov_t iov[] = {
+        { buf, cobs_encode_in_place(buf, PACKET_LENGTH) },
+        { &delimiter, 1 },
+    };
+#else
+    // Raw framing, the vector points straight into the packet.
+    transport_iov_t iov[] = {
+        { &p->length, LENGTH },
+        { p->data, DATA_LENGTH },
+        { &p->crc, CRC },
+    };
+#endif
+    uint8_t count = sizeof(iov) / sizeof(iov[0]);
+    size_t sent = t->send(t, iov, count);
+
+    if (sent == 0) {
+        t->busy++;
+        return -1;
+    }
+
+    t->bytes_sent += sent;
+
+    return 0;
+}
+
+size_t transport_poll(transport_t *t, parser_t *parser) {
+    uint8_t buf[32];
+    size_t total = 0;
+    size_t n;
+    uint32_t position = t->bytes_received;
+
+    // Bytes lost by the transport break the packet they were in, the
+    // parser starts over right where they are missing.
+    uint32_t lost = t->lost_bytes;
+    uint32_t lost_at = t->lost_at;
+    int broken = lost != t->lost_seen;
+
+    t->lost_seen = lost;
+
+    // Behind us: it came in while the last poll was reading, right away then.
+    if (broken && (int32_t)(lost_at - position) < 0) {
+        parser_lost_bytes(parser);
+        broken = 0;
+    }
+
+    while ((n = t->recv(t, buf, sizeof(buf))) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            if (broken && position == lost_at) {
+                parser_lost_bytes(parser);
+                broken = 0;
+            }
+
+            parser_feed_wire(parser, buf[i]);
+            position++;
+        }
+
+        total += n;
+    }
+
+    // After the last byte here, before the next ones.
+    if (broken) {
+        parser_lost_bytes(parser);
+    }
+
+    t->bytes_received += total;
+
+    return total;
+}
+
+void transport_init(transport_t *t, const char *name, transport_send_t send, transport_recv_t recv, void *context) {
+    t->name = name;
+    t->send = send;
+    t->recv = recv;
+    t->context = context;
+    t->lost_bytes = 0;
+    t->lost_at = 0;
+    t->lost_seen = 0;
+    t->bytes_sent = 0;
+    t->bytes_received = 0;
+    t->busy = 0;
+}
+
+/*
+ * Loopback transport.
+ * */
+static size_t loopback_send(transport_t *t, const transport_iov_t *iov, uint8_t count) {
+    transport_loopback_t *pair = t->context;
+    loopback_ring_t *ring = (t == &pair->a) ? &pair->a_to_b : &pair->b_to_a;
+    size_t total = 0;
+
+    for (uint8_t i = 0; i < count; ++i) {
+        total += iov[i].len;
+    }
+
+    if (TRANSPORT_LOOPBACK_SIZE - (ring->head - ring->tail) < total) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < iov[i].len; ++j) {
+            ring->buf[ring->head++ % TRANSPORT_LOOPBACK_SIZE] = iov[i].base[j];
+        }
+    }
+
+    return total;
+}
+
+static size_t loopback_recv(transport_t *t, uint8_t *buf, size_t len) {
+    transport_loopback_t *pair = t->context;
+    loopback_ring_t *ring = (t == &pair->a) ? &pair->b_to_a : &pair->a_to_b;
+    size_t n = 0;
+
+    while (n < len && ring->tail != ring->head) {
+        buf[n++] = ring->buf[ring->tail++ % TRANSPORT_LOOPBACK_SIZE];
+    }
+
+    return n;
+}
+
+void transport_loopback_init(transport_loopback_t *pair) {
+    transport_init(&pair->a, "loopback", loopback_send, loopback_recv, pair);
+    transport_init(&pair->b, "loopback", loopback_send, loopback_recv, pair);
+
+    pair->a_to_b.head = 0;
+    pair->a_to_b.tail = 0;
+    pair->b_to_a.head = 0;
+    pair->b_to_a.tail = 0;
+}
@@ -0,0 +1,150 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "p_p.h"
+#include "parser.h"
+
+/*
+ * Whatever carries the p_p bytes between two ends: the USART, an I2C bus
+ * to a co-processor, or just memory (for the host benchmarks).
+ *
+ * Both callbacks never block:
+ *
+ * send -> takes the whole vector of buffers or nothing at all, and returns
+ *         the number of bytes taken (0 when it has no room right now).
+ *         All or nothing keeps a packet in one piece, so the link can put
+ *         something more urgent first (see link.h) while a transport is busy.
+ * recv -> copies at most 'len' of the bytes received so far into 'buf',
+ *         and returns how many.
+ * */
+typedef struct transport_iov_t {
+    const uint8_t *base;
+    size_t len;
+} transport_iov_t;
+
+typedef struct transport_t transport_t;
+
+typedef size_t (*transport_send_t)(transport_t *t, const transport_iov_t *iov, uint8_t count);
+typedef size_t (*transport_recv_t)(transport_t *t, uint8_t *buf, size_t len);
+
+struct transport_t {
+    const char *name;
+    transport_send_t send;
+    transport_recv_t recv;
+    // Whatever the transport needs to find its state.
+    void *context;
+    // Bytes the transport itself lost on the way in (e.g. an USART overrun),
+    // counted by the transport and checked by transport_poll. lost_at is
+    // where the first of them since lost_seen went missing, in received
+    // bytes (what bytes_received counts): the parser starts over there,
+    // after the good bytes that came before.
+    volatile uint32_t lost_bytes;
+    volatile uint32_t lost_at;
+    uint32_t lost_seen;
+    // Counters.
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+    uint32_t busy;
+};
+
+/*
+ * Fills in a transport and clears its counters, for the
+ * transports below and any other (e.g. SPI) built the same way.
+ * */
+void transport_init(transport_t *t, const char *name, transport_send_t send, transport_recv_t recv, void *context);
+
+/*
+ * Hands a packet to the transport, framed as configured by P_P_COBS.
+ * Returns -1 if the transport couldn't take it now, try again later.
+ * */
+int transport_send_packet(transport_t *t, const packet_t *p);
+
+/*
+ * Feeds everything the transport received so far to the parser.
+ * Returns the number of bytes.
+ * */
+size_t transport_poll(transport_t *t, parser_t *parser);
+
+/*
+ * In memory transport: two ends, what one sends the other receives.
+ * Each direction holds up to TRANSPORT_LOOPBACK_SIZE bytes (a power of 2).
+ * */
+#define TRANSPORT_LOOPBACK_SIZE 256
+
+typedef struct loopback_ring_t {
+    uint8_t buf[TRANSPORT_LOOPBACK_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} loopback_ring_t;
+
+typedef struct transport_loopback_t {
+    transport_t a;
+    transport_t b;
+    loopback_ring_t a_to_b;
+    loopback_ring_t b_to_a;
+} transport_loopback_t;
+
+void transport_loopback_init(transport_loopback_t *pair);
+
+/*
+ * USART2 transport, driven by its interrupt: sent bytes wait in a TX ring
+ * that the TXE interrupt empties, received ones in an RX ring that the RXNE
+ * interrupt fills. The USART itself is set up by main (setup_usart), and
+ * USART2_IRQHandler must call transport_uart_irq.
+ * */
+#define TRANSPORT_UART_TX 128
+#define TRANSPORT_UART_RX 128
+
+void transport_uart_init(transport_t *t);
+void transport_uart_irq(void);
+
+/*
+ * 1 when the TX ring is empty and the last byte has left the shift
+ * register, so e.g. the baud rate can be changed.
+ * */
+int transport_uart_idle(void);
+
+/*
+ * I2C1 transport, the board is the master and the co-processor a slave at
+ * 'address': a send is one write transfer, a recv one read transfer of up
+ * to TRANSPORT_I2C_CHUNK bytes. When the slave has nothing to say it
+ * answers with TRANSPORT_I2C_IDLE, which the parser just skips (an invalid
+ * length byte, or an empty COBS frame).
+ *
+ * The transfers are those of the I2C1 master (i2c1.h), run by its
+ * interrupts: send starts the write and returns, recv hands out the chunk
+ * the last read got and starts the next one. While a transfer is on the
+ * bus (at 100 kHz, 16 bytes are about 1.5 ms) a send takes 0 bytes, and
+ * has the bus next. A write that fails once started (a NACK, the slave
+ * stuck past I2C1_TIMEOUT_DEFAULT ticks) is counted in
+ * transport_i2c_failed: its packet is lost like one garbled on the USART,
+ * the link sends it again if it's reliable, and the slave's parser drops
+ * the broken start. transport_i2c_timing.scl is the bus speed it got.
+ *
+ * The I2C1 interrupts and the one calling i2c1_tick must share a
+ * preemption priority (see i2c1.h): main calls it from SysTick.
+ * */
+#ifndef P_P_I2C
+#define P_P_I2C 0
+#endif
+
+#define TRANSPORT_I2C_ADDRESS 0x42
+#define TRANSPORT_I2C_CHUNK 16
+// SCL in Hz, up to 400000 (I2C_FAST), a clock that can't do it gets
+// 100000 (I2C_STANDARD).
+#ifndef TRANSPORT_I2C_SPEED
+#define TRANSPORT_I2C_SPEED 100000
+#endif
+#if P_P_COBS
+#define TRANSPORT_I2C_IDLE 0x00
+#else
+#define TRANSPORT_I2C_IDLE 0xFF
+#endif
+
+extern uint32_t transport_i2c_failed;
+
+void transport_i2c_init(transport_t *t, uint8_t address);
+
+#endif // !TRANSPORT_H
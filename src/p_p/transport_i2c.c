@@ -0,0 +1,165 @@
+/*
+ *@brief I2C1 master transport for the p_p protocol.
+ *
+ * The transfers go through the I2C1 master of the i2c project
+ * (src/common/i2c1.c): they run in its interrupts, and send and recv only
+ * start them and hand over what the last one got, never waiting for the
+ * bus. One at a time: recv keeps the bus reading while there's nothing
+ * to send, and a send that found it busy has it next.
+ **/
+#include "transport.h"
+#include "../../inc/peripherals.h"
+#include "../../inc/i2c_timing.h"
+#include "../../inc/i2c1.h"
+
+#define PB8 8
+#define PB9 9
+#define CR1_SWRST       15
+
+// A packet, framed: the most a send takes.
+#define TRANSPORT_I2C_TX (COBS_MAX_ENCODED(PACKET_LENGTH) + 1)
+
+static uint8_t slave;
+static i2c1_xfer_t xfer;
+
+static uint8_t tx_buf[TRANSPORT_I2C_TX];
+
+/*
+ * The chunk of the last read: the interrupt fills it and sets rx_len
+ * once it's over (reading goes back to 0), recv hands it out from rx_at.
+ * Nobody starts another read before it's all gone.
+ * */
+static uint8_t rx_buf[TRANSPORT_I2C_CHUNK];
+static volatile uint8_t rx_len;
+static uint8_t rx_at;
+static volatile uint8_t reading;
+// A send found the bus busy, no read starts before it had its turn: the
+// link offers the packet again on its next poll.
+static uint8_t send_waiting;
+
+/*
+ * The clock setup of the bus, scl is the SCL frequency it gets.
+ * */
+i2c_timing_t transport_i2c_timing;
+
+uint32_t transport_i2c_failed;
+
+/*
+ * A slave with nothing to say only sends idle bytes, and the parser
+ * would skip them anyway, so an all idle chunk is just no bytes.
+ * */
+static uint8_t chunk(const uint8_t *buf, uint8_t got) {
+    for (uint8_t i = 0; i < got; ++i) {
+        if (buf[i] != TRANSPORT_I2C_IDLE) {
+            return got;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * From the I2C1 interrupts, when the write or the read is over.
+ * */
+static void on_done(i2c1_xfer_t *done) {
+    if (done->status != I2C1_DONE) {
+        transport_i2c_failed++;
+    }
+
+    if (done->rx_length > 0) {
+        rx_at = 0;
+        rx_len = done->status == I2C1_DONE ? chunk(rx_buf, done->rx_length) : 0;
+        reading = 0;
+    }
+}
+
+static size_t i2c_send(transport_t *t, const transport_iov_t *iov, uint8_t count) {
+    size_t total = 0;
+
+    if (i2c1_busy()) {
+        send_waiting = 1;
+        return 0;
+    }
+
+    send_waiting = 0;
+
+    for (uint8_t i = 0; i < count; ++i) {
+        if (total + iov[i].len > sizeof(tx_buf)) {
+            return 0;
+        }
+
+        for (size_t j = 0; j < iov[i].len; ++j) {
+            tx_buf[total++] = iov[i].base[j];
+        }
+    }
+
+    if (i2c1_write(&xfer, slave, tx_buf, total, on_done, NULL) < 0) {
+        return 0;
+    }
+
+    return total;
+}
+
+static size_t i2c_recv(transport_t *t, uint8_t *buf, size_t len) {
+    size_t n = 0;
+
+    if (reading) {
+        return 0;
+    }
+
+    while (n < len && rx_at < rx_len) {
+        buf[n++] = rx_buf[rx_at++];
+    }
+
+    // All of the last chunk is out, the next one is on its way by the
+    // time we are called again.
+    if (rx_at == rx_len && !send_waiting && !i2c1_busy()) {
+        reading = 1;
+
+        if (i2c1_read(&xfer, slave, rx_buf, TRANSPORT_I2C_CHUNK, on_done, NULL) < 0) {
+            reading = 0;
+        }
+    }
+
+    return n;
+}
+
+void transport_i2c_init(transport_t *t, uint8_t address) {
+    // We enable the clock of GPIOB (AHB1, Section 6.3.9), and
+    // the one of I2C1 (APB1, Section 6.3.11).
+    RCC->RCC_AHB1ENR |= (1 << 1);
+    RCC->RCC_APB1ENR |= (1 << 21);
+
+    // PB8 (SCL) and PB9 (SDA) in alternate function 4, open drain,
+    // with the pull-ups on (Section 8.4).
+    GPIOB->GPIOx_AFRH &= ~0xFF;
+    GPIOB->GPIOx_AFRH |= 0x44;
+    GPIOB->GPIOx_MODER &= ~(3 << (2 * PB8));
+    GPIOB->GPIOx_MODER &= ~(3 << (2 * PB9));
+    GPIOB->GPIOx_MODER |= (2 << (2 * PB8));
+    GPIOB->GPIOx_MODER |= (2 << (2 * PB9));
+    GPIOB->GPIOx_OTYPER |= (1 << PB8);
+    GPIOB->GPIOx_OTYPER |= (1 << PB9);
+    GPIOB->GPIOx_PUPDR &= ~(0xF << (2 * PB8));
+    GPIOB->GPIOx_PUPDR |= (1 << (2 * PB8));
+    GPIOB->GPIOx_PUPDR |= (1 << (2 * PB9));
+
+    // Reset, then the peripheral clock, TRANSPORT_I2C_SPEED and the
+    // maximum rise time from the real PCLK1 (see i2c_timing.h), and enable.
+    I2C1->I2C_CR1 = (1 << CR1_SWRST);
+    I2C1->I2C_CR1 &= ~(1 << CR1_SWRST);
+
+    if (i2c_timing(i2c_pclk1(), TRANSPORT_I2C_SPEED, &transport_i2c_timing) < 0) {
+        i2c_timing(i2c_pclk1(), I2C_STANDARD, &transport_i2c_timing);
+    }
+
+    i2c_timing_apply(I2C1, &transport_i2c_timing);
+    i2c1_init();
+
+    slave = address;
+    rx_len = 0;
+    rx_at = 0;
+    reading = 0;
+    send_waiting = 0;
+    transport_init(t, "i2c", i2c_send, i2c_recv, NULL);
+}
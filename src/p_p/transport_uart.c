@@ -0,0 +1,140 @@
+/*
+ *@brief interrupt driven USART2 transport for the p_p protocol.
+ *
+ * The main loop and the USART2 interrupt share two rings: the main loop
+ * writes the TX ring and reads the RX ring, the interrupt does the opposite,
+ * and each index is written by one side only.
+ **/
+#include "transport.h"
+#include "../../inc/peripherals.h"
+
+#define SR_ORE 3
+#define SR_RXNE 5
+#define SR_TC 6
+#define SR_TXE 7
+#define CR1_RXNEIE 5
+#define CR1_TXEIE 7
+
+/*
+ * Keeps the compiler from moving the ring writes past the index update.
+ * */
+#define TRANSPORT_BARRIER() __asm volatile ("" ::: "memory")
+
+static uint8_t tx_ring[TRANSPORT_UART_TX];
+static volatile uint16_t tx_head;
+static volatile uint16_t tx_tail;
+
+static uint8_t rx_ring[TRANSPORT_UART_RX];
+static volatile uint16_t rx_head;
+static volatile uint16_t rx_tail;
+// All the bytes that went in the RX ring, for lost_at.
+static uint32_t rx_count;
+
+static transport_t *uart;
+
+static size_t uart_send(transport_t *t, const transport_iov_t *iov, uint8_t count) {
+    size_t total = 0;
+
+    for (uint8_t i = 0; i < count; ++i) {
+        total += iov[i].len;
+    }
+
+    if (TRANSPORT_UART_TX - (uint16_t)(tx_head - tx_tail) < total) {
+        return 0;
+    }
+
+    uint16_t head = tx_head;
+
+    for (uint8_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < iov[i].len; ++j) {
+            tx_ring[head++ % TRANSPORT_UART_TX] = iov[i].base[j];
+        }
+    }
+
+    TRANSPORT_BARRIER();
+    tx_head = head;
+
+    // The TXE interrupt takes it from here, and turns itself off
+    // once the ring is empty (Section 19.6.4).
+    USART2->USART_CR1 |= (1 << CR1_TXEIE);
+
+    return total;
+}
+
+static size_t uart_recv(transport_t *t, uint8_t *buf, size_t len) {
+    size_t n = 0;
+    uint16_t tail = rx_tail;
+
+    while (n < len && tail != rx_head) {
+        buf[n++] = rx_ring[tail++ % TRANSPORT_UART_RX];
+    }
+
+    TRANSPORT_BARRIER();
+    rx_tail = tail;
+
+    return n;
+}
+
+void transport_uart_init(transport_t *t) {
+    tx_head = 0;
+    tx_tail = 0;
+    rx_head = 0;
+    rx_tail = 0;
+    rx_count = 0;
+
+    transport_init(t, "uart", uart_send, uart_recv, NULL);
+    uart = t;
+}
+
+/*
+ * Counts a byte lost before the next one that goes in the RX ring, and
+ * where, if it's the first transport_poll hasn't seen yet.
+ * */
+static void lost(void) {
+    if (uart == NULL) {
+        return;
+    }
+
+    if (uart->lost_bytes == uart->lost_seen) {
+        uart->lost_at = rx_count;
+        TRANSPORT_BARRIER();
+    }
+
+    uart->lost_bytes++;
+}
+
+void transport_uart_irq(void) {
+    // Reading SR followed by DR clears both the RXNE and the ORE flags (Section 19.6.1).
+    uint32_t status = USART2->USART_SR;
+
+    if (status & ((1 << SR_RXNE) | (1 << SR_ORE))) {
+        uint8_t byte = USART2->USART_DR;
+
+        // On an overrun at least one byte got lost before this one.
+        if (status & (1 << SR_ORE)) {
+            lost();
+        }
+
+        if ((uint16_t)(rx_head - rx_tail) < TRANSPORT_UART_RX) {
+            rx_ring[rx_head % TRANSPORT_UART_RX] = byte;
+            TRANSPORT_BARRIER();
+            rx_head++;
+            rx_count++;
+        } else {
+            lost();
+        }
+    }
+
+    if ((status & (1 << SR_TXE)) && (USART2->USART_CR1 & (1 << CR1_TXEIE))) {
+        if (tx_tail != tx_head) {
+            USART2->USART_DR = tx_ring[tx_tail % TRANSPORT_UART_TX];
+            tx_tail++;
+        } else {
+            USART2->USART_CR1 &= ~(1 << CR1_TXEIE);
+        }
+    }
+}
+
+int transport_uart_idle(void) {
+    return tx_tail == tx_head && (USART2->USART_SR & (1 << SR_TC));
+}
@@ -0,0 +1,42 @@
+/*
+ *@brief USART2 byte level access for the p_p protocol.
+ *
+ * This is the only part of the protocol that touches the hardware, on the
+ * host the same functions are implemented on top of a file descriptor (see host/peer.c).
+ **/
+#include "p_p.h"
+#include "../../inc/peripherals.h"
+
+void write_byte(uint8_t byte) {
+    // We check if there are any data that is being transferred 
+    // using the USART_SR register, if the bit 7 is 1, it means that 
+    // the data has finished writing.
+    // If so, we can use the USART_DR register to write the new data.
+    //
+    // Section 19.6.1
+    while(!((USART2->USART_SR & (1 << 7)))); 
+
+    // Sets the data register to the ASCII code of the 
+    // character 'x' by bitwise ANDing it with 0xFF
+    // to ensure only the lower 8 bits (byte that we wanna transmit) are considered.
+    // To see the actual bytes sent, I used picocom, but any dumb-terminal emulation works
+    // fine:
+    //
+    // picocom -b 9600 /dev/ttyACM0.
+    USART2->USART_DR = (byte & 0xFF); 
+
+    // We wait for the transmission to be completed.
+    while(!(USART2->USART_SR & (1 << 6)));
+}
+
+uint8_t read_byte() {
+    // We check if there are any data that is being transferred 
+    // using the USART_SR register, if the bit 5 is 1, it means that 
+    // the data has finished writing.
+    // If so, we can return the USART_DR register to read new data.
+    //
+    // Section 19.6.1
+    while(!((USART2->USART_SR & (1 << 5))));
+
+    return USART2->USART_DR;
+}
@@ -2,6 +2,7 @@
  *@brief simple pwm project
  **/
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
 
 #define MODER 2
 #define pin5 5
@@ -85,18 +86,6 @@ void setup_tim(void) {
     TIM2->TIMx_CR1 |= 1;
 }
 
-void setup_syst(void) {
-    // We load the reload register with the maximum value (Section 4.4.2)
-    SYST->SYST_RVR = 250000 - 1;
-
-    // We set as internal source the processor clock, from where our systick will 'based' on, the 
-    // 'rhythm' to derive from (Section 4.4.1).
-    SYST->SYST_CSR |= (1 << 2);
-    
-    // We then proceed to finally enable the SysTick timer (Section 4.4.1)
-    SYST->SYST_CSR |= (1 << 0);
-}
-
 /**
  * @brief Main entry point for pwm project
  *
@@ -122,9 +111,12 @@ void setup_syst(void) {
  * switching it on and off really quickly.
  **/
 int main(void) {
+    systick_t systick;
+
     setup_gpio();
     setup_tim();
-    setup_syst();
+    // A step of the fade 64 times a second, 1.5 s from off to full.
+    systick_setup(&systick, 64, 0);
 
     float duty_cycle = 0.0f;
     set_duty_cycle(duty_cycle);
@@ -2,6 +2,7 @@
  * @brieft simple systick project
  * */
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
 
 #define MODER 2
 #define pin5 5
@@ -73,18 +74,11 @@ int main(void) {
     // This is a OR operation, in particular in this case...
     GPIOA->GPIOx_MODER |=  (1 << (pin5 * MODER));
 
-    // Enable Clock for SysTick (Section 6.3.12)
-    RCC->RCC_APB2ENR |= (1 << 14);
-
-    // We load the reload register with the maximum value (Section 4.4.2)
-    SYST->SYST_RVR |= 0x00FFFFFF;
-
-    // We set as internal source the processor clock, from where our systick will 'based' on, the 
-    // 'rhythm' to derive from (Section 4.4.1).
-    SYST->SYST_CSR |= (1 << 2);
-    
-    // We then proceed to finally enable the SysTick timer (Section 4.4.1)
-    SYST->SYST_CSR |= (1 << 0);
+    // One tick per second, the driver works out the reload value from the
+    // clock we run at (see inc/systick.h), no interrupt: we look at the
+    // COUNTFLAG below.
+    systick_t systick;
+    systick_setup(&systick, 1, 0);
 
     while (1) {
         // We check each iteration if the timer has expired
@@ -0,0 +1,271 @@
+/*
+ *@brief cost of the timing wheel against polling minimal_timer_t one by one.
+ *
+ * The same n auto reset timers, with random wait times, run for the given
+ * number of ticks in two ways:
+ *
+ * polling -> has_timer_elapsed on every timer, every tick, like the main
+ *            loop of the timer project used to
+ * wheel   -> wheel_advance once per tick, from the same loop
+ *
+ * There's no SysTick here: get_systicks is a counter the bench moves one
+ * tick at a time, as fast as it can, so what's measured is the CPU time per
+ * tick. Both ways must see every timer expire on the exact tick it's due,
+ * the same number of times.
+ *
+ * Two sets of wait times:
+ * short -> 1 to 1000 ticks, a few timers due every tick
+ * long  -> 1 to 600000 ticks (10 minutes), most ticks nothing is due
+ *
+ * tickless -> the wheel again, but instead of every tick the loop jumps
+ *            straight to the one wheel_next says, capped at what SysTick
+ *            can count in one go, like the tickless idle of the timer
+ *            project: wakeups per second, against 1000 with a periodic tick
+ *
+ * Then the cost of wheel_start and wheel_cancel with n timers running.
+ *
+ * Usage: wheel_bench [-n timers] [-t ticks] [-s seed]
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "timer.h"
+#include "wheel.h"
+
+typedef struct waits_t {
+    const char *name;
+    uint32_t min;
+    uint32_t max;
+} waits_t;
+
+/*
+ * The longest a tickless sleep lasts: 2^24 SysTick cycles at 16 MHz.
+ * */
+#define TICKLESS_MAX_TICKS (0x00FFFFFF / (16000000 / 1000))
+
+static const waits_t wait_sets[] = {
+    {"short", 1, 1000},
+    {"long", 1, 600000},
+};
+
+static uint32_t ticks;
+
+uint32_t get_systicks() {
+    return ticks;
+}
+
+static uint64_t expirations;
+static uint64_t late;
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_expired(wheel_timer_t *timer, void *context) {
+    // Already moved on to the next period, the one that
+    // ended is a wait time before.
+    if (timer->timer.target_time - timer->timer.wait_time != ticks) {
+        late++;
+    }
+
+    expirations++;
+}
+
+static void random_waits(uint32_t *waits, uint32_t n, const waits_t *set) {
+    for (uint32_t i = 0; i < n; i++) {
+        waits[i] = set->min + (uint32_t)(rand() % (set->max - set->min + 1));
+    }
+}
+
+static double run_polling(const uint32_t *waits, uint32_t n, uint32_t length) {
+    minimal_timer_t *timers = malloc(n * sizeof(*timers));
+
+    ticks = 0;
+    expirations = 0;
+    late = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        setup_timer(&timers[i], waits[i], 1);
+    }
+
+    double start = now_s();
+
+    for (uint32_t t = 0; t < length; t++) {
+        ticks++;
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t due = timers[i].target_time;
+
+            if (has_timer_elapsed(&timers[i])) {
+                late += due != ticks;
+                expirations++;
+            }
+        }
+    }
+
+    double elapsed = now_s() - start;
+
+    free(timers);
+
+    return elapsed;
+}
+
+/*
+ * Returns how many times the loop woke up.
+ * */
+static uint32_t run_wheel(const uint32_t *waits, uint32_t n, uint32_t length, int tickless, wheel_t *wheel,
+                          double *elapsed) {
+    wheel_timer_t *timers = calloc(n, sizeof(*timers));
+
+    ticks = 0;
+    expirations = 0;
+    late = 0;
+
+    wheel_init(wheel, get_systicks());
+
+    for (uint32_t i = 0; i < n; i++) {
+        wheel_start(wheel, &timers[i], waits[i], 1, on_expired, NULL);
+    }
+
+    uint32_t wakeups = 0;
+    double start = now_s();
+
+    while (ticks < length) {
+        uint32_t step = 1;
+
+        if (tickless) {
+            step = wheel_next(wheel);
+            step = step < TICKLESS_MAX_TICKS ? step : TICKLESS_MAX_TICKS;
+            // The end of the run is a deadline too.
+            step = step < length - ticks ? step : length - ticks;
+        }
+
+        ticks += step;
+        wheel_advance(wheel, get_systicks());
+        wakeups++;
+    }
+
+    *elapsed = now_s() - start;
+
+    free(timers);
+
+    return wakeups;
+}
+
+/*
+ * Every timer started, then cancelled, 'rounds' times, while the others
+ * of the n keep running: ns per call.
+ * */
+static void run_start_cancel(const uint32_t *waits, uint32_t n, uint32_t rounds, wheel_t *wheel) {
+    wheel_timer_t *timers = calloc(n, sizeof(*timers));
+    double start_s = 0;
+    double cancel_s = 0;
+
+    ticks = 0;
+    wheel_init(wheel, get_systicks());
+
+    for (uint32_t i = 0; i < n; i++) {
+        wheel_start(wheel, &timers[i], waits[i], 1, on_expired, NULL);
+    }
+
+    for (uint32_t r = 0; r < rounds; r++) {
+        double t0 = now_s();
+
+        for (uint32_t i = 0; i < n; i++) {
+            wheel_cancel(wheel, &timers[i]);
+        }
+
+        double t1 = now_s();
+
+        for (uint32_t i = 0; i < n; i++) {
+            wheel_start(wheel, &timers[i], waits[(i + r) % n], 1, on_expired, NULL);
+        }
+
+        cancel_s += t1 - t0;
+        start_s += now_s() - t1;
+    }
+
+    printf("wheel_start  %6.1f ns, wheel_cancel %6.1f ns (%u timers running, every level)\n",
+           start_s * 1e9 / ((double)n * rounds), cancel_s * 1e9 / ((double)n * rounds), n);
+
+    free(timers);
+}
+
+int main(int argc, char **argv) {
+    uint32_t n = 10000;
+    uint32_t length = 60000;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:s:")) != -1) {
+        switch (opt) {
+        case 'n': n = strtoul(optarg, NULL, 0); break;
+        case 't': length = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n timers] [-t ticks] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (n == 0 || length == 0) {
+        fprintf(stderr, "timers and ticks must be more than 0\n");
+        return 1;
+    }
+
+    uint32_t *waits = malloc(n * sizeof(*waits));
+    wheel_t *wheel = malloc(sizeof(*wheel));
+
+    printf("%u timers, %u ticks, wheel of %u levels x %u slots (%zu bytes), %zu bytes per timer (polling %zu)\n",
+           n, length, WHEEL_LEVELS, WHEEL_SLOTS, sizeof(wheel_t), sizeof(wheel_timer_t), sizeof(minimal_timer_t));
+
+    for (uint32_t s = 0; s < sizeof(wait_sets) / sizeof(wait_sets[0]); s++) {
+        srand(seed);
+        random_waits(waits, n, &wait_sets[s]);
+
+        double polling = run_polling(waits, n, length);
+        uint64_t polling_expirations = expirations;
+        uint64_t polling_late = late;
+
+        double wheeled;
+        run_wheel(waits, n, length, 0, wheel, &wheeled);
+
+        printf("%-5s waits %u-%u: polling %8.1f ns/tick, wheel %7.1f ns/tick (x%.0f) | expirations %llu/%llu,"
+               " late %llu/%llu, cascaded %u\n",
+               wait_sets[s].name, wait_sets[s].min, wait_sets[s].max,
+               polling * 1e9 / length, wheeled * 1e9 / length, polling / wheeled,
+               (unsigned long long)polling_expirations, (unsigned long long)expirations,
+               (unsigned long long)polling_late, (unsigned long long)late, wheel->cascaded);
+
+        if (polling_expirations != expirations || polling_late != 0 || late != 0) {
+            printf("MISMATCH\n");
+            return 1;
+        }
+
+        double tickless;
+        uint32_t wakeups = run_wheel(waits, n, length, 1, wheel, &tickless);
+
+        printf("      tickless: %8.1f wakeups/s (periodic 1000), %7.1f ns/tick | expirations %llu, late %llu\n",
+               wakeups * 1000.0 / length, tickless * 1e9 / length,
+               (unsigned long long)expirations, (unsigned long long)late);
+
+        if (polling_expirations != expirations || late != 0) {
+            printf("MISMATCH\n");
+            return 1;
+        }
+    }
+
+    srand(seed);
+    random_waits(waits, n, &wait_sets[1]);
+    run_start_cancel(waits, n, 100, wheel);
+
+    free(wheel);
+    free(waits);
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include "../../inc/peripherals.h"
+#include "../../inc/critical.h"
+#include "../../inc/irq.h"
+#include "hrtimer.h"
+
+#include <stddef.h>
+
+#define TIM2_EN 0
+#define CR1_CEN 0
+#define EGR_UG 0
+// CC1IF/CC1IE/CC1G are bit 1 of SR/DIER/EGR, the other channels follow.
+#define CC_BIT(channel) (1 << ((channel) + 1))
+
+/*
+ * @brief Pending timers sorted by deadline, and the one on each channel.
+ * */
+static hrtimer_t *s_pending;
+static hrtimer_t *s_armed[HRTIMER_CHANNELS];
+
+static __IO uint32_t *compare(uint8_t channel) {
+    return &TIM2->TIMx_CCR1 + channel;
+}
+
+static void channel_arm(uint8_t channel, hrtimer_t *timer) {
+    s_armed[channel] = timer;
+    timer->channel = channel;
+
+    *compare(channel) = timer->deadline;
+    // A flag left from the timer it had before.
+    TIM2->TIMx_SR = ~CC_BIT(channel);
+    TIM2->TIMx_DIER |= CC_BIT(channel);
+
+    // The counter may be past the deadline already (or get past it while
+    // we were writing CCR): there won't be a match until it wraps, so the
+    // compare event is generated by hand (Section 13.4.6, CCxG).
+    if ((int32_t)(TIM2->TIMx_CNT - timer->deadline) >= 0) {
+        TIM2->TIMx_EGR = CC_BIT(channel);
+    }
+}
+
+static void channel_disarm(uint8_t channel) {
+    TIM2->TIMx_DIER &= ~CC_BIT(channel);
+    TIM2->TIMx_SR = ~CC_BIT(channel);
+
+    s_armed[channel]->channel = HRTIMER_CHANNELS;
+    s_armed[channel] = NULL;
+}
+
+/*
+ * @brief Makes the first HRTIMER_CHANNELS timers of the list the armed
+ * ones: the channels of those that fell behind go to those that moved up.
+ * */
+static void hrtimer_rearm(void) {
+    uint8_t keep = 0;
+    uint8_t n = 0;
+
+    for (hrtimer_t *t = s_pending; t != NULL && n < HRTIMER_CHANNELS; t = t->next, ++n) {
+        if (t->channel < HRTIMER_CHANNELS) {
+            keep |= 1 << t->channel;
+        }
+    }
+
+    for (uint8_t channel = 0; channel < HRTIMER_CHANNELS; ++channel) {
+        if (s_armed[channel] != NULL && !(keep & (1 << channel))) {
+            channel_disarm(channel);
+        }
+    }
+
+    n = 0;
+
+    for (hrtimer_t *t = s_pending; t != NULL && n < HRTIMER_CHANNELS; t = t->next, ++n) {
+        if (t->channel < HRTIMER_CHANNELS) {
+            continue;
+        }
+
+        for (uint8_t channel = 0; channel < HRTIMER_CHANNELS; ++channel) {
+            if (s_armed[channel] == NULL) {
+                channel_arm(channel, t);
+                break;
+            }
+        }
+    }
+}
+
+static void hrtimer_remove(hrtimer_t *timer) {
+    hrtimer_t **link = &s_pending;
+
+    while (*link != timer) {
+        link = &(*link)->next;
+    }
+
+    *link = timer->next;
+    timer->next = NULL;
+    timer->pending = 0;
+
+    if (timer->channel < HRTIMER_CHANNELS) {
+        channel_disarm(timer->channel);
+    }
+}
+
+void hrtimer_setup(void) {
+    // Enable the clock for TIM2 (Section 6.3.11), APB1 isn't divided,
+    // so it counts at 16 MHz with no prescaler.
+    RCC->RCC_APB1ENR |= (1 << TIM2_EN);
+
+    TIM2->TIMx_CR1 = 0;
+    TIM2->TIMx_PSC = 0;
+    // All 32 bits, it wraps at 2^32 (Section 13.4.12).
+    TIM2->TIMx_ARR = 0xFFFFFFFF;
+    // The prescaler is only loaded on an update event.
+    TIM2->TIMx_EGR = (1 << EGR_UG);
+    TIM2->TIMx_DIER = 0;
+    TIM2->TIMx_SR = 0;
+
+    for (uint8_t channel = 0; channel < HRTIMER_CHANNELS; ++channel) {
+        s_armed[channel] = NULL;
+    }
+    s_pending = NULL;
+
+    // The channels stay in their reset mode, frozen outputs (Section 13.4.7):
+    // the pins don't change, only the flag is set on a match.
+    // Start and cancel keep it out with a critical section, so it has to be
+    // one of the priorities that masks (it resets to 0, above all of them).
+    NVIC->NVIC_IPR[TIM2_IRQ] = PRIORITY(CRITICAL_PRIORITY);
+    NVIC->NVIC_ISER[TIM2_IRQ / 32] = (1 << (TIM2_IRQ % 32));
+    TIM2->TIMx_CR1 |= (1 << CR1_CEN);
+}
+
+uint32_t hrtimer_now(void) {
+    return TIM2->TIMx_CNT;
+}
+
+void hrtimer_start_at(hrtimer_t *timer, uint32_t deadline, hrtimer_callback_t callback, void *context) {
+    // They run in callbacks too, where TIM2 is already masked: it nests.
+    uint32_t basepri = critical_enter();
+
+    if (timer->pending) {
+        hrtimer_remove(timer);
+    }
+
+    timer->deadline = deadline;
+    timer->callback = callback;
+    timer->context = context;
+    timer->pending = 1;
+    timer->channel = HRTIMER_CHANNELS;
+
+    // After the ones due at the same time, they run in the order they were started.
+    hrtimer_t **link = &s_pending;
+
+    while (*link != NULL && (int32_t)((*link)->deadline - deadline) <= 0) {
+        link = &(*link)->next;
+    }
+
+    timer->next = *link;
+    *link = timer;
+
+    hrtimer_rearm();
+    critical_exit(basepri);
+}
+
+void hrtimer_start_us(hrtimer_t *timer, uint32_t delay_us, hrtimer_callback_t callback, void *context) {
+    if (delay_us > HRTIMER_MAX_COUNTS / HRTIMER_COUNTS_PER_US) {
+        delay_us = HRTIMER_MAX_COUNTS / HRTIMER_COUNTS_PER_US;
+    }
+
+    hrtimer_start_at(timer, hrtimer_now() + delay_us * HRTIMER_COUNTS_PER_US, callback, context);
+}
+
+void hrtimer_cancel(hrtimer_t *timer) {
+    uint32_t basepri = critical_enter();
+
+    if (timer->pending) {
+        hrtimer_remove(timer);
+        hrtimer_rearm();
+    }
+
+    critical_exit(basepri);
+}
+
+void TIM2_IRQHandler(void) {
+    irq_enter(TIM2_IRQ);
+
+    // How late we are for the first timer due, TIM2 counts the CPU
+    // clock: that's the entry latency (see irq.h).
+    if (s_pending != NULL) {
+        int32_t late = (int32_t)(TIM2->TIMx_CNT - s_pending->deadline);
+
+        if (late >= 0) {
+            irq_latency(TIM2_IRQ, late);
+        }
+    }
+
+    uint32_t flags = TIM2->TIMx_SR & TIM2->TIMx_DIER;
+
+    TIM2->TIMx_SR = ~flags;
+
+    // Whatever the channel that matched, the timers due are at the head of
+    // the list: they run in deadline order, ones started from a callback
+    // with a deadline already past included.
+    while (s_pending != NULL && (int32_t)(TIM2->TIMx_CNT - s_pending->deadline) >= 0) {
+        hrtimer_t *timer = s_pending;
+
+        hrtimer_remove(timer);
+        timer->callback(timer, timer->context);
+    }
+
+    hrtimer_rearm();
+
+    irq_exit(TIM2_IRQ);
+}
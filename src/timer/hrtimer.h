@@ -0,0 +1,79 @@
+#ifndef HRTIMER_H
+#define HRTIMER_H
+
+#include <stdint.h>
+
+/*
+ * One-shot timers with the resolution of TIM2 instead of the 1 ms tick,
+ * for protocol timeouts and sampling at exact times.
+ *
+ * TIM2 is a 32 bit timer, here counting at the full 16 MHz (62.5 ns per
+ * count) and never stopped, so it's also the clock the deadlines are in:
+ * it wraps every ~268 s, all the comparisons are on differences, and a
+ * deadline can be at most HRTIMER_MAX_COUNTS (~134 s) away.
+ *
+ * Any number of timers, on TIM2's 4 compare channels: they are kept in a
+ * list sorted by deadline, and the first 4 are always armed, each on its
+ * own channel. The compare match raises the interrupt with no software
+ * in between, and timers due within a few µs of each other don't wait for
+ * one interrupt to re-arm the channel for the next one. When one fires
+ * its channel goes to the next timer in the list that isn't armed yet.
+ *
+ * The callbacks run in the TIM2 interrupt, and may start timers (their
+ * own too) or cancel them, as anything else can from any context.
+ * A timer must be zeroed before its first start, static ones already are.
+ * */
+#define HRTIMER_FREQUENCY 16000000
+#define HRTIMER_COUNTS_PER_US (HRTIMER_FREQUENCY / 1000000)
+#define HRTIMER_MAX_COUNTS 0x7FFFFFFFu
+#define HRTIMER_CHANNELS 4
+#define TIM2_IRQ 28
+
+struct hrtimer_t;
+
+typedef void (*hrtimer_callback_t)(struct hrtimer_t *timer, void *context);
+
+typedef struct hrtimer_t {
+    struct hrtimer_t *next;
+    // In TIM2 counts, see hrtimer_now.
+    uint32_t deadline;
+    hrtimer_callback_t callback;
+    void *context;
+    uint8_t pending;
+    // Compare channel it's armed on, HRTIMER_CHANNELS when it isn't.
+    uint8_t channel;
+} hrtimer_t;
+
+/*
+ * Starts TIM2 and its interrupt.
+ * */
+void hrtimer_setup(void);
+
+/*
+ * TIM2 counts since hrtimer_setup.
+ * */
+uint32_t hrtimer_now(void);
+
+/*
+ * Runs 'callback' 'delay_us' microseconds from now.
+ * */
+void hrtimer_start_us(hrtimer_t *timer, uint32_t delay_us, hrtimer_callback_t callback, void *context);
+
+/*
+ * Runs 'callback' when TIM2 gets to 'deadline', one already past runs
+ * right away. For periodic work without drift, start the next one from
+ * the deadline of the last: deadline + period.
+ * */
+void hrtimer_start_at(hrtimer_t *timer, uint32_t deadline, hrtimer_callback_t callback, void *context);
+
+/*
+ * Stops 'timer', nothing happens if it isn't pending.
+ * */
+void hrtimer_cancel(hrtimer_t *timer);
+
+/*
+ * The TIM2 interrupt handler.
+ * */
+void TIM2_IRQHandler(void);
+
+#endif // !HRTIMER_H
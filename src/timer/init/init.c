@@ -20,26 +20,21 @@ extern int main(void);
 extern void __libc_init_array(void);
 void Reset_handler          (void);
 extern void SysTick_Handler        (void);
+extern void TIM2_IRQHandler        (void);
+extern void USART2_IRQHandler      (void);
 
 /** Initialize Interrupt Vector **/
 __attribute__ ((section(".isr_vector")))
 void (* const fpn_vector[])(void) = {
     (void (*)(void))(&_estack),
     Reset_handler,
-    0,
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    0, 
-    SysTick_Handler
+    [15] = SysTick_Handler,
+    /*
+     * The peripheral interrupts start right after the 16 system exceptions,
+     * TIM2 is the IRQ number 28, USART2 38 (Section 10.2, vector table).
+     * */
+    [16 + 28] = TIM2_IRQHandler,
+    [16 + 38] = USART2_IRQHandler,
 };
 
 void Reset_handler(void){
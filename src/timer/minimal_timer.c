@@ -0,0 +1,30 @@
+#include "timer.h"
+
+void setup_timer(minimal_timer_t *timer, uint32_t wait_time, int auto_reset) {
+    timer->wait_time = wait_time;
+    timer->auto_reset = auto_reset;
+    timer->target_time = get_systicks() + (wait_time);
+}
+
+int has_timer_elapsed(minimal_timer_t *timer) {
+    uint32_t now = get_systicks();
+
+    // The difference read as signed keeps working when s_ticks wraps:
+    // a target just past the wrap is still 'in the future' for a 'now'
+    // just before it, where now >= target_time would already be true.
+    int32_t delta = (int32_t)(now - timer->target_time);
+
+    if (delta >= 0) {
+        // Next period starts from when this one should have ended,
+        // so a late check doesn't make the timer drift.
+        timer->target_time = (now + timer->wait_time) - delta;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+void timer_reset(minimal_timer_t *timer) {
+    setup_timer(timer, timer->wait_time, timer->auto_reset);
+}
@@ -95,24 +95,11 @@ int read_byte() {
     return USART2->USART_DR;
 }
 
-void write_byte(uint8_t byte) {
-    // We check if there are any data that is being transferred 
-    // using the USART_SR register, if the bit 7 is 1, it means that 
-    // the data has finished writing.
-    // If so, we can use the USART_DR register to write the new data.
-    //
-    // Section 19.6.1
-    while(!((USART2->USART_SR & (1 << 7)))); 
-
-    // Sets the data register to the ASCII code of the 
-    // character 'x' by bitwise ANDing it with 0xFF
-    // to ensure only the lower 8 bits (byte that we wanna transmit) are considered.
-    // To see the actual bytes sent, I used picocom, but any dumb-terminal emulation works
-    // fine:
-    //
-    // picocom -b 9600 /dev/ttyACM0.
-    USART2->USART_DR = (byte & 0xFF); 
-}
+/*
+ * In timer.c: it queues the byte for the USART2 interrupt, a printf
+ * doesn't wait for the bytes to go out.
+ * */
+void write_byte(uint8_t byte);
 
 __attribute__((weak)) int _write(int file, char *ptr, int len)
 {
@@ -2,8 +2,15 @@
  *@brief simple redirect printf to uart project
  **/
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
 #include <stddef.h>
 #include "timer.h"
+#include "wheel.h"
+#include "hrtimer.h"
+#include "../../inc/event.h"
+#include "../../inc/critical.h"
+#include "../../inc/irq.h"
+#include "../../inc/queue.h"
 #include <stdint.h>
 #include <stdio.h>
 
@@ -11,6 +18,25 @@
 #define pin5 5
 #define MODER 2
 #define CPU_FREQUENCY 16000000
+#define TICK_FREQUENCY 1000
+#define ICSR_PENDSTSET 26
+#define CSR_ENABLE 0
+#define CSR_COUNTFLAG 16
+#define CYCLES_PER_TICK (CPU_FREQUENCY / TICK_FREQUENCY)
+// The longest SysTick counts in one go: its counter has 24 bits.
+#define SYST_MAX_RELOAD 0x00FFFFFF
+#define TICKLESS_MAX_TICKS (SYST_MAX_RELOAD / CYCLES_PER_TICK)
+// Less than this left of a tick when we wake up, and the
+// counter would reach 0 before we are done setting it up.
+#define TICKLESS_MIN_CYCLES 64
+#define REPORT_TICKS 10000
+#define PROBE_TICKS 250
+#define HRTIMER_PROBES 3
+#define USART2_IRQ 38
+#define SR_TXE 7
+#define CR1_TXEIE 7
+// A whole report, with room to spare.
+#define TX_RING_SIZE 1024
 
 /**
  * @brief Struct Pointer for RCC Peripherals assigned with fixed address specified in reference manual.
@@ -40,21 +66,271 @@ USART_t * const USART2 = (USART_t *) 0x40004400;
  * */
 SYST_t * const SYST = (SYST_t *) 0xE000E010;
 
+/*
+ * @brief Struct Pointer for TIM2 Peripherals assigned with fixed address specified in reference manual.
+ *
+ * See Memory map, Section 2.3.
+ * */
+TIMx_t * const TIM2 = (TIMx_t *) 0x40000000;
+
+/*
+ * @brief Struct Pointer for the NVIC assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.2 Nested Vectored Interrupt Controller (ARM-cortex-m4 datasheet).
+ * */
+NVIC_t * const NVIC = (NVIC_t *) 0xE000E100;
+
+/*
+ * @brief Struct Pointer for the SCB assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.3 System control block (ARM-cortex-m4 datasheet).
+ * */
+SCB_t * const SCB = (SCB_t *) 0xE000ED00;
+
+/*
+ * @brief Struct Pointers for the DWT and the debug control block, the event loop
+ * counts cycles with them.
+ *
+ * See section C1.8 of the ARMv7-M architecture reference manual.
+ * */
+DWT_t * const DWT = (DWT_t *) 0xE0001000;
+DCB_t * const DCB = (DCB_t *) 0xE000EDF0;
+
+/*
+ * @brief Interrupt priorities (see irq.h), 4 bits of preemption so they
+ * are the numbers CRITICAL_PRIORITY goes by.
+ *
+ * TIM2 runs the hrtimer callbacks, the control loop kind of work that
+ * has to be on time: above SysTick, at the priority the hrtimer critical
+ * sections mask. SysTick only counts and posts, below it. USART2 feeds
+ * the bytes of the report to the USART, a byte every ~1 ms: the lowest.
+ *
+ * Budgets in DWT cycles, 62.5 ns each: TIM2 is 10 us late at most (its
+ * latency is measured from the deadline it matched).
+ * */
+#define IRQ_TIM2 0
+#define IRQ_TICK 1
+#define IRQ_USART2 2
+#define IRQ_COUNT 3
+
+static const char * const irq_names[IRQ_COUNT] = {"TIM2", "SysTick", "USART2"};
+
+static const irq_config_t irqs[IRQ_COUNT] = {
+    [IRQ_TIM2] = {.irq = TIM2_IRQ, .preempt = CRITICAL_PRIORITY, .latency_budget = 160, .run_budget = 800},
+    [IRQ_TICK] = {.irq = IRQ_SYSTICK, .preempt = CRITICAL_PRIORITY + 1, .run_budget = 300},
+    [IRQ_USART2] = {.irq = USART2_IRQ, .preempt = CRITICAL_PRIORITY + 2, .run_budget = 200},
+};
+
+/*
+ * @brief The main loop is the event loop (see event.h), with one queue:
+ * the ticks, that advance the wheel. A tick it hasn't run yet is enough,
+ * the wheel catches up to get_systicks by itself.
+ *
+ * SysTick is the one posting to it, or the tickless sleep when it counts
+ * the ticks it slept through, with interrupts off.
+ * */
+#define SIGNAL_TICK 0
+
+static event_queue_t tick_queue;
+
+static void post_tick(void) {
+    if (event_queue_empty(&tick_queue)) {
+        event_post(&tick_queue, SIGNAL_TICK, 0);
+    }
+}
+
 /*
  * @brief Simple variable (and relative function) that keeps track of the number of ticks that happened since
- * the program started.
+ * the program started, one tick is 1 ms (see systick_setup in main).
  *
  * Gets called everytime SysTick generates an interrupt.
+ * s_ticks_high counts the times s_ticks wrapped (every ~49 days), the two
+ * together make the 64 bit tick count used by get_micros64.
  * */
 static volatile uint32_t s_ticks;
+static volatile uint32_t s_ticks_high;
 void SysTick_Handler(void) {
-    s_ticks++;
+    irq_enter(IRQ_SYSTICK);
+
+    if (++s_ticks == 0) {
+        s_ticks_high++;
+    }
+
+    post_tick();
+
+    irq_exit(IRQ_SYSTICK);
 }
 
 uint32_t get_systicks() {
     return s_ticks;
 }
 
+/*
+ * @brief Microseconds since startup, on 64 bits so it never wraps.
+ *
+ * It's the ticks, plus how far SysTick has counted down into the current
+ * one (SYST_CVR counts from RVR down to 0, one step per CPU cycle).
+ *
+ * Two races to take care of:
+ * - the interrupt comes in between our reads, and changes the ticks:
+ *   we notice it, and read everything again;
+ * - the counter reloaded, but the interrupt didn't run yet (we are inside
+ *   an interrupt ourselves, or they are disabled): PENDSTSET (Section 4.3.3)
+ *   is set, so that tick counts as well, and the counter is read again
+ *   since we don't know if the first read was before or after the reload.
+ *
+ * No division (CPU_FREQUENCY / 1000000 is a power of 2), so it's cheap
+ * enough to stamp every packet with.
+ * */
+uint64_t get_micros64() {
+    uint32_t high, ticks, counter, pending;
+
+    do {
+        high = s_ticks_high;
+        ticks = s_ticks;
+        counter = SYST->SYST_CVR;
+        pending = SCB->SCB_ICSR & (1 << ICSR_PENDSTSET);
+    } while (ticks != s_ticks || high != s_ticks_high);
+
+    uint64_t total = (uint64_t)high << 32 | ticks;
+
+    if (pending) {
+        counter = SYST->SYST_CVR;
+        total++;
+    }
+
+    // Right after a tickless sleep the counter can be over RVR for a tick
+    // (tickless_sleep counted it already): we are a bit before 'total'.
+    int32_t into = (int32_t)(SYST->SYST_RVR - counter);
+
+    return total * (1000000 / TICK_FREQUENCY) + into / (int32_t)(CPU_FREQUENCY / 1000000);
+}
+
+/*
+ * @brief Adds 'n' ticks to the count, for the ones that passed while
+ * SysTick wasn't interrupting, with interrupts disabled.
+ * */
+static void step_ticks(uint32_t n) {
+    uint32_t before = s_ticks;
+
+    s_ticks = before + n;
+
+    if (s_ticks < before) {
+        s_ticks_high++;
+    }
+
+    if (n > 0) {
+        post_tick();
+    }
+}
+
+/*
+ * @brief How many times the core woke up, from either idle.
+ * */
+static volatile uint32_t s_wakeups;
+
+static void wait_for_interrupt(void) {
+    __asm volatile ("dsb\n\twfi\n\tisb" ::: "memory");
+    s_wakeups++;
+}
+
+/*
+ * @brief Sleeps until the tick 'deadline' (or until another interrupt), with
+ * one SysTick interrupt at the end instead of one per tick.
+ *
+ * Like the tickless idle of FreeRTOS:
+ * - with interrupts disabled (so nothing runs between us deciding to
+ *   sleep and the sleep itself, WFI still wakes up on a pending one)
+ *   SysTick is stopped, and reloaded with the cycles left of the current
+ *   tick plus 'ticks' - 1 whole ones;
+ * - on wakeup, from the cycles it counted we know how many ticks went by,
+ *   add them to s_ticks, and restart SysTick with what's left of the tick
+ *   we are in, so the next interrupt comes when it would have anyway.
+ *
+ * When the sleep ran to the end, the SysTick interrupt is pending and
+ * counts the last tick itself as soon as interrupts are enabled again.
+ *
+ * While SysTick is stopped it doesn't count, so every sleep loses the
+ * handful of cycles it takes to set it up again (well under a ppm per
+ * sleep at 16 MHz). The interrupt that ends the sleep runs once the
+ * ticks are counted, after the wakeup.
+ * */
+static void tickless_sleep(uint32_t deadline) {
+    __asm volatile ("cpsid i" ::: "memory");
+
+    SYST->SYST_CSR &= ~(1 << CSR_ENABLE);
+
+    uint32_t counter = SYST->SYST_CVR;
+    int32_t ticks = (int32_t)(deadline - s_ticks);
+
+    // A tick came in while we were deciding (or is about to), and the
+    // deadline is the next one or already here: a plain sleep does it.
+    if (ticks < 2 || (SCB->SCB_ICSR & (1 << ICSR_PENDSTSET)) || counter < TICKLESS_MIN_CYCLES) {
+        SYST->SYST_CSR |= (1 << CSR_ENABLE);
+        __asm volatile ("cpsie i" ::: "memory");
+        return;
+    }
+
+    if (ticks > TICKLESS_MAX_TICKS) {
+        ticks = TICKLESS_MAX_TICKS;
+    }
+
+    // How far into the current tick we are, to count from its start.
+    uint32_t into = CYCLES_PER_TICK - counter;
+    uint32_t reload = counter + (ticks - 1) * CYCLES_PER_TICK;
+
+    SYST->SYST_RVR = reload;
+    SYST->SYST_CVR = 0;
+    SYST->SYST_CSR |= (1 << CSR_ENABLE);
+
+    wait_for_interrupt();
+
+    // The interrupt that woke us up waits for the math below: it must see
+    // the ticks and the reload of SysTick put back, or get_systicks and
+    // get_micros64 would go back in time for it. A TIM2 deadline
+    // (hrtimer.h) that ends the sleep runs that much later, the cycles
+    // of the few lines below.
+    // Read once, reading CSR clears COUNTFLAG.
+    uint32_t csr = SYST->SYST_CSR;
+
+    SYST->SYST_CSR = csr & ~(1 << CSR_ENABLE);
+
+    uint32_t elapsed;
+
+    if (csr & (1 << CSR_COUNTFLAG)) {
+        // It ran to 0 and started again from the reload value.
+        elapsed = reload + (reload - SYST->SYST_CVR);
+    } else {
+        elapsed = reload - SYST->SYST_CVR;
+    }
+
+    uint32_t passed = (into + elapsed) / CYCLES_PER_TICK;
+    uint32_t left = CYCLES_PER_TICK - (into + elapsed) % CYCLES_PER_TICK;
+
+    // The end of the tick is too close to be caught, it's
+    // counted now and the interrupt comes at the next one.
+    if (left < TICKLESS_MIN_CYCLES) {
+        left += CYCLES_PER_TICK;
+        passed++;
+    }
+
+    // The last one is counted by the pending interrupt.
+    if (csr & (1 << CSR_COUNTFLAG)) {
+        passed--;
+    }
+
+    // Counts 'left' once (the counter loads RVR on the cycle after the
+    // write to CVR), then whole ticks from the RVR we put back.
+    SYST->SYST_RVR = left - 1;
+    SYST->SYST_CVR = 0;
+    SYST->SYST_CSR |= (1 << CSR_ENABLE);
+    SYST->SYST_RVR = CYCLES_PER_TICK - 1;
+
+    step_ticks(passed);
+
+    __asm volatile ("cpsie i" ::: "memory");
+}
+
 void setup_gpio(void) {
     // Enable Clock for the GPIOA Peripheral (Section 6.3.9)
     // This is a OR operation and lets us set individual bits,
@@ -131,72 +407,254 @@ void setup_usart(void) {
     // Section 19.6.4
     //
     USART2->USART_CR1 |= (1 << 13); // CR1[13], USART enable.
+
+    // Nothing to send yet: TXEIE goes on with the first byte.
+    NVIC->NVIC_ISER[USART2_IRQ / 32] = (1 << (USART2_IRQ % 32));
 }
 
-void setup_systick(void) {
-    // Enable Clock for SysTick (Section 6.3.12)
-    RCC->RCC_APB2ENR |= (1 << 14);
+/*
+ * @brief Bytes waiting to go out, the USART2 interrupt sends them one at
+ * a time on TXE. A report is a few hundred bytes, ~0.5 s at 9600 baud:
+ * printing it has to be copying it here, or the loop is held up that
+ * long and the probe due in the meantime measures the report instead of
+ * the wake up. The loop is the only producer and the interrupt the only
+ * consumer, an spsc queue (inc/queue.h) needs no masking.
+ * */
+static uint8_t tx_ring[TX_RING_SIZE];
+static spsc_t tx_queue;
+// Bytes that found the queue full.
+static uint32_t tx_dropped;
 
-    // We load the reload register with the maximum value (Section 4.4.2)
-    SYST->SYST_RVR |= 0x00FFFFFF;
+void write_byte(uint8_t byte) {
+    // Full: dropped and counted, waiting would hold up the loop.
+    if (spsc_push(&tx_queue, &byte) < 0) {
+        tx_dropped++;
+        return;
+    }
 
-    // We set as internal source the processor clock, from where our systick will 'based' on, the 
-    // 'rhythm' to derive from (Section 4.4.1).
-    SYST->SYST_CSR |= (1 << 2);
+    // TXE interrupt on, it goes off by itself once the queue is empty
+    // (Section 19.6.4, TXEIE).
+    USART2->USART_CR1 |= (1 << CR1_TXEIE);
+}
 
-    // We enable the callback feature, so that when the syst counter ends
-    // it calls the handler that we set up. (Section 4.4.1.)
-    SYST->SYST_CSR |= (1 << 1);
+void USART2_IRQHandler(void) {
+    irq_enter(USART2_IRQ);
 
-    // We set the initial value to zero.
-    SYST->SYST_CVR |= 0;
-    
-    // We then proceed to finally enable the SysTick timer (Section 4.4.1)
-    SYST->SYST_CSR |= (1 << 0);
+    if ((USART2->USART_SR & (1 << SR_TXE)) && (USART2->USART_CR1 & (1 << CR1_TXEIE))) {
+        uint8_t byte;
+
+        if (spsc_pop(&tx_queue, &byte) == 0) {
+            USART2->USART_DR = byte;
+        } else {
+            USART2->USART_CR1 &= ~(1 << CR1_TXEIE);
+        }
+    }
+
+    irq_exit(USART2_IRQ);
+}
+
+/*
+ * @brief The timers of the project, all driven by the same wheel from the tick events.
+ *
+ * Besides the blink, a probe that measures how late its callback runs
+ * after the start of the tick it's due in, that is the wake up latency,
+ * and a report that prints it with the wakeups per second.
+ *
+ * On TIM2 the same for the hrtimer service: a few one-shot timers that
+ * start themselves again, with periods that make them fall on top of each
+ * other and of the ticks now and then, measure how late (in TIM2 counts,
+ * 62.5 ns) their callback runs after the deadline:
+ *
+ * wakeups/s <n> latency us avg <n> max <n> hrtimer late ns avg <n> max <n>
+ *
+ * Then what the event loop did: the tick events it ran, how many cycles
+ * (62.5 ns) they waited from the post to the handler, and how much of the
+ * time the core slept:
+ *
+ * events <n> dispatch cycles avg <n> max <n> idle % <n> tx dropped <n>
+ *
+ * The report falls half a probe period after a probe, never on one: what
+ * printing it costs isn't anyone's wake up latency.
+ * */
+#define REPORT_OFFSET (PROBE_TICKS / 2)
+
+static wheel_t wheel;
+static wheel_timer_t blink;
+static wheel_timer_t probe;
+static wheel_timer_t report;
+
+static uint32_t s_latency_sum;
+static uint32_t s_latency_max;
+static uint32_t s_latency_count;
+
+static hrtimer_t hr_probes[HRTIMER_PROBES];
+static const uint32_t hr_periods_us[HRTIMER_PROBES] = {97000, 101000, 103000};
+static volatile uint32_t s_hr_late_sum;
+static volatile uint32_t s_hr_late_max;
+static volatile uint32_t s_hr_late_count;
+
+static void on_blink(wheel_timer_t *timer, void *context) {
+    GPIOA->GPIOx_ODR ^= (1 << pin5);
 }
 
-void setup_timer(minimal_timer_t *timer, uint32_t wait_time, int auto_reset) {
-    timer->wait_time = wait_time;
-    timer->auto_reset = auto_reset;
-    timer->target_time = get_systicks() + (wait_time);
+static void on_probe(wheel_timer_t *timer, void *context) {
+    // Auto reset already moved the target to the next period. Only the
+    // low 32 bits are needed: they are the same for ticks * 1000 and for
+    // the microseconds, whatever the high ones are.
+    uint32_t due = timer->timer.target_time - timer->timer.wait_time;
+    uint32_t latency = (uint32_t)get_micros64() - due * (1000000 / TICK_FREQUENCY);
+
+    s_latency_sum += latency;
+    s_latency_count++;
+
+    if (latency > s_latency_max) {
+        s_latency_max = latency;
+    }
 }
 
-int has_timer_elapsed(minimal_timer_t *timer) {
-    uint32_t now = get_systicks();
-    uint64_t delta;
+static void on_hr_probe(hrtimer_t *timer, void *context) {
+    uint32_t late = hrtimer_now() - timer->deadline;
+    uint32_t period = *(const uint32_t *)context;
 
-    if (now >= timer->target_time) {
-        delta = now - timer->target_time;
+    s_hr_late_sum += late;
+    s_hr_late_count++;
 
-        timer->target_time = (now + timer->wait_time) - delta;
+    if (late > s_hr_late_max) {
+        s_hr_late_max = late;
+    }
+
+    // From the deadline, not from now, so the probe doesn't drift.
+    hrtimer_start_at(timer, timer->deadline + period * HRTIMER_COUNTS_PER_US, on_hr_probe, context);
+}
 
-        return 1;
+static void on_report(wheel_timer_t *timer, void *context) {
+    static uint32_t last_wakeups;
+    uint32_t wakeups = s_wakeups;
+    event_stats_t stats;
+
+    // The first one was REPORT_OFFSET late, every REPORT_TICKS from it.
+    if (!timer->timer.auto_reset) {
+        wheel_start(&wheel, timer, REPORT_TICKS, 1, on_report, context);
     }
 
-    return 0;
+    event_stats(&stats);
+
+    critical_stats_t masked;
+
+    // The probe writes them from TIM2, masked here.
+    uint32_t basepri = critical_enter();
+    uint32_t hr_sum = s_hr_late_sum;
+    uint32_t hr_max = s_hr_late_max;
+    uint32_t hr_count = s_hr_late_count;
+    s_hr_late_sum = 0;
+    s_hr_late_max = 0;
+    s_hr_late_count = 0;
+    critical_exit(basepri);
+
+    critical_stats(&masked);
+
+    // Counts to ns: 62.5 ns each.
+    printf("wakeups/s %lu latency us avg %lu max %lu hrtimer late ns avg %lu max %lu\n",
+           (unsigned long)((wakeups - last_wakeups) / (REPORT_TICKS / TICK_FREQUENCY)),
+           (unsigned long)(s_latency_count ? s_latency_sum / s_latency_count : 0),
+           (unsigned long)s_latency_max,
+           (unsigned long)(hr_count ? hr_sum / hr_count * 125 / 2 : 0),
+           (unsigned long)(hr_max * 125 / 2));
+    printf("events %lu dispatch cycles avg %lu max %lu idle %% %lu tx dropped %lu\n",
+           (unsigned long)stats.dispatched,
+           (unsigned long)(stats.dispatched ? stats.latency_sum / stats.dispatched : 0),
+           (unsigned long)stats.latency_max,
+           (unsigned long)(stats.cycles >= 100 ? stats.idle / (stats.cycles / 100) : 0),
+           (unsigned long)tx_dropped);
+    printf("critical sections %lu masked cycles avg %lu max %lu at 0x%08lx\n",
+           (unsigned long)masked.sections,
+           (unsigned long)(masked.sections ? masked.sum_cycles / masked.sections : 0),
+           (unsigned long)masked.max_cycles,
+           (unsigned long)masked.max_where);
+
+    uint32_t over = irq_over();
+
+    for (uint8_t slot = 0; slot < IRQ_COUNT; ++slot) {
+        irq_stats_t irq;
+
+        irq_stats(slot, &irq);
+
+        printf("%s runs %lu latency cycles max %lu run cycles avg %lu max %lu over budget %lu%s\n",
+               irq_names[slot],
+               (unsigned long)irq.runs,
+               (unsigned long)irq.latency_max,
+               (unsigned long)(irq.runs ? irq.run_sum / irq.runs : 0),
+               (unsigned long)irq.run_max,
+               (unsigned long)irq.over,
+               (over & (1 << slot)) ? " !" : "");
+    }
+
+    last_wakeups = wakeups;
+    s_latency_sum = 0;
+    s_latency_max = 0;
+    s_latency_count = 0;
+}
+
+/*
+ * @brief Nothing to do until the next timer: with TIMER_TICKLESS the core
+ * sleeps right until it, otherwise until the next tick.
+ *
+ * The idle of the event loop: called with interrupts disabled, they are
+ * enabled again on the way out.
+ * */
+static void idle(void) {
+#if TIMER_TICKLESS
+    // Counted from the wheel's current tick, s_ticks may be past it by now.
+    uint32_t deadline = wheel.now - 1 + wheel_next(&wheel);
+
+    if ((int32_t)(deadline - get_systicks()) > 1) {
+        tickless_sleep(deadline);
+        return;
+    }
+#endif
+
+    wait_for_interrupt();
+    __asm volatile ("cpsie i" ::: "memory");
 }
 
-void timer_reset(minimal_timer_t *timer) {
-    setup_timer(timer, timer->wait_time, timer->auto_reset);
+static void on_tick(const event_t *event) {
+    // However many timers there are, only the ones due cost anything.
+    wheel_advance(&wheel, get_systicks());
 }
 
 int main(void) {
+    systick_t systick;
+
     setup_gpio();
+
+    // The priorities must be there before any interrupt is enabled,
+    // and the queue before the first byte written to it.
+    irq_setup(4, irqs, IRQ_COUNT);
+    spsc_init(&tx_queue, tx_ring, 1, TX_RING_SIZE);
     setup_usart();
-    setup_systick();
 
-    minimal_timer_t timer;
+    // The queue must be there before SysTick posts to it.
+    event_init();
+    event_queue_init(&tick_queue, 0, on_tick);
 
-    // Since the RELOAD register is 1000ms,
-    // the cycle is 1000ms, which means that
-    // our timer with a value of 5 is 5000ms (5 seconds)
-    setup_timer(&timer, 5, 1);
+    // TICK_FREQUENCY ticks per second, each one interrupting.
+    systick_setup(&systick, TICK_FREQUENCY, 1);
 
-    while(1) {
-        if (has_timer_elapsed(&timer)) {
-            GPIOA->GPIOx_ODR ^= (1 << pin5);
-        }
+    wheel_init(&wheel, get_systicks());
+
+    // One tick is 1 ms, so our timer with
+    // a value of 5000 is 5 seconds.
+    wheel_start(&wheel, &blink, 5000, 1, on_blink, NULL);
+    wheel_start(&wheel, &probe, PROBE_TICKS, 1, on_probe, NULL);
+    wheel_start(&wheel, &report, REPORT_TICKS + REPORT_OFFSET, 0, on_report, NULL);
+
+    hrtimer_setup();
+
+    for (uint8_t i = 0; i < HRTIMER_PROBES; ++i) {
+        hrtimer_start_us(&hr_probes[i], hr_periods_us[i], on_hr_probe, (void *)&hr_periods_us[i]);
     }
 
+    event_run(idle);
+
     return 0;
 }
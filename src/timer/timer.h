@@ -3,6 +3,15 @@
 
 #include <stdint.h>
 
+/*
+ * With TIMER_TICKLESS the idle loop sleeps until the next timer is due,
+ * programming SysTick for it, instead of waking up on every tick: build
+ * with -DTIMER_TICKLESS=0 for the periodic 1 ms tick.
+ * */
+#ifndef TIMER_TICKLESS
+#define TIMER_TICKLESS 1
+#endif
+
 /*
  * Struct of the (simple) timer.
  * */
@@ -17,4 +26,31 @@ typedef struct minimal_timer_t {
     int auto_reset;
 } minimal_timer_t;
 
+/*
+ * Starts the timer, 'wait_time' ticks from now.
+ * */
+void setup_timer(minimal_timer_t *timer, uint32_t wait_time, int auto_reset);
+
+/*
+ * True once the wait time has passed, and the next period starts,
+ * to be polled from the main loop.
+ * */
+int has_timer_elapsed(minimal_timer_t *timer);
+
+/*
+ * Starts the timer again, a full wait time from now.
+ * */
+void timer_reset(minimal_timer_t *timer);
+
+/*
+ * Ticks (1 ms) since startup, wraps every ~49 days.
+ * */
+uint32_t get_systicks();
+
+/*
+ * Microseconds since startup, monotonic and never wrapping, safe to call
+ * from interrupts too.
+ * */
+uint64_t get_micros64();
+
 #endif // !TIMER_H
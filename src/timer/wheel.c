@@ -0,0 +1,226 @@
+#include "wheel.h"
+
+#include <stddef.h>
+
+static void list_init(wheel_node_t *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_append(wheel_node_t *head, wheel_node_t *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void list_remove(wheel_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+/*
+ * Moves everything in 'from' to 'to', leaving 'from' empty.
+ * */
+static void list_take(wheel_node_t *to, wheel_node_t *from) {
+    if (from->next == from) {
+        list_init(to);
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+/*
+ * Puts the timer in the slot its target falls in, seen from wheel->now.
+ * */
+static void wheel_insert(wheel_t *wheel, wheel_timer_t *timer) {
+    uint32_t target = timer->timer.target_time;
+    uint32_t delta = target - wheel->now;
+
+    // Already due (started with a wait of 0): it runs with the next tick.
+    if ((int32_t)delta < 0) {
+        delta = 0;
+        target = wheel->now;
+    }
+
+    // Too far for the wheel, it waits as far as it reaches.
+    if (delta >= WHEEL_RANGE) {
+        delta = WHEEL_RANGE - 1;
+        target = wheel->now + delta;
+    }
+
+    uint8_t level = 0;
+
+    while (delta >= (1ul << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    uint8_t slot = (target >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    list_append(&wheel->slots[level][slot], &timer->node);
+}
+
+/*
+ * Empties a slot of 'level' into the levels below, returns its
+ * index, as the cascade of the level above goes on only at 0.
+ * */
+static uint8_t wheel_cascade(wheel_t *wheel, uint8_t level) {
+    uint8_t slot = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    wheel_node_t list;
+
+    list_take(&list, &wheel->slots[level][slot]);
+
+    while (list.next != &list) {
+        wheel_timer_t *timer = (wheel_timer_t *)list.next;
+
+        list_remove(&timer->node);
+        wheel_insert(wheel, timer);
+        wheel->cascaded++;
+    }
+
+    return slot;
+}
+
+static void wheel_tick(wheel_t *wheel) {
+    uint8_t slot = wheel->now & WHEEL_MASK;
+
+    // Every time level 0 goes around, the next 64 ticks come down from above.
+    if (slot == 0) {
+        for (uint8_t level = 1; level < WHEEL_LEVELS; ++level) {
+            if (wheel_cascade(wheel, level) != 0) {
+                break;
+            }
+        }
+    }
+
+    // Taken out first, so that a timer started again for this same tick
+    // (a wait of 0) runs on the next one instead of looping here forever.
+    wheel_node_t due;
+
+    list_take(&due, &wheel->slots[0][slot]);
+    wheel->now++;
+
+    while (due.next != &due) {
+        wheel_timer_t *timer = (wheel_timer_t *)due.next;
+
+        list_remove(&timer->node);
+        wheel->pending--;
+        wheel->expired++;
+
+        if (timer->timer.auto_reset) {
+            // The next period starts from when this one was due, like
+            // has_timer_elapsed, so a late tick doesn't make it drift.
+            timer->timer.target_time += timer->timer.wait_time;
+            wheel_insert(wheel, timer);
+            wheel->pending++;
+        }
+
+        // Last, so the callback can cancel or start it again.
+        timer->callback(timer, timer->context);
+    }
+}
+
+void wheel_init(wheel_t *wheel, uint32_t now) {
+    wheel->now = now + 1;
+    wheel->pending = 0;
+    wheel->expired = 0;
+    wheel->cascaded = 0;
+
+    for (uint8_t level = 0; level < WHEEL_LEVELS; ++level) {
+        for (uint8_t slot = 0; slot < WHEEL_SLOTS; ++slot) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void wheel_timer_init(wheel_timer_t *timer) {
+    timer->node.next = NULL;
+    timer->node.prev = NULL;
+    timer->callback = NULL;
+    timer->context = NULL;
+}
+
+void wheel_start(wheel_t *wheel, wheel_timer_t *timer, uint32_t wait_time, int auto_reset,
+                 wheel_callback_t callback, void *context) {
+    if (wheel_running(timer)) {
+        wheel_cancel(wheel, timer);
+    }
+
+    timer->timer.wait_time = wait_time;
+    timer->timer.auto_reset = auto_reset;
+    timer->timer.target_time = wheel->now - 1 + wait_time;
+    timer->callback = callback;
+    timer->context = context;
+
+    wheel_insert(wheel, timer);
+    wheel->pending++;
+}
+
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer) {
+    if (!wheel_running(timer)) {
+        return;
+    }
+
+    list_remove(&timer->node);
+    wheel->pending--;
+}
+
+int wheel_running(const wheel_timer_t *timer) {
+    return timer->node.next != NULL;
+}
+
+void wheel_advance(wheel_t *wheel, uint32_t now) {
+    while ((int32_t)(now - wheel->now) >= 0) {
+        wheel_tick(wheel);
+    }
+}
+
+uint32_t wheel_next(const wheel_t *wheel) {
+    uint32_t next = WHEEL_RANGE;
+
+    if (wheel->pending == 0) {
+        return next;
+    }
+
+    // Level 0 holds every target in the next 64 ticks, one per slot.
+    for (uint32_t k = 0; k < WHEEL_SLOTS; ++k) {
+        const wheel_node_t *slot = &wheel->slots[0][(wheel->now + k) & WHEEL_MASK];
+
+        if (slot->next != slot) {
+            next = k + 1;
+            break;
+        }
+    }
+
+    // Higher up, the timers of a slot come down with its cascade, on the
+    // first tick of its span, and may be due right then: the first slot
+    // that isn't empty on each level, whichever cascades first.
+    for (uint8_t level = 1; level < WHEEL_LEVELS; ++level) {
+        uint8_t shift = WHEEL_BITS * level;
+        // The span of the next cascade of this level, the one of
+        // 'now' itself when it's its first tick.
+        uint32_t span = ((wheel->now - 1) >> shift) + 1;
+
+        for (uint32_t k = 0; k < WHEEL_SLOTS; ++k) {
+            const wheel_node_t *slot = &wheel->slots[level][(span + k) & WHEEL_MASK];
+
+            if (slot->next != slot) {
+                uint32_t ticks = ((span + k) << shift) - wheel->now + 1;
+
+                if (ticks < next) {
+                    next = ticks;
+                }
+                break;
+            }
+        }
+    }
+
+    return next;
+}
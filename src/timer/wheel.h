@@ -0,0 +1,116 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+#include "timer.h"
+
+/*
+ * Hierarchical timing wheel, for when there are too many timers to poll
+ * them one by one with has_timer_elapsed.
+ *
+ * WHEEL_LEVELS wheels of WHEEL_SLOTS slots each, every slot a list of the
+ * timers due in it:
+ *
+ * level 0 -> one slot per tick, the next 64 ticks
+ * level 1 -> one slot per 64 ticks, the next 4096
+ * level 2 -> one slot per 4096 ticks, the next 262144 (~4 minutes)
+ * level 3 -> one slot per 262144 ticks, the next 2^24 (~4.6 hours)
+ *
+ * Starting a timer puts it in the slot of the level its target falls in,
+ * cancelling takes it out of its list, both O(1). Every tick the wheel
+ * runs the timers in the current level 0 slot, and every 64 ticks the next
+ * slot of the level above is emptied into the levels below (the cascade),
+ * so a timer moves at most WHEEL_LEVELS - 1 times before it's due.
+ * Targets farther than 2^24 ticks wait in the last slot of level 3, and
+ * go around until they are in range.
+ *
+ * A wheel_timer_t is a minimal_timer_t with a callback, with the same
+ * meaning for the fields: the callback runs 'wait_time' ticks after the
+ * start, and again every 'wait_time' if 'auto_reset', counted from when
+ * it was due, not from when it ran.
+ *
+ * Nothing is locked: start, cancel and wheel_advance must all run in the
+ * same context (the main loop, or all of them in the SysTick handler).
+ * */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_RANGE (1ul << (WHEEL_BITS * WHEEL_LEVELS))
+
+/*
+ * Links of a timer in its slot, a circular list around the slot head, so a
+ * timer can leave it without knowing which one it's in.
+ * */
+typedef struct wheel_node_t {
+    struct wheel_node_t *next;
+    struct wheel_node_t *prev;
+} wheel_node_t;
+
+struct wheel_timer_t;
+
+typedef void (*wheel_callback_t)(struct wheel_timer_t *timer, void *context);
+
+typedef struct wheel_timer_t {
+    // First, so that a node is also its timer.
+    wheel_node_t node;
+    minimal_timer_t timer;
+    wheel_callback_t callback;
+    void *context;
+} wheel_timer_t;
+
+typedef struct wheel_t {
+    // The next tick to run, everything before it already ran:
+    // now - 1 is the current one, that waits count from.
+    uint32_t now;
+    wheel_node_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    // Timers started and not due or cancelled yet.
+    uint32_t pending;
+    // Counters.
+    uint32_t expired;
+    uint32_t cascaded;
+} wheel_t;
+
+/*
+ * Empty wheel, with 'now' (get_systicks) as its current tick.
+ * */
+void wheel_init(wheel_t *wheel, uint32_t now);
+
+/*
+ * A timer that isn't running, for the ones that aren't
+ * static (those start zeroed, which is the same).
+ * */
+void wheel_timer_init(wheel_timer_t *timer);
+
+/*
+ * Starts 'timer' (again, if it was already running), due 'wait_time'
+ * ticks after the wheel's current tick (the one a callback runs in),
+ * up to 2^31 - 1 (~24 days).
+ * */
+void wheel_start(wheel_t *wheel, wheel_timer_t *timer, uint32_t wait_time, int auto_reset,
+                 wheel_callback_t callback, void *context);
+
+/*
+ * Stops 'timer', nothing happens if it isn't running.
+ * Safe from a callback, for any timer, itself included.
+ * */
+void wheel_cancel(wheel_t *wheel, wheel_timer_t *timer);
+
+int wheel_running(const wheel_timer_t *timer);
+
+/*
+ * The tick hook: runs every tick up to 'now' included, calling the
+ * callbacks of the timers due. Call it with get_systicks, as often as
+ * possible, it catches up on the ticks it missed.
+ * */
+void wheel_advance(wheel_t *wheel, uint32_t now);
+
+/*
+ * Ticks from the current one to the next that has something to do, a
+ * timer due or a cascade that may bring one down, WHEEL_RANGE when no
+ * timer is running. Nothing happens before it, so a tickless idle can
+ * sleep until then and call wheel_advance once it wakes up.
+ * */
+uint32_t wheel_next(const wheel_t *wheel);
+
+#endif // !WHEEL_H
@@ -2,6 +2,7 @@
  *@brief simple uart project
  **/
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -100,22 +101,6 @@ void setup_usart() {
     USART2->USART_CR1 |= (1 << 13); // CR1[13], USART enable.
 }
 
-void setup_systick() {
-    // Enable Clock for SysTick (Section 6.3.12)
-    RCC->RCC_APB2ENR |= (1 << 14);
-
-    // We load the reload register with the maximum value (Section 4.4.2)
-    SYST->SYST_RVR |= 0x00FFFFFF;
-
-    // We set as internal source the processor clock, from where our systick will 'based' on, the 
-    // 'rhythm' to derive from (Section 4.4.1).
-    SYST->SYST_CSR |= (1 << 2);
-    
-    // We then proceed to finally enable the SysTick timer (Section 4.4.1)
-    SYST->SYST_CSR |= (1 << 0);
-}
-
-
 void write_byte(uint8_t byte) {
     // We check if there are any new data using the USART_SR register,
     // if the bit 7 is 1, it means that the data has finished writing.
@@ -140,8 +125,11 @@ void write_string(char *string, size_t len) {
 }
 
 int main(void) {
+    systick_t systick;
+
     setup_gpio();
-    setup_systick();
+    // One tick per second, COUNTFLAG below tells when it went by.
+    systick_setup(&systick, 1, 0);
     setup_usart();
 
     char *string = "Hello world!\n";
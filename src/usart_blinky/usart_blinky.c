@@ -2,6 +2,9 @@
  *@brief simple uart project
  **/
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
+#include "../../inc/event.h"
+#include "../../inc/queue.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -10,6 +13,14 @@
 #define PA5 5
 
 #define CPU_FREQUENCY 16000000
+#define USART2_IRQ 38
+#define SR_ORE 3
+#define SR_RXNE 5
+#define SR_TXE 7
+#define CR1_RXNEIE 5
+#define CR1_TXEIE 7
+#define BLINK_FREQUENCY 2
+#define TX_RING_SIZE 128
 
 /**
  * @brief Struct Pointer for RCC Peripherals assigned with fixed address specified in reference manual.
@@ -32,6 +43,29 @@ GPIOx_t * const GPIOA   = (GPIOx_t  *)  0x40020000;
  * */
 USART_t * const USART2 = (USART_t *)  0x40004400;
 
+/*
+ * @brief Struct Pointer for SYST (System Timer) assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.4 System timer, SysTick (ARM-cortex-m4 datasheet).
+ * */
+SYST_t * const SYST = (SYST_t *) 0xE000E010;
+
+/*
+ * @brief Struct Pointer for the NVIC assigned with fixed address specified in the datasheet.
+ *
+ * See section 4.2 Nested Vectored Interrupt Controller (ARM-cortex-m4 datasheet).
+ * */
+NVIC_t * const NVIC = (NVIC_t *) 0xE000E100;
+
+/*
+ * @brief Struct Pointers for the DWT and the debug control block, the event loop
+ * counts cycles with them.
+ *
+ * See section C1.8 of the ARMv7-M architecture reference manual.
+ * */
+DWT_t * const DWT = (DWT_t *) 0xE0001000;
+DCB_t * const DCB = (DCB_t *) 0xE000EDF0;
+
 void setup_gpio() {
     // Enable Clock for the GPIOA Peripheral (Section 6.3.9)
     // This is a OR operation and lets us set individual bits,
@@ -96,6 +130,11 @@ void setup_usart() {
     // Section 19.6.4.
     USART2->USART_CR1 |= (1 << 3); // CR1[3], transmitter enable
     USART2->USART_CR1 |= (1 << 2); // CR1[2], receiver enable
+
+    // Every byte received raises the USART2 interrupt (RXNEIE), instead
+    // of us polling RXNE: it posts it to the event loop.
+    USART2->USART_CR1 |= (1 << CR1_RXNEIE);
+    NVIC->NVIC_ISER[USART2_IRQ / 32] = (1 << (USART2_IRQ % 32));
     
     // Finally, we can enable the USART2.
     //
@@ -104,32 +143,29 @@ void setup_usart() {
     USART2->USART_CR1 |= (1 << 13); // CR1[13], USART enable.
 }
 
-void write_byte(uint8_t byte) {
-    // We check if there are any new data using the USART_SR register,
-    // if the bit 7 is 1, it means that the data has finished writing.
-    // If so, we can use the USART_DR register to write the new data.
-    while(!((USART2->USART_SR & (1 << 7)))); 
-
-    // Sets the data register to the ASCII code of the 
-    // character 'x' by bitwise ANDing it with 0xFF
-    // to ensure only the lower 8 bits (byte that we wanna transmit) are considered.
-    // To see the actual bytes sent, I used picocom, but any dumb-terminal emulation works
-    // fine:
-    //
-    // picocom -b 9600 /dev/ttyACM0.
-    USART2->USART_DR = (byte & 0xFF); 
-}
+/*
+ * @brief Bytes waiting to go out, the USART2 interrupt sends them one at
+ * a time on TXE: the handlers only copy them in, and go on. The handlers
+ * are the only producer and the interrupt the only consumer, an spsc
+ * queue (inc/queue.h) needs no masking.
+ * */
+static uint8_t tx_ring[TX_RING_SIZE];
+static spsc_t tx_queue;
+// Bytes that found the queue full.
+static uint32_t tx_dropped;
 
-uint8_t read_byte() {
-    // We check if there are any data that is being transferred 
-    // using the USART_SR register, if the bit 5 is 1, it means that 
-    // the data has finished writing.
-    // If so, we can return the USART_DR register to read new data.
-    //
-    // Section 19.6.1
-    while(!((USART2->USART_SR & (1 << 5)))); 
+void write_byte(uint8_t byte) {
+    // Full: the interrupt empties it a byte every ~1 ms at 9600 baud,
+    // waiting for it would hold up the loop and every event behind us.
+    // The byte is dropped and counted instead.
+    if (spsc_push(&tx_queue, &byte) < 0) {
+        tx_dropped++;
+        return;
+    }
 
-    return USART2->USART_DR;
+    // TXE interrupt on, it goes off by itself once the queue is empty
+    // (Section 19.6.4, TXEIE).
+    USART2->USART_CR1 |= (1 << CR1_TXEIE);
 }
 
 void write_string(char *string, size_t len) {
@@ -139,35 +175,140 @@ void write_string(char *string, size_t len) {
     }
 }
 
+void write_number(char *label, uint32_t value) {
+    char digits[10];
+    uint8_t n = 0;
+
+    while (*label) {
+        write_byte(*label++);
+    }
+
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (n > 0) {
+        write_byte(digits[--n]);
+    }
+}
+
+/*
+ * @brief What the main loop does, all of it in handlers of events:
+ * - a byte received (posted by the USART2 interrupt) is a command;
+ * - a tick (posted by SysTick, BLINK_FREQUENCY per second) blinks the
+ *   LED, when the 'b' command asked for it.
+ *
+ * The bytes are the most urgent, so a command never waits for a blink.
+ * */
+#define SIGNAL_BYTE 0
+#define SIGNAL_TICK 1
+
+static event_queue_t rx_queue;
+static event_queue_t tick_queue;
+static uint8_t blinking;
+
+void USART2_IRQHandler(void) {
+    // Reading SR followed by DR clears both the RXNE and the ORE flags (Section 19.6.1).
+    uint32_t status = USART2->USART_SR;
+
+    if (status & ((1 << SR_RXNE) | (1 << SR_ORE))) {
+        event_post(&rx_queue, SIGNAL_BYTE, USART2->USART_DR);
+    }
+
+    if ((status & (1 << SR_TXE)) && (USART2->USART_CR1 & (1 << CR1_TXEIE))) {
+        uint8_t byte;
+
+        if (spsc_pop(&tx_queue, &byte) == 0) {
+            USART2->USART_DR = byte;
+        } else {
+            USART2->USART_CR1 &= ~(1 << CR1_TXEIE);
+        }
+    }
+}
+
+void SysTick_Handler(void) {
+    // The handler only toggles, a tick it hasn't run yet is enough.
+    if (event_queue_empty(&tick_queue)) {
+        event_post(&tick_queue, SIGNAL_TICK, 0);
+    }
+}
+
+/*
+ * @brief The 's' command: events dispatched, their average and worst
+ * latency (post to handler, in CPU cycles, 62.5 ns each), the ones lost
+ * on a full queue, the bytes dropped on a full TX queue (since startup),
+ * and the percentage of the time the core slept, since the last 's'.
+ * The line fits in the TX queue.
+ * */
+void report_stats(void) {
+    event_stats_t stats;
+
+    event_stats(&stats);
+
+    write_number("events ", stats.dispatched);
+    write_number(" latency cycles avg ", stats.dispatched ? stats.latency_sum / stats.dispatched : 0);
+    write_number(" max ", stats.latency_max);
+    write_number(" lost ", rx_queue.lost + tick_queue.lost);
+    write_number(" tx dropped ", tx_dropped);
+    // Both on 32 bits, idle / (cycles / 100) doesn't overflow.
+    write_number(" idle % ", stats.cycles >= 100 ? stats.idle / (stats.cycles / 100) : 0);
+    write_byte('\n');
+}
+
 void toggle_led(uint8_t byte) {
     char *string_on = "LED is on.\n";
     char *string_off = "LED is off.\n";
+    char *string_blink = "LED is blinking.\n";
     char *error = "Value not valid.\n";
     size_t len = 11;
 
     if (byte == '1') {
+        blinking = 0;
         write_string(string_on, len);
         GPIOA->GPIOx_ODR &= ~(1 << PA5);
         GPIOA->GPIOx_ODR ^= (1 << 5);
     } else if (byte == '0') {
+        blinking = 0;
         write_string(string_off, len+1);
         GPIOA->GPIOx_ODR &= ~(1 << PA5);
+    } else if (byte == 'b') {
+        blinking = 1;
+        write_string(string_blink, len+6);
+    } else if (byte == 's') {
+        report_stats();
     } else {
         write_string(error, len+6);
     }
 }
 
+void on_byte(const event_t *event) {
+    toggle_led(event->param);
+}
+
+void on_tick(const event_t *event) {
+    if (blinking) {
+        GPIOA->GPIOx_ODR ^= (1 << PA5);
+    }
+}
+
 int main(void) {
+    systick_t systick;
+
     setup_gpio();
-    setup_usart();
 
+    // The queues must be there before the interrupts that post to them.
+    spsc_init(&tx_queue, tx_ring, 1, TX_RING_SIZE);
+    event_init();
+    event_queue_init(&rx_queue, 0, on_byte);
+    event_queue_init(&tick_queue, 1, on_tick);
+
+    setup_usart();
+    systick_setup(&systick, BLINK_FREQUENCY, 1);
 
     // Amazing! Now we can finally write the bytes, and check them out 
-    // from our host system.
-    while(1) {
-        uint8_t byte = read_byte();
-        toggle_led(byte);
-    }
+    // from our host system. Between one and the other, the core sleeps.
+    event_run(NULL);
 
     return 0;
 }
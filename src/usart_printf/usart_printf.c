@@ -2,6 +2,7 @@
  *@brief simple redirect printf to uart project
  **/
 #include "../../inc/peripherals.h"
+#include "../../inc/systick.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -101,25 +102,13 @@ void setup_usart() {
     USART2->USART_CR1 |= (1 << 13); // CR1[13], USART enable.
 }
 
-void setup_systick() {
-    // Enable Clock for SysTick (Section 6.3.12)
-    RCC->RCC_APB2ENR |= (1 << 14);
-
-    // We load the reload register with the maximum value (Section 4.4.2)
-    SYST->SYST_RVR |= 0x00FFFFFF;
-
-    // We set as internal source the processor clock, from where our systick will 'based' on, the 
-    // 'rhythm' to derive from (Section 4.4.1).
-    SYST->SYST_CSR |= (1 << 2);
-    
-    // We then proceed to finally enable the SysTick timer (Section 4.4.1)
-    SYST->SYST_CSR |= (1 << 0);
-}
-
 int main(void) {
+    systick_t systick;
+
     setup_gpio();
     setup_usart();
-    setup_systick();
+    // One tick per second, COUNTFLAG below tells when it went by.
+    systick_setup(&systick, 1, 0);
 
     // Amazing! Now we can finally write the bytes, and check them out 
     // from our host system.